@@ -0,0 +1,161 @@
+// Host-side check of the asynchronous reads of the energy chip driver,
+// against the simulated ATM90E32 in Firmware/HostSim with a slow bus
+// (100 kHz, 20 us to claim the bus, 5 us of select setup per frame):
+//
+//   - service() keeps to its budget, so loop() keeps running while a
+//     long burst is clocked out, where a blocking read stalls it whole
+//   - a full queue returns 0 and never hands out an entry whose result
+//     has not been collected, even once every request has completed
+//   - requests with a callback complete in order and free their entries
+//
+// Build:  g++ -std=c++11 -O2 -fpermissive -I../HostSim -o AsyncReadTest AsyncReadTest.cpp
+//             ../WattMeterJR_Firmware_main/ATM90E32.cpp
+//             ../WattMeterJR_Firmware_main/RegisterDescriptors.cpp
+// Usage:  AsyncReadTest   (prints each failed check; exit status 1 if any)
+
+#include <cstdio>
+
+#include "../WattMeterJR_Firmware_main/ATM90E32.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+// The simulated chip holds a word derived from each address
+static uint16_t wordAt(uint16_t addr) {
+    return (uint16_t)(addr * 37 + 11);
+}
+
+static bool wordsMatch(const uint16_t* addrs, const uint16_t* words, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (words[i] != wordAt(addrs[i])) return false;
+    }
+    return true;
+}
+
+struct Delivery {
+    uint32_t tickets[ATM_ASYNC_QUEUE_DEPTH];
+    bool correct[ATM_ASYNC_QUEUE_DEPTH];
+    size_t count;
+};
+
+static const uint16_t* callbackAddrs[ATM_ASYNC_QUEUE_DEPTH];
+
+static void onComplete(uint32_t ticket, const uint16_t* words, size_t n, void* context) {
+    Delivery* delivery = (Delivery*)context;
+    if (delivery->count < ATM_ASYNC_QUEUE_DEPTH) {
+        delivery->correct[delivery->count] = wordsMatch(callbackAddrs[delivery->count], words, n);
+        delivery->tickets[delivery->count++] = ticket;
+    }
+}
+
+int main() {
+    for (uint16_t addr = 0; addr < HostSim::CHIP_WORDS; addr++) {
+        HostSim::setWord(addr, wordAt(addr));
+    }
+
+    ATM90E32 chip(5);
+    chip.begin();
+    HostSim::state().setupUs = 20;
+    HostSim::state().selectUs = 5;
+    const unsigned long frameUs = 320 + 5;  // 32 bits at 100 kHz, plus select
+
+    // A whole queue entry's worth of words
+    uint16_t longAddrs[ATM_ASYNC_MAX_WORDS];
+    uint16_t longWords[ATM_ASYNC_MAX_WORDS];
+    for (size_t i = 0; i < ATM_ASYNC_MAX_WORDS; i++) {
+        longAddrs[i] = (uint16_t)(0x80 + i);
+    }
+
+    // Blocking: loop() stalls for the whole burst
+    unsigned long start = micros();
+    chip.readBurst(longAddrs, longWords, ATM_ASYNC_MAX_WORDS);
+    unsigned long blockingUs = micros() - start;
+    check(wordsMatch(longAddrs, longWords, ATM_ASYNC_MAX_WORDS), "blocking burst words");
+
+    // Queued: loop() runs between budget-sized slices
+    uint32_t ticket = chip.queueBurst(longAddrs, ATM_ASYNC_MAX_WORDS);
+    check(ticket != 0, "queueBurst() on an empty queue");
+    unsigned long longestSliceUs = 0;
+    unsigned loopPasses = 0;
+    while (!chip.isComplete(ticket) && loopPasses < 1000) {
+        start = micros();
+        chip.service(ATM_ASYNC_BUDGET_US);
+        unsigned long sliceUs = micros() - start;
+        if (sliceUs > longestSliceUs) longestSliceUs = sliceUs;
+        HostSim::advance(500);  // The rest of loop()
+        loopPasses++;
+    }
+    check(chip.getResult(ticket, longWords, ATM_ASYNC_MAX_WORDS), "getResult() of the long burst");
+    check(wordsMatch(longAddrs, longWords, ATM_ASYNC_MAX_WORDS), "queued burst words");
+    check(longestSliceUs <= ATM_ASYNC_BUDGET_US + frameUs + 20, "service() within its budget plus one frame");
+    check(loopPasses >= blockingUs / (ATM_ASYNC_BUDGET_US + frameUs + 20), "loop() kept running during the burst");
+    check(!chip.getResult(ticket, longWords, 1), "a collected ticket is gone");
+
+    // Fill the queue, then complete everything without collecting it
+    uint16_t addrs[ATM_ASYNC_QUEUE_DEPTH][2];
+    uint32_t tickets[ATM_ASYNC_QUEUE_DEPTH];
+    for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+        addrs[i][0] = (uint16_t)(0x200 + 2 * i);
+        addrs[i][1] = (uint16_t)(0x201 + 2 * i);
+        tickets[i] = chip.queueBurst(addrs[i], 2);
+        check(tickets[i] != 0, "queueBurst() while entries are free");
+    }
+    uint16_t other = 0x300;
+    check(chip.queueRead(other) == 0, "queueRead() on a queue of pending requests");
+    for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+        chip.wait(tickets[i]);
+    }
+    check(chip.queueRead(other) == 0, "queueRead() on a queue of uncollected results");
+    for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+        uint16_t words[2] = { 0, 0 };
+        check(chip.getResult(tickets[i], words, 2), "getResult() after the queue was full");
+        check(wordsMatch(addrs[i], words, 2), "uncollected results kept their words");
+        if (i == 0) {
+            // One collected entry is enough for the next request
+            uint32_t next = chip.queueRead(other);
+            check(next != 0, "queueRead() once a result is collected");
+            chip.wait(next);
+            uint16_t word = 0;
+            check(chip.getResult(next, &word, 1) && word == wordAt(other), "the request that took the freed entry");
+        }
+    }
+
+    // Callbacks: delivered in the order queued, entries freed afterwards
+    Delivery delivery = {};
+    uint32_t callbackTickets[ATM_ASYNC_QUEUE_DEPTH];
+    for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+        callbackAddrs[i] = addrs[i];
+        callbackTickets[i] = chip.queueBurst(addrs[i], 2, onComplete, &delivery);
+        check(callbackTickets[i] != 0, "queueBurst() with a callback");
+    }
+    while (delivery.count < ATM_ASYNC_QUEUE_DEPTH && loopPasses < 2000) {
+        chip.service(ATM_ASYNC_BUDGET_US);
+        loopPasses++;
+    }
+    check(delivery.count == ATM_ASYNC_QUEUE_DEPTH, "every callback ran");
+    for (size_t i = 0; i < delivery.count; i++) {
+        check(delivery.tickets[i] == callbackTickets[i], "callbacks in the order queued");
+        check(delivery.correct[i], "callback words");
+    }
+    for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+        tickets[i] = chip.queueRead(other);
+        check(tickets[i] != 0, "callback entries freed after their callback");
+    }
+
+    printf("%u words at 100 kHz:\n", (unsigned)ATM_ASYNC_MAX_WORDS);
+    printf("  blocking readBurst(): one %lu us stall\n", blockingUs);
+    printf("  queueBurst():         longest service() %lu us\n", longestSliceUs);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,161 @@
+// Host-side check of the burst SPI reads and writes of the energy chip
+// driver, against the simulated ATM90E32 in Firmware/HostSim: a logged
+// sample read word by word (one bus transaction per word, as read16()
+// and read32() used to) against the same sample through
+// RegisterAccess::readRegisters() (one transaction for the whole list).
+//
+// Build:  g++ -std=c++11 -O2 -fpermissive -I../HostSim -o BurstReadTest BurstReadTest.cpp
+//             ../WattMeterJR_Firmware_main/ATM90E32.cpp
+//             ../WattMeterJR_Firmware_main/RegisterAccess.cpp
+//             ../WattMeterJR_Firmware_main/RegisterDescriptors.cpp
+// Usage:  BurstReadTest   (prints each failed check; exit status 1 if any)
+
+#include <cmath>
+#include <cstdio>
+
+#include "../WattMeterJR_Firmware_main/ATM90E32.h"
+#include "../WattMeterJR_Firmware_main/RegisterAccess.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+static void checkCount(uint32_t got, uint32_t expected, const char* what) {
+    if (got != expected) {
+        printf("FAIL %s: %u, expected %u\n", what, (unsigned)got, (unsigned)expected);
+        failures++;
+    }
+}
+
+static void checkValue(float got, float expected, const char* what) {
+    if (std::fabs(got - expected) > std::fabs(expected) * 1e-5f + 1e-6f) {
+        printf("FAIL %s: %g, expected %g\n", what, got, expected);
+        failures++;
+    }
+}
+
+static size_t wordsOf(const RegisterDescriptor* reg) {
+    return (reg->regType == DT_UINT32 || reg->regType == DT_INT32) ? 2 : 1;
+}
+
+int main() {
+    // A typical LogFields list: four 16-bit fields and two 32-bit powers
+    const char* names[] = { "UrmsA", "IrmsA", "PmeanA", "QmeanA", "Freq", "PFmeanA" };
+    const size_t count = sizeof(names) / sizeof(names[0]);
+
+    HostSim::setWord(0xD9, 23012);                        // UrmsA 230.12 V
+    HostSim::setWord(0xDD, 4567);                         // IrmsA 4.567 A
+    HostSim::setWord(0xB1, 0x0001);                       // PmeanA 0x00012345
+    HostSim::setWord(0xC1, 0x2345);
+    HostSim::setWord(0xB5, 0xFFFF);                       // QmeanA -2
+    HostSim::setWord(0xC5, 0xFFFE);
+    HostSim::setWord(0xF8, 5998);                         // Freq 59.98 Hz
+    HostSim::setWord(0xBD, 987);                          // PFmeanA 0.987
+    const float expected[] = { 230.12f, 4.567f, 0x12345 * 0.00032f, -2 * 0.00032f, 59.98f, 0.987f };
+
+    ATM90E32 chip(5);
+    chip.begin();
+    RegisterAccess regAccess(chip);
+    HostSim::state().setupUs = 20;  // Claiming and configuring the bus
+
+    const RegisterDescriptor* regs[count];
+    size_t words = 0;
+    for (size_t i = 0; i < count; i++) {
+        regs[i] = regAccess.getRegisterInfo(names[i]);
+        check(regs[i] != nullptr, names[i]);
+        if (regs[i]) words += wordsOf(regs[i]);
+    }
+    if (failures > 0) {
+        return 1;
+    }
+
+    // Before: a transaction per word
+    HostSim::resetCounters();
+    unsigned long start = micros();
+    for (size_t i = 0; i < count; i++) {
+        for (size_t w = 0; w < wordsOf(regs[i]); w++) {
+            chip.read16(regs[i]->address[w]);
+        }
+    }
+    unsigned long wordByWordUs = micros() - start;
+    uint32_t wordByWordTransactions = HostSim::state().transactions;
+    checkCount(wordByWordTransactions, words, "transactions reading word by word");
+
+    // A register at a time: one transaction each, 32-bit ones included
+    HostSim::resetCounters();
+    for (size_t i = 0; i < count; i++) {
+        bool ok = false;
+        float value = regAccess.readRegister(names[i], &ok);
+        check(ok, "readRegister()");
+        checkValue(value, expected[i], names[i]);
+    }
+    checkCount(HostSim::state().transactions, count, "transactions reading a register at a time");
+
+    // After: the whole sample in one transaction
+    float values[count];
+    bool ok[count];
+    HostSim::resetCounters();
+    start = micros();
+    size_t readCount = regAccess.readRegisters(regs, values, ok, count);
+    unsigned long burstUs = micros() - start;
+    checkCount(readCount, count, "registers read by readRegisters()");
+    checkCount(HostSim::state().transactions, 1, "transactions reading the sample in a burst");
+    checkCount(HostSim::state().readFrames, words, "frames in the burst");
+    checkCount(HostSim::state().framesOutsideTransaction, 0, "frames outside a transaction");
+    for (size_t i = 0; i < count; i++) {
+        check(ok[i], "readRegisters() success");
+        checkValue(values[i], expected[i], names[i]);
+    }
+
+    // By name, the same burst
+    HostSim::resetCounters();
+    regAccess.readRegisters(names, values, ok, count);
+    checkCount(HostSim::state().transactions, 1, "transactions reading the sample by name");
+
+    // A contiguous range (UrmsA..UrmsC)
+    uint16_t range[3];
+    HostSim::setWord(0xDA, 23100);
+    HostSim::setWord(0xDB, 22950);
+    HostSim::resetCounters();
+    chip.readRange(0xD9, range, 3);
+    checkCount(HostSim::state().transactions, 1, "transactions in readRange()");
+    check(range[0] == 23012 && range[1] == 23100 && range[2] == 22950, "readRange() words");
+
+    // A burst write lands every word in one transaction
+    const uint16_t addrs[] = { 0x61, 0x62, 0x63 };
+    const uint16_t gains[] = { 0x1234, 0x5678, 0x9ABC };
+    HostSim::resetCounters();
+    chip.writeBurst(addrs, gains, 3);
+    checkCount(HostSim::state().transactions, 1, "transactions in writeBurst()");
+    checkCount(HostSim::state().writeFrames, 3, "frames in writeBurst()");
+    check(HostSim::getWord(0x61) == 0x1234 && HostSim::getWord(0x62) == 0x5678 &&
+          HostSim::getWord(0x63) == 0x9ABC, "writeBurst() words");
+
+    // Lists longer than one burst split into as few transactions as fit
+    const RegisterDescriptor* many[40];
+    for (size_t i = 0; i < 40; i++) {
+        many[i] = regs[i % count];
+    }
+    float manyValues[40];
+    bool manyOk[40];
+    HostSim::resetCounters();
+    regAccess.readRegisters(many, manyValues, manyOk, 40);
+    uint32_t manyWords = HostSim::state().readFrames;
+    checkCount(HostSim::state().transactions, (manyWords + 31) / 32, "transactions for 40 registers");
+
+    printf("Sample of %u fields (%u words) at 100 kHz:\n", (unsigned)count, (unsigned)words);
+    printf("  word by word: %u transactions, %lu us\n", (unsigned)wordByWordTransactions, wordByWordUs);
+    printf("  burst:        1 transaction, %lu us\n", burstUs);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Host-side checks for the SPI bus arbiter shared by loop() and the SD
+// writer task, with the task as a real thread (Firmware/HostSim/FreeRTOS.h)
+// and each sector write as a 2 ms sleep:
+//
+//   - a metering read queued on loop() while the writer flushes 64
+//     sectors gets the bus within about a sector, where a writer holding
+//     it for the whole flush keeps it waiting for most of the flush
+//   - the two never hold the bus at once
+//   - on loop() alone, yieldBus() still runs the metering callback once
+//     the hold budget is used up, and nested holds restore the outer one
+//
+// Build:  g++ -std=c++11 -O2 -fpermissive -pthread -I../HostSim -o BusArbiterTest BusArbiterTest.cpp
+//             ../WattMeterJR_Firmware_main/SPIBusArbiter.cpp
+// Usage:  BusArbiterTest   (prints each failed check; exit status 1 if any)
+
+#include <cstdio>
+
+#include "../WattMeterJR_Firmware_main/SPIBusArbiter.h"
+
+static const int FLUSH_SECTORS = 64;
+static const int SECTOR_WRITE_MS = 2;
+static const int METERING_READS = 20;
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static std::atomic<int> onBus(0);
+static std::atomic<bool> overlapped(false);
+
+static void busWork(int ms) {
+    if (onBus.fetch_add(1) != 0) {
+        overlapped = true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    onBus.fetch_sub(1);
+}
+
+// The SD writer task: one flush, yielding (or not) between sectors
+static void flush(SPIBusArbiter* arbiter, bool yieldPerSector, std::atomic<bool>* writing) {
+    arbiter->acquire(BUS_STORAGE);
+    *writing = true;
+    for (int i = 0; i < FLUSH_SECTORS; i++) {
+        busWork(SECTOR_WRITE_MS);
+        if (yieldPerSector) arbiter->yieldBus(BUS_STORAGE);
+    }
+    *writing = false;
+    arbiter->release(BUS_STORAGE);
+}
+
+// loop(): metering reads while the flush runs; returns the longest wait
+// for the bus in ms
+static double meterDuringFlush(bool yieldPerSector, uint32_t* yields) {
+    SPIBusArbiter arbiter;
+    arbiter.begin();
+    std::atomic<bool> writing(false);
+    std::thread writer(flush, &arbiter, yieldPerSector, &writing);
+    while (!writing) {
+        std::this_thread::yield();
+    }
+
+    double longest = 0;
+    for (int i = 0; i < METERING_READS && writing; i++) {
+        Clock::time_point queued = Clock::now();
+        arbiter.acquire(BUS_METERING);
+        double waited = msSince(queued);
+        if (waited > longest) longest = waited;
+        busWork(0);
+        arbiter.release(BUS_METERING);
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    }
+    writer.join();
+    *yields = arbiter.getYieldCount();
+    return longest;
+}
+
+static int callbackRuns = 0;
+static void countCallback(void*) {
+    callbackRuns++;
+}
+
+int main() {
+    uint32_t yields = 0;
+    double blocking = meterDuringFlush(false, &yields);
+    check(yields == 0, "a flush that doesn't yield hands the bus over only at its end");
+    double yielding = meterDuringFlush(true, &yields);
+    check(yields > 0, "the writer handed the bus to waiting metering reads");
+    check(yielding < 4 * SECTOR_WRITE_MS + 2, "metering waits about a sector at most");
+    check(blocking > FLUSH_SECTORS * SECTOR_WRITE_MS / 2, "without yields metering waits out the flush");
+    check(!overlapped, "the bus is never held by both tasks");
+
+    // loop() only, as before begin(): the callback runs after the budget
+    SPIBusArbiter single;
+    single.setServiceCallback(BUS_METERING, countCallback);
+    single.acquire(BUS_STORAGE);
+    check(!single.yieldBus(BUS_STORAGE) && callbackRuns == 0, "no yield within the hold budget");
+    HostSim::advance((SPI_BUS_DEFAULT_MAX_HOLD_MS + 1) * 1000.0);
+    check(single.yieldBus(BUS_STORAGE) && callbackRuns == 1, "the callback runs once the budget is used up");
+    single.acquire(BUS_METERING);
+    single.release(BUS_METERING);
+    HostSim::advance((SPI_BUS_DEFAULT_MAX_HOLD_MS + 1) * 1000.0);
+    check(single.yieldBus(BUS_STORAGE), "the outer hold is restored after a nested one");
+    single.release(BUS_STORAGE);
+    check(!single.yieldBus(BUS_STORAGE), "no yield once released");
+
+    printf("Longest metering wait during a %d-sector flush: %.1f ms yielding per sector, %.1f ms without\n",
+           FLUSH_SECTORS, yielding, blocking);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef HOSTSIM_ARDUINO_H
+#define HOSTSIM_ARDUINO_H
+
+// Just enough of the Arduino core for the host builds of the chip-side
+// sources; see HostSim.h. Like the ESP32 core, it brings in FreeRTOS.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "HostSim.h"
+#include "FreeRTOS.h"
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+inline unsigned long micros() { return (unsigned long)HostSim::state().nowUs; }
+inline unsigned long millis() { return (unsigned long)(HostSim::state().nowUs / 1000); }
+inline void delay(unsigned long ms) { HostSim::advance(ms * 1000.0); }
+inline void delayMicroseconds(unsigned int us) { HostSim::advance(us); }
+inline void yield() {}
+
+inline void pinMode(int, int) {}
+// The simulated chip is the only device with a select line
+inline void digitalWrite(int, int value) { HostSim::select(value == LOW); }
+inline int digitalRead(int) { return HIGH; }
+
+class HostSimSerial {
+public:
+    void begin(unsigned long) {}
+    void print(const char* text) { if (!HostSim::state().quiet) fputs(text, stdout); }
+    void println(const char* text = "") { if (!HostSim::state().quiet) puts(text); }
+    void printf(const char* format, ...) {
+        if (HostSim::state().quiet) return;
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+};
+static HostSimSerial Serial __attribute__((unused));
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef HOSTSIM_FREERTOS_H
+#define HOSTSIM_FREERTOS_H
+
+// The FreeRTOS calls the bus arbiter makes, on host threads: tasks are
+// std::threads, a recursive mutex is a std::recursive_mutex and a tick
+// is a real millisecond. Unlike millis(), these run in real time, so
+// the host programs using them time tasks with std::chrono.
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    static thread_local char task;
+    return &task;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    return new std::recursive_mutex;
+}
+
+inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t wait) {
+    std::recursive_mutex* m = (std::recursive_mutex*)mutex;
+    if (wait == portMAX_DELAY) {
+        m->lock();
+        return pdTRUE;
+    }
+    std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait);
+    while (!m->try_lock()) {
+        if (std::chrono::steady_clock::now() >= until) {
+            return pdFALSE;
+        }
+        std::this_thread::yield();
+    }
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex) {
+    ((std::recursive_mutex*)mutex)->unlock();
+    return pdTRUE;
+}
+
+// Spinlock critical sections
+struct portMUX_TYPE {
+    std::atomic_flag flag;
+    portMUX_TYPE(int) { flag.clear(); }
+};
+#define portMUX_INITIALIZER_UNLOCKED 0
+
+inline void portENTER_CRITICAL(portMUX_TYPE* mux) {
+    while (mux->flag.test_and_set(std::memory_order_acquire)) {
+    }
+}
+
+inline void portEXIT_CRITICAL(portMUX_TYPE* mux) {
+    mux->flag.clear(std::memory_order_release);
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef HOSTSIM_H
+#define HOSTSIM_H
+
+// Simulated hardware behind the host builds of the chip-side sources
+// (ATM90E32, RegisterAccess, RegisterCache, MeasurementEngine). The host
+// programs under Firmware/ put this directory first on the include path,
+// so <Arduino.h> and <SPI.h> resolve to the stand-ins next to this file.
+//
+// Time is simulated: millis() and micros() only move when the simulation
+// advances them, by the SPI clock time of each 16-bit transfer (and
+// optional per-transaction and per-frame latencies) or by
+// HostSim::advance(). Runs are therefore exact and repeatable.
+//
+// The chip is a word array addressed like the ATM90E32. Every frame is
+// CS low, a 16-bit address (bit 15 set for a read), 16 bits of data and
+// CS high; a read returns the stored word, a write stores it. Registers
+// marked clear-on-read return their value once and then read as 0.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace HostSim {
+
+static const size_t CHIP_WORDS = 0x400;
+
+struct State {
+    // Clock
+    uint64_t nowUs;
+    double fractionUs;          // Below a microsecond, carried over
+
+    // SPI bus
+    uint32_t clockHz;           // From the last SPISettings
+    unsigned long setupUs;      // Added by every beginTransaction()
+    unsigned long selectUs;     // Added by every CS low (select setup and hold)
+    bool inTransaction;
+    bool selected;              // CS low
+    uint8_t phase;              // Transfers since CS went low
+    uint16_t frameAddr;
+
+    // Traffic since the last reset()
+    uint32_t transactions;
+    uint32_t frames;
+    uint32_t readFrames;
+    uint32_t writeFrames;
+    uint32_t framesOutsideTransaction;
+
+    // The chip
+    uint16_t words[CHIP_WORDS];
+    bool clearOnRead[CHIP_WORDS];
+    uint32_t readsOf[CHIP_WORDS];
+
+    bool quiet;                 // Drop Serial output
+};
+
+inline State& state() {
+    static State s;
+    return s;
+}
+
+inline void advance(double us) {
+    State& s = state();
+    s.fractionUs += us;
+    uint64_t whole = (uint64_t)s.fractionUs;
+    s.nowUs += whole;
+    s.fractionUs -= whole;
+}
+
+// Traffic counters back to zero; the clock and the chip are kept
+inline void resetCounters() {
+    State& s = state();
+    s.transactions = 0;
+    s.frames = 0;
+    s.readFrames = 0;
+    s.writeFrames = 0;
+    s.framesOutsideTransaction = 0;
+    memset(s.readsOf, 0, sizeof(s.readsOf));
+}
+
+inline void setWord(uint16_t addr, uint16_t value) { state().words[addr % CHIP_WORDS] = value; }
+inline uint16_t getWord(uint16_t addr) { return state().words[addr % CHIP_WORDS]; }
+
+// Bus side, called by the SPI.h and Arduino.h stand-ins
+inline void select(bool low) {
+    State& s = state();
+    if (low && !s.selected) {
+        s.phase = 0;
+        advance(s.selectUs);
+    }
+    s.selected = low;
+}
+
+inline uint16_t transfer16(uint16_t data) {
+    State& s = state();
+    advance(16.0 * 1000000.0 / (s.clockHz ? s.clockHz : 1000000));
+    if (!s.selected) {
+        return 0xFFFF;
+    }
+    uint16_t result = 0;
+    if (s.phase == 0) {
+        s.frameAddr = data;
+    } else if (s.phase == 1) {
+        uint16_t addr = (s.frameAddr & 0x7FFF) % CHIP_WORDS;
+        s.frames++;
+        if (!s.inTransaction) {
+            s.framesOutsideTransaction++;
+        }
+        if (s.frameAddr & 0x8000) {
+            s.readFrames++;
+            s.readsOf[addr]++;
+            result = s.words[addr];
+            if (s.clearOnRead[addr]) {
+                s.words[addr] = 0;
+            }
+        } else {
+            s.writeFrames++;
+            s.words[addr] = data;
+        }
+    }
+    s.phase++;
+    return result;
+}
+
+}  // namespace HostSim
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef HOSTSIM_SPI_H
+#define HOSTSIM_SPI_H
+
+// The SPI bus of the host builds, wired to the simulated chip in HostSim.h
+
+#include "HostSim.h"
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+#define SPI_MODE3 3
+
+class SPISettings {
+public:
+    SPISettings(uint32_t clock = 1000000, uint8_t = MSBFIRST, uint8_t = SPI_MODE0) : clockHz(clock) {}
+    uint32_t clockHz;
+};
+
+class SPIClass {
+public:
+    void begin(int = -1, int = -1, int = -1, int = -1) {}
+    void beginTransaction(const SPISettings& settings) {
+        HostSim::State& s = HostSim::state();
+        s.clockHz = settings.clockHz;
+        s.inTransaction = true;
+        s.transactions++;
+        HostSim::advance(s.setupUs);
+    }
+    void endTransaction() { HostSim::state().inTransaction = false; }
+    uint16_t transfer16(uint16_t data) { return HostSim::transfer16(data); }
+    uint8_t transfer(uint8_t data) { return (uint8_t)HostSim::transfer16(data); }
+};
+static SPIClass SPI __attribute__((unused));
+
+#endif
@@ -0,0 +1,247 @@
+// Host model of what the SD logger's buffer does to the ESP32 heap, for
+// three layouts over the same background traffic:
+//   - per record: the old Measurement array plus a FieldValue array for
+//     every record, all freed after each flush
+//   - one block: the column block allocateBuffer() made once when the
+//     buffer became a struct of arrays
+//   - two blocks: the current fill and pending column blocks, one of them
+//     handed to the SD writer task
+// For each it prints what loop() reports every minute on the device: the
+// free-heap minimum (ESP.getMinFreeHeap()) and the largest free block
+// (ESP.getMaxAllocHeap()), and how many free blocks the heap is split into.
+//
+// The heap is a first-fit, address-ordered free list with coalescing and
+// an 8-byte header per block, like ESP-IDF 4's multi_heap (ESP-IDF 5's
+// TLSF picks blocks differently), over HEAP_SIZE bytes, about what is
+// free once WiFi and the web server are up. The background traffic is a
+// guess at loop()'s String and JSON churn, not a recording:
+//   - BURST_ALLOCS short-lived blocks a second, 16-128 bytes, freed
+//     within the second
+//   - one block a second of 64-512 bytes, kept for 1-120 s
+//
+// Build:  g++ -std=c++11 -O2 -o LogBufferHeapSim LogBufferHeapSim.cpp
+// Usage:  LogBufferHeapSim [bufferSize] [fields] [days]   (defaults 1000 6 7;
+//         exit status 1 if a check fails)
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+static const size_t HEAP_SIZE = 160 * 1024;
+static const size_t HEADER = 8;
+static const size_t ALIGN = 8;
+static const size_t MIN_BLOCK = 16;
+static const int BURST_ALLOCS = 20;
+
+// ESP32 sizes: 64-bit time_t (ESP-IDF 5), 32-bit pointers
+static const size_t TIME_SIZE = 8;
+static const size_t MEASUREMENT_SIZE = 24;   // FieldValue*, fieldCount, time_t, double
+static const size_t FIELD_VALUE_SIZE = 8;    // float, bool
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+class Heap {
+public:
+    Heap() : _free(HEAP_SIZE), _minFree(HEAP_SIZE), _minLargest(HEAP_SIZE), _allocs(0), _failed(0) {
+        _freeBlocks[0] = HEAP_SIZE;
+    }
+
+    // Offset of the block's data, or -1 when nothing fits
+    long alloc(size_t size) {
+        size_t need = (size + HEADER + ALIGN - 1) / ALIGN * ALIGN;
+        if (need < MIN_BLOCK) need = MIN_BLOCK;
+        _allocs++;
+        for (std::map<size_t, size_t>::iterator it = _freeBlocks.begin(); it != _freeBlocks.end(); ++it) {
+            if (it->second < need) continue;
+            size_t at = it->first;
+            size_t left = it->second - need;
+            _freeBlocks.erase(it);
+            if (left >= MIN_BLOCK) {
+                _freeBlocks[at + need] = left;
+            } else {
+                need += left;
+            }
+            _used[at] = need;
+            _free -= need;
+            if (_free < _minFree) _minFree = _free;
+            return (long)at;
+        }
+        _failed++;
+        return -1;
+    }
+
+    void release(long at) {
+        if (at < 0) return;
+        std::map<size_t, size_t>::iterator used = _used.find((size_t)at);
+        size_t start = used->first;
+        size_t size = used->second;
+        _used.erase(used);
+        _free += size;
+
+        // Coalesce with the neighbours
+        std::map<size_t, size_t>::iterator next = _freeBlocks.lower_bound(start);
+        if (next != _freeBlocks.end() && start + size == next->first) {
+            size += next->second;
+            next = _freeBlocks.erase(next);
+        }
+        if (next != _freeBlocks.begin()) {
+            std::map<size_t, size_t>::iterator prev = next;
+            --prev;
+            if (prev->first + prev->second == start) {
+                prev->second += size;
+                return;
+            }
+        }
+        _freeBlocks[start] = size;
+    }
+
+    size_t largestFree() {
+        size_t largest = 0;
+        for (std::map<size_t, size_t>::iterator it = _freeBlocks.begin(); it != _freeBlocks.end(); ++it) {
+            if (it->second > largest) largest = it->second;
+        }
+        // What a caller can ask for
+        return largest > HEADER ? largest - HEADER : 0;
+    }
+
+    // The minute report in loop()
+    void report() {
+        size_t largest = largestFree();
+        if (largest < _minLargest) _minLargest = largest;
+    }
+
+    bool consistent() {
+        size_t total = 0;
+        for (std::map<size_t, size_t>::iterator it = _freeBlocks.begin(); it != _freeBlocks.end(); ++it) total += it->second;
+        for (std::map<size_t, size_t>::iterator it = _used.begin(); it != _used.end(); ++it) total += it->second;
+        return total == HEAP_SIZE;
+    }
+
+    size_t freeBytes() { return _free; }
+    size_t minFree() { return _minFree; }
+    size_t minLargest() { return _minLargest; }
+    size_t freeBlockCount() { return _freeBlocks.size(); }
+    unsigned long allocs() { return _allocs; }
+    unsigned long failed() { return _failed; }
+
+private:
+    std::map<size_t, size_t> _freeBlocks;   // Offset -> size, address order
+    std::map<size_t, size_t> _used;
+    size_t _free;
+    size_t _minFree;
+    size_t _minLargest;
+    unsigned long _allocs;
+    unsigned long _failed;
+};
+
+enum Layout { PER_RECORD, ONE_BLOCK, TWO_BLOCKS };
+
+struct Result {
+    size_t minFree;
+    size_t minLargest;
+    size_t endLargest;
+    size_t endFreeBlocks;
+    unsigned long loggerAllocs;
+    unsigned long failed;
+};
+
+// One record a second (LoggingInterval=1000) for days, flushing every
+// bufferSize records
+static Result simulate(Layout layout, unsigned int bufferSize, unsigned int fields, unsigned int days) {
+    Heap heap;
+    srand(1);  // Same background traffic for each layout
+
+    // Allocated once and kept, like the logger's buffer
+    bool perRecord = (layout == PER_RECORD);
+    if (perRecord) {
+        heap.alloc(bufferSize * MEASUREMENT_SIZE);
+    } else if (layout == ONE_BLOCK) {
+        heap.alloc(bufferSize * (sizeof(double) + TIME_SIZE + fields * sizeof(float)));
+    } else {
+        // Plus the presence mask column
+        size_t rowBytes = sizeof(double) + sizeof(uint64_t) + TIME_SIZE + fields * sizeof(float);
+        for (int i = 0; i < 2; i++) heap.alloc(bufferSize * rowBytes);
+    }
+    unsigned long setupAllocs = heap.allocs();
+    std::vector<long> records;
+    unsigned long loggerAllocs = 0;
+
+    std::multimap<unsigned long, long> expiring;   // Second it is freed -> block
+    unsigned long seconds = (unsigned long)days * 86400;
+    for (unsigned long now = 0; now < seconds; now++) {
+        long burst[BURST_ALLOCS];
+        for (int i = 0; i < BURST_ALLOCS; i++) {
+            burst[i] = heap.alloc(16 + rand() % 113);
+        }
+        expiring.insert(std::make_pair(now + 1 + rand() % 120, heap.alloc(64 + rand() % 449)));
+
+        if (perRecord) {
+            records.push_back(heap.alloc(fields * FIELD_VALUE_SIZE));
+            loggerAllocs++;
+            if (records.size() == bufferSize) {
+                for (size_t i = 0; i < records.size(); i++) heap.release(records[i]);
+                records.clear();
+            }
+        }
+
+        for (int i = BURST_ALLOCS - 1; i >= 0; i--) heap.release(burst[i]);
+        while (!expiring.empty() && expiring.begin()->first <= now) {
+            heap.release(expiring.begin()->second);
+            expiring.erase(expiring.begin());
+        }
+        if (now % 60 == 59) heap.report();
+    }
+    check(heap.consistent(), "the model heap accounts for every byte");
+
+    Result r;
+    r.minFree = heap.minFree();
+    r.minLargest = heap.minLargest();
+    r.endLargest = heap.largestFree();
+    r.endFreeBlocks = heap.freeBlockCount();
+    r.loggerAllocs = perRecord ? setupAllocs + loggerAllocs : setupAllocs;
+    r.failed = heap.failed();
+    return r;
+}
+
+static void print(const char* label, const Result& r) {
+    printf("%-11s min free %6zu  largest block min %6zu, at end %6zu  free blocks at end %4zu  logger allocations %lu%s\n",
+           label, r.minFree, r.minLargest, r.endLargest, r.endFreeBlocks, r.loggerAllocs,
+           r.failed ? "  (allocations failed)" : "");
+}
+
+int main(int argc, char** argv) {
+    unsigned int bufferSize = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+    unsigned int fields = argc > 2 ? strtoul(argv[2], nullptr, 10) : 6;
+    unsigned int days = argc > 3 ? strtoul(argv[3], nullptr, 10) : 7;
+    if (bufferSize == 0) bufferSize = 1;
+    if (days == 0) days = 1;
+
+    printf("BufferSize=%u, %u fields, %u day(s) at one record a second, %zu-byte heap\n",
+           bufferSize, fields, days, HEAP_SIZE);
+    Result before = simulate(PER_RECORD, bufferSize, fields, days);
+    Result oneBlock = simulate(ONE_BLOCK, bufferSize, fields, days);
+    Result twoBlocks = simulate(TWO_BLOCKS, bufferSize, fields, days);
+    print("per record", before);
+    print("one block", oneBlock);
+    print("two blocks", twoBlocks);
+
+    check(oneBlock.loggerAllocs == 1 && twoBlocks.loggerAllocs == 2,
+          "the column buffers allocate only in allocateBuffer()");
+    check(before.failed == 0 && oneBlock.failed == 0 && twoBlocks.failed == 0, "no allocation failed");
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,543 @@
+// Host-side decoder for the binary daily logs (DD.bin) written by the
+// firmware with [DataLogging] LogFormat=binary. Prints the same CSV layout
+// the firmware writes with LogFormat=csv.
+//
+// Build:  g++ -std=c++11 -O2 -o LogDecoder LogDecoder.cpp
+// Usage:  LogDecoder [--sparse] DD.bin [DD.csv]   (CSV goes to stdout without an output file)
+//         LogDecoder --fill INTERVAL_MS MAX_GAP_MS DD.csv [out.csv]
+//         LogDecoder ROLLUP.bin [out.csv]          (/rollup/1m, 15m or 1h files)
+//
+// Blocks with a bad CRC are skipped with a warning on stderr; the rest of
+// the file is still decoded. A file still carrying its preallocation
+// trailer is decoded up to the logical end the trailer records.
+//
+// Logs written with deadbands (LogFields=Name~band) only hold the samples
+// that left a band. The decoder puts the uniform series back: each record
+// is repeated every logging interval until the next one, with kWh
+// interpolated in between. Gaps longer than the logger's MaxLogGap are
+// outages and stay gaps. Binary logs carry the interval and gap in their
+// header; CSV logs take them from --fill. --sparse prints the stored
+// records only.
+//
+// Logs with fields at different intervals (LogFields=Name@ms) are sparse:
+// a record only has the fields sampled for it, and the firmware leaves
+// the rest of its CSV cells empty. The decoder fills each empty cell with
+// the field's last value, unless --sparse is given. --fill does the same
+// for CSV logs; use a MAX_GAP_MS of 0 for a multi-rate log without
+// deadbands.
+//
+// Fields logged as statistics of their samples (LogFields=Name:min+max)
+// get one column each, marked in the header as for the firmware's CSV.
+//
+// Rollup files print a row per bucket: its start, the records in it, the
+// kWh of its first and last record (the energy of a bucket is its kWhLast
+// less the previous bucket's) and the mean, min and max of each field.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../WattMeterJR_Firmware_main/BinaryLogFormat.h"
+
+struct FieldInfo {
+    uint8_t encoding;
+    uint8_t decimals;
+    float scale;
+    uint32_t intervalMs;   // 0 before version 4
+    uint8_t statistic;     // BINLOG_STAT_LAST before version 5
+    std::string name;
+    std::string friendlyName;
+    std::string unit;
+};
+
+struct LogLayout {
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t intervalMs;
+    uint32_t maxGapMs;     // 0: every sample was recorded
+    uint16_t flags;
+    std::vector<FieldInfo> fields;
+
+    bool sparse() const { return (flags & BINLOG_FLAG_SPARSE) != 0; }
+    size_t maskSize() const { return sparse() ? (fields.size() + 7) / 8 : 0; }
+    // A record with every field, as the decoder keeps it
+    size_t fullRecordSize() const { return BINLOG_RECORD_FIXED_SIZE + fields.size() * BINLOG_FIELD_SIZE; }
+};
+
+// Repeats a held record until the next one arrives (deadband logs)
+struct GapFiller {
+    bool enabled;
+    uint32_t intervalMs;
+    uint32_t maxGapMs;
+    bool havePrevious;
+    uint32_t previousTime;
+    double previousKWh;
+
+    // Timestamps to emit, as copies of the previous record, before a
+    // record at unixTime. emit(t, kWh) prints one.
+    template <typename Emit>
+    void fillUpTo(uint32_t unixTime, double kWh, Emit emit) {
+        if (enabled && havePrevious && intervalMs > 0 && maxGapMs > 0 && unixTime > previousTime) {
+            uint32_t step = intervalMs < 1000 ? 1 : (intervalMs + 500) / 1000;
+            uint32_t gap = unixTime - previousTime;
+            // A heartbeat lands up to one interval after MaxLogGap
+            if ((uint64_t)gap * 1000 <= (uint64_t)maxGapMs + intervalMs) {
+                for (uint32_t t = previousTime + step; t < unixTime; t += step) {
+                    emit(t, previousKWh + (kWh - previousKWh) * (t - previousTime) / gap);
+                }
+            }
+        }
+        havePrevious = true;
+        previousTime = unixTime;
+        previousKWh = kWh;
+    }
+};
+
+static bool readString(const std::vector<uint8_t>& data, size_t& pos, std::string& out) {
+    if (pos >= data.size()) return false;
+    size_t len = data[pos++];
+    if (pos + len > data.size()) return false;
+    out.assign((const char*)&data[pos], len);
+    pos += len;
+    return true;
+}
+
+// Parse a file header at pos; on success pos is just past it
+static bool readHeader(const std::vector<uint8_t>& data, size_t& pos, LogLayout& layout) {
+    if (pos + BINLOG_FILE_HEADER_SIZE_V2 > data.size()) return false;
+    const uint8_t* p = &data[pos];
+    uint16_t version = binlogGet16(p + 4);
+    if (version < 1 || version > BINLOG_VERSION) {
+        fprintf(stderr, "Unsupported log version %u at offset %zu\n", version, pos);
+        return false;
+    }
+    size_t headerSize = version >= 4 ? BINLOG_FILE_HEADER_SIZE
+                      : version == 3 ? BINLOG_FILE_HEADER_SIZE_V3 : BINLOG_FILE_HEADER_SIZE_V2;
+    if (pos + headerSize > data.size()) return false;
+    uint16_t fieldCount = binlogGet16(p + 6);
+    layout.version = version;
+    layout.recordSize = binlogGet16(p + 8);
+    layout.intervalMs = version >= 3 ? binlogGet32(p + 10) : 0;
+    layout.maxGapMs = version >= 3 ? binlogGet32(p + 14) : 0;
+    layout.flags = version >= 4 ? binlogGet16(p + 18) : 0;
+    size_t maskSize = (layout.flags & BINLOG_FLAG_SPARSE) ? (fieldCount + 7) / 8 : 0;
+    if (layout.recordSize != BINLOG_RECORD_FIXED_SIZE + maskSize + fieldCount * BINLOG_FIELD_SIZE) {
+        fprintf(stderr, "Inconsistent record size at offset %zu\n", pos);
+        return false;
+    }
+
+    size_t cursor = pos + headerSize;
+    layout.fields.clear();
+    for (uint16_t i = 0; i < fieldCount; i++) {
+        FieldInfo field;
+        size_t descSize = version >= 5 ? BINLOG_FIELD_DESC_SIZE
+                        : version == 4 ? BINLOG_FIELD_DESC_SIZE_V4 : BINLOG_FIELD_DESC_SIZE_V3;
+        if (cursor + descSize > data.size()) return false;
+        field.encoding = data[cursor];
+        field.decimals = data[cursor + 1];
+        field.scale = binlogGetFloat(&data[cursor + 2]);
+        field.intervalMs = version >= 4 ? binlogGet32(&data[cursor + 6]) : 0;
+        field.statistic = version >= 5 ? data[cursor + 10] : (uint8_t)BINLOG_STAT_LAST;
+        cursor += descSize;
+        if (!readString(data, cursor, field.name) ||
+            !readString(data, cursor, field.friendlyName) ||
+            !readString(data, cursor, field.unit)) {
+            return false;
+        }
+        layout.fields.push_back(field);
+    }
+
+    pos = cursor;
+    return true;
+}
+
+// Same header line as SDCardLogger::generateCSVHeader(), println'd (CRLF)
+static void printCsvHeader(FILE* out, const LogLayout& layout) {
+    for (size_t i = 0; i < layout.fields.size(); i++) {
+        const FieldInfo& field = layout.fields[i];
+        if (i > 0) fputc(',', out);
+        fputs(field.friendlyName.empty() ? field.name.c_str() : field.friendlyName.c_str(), out);
+        if (field.statistic != BINLOG_STAT_LAST && field.statistic != BINLOG_STAT_MEAN) {
+            fprintf(out, " (%s)", binlogStatName(field.statistic));
+        }
+    }
+    fputs(",kWh,UnixTime\r\n", out);
+}
+
+// record is a full record; fields without a value (have[j] false) are
+// printed as empty cells
+static void printCsvRecord(FILE* out, const LogLayout& layout, const uint8_t* record,
+                           const std::vector<bool>& have, uint32_t unixTime, double kWh) {
+    const uint8_t* p = record + BINLOG_RECORD_FIXED_SIZE;
+
+    for (size_t j = 0; j < layout.fields.size(); j++, p += BINLOG_FIELD_SIZE) {
+        const FieldInfo& field = layout.fields[j];
+        if (j > 0) fputc(',', out);
+        if (!have[j]) continue;
+
+        float value;
+        if (field.encoding == BINLOG_FIELD_RAW) {
+            int32_t raw = (int32_t)binlogGet32(p);
+            // Same float arithmetic as RegisterAccess::scaleValue()
+            value = raw == BINLOG_RAW_INVALID ? NAN : (float)raw * field.scale;
+        } else {
+            value = binlogGetFloat(p);
+        }
+
+        if (!std::isnan(value)) {
+            fprintf(out, "%.*f", field.decimals, value);
+        } else {
+            fputs("NaN", out);
+        }
+    }
+    fprintf(out, ",%.3f,%lu\n", kWh, (unsigned long)unixTime);
+}
+
+// Put the last known value into the empty cells of a sparse CSV record
+static std::string holdCsvValues(const std::string& values, std::vector<std::string>& held) {
+    std::string result;
+    size_t start = 0;
+    for (size_t j = 0; start <= values.size(); j++) {
+        size_t comma = values.find(',', start);
+        if (comma == std::string::npos) comma = values.size();
+        std::string cell = values.substr(start, comma - start);
+        if (held.size() <= j) held.resize(j + 1);
+        if (cell.empty()) {
+            cell = held[j];
+        } else {
+            held[j] = cell;
+        }
+        if (j > 0) result += ',';
+        result += cell;
+        start = comma + 1;
+    }
+    return result;
+}
+
+// Fill the gaps of a CSV log written with deadbands or at several rates.
+// Empty cells get the field's last value; the filled lines repeat the
+// values of the line before, with the kWh and time columns replaced.
+static void fillCsv(const std::vector<uint8_t>& data, FILE* out, GapFiller& filler) {
+    unsigned long records = 0;
+    unsigned long filled = 0;
+    size_t pos = 0;
+    std::string previousValues;
+    std::vector<std::string> held;
+
+    while (pos < data.size()) {
+        size_t end = pos;
+        while (end < data.size() && data[end] != '\n') end++;
+        std::string line((const char*)&data[pos], end - pos);
+        pos = end + 1;
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+
+        // Values, kWh and UnixTime; anything else (header lines) passes through
+        size_t timeComma = line.rfind(',');
+        size_t kWhComma = timeComma == std::string::npos || timeComma == 0
+                              ? std::string::npos : line.rfind(',', timeComma - 1);
+        char* parseEnd = nullptr;
+        unsigned long unixTime = 0;
+        double kWh = 0;
+        bool isRecord = kWhComma != std::string::npos;
+        if (isRecord) {
+            std::string timeText = line.substr(timeComma + 1);
+            unixTime = strtoul(timeText.c_str(), &parseEnd, 10);
+            isRecord = !timeText.empty() && *parseEnd == '\0';
+        }
+        if (isRecord) {
+            std::string kWhText = line.substr(kWhComma + 1, timeComma - kWhComma - 1);
+            kWh = strtod(kWhText.c_str(), &parseEnd);
+            isRecord = !kWhText.empty() && *parseEnd == '\0';
+        }
+        if (!isRecord) {
+            fprintf(out, "%s\r\n", line.c_str());
+            filler.havePrevious = false;
+            held.clear();
+            continue;
+        }
+
+        filler.fillUpTo((uint32_t)unixTime, kWh, [&](uint32_t t, double k) {
+            fprintf(out, "%s,%.3f,%lu\n", previousValues.c_str(), k, (unsigned long)t);
+            filled++;
+        });
+        previousValues = holdCsvValues(line.substr(0, kWhComma), held);
+        fprintf(out, "%s%s\n", previousValues.c_str(), line.c_str() + kWhComma);
+        records++;
+    }
+    fprintf(stderr, "%lu records, %lu filled in\n", records, filled);
+}
+
+// Bytes taken by count records at start; false if they run past the end
+static bool recordsSize(const std::vector<uint8_t>& data, size_t start, uint16_t count,
+                        const LogLayout& layout, size_t& size) {
+    if (!layout.sparse()) {
+        size = (size_t)count * layout.recordSize;
+        return start + size <= data.size();
+    }
+    size_t pos = start;
+    for (uint16_t i = 0; i < count; i++) {
+        size_t head = BINLOG_RECORD_FIXED_SIZE + layout.maskSize();
+        if (pos + head > data.size()) return false;
+        size_t present = 0;
+        for (size_t j = 0; j < layout.fields.size(); j++) {
+            if (data[pos + BINLOG_RECORD_FIXED_SIZE + j / 8] & (1 << (j % 8))) present++;
+        }
+        pos += head + present * BINLOG_FIELD_SIZE;
+        if (pos > data.size()) return false;
+    }
+    size = pos - start;
+    return true;
+}
+
+// Bring the full record in current up to date with a stored one. Fields
+// missing from a sparse record keep their last value when hold is set,
+// and are marked as having none otherwise. Returns the stored size.
+static size_t expandRecord(const LogLayout& layout, const uint8_t* record, bool hold,
+                           std::vector<uint8_t>& current, std::vector<bool>& have) {
+    memcpy(current.data(), record, BINLOG_RECORD_FIXED_SIZE);
+    if (!layout.sparse()) {
+        memcpy(current.data(), record, layout.recordSize);
+        have.assign(layout.fields.size(), true);
+        return layout.recordSize;
+    }
+
+    const uint8_t* mask = record + BINLOG_RECORD_FIXED_SIZE;
+    const uint8_t* p = mask + layout.maskSize();
+    for (size_t j = 0; j < layout.fields.size(); j++) {
+        if (mask[j / 8] & (1 << (j % 8))) {
+            memcpy(&current[BINLOG_RECORD_FIXED_SIZE + j * BINLOG_FIELD_SIZE], p, BINLOG_FIELD_SIZE);
+            p += BINLOG_FIELD_SIZE;
+            have[j] = true;
+        } else if (!hold) {
+            have[j] = false;
+        }
+    }
+    return p - record;
+}
+
+static bool magicAt(const std::vector<uint8_t>& data, size_t pos, const char* magic) {
+    return pos + BINLOG_MAGIC_SIZE <= data.size() &&
+           memcmp(&data[pos], magic, BINLOG_MAGIC_SIZE) == 0;
+}
+
+static int decodeRollup(const std::vector<uint8_t>& data, FILE* out) {
+    if (data.size() < ROLLUP_HEADER_SIZE || binlogGet16(&data[4]) != ROLLUP_VERSION) {
+        fprintf(stderr, "Unsupported rollup file\n");
+        return 1;
+    }
+    uint16_t fieldCount = binlogGet16(&data[6]);
+    size_t recordSize = binlogGet16(&data[8]);
+    if (recordSize != ROLLUP_RECORD_FIXED_SIZE + (size_t)fieldCount * ROLLUP_FIELD_SIZE) {
+        fprintf(stderr, "Bad rollup header\n");
+        return 1;
+    }
+
+    std::vector<std::string> names;
+    std::vector<uint8_t> decimals;
+    size_t pos = ROLLUP_HEADER_SIZE;
+    for (uint16_t f = 0; f < fieldCount; f++) {
+        if (pos + ROLLUP_FIELD_DESC_SIZE > data.size()) return 1;
+        uint8_t statistic = data[pos];
+        decimals.push_back(data[pos + 1]);
+        pos += ROLLUP_FIELD_DESC_SIZE;
+        std::string name;
+        if (!readString(data, pos, name)) return 1;
+        if (statistic != BINLOG_STAT_LAST && statistic != BINLOG_STAT_MEAN) {
+            name += std::string(" (") + binlogStatName(statistic) + ")";
+        }
+        names.push_back(name);
+    }
+
+    fputs("Start,Records,kWhFirst,kWhLast", out);
+    for (size_t f = 0; f < names.size(); f++) {
+        fprintf(out, ",%s mean,%s min,%s max", names[f].c_str(), names[f].c_str(), names[f].c_str());
+    }
+    fputs("\r\n", out);
+
+    unsigned long rows = 0;
+    for (; pos + recordSize <= data.size(); pos += recordSize, rows++) {
+        const uint8_t* p = &data[pos];
+        fprintf(out, "%lu,%lu,%.3f,%.3f", (unsigned long)binlogGet32(p), (unsigned long)binlogGet32(p + 4),
+                binlogGetDouble(p + 8), binlogGetDouble(p + 16));
+        p += ROLLUP_RECORD_FIXED_SIZE;
+        for (size_t f = 0; f < names.size(); f++) {
+            for (int k = 0; k < 3; k++, p += 4) {
+                float value = binlogGetFloat(p);
+                if (!std::isnan(value)) {
+                    fprintf(out, ",%.*f", decimals[f], value);
+                } else {
+                    fputs(",NaN", out);
+                }
+            }
+        }
+        fputc('\n', out);
+    }
+    if (pos < data.size()) {
+        fprintf(stderr, "Ignoring a torn row at the end\n");
+    }
+    fprintf(stderr, "%lu rollup rows decoded\n", rows);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    GapFiller filler = { true, 0, 0, false, 0, 0.0 };
+    bool csvInput = false;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "--sparse") == 0) {
+        filler.enabled = false;
+        arg++;
+    } else if (arg + 2 < argc && strcmp(argv[arg], "--fill") == 0) {
+        filler.intervalMs = strtoul(argv[arg + 1], nullptr, 10);
+        filler.maxGapMs = strtoul(argv[arg + 2], nullptr, 10);
+        csvInput = true;
+        arg += 3;
+    }
+    if (argc - arg < 1 || argc - arg > 2) {
+        fprintf(stderr, "Usage: %s [--sparse] DD.bin [DD.csv]\n"
+                        "       %s --fill INTERVAL_MS MAX_GAP_MS DD.csv [out.csv]\n", argv[0], argv[0]);
+        return 2;
+    }
+    const char* inPath = argv[arg];
+    const char* outPath = argc - arg == 2 ? argv[arg + 1] : nullptr;
+
+    FILE* in = fopen(inPath, "rb");
+    if (in == nullptr) {
+        perror(inPath);
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(in);
+
+    // Today's file is still preallocated: only decode up to the newest
+    // commit. A torn last flush shows up as a bad block below.
+    if (data.size() >= BINLOG_COMMIT_AREA) {
+        size_t dataLimit = data.size() - BINLOG_COMMIT_AREA;
+        bool found = false;
+        BinlogCommit newest;
+        for (int slot = 0; slot < 2; slot++) {
+            BinlogCommit commit;
+            if (binlogGetCommit(&data[dataLimit + slot * BINLOG_COMMIT_SLOT_SIZE], &commit) &&
+                commit.logicalEnd <= dataLimit && (!found || commit.sequence > newest.sequence)) {
+                newest = commit;
+                found = true;
+            }
+        }
+        if (found) {
+            data.resize(newest.logicalEnd);
+        }
+    }
+
+    FILE* out = stdout;
+    if (outPath != nullptr) {
+        out = fopen(outPath, "wb");
+        if (out == nullptr) {
+            perror(outPath);
+            return 1;
+        }
+    }
+
+    if (!csvInput && magicAt(data, 0, ROLLUP_MAGIC)) {
+        int result = decodeRollup(data, out);
+        if (out != stdout) {
+            fclose(out);
+        }
+        return result;
+    }
+
+    if (csvInput) {
+        fillCsv(data, out, filler);
+        if (out != stdout) {
+            fclose(out);
+        }
+        return 0;
+    }
+
+    LogLayout layout;
+    bool haveLayout = false;
+    unsigned long records = 0;
+    unsigned long badBlocks = 0;
+    unsigned long filled = 0;
+    std::vector<uint8_t> current;   // Last record printed, with every field
+    std::vector<bool> have;         // Fields of current with a value
+    size_t pos = 0;
+
+    while (pos < data.size()) {
+        if (magicAt(data, pos, BINLOG_FILE_MAGIC)) {
+            size_t start = pos;
+            if (!readHeader(data, pos, layout)) {
+                fprintf(stderr, "Bad file header at offset %zu\n", start);
+                haveLayout = false;
+                pos = start + 1;
+                continue;
+            }
+            haveLayout = true;
+            filler.intervalMs = layout.intervalMs;
+            filler.maxGapMs = layout.maxGapMs;
+            filler.havePrevious = false;  // Don't fill across a layout change
+            current.assign(layout.fullRecordSize(), 0);
+            have.assign(layout.fields.size(), false);
+            printCsvHeader(out, layout);
+            continue;
+        }
+
+        size_t headerSize = (haveLayout && layout.version >= 2) ? BINLOG_BLOCK_HEADER_SIZE
+                                                                : BINLOG_BLOCK_HEADER_SIZE_V1;
+        if (magicAt(data, pos, BINLOG_BLOCK_MAGIC) && haveLayout &&
+            pos + headerSize <= data.size()) {
+            uint16_t count = binlogGet16(&data[pos + 4]);
+            const size_t start = pos + headerSize;
+            size_t payload = 0;
+            uint32_t crc;
+            uint32_t expected = 0;
+            if (layout.version >= 2) {
+                // Covers the record count and sequence too
+                crc = binlogGet32(&data[pos + 10]);
+                expected = binlogCrc32(&data[pos + 4], 6);
+            } else {
+                crc = binlogGet32(&data[pos + 6]);
+            }
+
+            if (recordsSize(data, start, count, layout, payload) &&
+                binlogCrc32(data.data() + start, payload, expected) == crc) {
+                size_t offset = start;
+                for (uint16_t i = 0; i < count; i++) {
+                    const uint8_t* record = &data[offset];
+                    uint32_t unixTime = binlogGet32(record);
+                    double kWh = binlogGetDouble(record + 4);
+                    filler.fillUpTo(unixTime, kWh, [&](uint32_t t, double k) {
+                        printCsvRecord(out, layout, current.data(), have, t, k);
+                        filled++;
+                    });
+                    offset += expandRecord(layout, record, filler.enabled, current, have);
+                    printCsvRecord(out, layout, current.data(), have, unixTime, kWh);
+                }
+                records += count;
+                pos = start + payload;
+                continue;
+            }
+            fprintf(stderr, "Skipping block with bad CRC or length at offset %zu\n", pos);
+            badBlocks++;
+        }
+
+        // Not at a valid header or block: scan for the next one
+        pos++;
+        while (pos < data.size() && !magicAt(data, pos, BINLOG_FILE_MAGIC) &&
+               !magicAt(data, pos, BINLOG_BLOCK_MAGIC)) {
+            pos++;
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    fprintf(stderr, "%lu records decoded, %lu filled in, %lu bad blocks\n", records, filled, badBlocks);
+    return badBlocks > 0 ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+// Host-side checks for the byte ranges of a log download (GET /api/log):
+// every form of "Range:" header the firmware honours or ignores, and the
+// mapping of the range's first byte onto the pieces of log files that
+// make up the body.
+//
+// Build:  g++ -std=c++11 -O2 -o LogDownloadTest LogDownloadTest.cpp
+// Usage:  LogDownloadTest   (prints each failed check; exit status 1 if any)
+
+#include <climits>
+#include <cstdio>
+
+#include "../WattMeterJR_Firmware_main/LogDownloadRange.h"
+
+struct Segment {
+    size_t length;
+};
+
+static int failures = 0;
+
+// Range header applied to a body of total bytes: expect the return value
+// and the resulting [start, end)
+static void checkRange(const char* header, size_t total, bool ok, size_t start, size_t end) {
+    size_t gotStart = 0;
+    size_t gotEnd = total;
+    bool gotOk = parseByteRange(header, total, &gotStart, &gotEnd);
+    if (gotOk != ok || (ok && (gotStart != start || gotEnd != end))) {
+        printf("FAIL range \"%s\" of %zu: got %s [%zu, %zu), expected %s [%zu, %zu)\n",
+               header ? header : "(none)", total, gotOk ? "ok" : "416", gotStart, gotEnd,
+               ok ? "ok" : "416", start, end);
+        failures++;
+    }
+}
+
+static void checkSegment(const Segment* segments, unsigned int count, size_t pos,
+                         bool found, unsigned int segment, size_t offset) {
+    unsigned int gotSegment = 0;
+    size_t gotOffset = 0;
+    bool gotFound = findSegment(segments, count, pos, &gotSegment, &gotOffset);
+    if (gotFound != found || (found && (gotSegment != segment || gotOffset != offset))) {
+        printf("FAIL byte %zu: got %s segment %u offset %zu, expected %s segment %u offset %zu\n",
+               pos, gotFound ? "" : "no", gotSegment, gotOffset,
+               found ? "" : "no", segment, offset);
+        failures++;
+    }
+}
+
+int main() {
+    const size_t total = 1000;
+
+    // Ignored: the whole body
+    checkRange(nullptr, total, true, 0, total);
+    checkRange("", total, true, 0, total);
+    checkRange("items=0-99", total, true, 0, total);
+    checkRange("bytes=0-99,200-299", total, true, 0, total);
+    checkRange("bytes=100", total, true, 0, total);
+    checkRange("bytes=500-400", total, true, 0, total);
+
+    // bytes=first-last
+    checkRange("bytes=0-99", total, true, 0, 100);
+    checkRange("bytes=100-199", total, true, 100, 200);
+    checkRange("bytes=999-999", total, true, 999, 1000);
+    checkRange("bytes=0-999", total, true, 0, 1000);
+    checkRange("bytes=10-5000", total, true, 10, 1000);
+    checkRange("bytes= 10 - 20 ", total, true, 10, 21);
+    checkRange("bytes=1000-1100", total, false, 0, 0);
+
+    // A last byte at the top of unsigned long must not wrap to+1 to 0
+    checkRange("bytes=5-4294967295", total, true, 5, 1000);
+    checkRange("bytes=0-4294967295", total, true, 0, 1000);
+    char header[64];
+    snprintf(header, sizeof(header), "bytes=5-%lu", ULONG_MAX);
+    checkRange(header, total, true, 5, 1000);
+    checkRange("bytes=5-99999999999999999999999", total, true, 5, 1000);
+
+    // bytes=first-
+    checkRange("bytes=100-", total, true, 100, 1000);
+    checkRange("bytes=999-", total, true, 999, 1000);
+    checkRange("bytes=1000-", total, false, 0, 0);
+
+    // bytes=-suffix
+    checkRange("bytes=-100", total, true, 900, 1000);
+    checkRange("bytes=-1000", total, true, 0, 1000);
+    checkRange("bytes=-5000", total, true, 0, 1000);
+    checkRange("bytes=-0", total, false, 0, 0);
+
+    // A one-byte body
+    checkRange("bytes=0-0", 1, true, 0, 1);
+    checkRange("bytes=0-4294967295", 1, true, 0, 1);
+    checkRange("bytes=-1", 1, true, 0, 1);
+
+    // A header and a stretch per log, as handleLogDownload() builds them
+    const Segment segments[] = { { 64 }, { 300 }, { 64 }, { 500 } };
+    const unsigned int count = sizeof(segments) / sizeof(segments[0]);
+    checkSegment(segments, count, 0, true, 0, 0);
+    checkSegment(segments, count, 63, true, 0, 63);
+    checkSegment(segments, count, 64, true, 1, 0);
+    checkSegment(segments, count, 363, true, 1, 299);
+    checkSegment(segments, count, 364, true, 2, 0);
+    checkSegment(segments, count, 428, true, 3, 0);
+    checkSegment(segments, count, 927, true, 3, 499);
+    checkSegment(segments, count, 928, false, 0, 0);
+    checkSegment(segments, 0, 0, false, 0, 0);
+
+    // Every Range form, through to the segment the body starts in
+    const size_t body = 928;
+    const struct { const char* header; unsigned int segment; size_t offset; } starts[] = {
+        { "bytes=0-99", 0, 0 },
+        { "bytes=64-", 1, 0 },
+        { "bytes=400-4294967295", 2, 36 },
+        { "bytes=-500", 3, 0 },
+        { "bytes=-1", 3, 499 },
+        { "bytes=500-400", 0, 0 },
+    };
+    for (const auto& s : starts) {
+        size_t start = 0;
+        size_t end = body;
+        if (!parseByteRange(s.header, body, &start, &end)) {
+            printf("FAIL range \"%s\" of %zu refused\n", s.header, body);
+            failures++;
+            continue;
+        }
+        checkSegment(segments, count, start, true, s.segment, s.offset);
+    }
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
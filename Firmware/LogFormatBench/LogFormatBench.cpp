@@ -0,0 +1,259 @@
+// Host benchmark of CSV record formatting in SDCardLogger: the printf
+// path writeBufferToFile() used to take (file.printf() per value and
+// file.print() per separator, each a write() to the card) against the
+// current one (formatFixed() into the 1 KB write block, written out in
+// whole sectors). Also checks that both produce the same bytes.
+//
+// Field lists are the default LogFields in Settings.ini (6 fields) and a
+// three-phase one (16 fields), with the decimal places setLogFields()
+// chooses for each register and values drawn from the register's range
+// and scale, averaged like the logger's means.
+//
+// Build:  g++ -std=c++11 -O2 -fpermissive -I../HostSim -o LogFormatBench LogFormatBench.cpp
+//             ../WattMeterJR_Firmware_main/ATM90E32.cpp
+//             ../WattMeterJR_Firmware_main/RegisterDescriptors.cpp
+// Usage:  LogFormatBench [records]   (exit status 1 if a check fails)
+//
+// The writes go to RAM, so the printf path is not charged for its extra
+// write() calls into the SD driver; the call counts are printed instead.
+// Rates are host records/second; the ratio is what carries over.
+
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../WattMeterJR_Firmware_main/RegisterDescriptors.h"
+#include "../WattMeterJR_Firmware_main/LogNumberFormat.h"
+
+static const size_t SECTOR_SIZE = 512;        // LOG_SECTOR_SIZE
+static const size_t WRITE_BLOCK_SIZE = 1024;  // LOG_WRITE_BLOCK_SIZE
+
+static int failures = 0;
+
+// Stands in for the log File: keeps the bytes, counts write() calls
+class MemoryFile {
+public:
+    std::string bytes;
+    unsigned long writes = 0;
+
+    size_t write(const uint8_t* data, size_t len) {
+        bytes.append((const char*)data, len);
+        writes++;
+        return len;
+    }
+    // What Arduino's Print does: format onto the stack, then one write()
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char text[64];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        if (len > 0) write((const uint8_t*)text, (size_t)len < sizeof(text) ? len : sizeof(text) - 1);
+    }
+    void print(const char* text) { write((const uint8_t*)text, strlen(text)); }
+};
+
+struct Field {
+    const char* name;
+    uint8_t decimals;
+    float low;    // Range of the scaled value
+    float high;
+};
+
+struct Records {
+    std::vector<Field> fields;
+    std::vector<float> values;   // Column per field, like LogBuffer
+    std::vector<double> kWh;
+    std::vector<long> time;
+    size_t count;
+};
+
+// As setLogFields() decides them
+static uint8_t decimalsFor(const RegisterDescriptor* reg, const char* name) {
+    if (reg->regType == DT_INT16 || reg->regType == DT_INT32) return 0;
+    if (strstr(name, "rms") != nullptr) return 3;
+    return 2;
+}
+
+static const RegisterDescriptor* findRegister(const char* name) {
+    for (size_t i = 0; i < registerCount; i++) {
+        if (strcmp(registers[i].name, name) == 0) return &registers[i];
+    }
+    return nullptr;
+}
+
+static bool makeRecords(const char* const* names, size_t fieldCount, size_t count, Records* out) {
+    out->fields.clear();
+    for (size_t j = 0; j < fieldCount; j++) {
+        const RegisterDescriptor* reg = findRegister(names[j]);
+        if (reg == nullptr) {
+            printf("FAIL no register %s\n", names[j]);
+            failures++;
+            return false;
+        }
+        // Mains-like readings: a quarter of the signed 16-bit range, or
+        // the top of an unsigned one
+        float span = (reg->regType == DT_UINT16 ? 1000.0f : 8192.0f) * reg->scale;
+        if (reg->regType == DT_INT32) span *= 16;
+        Field f = { names[j], decimalsFor(reg, names[j]), reg->regType == DT_UINT16 ? 0 : -span, span };
+        out->fields.push_back(f);
+    }
+
+    srand(1);
+    out->count = count;
+    out->values.resize(fieldCount * count);
+    out->kWh.resize(count);
+    out->time.resize(count);
+    for (size_t j = 0; j < fieldCount; j++) {
+        const Field& f = out->fields[j];
+        for (size_t i = 0; i < count; i++) {
+            // Mean of 10 samples, so not on the register's grid
+            float sum = 0;
+            for (int s = 0; s < 10; s++) {
+                sum += f.low + (f.high - f.low) * (float)rand() / RAND_MAX;
+            }
+            out->values[j * count + i] = (i % 997 == 0) ? NAN : sum / 10;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        out->kWh[i] = 1234.5 + i * 0.0004;
+        out->time[i] = 1792108800L + (long)i * 10;
+    }
+    return true;
+}
+
+// The old path
+static void writePrintf(const Records& r, MemoryFile& file) {
+    size_t fieldCount = r.fields.size();
+    for (size_t i = 0; i < r.count; i++) {
+        for (size_t j = 0; j < fieldCount; j++) {
+            if (j > 0) file.print(",");
+            float value = r.values[j * r.count + i];
+            if (!std::isnan(value)) {
+                file.printf("%.*f", r.fields[j].decimals, value);
+            } else {
+                file.print("NaN");
+            }
+        }
+        file.printf(",%.3f", r.kWh[i]);
+        file.printf(",%ld\n", r.time[i]);
+    }
+}
+
+// The current path: SDCardLogger::appendToBlock() and writeBlock()
+class BlockWriter {
+public:
+    BlockWriter(MemoryFile& file) : _file(file), _length(0), _fileOffset(file.bytes.size()) {}
+
+    void append(const char* text, size_t len) {
+        while (len > 0) {
+            size_t space = WRITE_BLOCK_SIZE - _length;
+            size_t n = len < space ? len : space;
+            memcpy(&_block[_length], text, n);
+            _length += n;
+            text += n;
+            len -= n;
+            if (_length == WRITE_BLOCK_SIZE) flush(false);
+        }
+    }
+
+    void flush(bool all) {
+        size_t n = _length;
+        if (!all) n -= (_fileOffset + _length) % SECTOR_SIZE;
+        if (n == 0) return;
+        _file.write(_block, n);
+        memmove(_block, &_block[n], _length - n);
+        _length -= n;
+        _fileOffset += n;
+    }
+
+private:
+    MemoryFile& _file;
+    uint8_t _block[WRITE_BLOCK_SIZE];
+    size_t _length;
+    size_t _fileOffset;
+};
+
+static void writeFormatted(const Records& r, MemoryFile& file) {
+    BlockWriter block(file);
+    size_t fieldCount = r.fields.size();
+    char text[LOG_MAX_NUMBER_CHARS + 1];
+    for (size_t i = 0; i < r.count; i++) {
+        for (size_t j = 0; j < fieldCount; j++) {
+            size_t len = 0;
+            if (j > 0) text[len++] = ',';
+            float value = r.values[j * r.count + i];
+            if (!std::isnan(value)) {
+                len += formatFixed(&text[len], value, r.fields[j].decimals);
+            } else {
+                memcpy(&text[len], "NaN", 3);
+                len += 3;
+            }
+            block.append(text, len);
+        }
+        text[0] = ',';
+        size_t len = 1 + formatFixed(&text[1], r.kWh[i], 3);
+        block.append(text, len);
+        text[0] = ',';
+        len = 1 + formatFixed(&text[1], (double)r.time[i], 0);
+        text[len++] = '\n';
+        block.append(text, len);
+    }
+    block.flush(true);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double recordsPerSecond(void (*write)(const Records&, MemoryFile&), const Records& r, MemoryFile& file) {
+    file.bytes.clear();
+    file.bytes.reserve(r.count * (r.fields.size() + 2) * 12);
+    file.writes = 0;
+    Clock::time_point start = Clock::now();
+    write(r, file);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return r.count / seconds;
+}
+
+static void run(const char* label, const char* const* names, size_t fieldCount, size_t count) {
+    Records records;
+    if (!makeRecords(names, fieldCount, count, &records)) return;
+
+    MemoryFile before, after;
+    double printfRate = recordsPerSecond(writePrintf, records, before);
+    double blockRate = recordsPerSecond(writeFormatted, records, after);
+    if (before.bytes != after.bytes) {
+        size_t at = 0;
+        while (at < before.bytes.size() && at < after.bytes.size() && before.bytes[at] == after.bytes[at]) at++;
+        printf("FAIL %s: the block path's text differs from printf's at byte %zu\n", label, at);
+        failures++;
+    }
+
+    printf("%-9s %8.0f rec/s printf, %8.0f rec/s block (x%.1f); write() calls %.1f vs %.3f per record\n",
+           label, printfRate, blockRate, blockRate / printfRate,
+           (double)before.writes / count, (double)after.writes / count);
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    if (count == 0) count = 1;
+
+    static const char* const defaults[] = { "UrmsA", "IrmsA", "PmeanA", "QmeanA", "SmeanA", "Freq" };
+    static const char* const threePhase[] = {
+        "UrmsA", "UrmsB", "UrmsC", "IrmsA", "IrmsB", "IrmsC", "PmeanA", "PmeanB",
+        "PmeanC", "PmeanT", "QmeanT", "SmeanT", "PFmeanA", "PFmeanT", "Freq", "Temp"
+    };
+    run("6 fields", defaults, sizeof(defaults) / sizeof(defaults[0]), count);
+    run("16 fields", threePhase, sizeof(threePhase) / sizeof(threePhase[0]), count);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,180 @@
+// Host-side checks for the recovery of a daily log after a power cut
+// (LogRecovery.h), on in-memory files:
+//
+//   - a plain binary log, whose records are full of 0x0A bytes, is kept
+//     whole; the CSV scan for the last complete line would have cut it
+//     back to its last 0x0A (the boot-time recovery did, on DD.bin)
+//   - a plain CSV log loses only its torn last line
+//   - a preallocated log ends at its newest commit whose data matches
+//     its CRC, or at the older commit when the newest flush was torn
+//
+// Build:  g++ -std=c++11 -O2 -o LogRecoveryTest LogRecoveryTest.cpp
+// Usage:  LogRecoveryTest   (prints each failed check; exit status 1 if any)
+
+#include <cstdio>
+#include <vector>
+
+#include "../WattMeterJR_Firmware_main/LogRecovery.h"
+
+// The parts of an SD card File that recovery uses
+class MemoryFile {
+public:
+    std::vector<uint8_t> bytes;
+    size_t position = 0;
+
+    size_t size() { return bytes.size(); }
+    bool seek(size_t pos) {
+        if (pos > bytes.size()) return false;
+        position = pos;
+        return true;
+    }
+    size_t read(uint8_t* out, size_t n) {
+        if (n > bytes.size() - position) n = bytes.size() - position;
+        memcpy(out, &bytes[position], n);
+        position += n;
+        return n;
+    }
+};
+
+static int failures = 0;
+static uint8_t scratch[1024];  // Like the logger's write block
+
+static void checkEnd(const char* what, const LogRecovery& got, size_t end, bool preallocated) {
+    if (got.end != end || got.preallocated != preallocated) {
+        printf("FAIL %s: end %zu%s, expected %zu%s\n", what, got.end, got.preallocated ? " (preallocated)" : "",
+               end, preallocated ? " (preallocated)" : "");
+        failures++;
+    }
+}
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+// Binary records as the logger writes them: little-endian times, kWh
+// and raw values, so 0x0A turns up wherever a byte happens to be 10
+static std::vector<uint8_t> binaryData(size_t records) {
+    std::vector<uint8_t> data(BINLOG_FILE_HEADER_SIZE, 0);
+    memcpy(&data[0], BINLOG_FILE_MAGIC, BINLOG_MAGIC_SIZE);
+    for (size_t r = 0; r < records; r++) {
+        uint8_t record[BINLOG_RECORD_FIXED_SIZE + 3 * BINLOG_FIELD_SIZE];
+        binlogPut32(record, 1792108800 + (uint32_t)r * 10);
+        binlogPutDouble(record + 4, 10.0 + r * 0.001);
+        binlogPut32(record + 12, 23010 + (uint32_t)(r % 7));   // 0x59E2..: no newline
+        binlogPut32(record + 16, 0x0A0A + (uint32_t)r);        // Newlines aplenty
+        binlogPut32(record + 20, (uint32_t)(r * 2654435761u));
+        data.insert(data.end(), record, record + sizeof(record));
+    }
+    return data;
+}
+
+static size_t lastNewline(const std::vector<uint8_t>& data) {
+    for (size_t i = data.size(); i > 0; i--) {
+        if (data[i - 1] == '\n') return i;
+    }
+    return 0;
+}
+
+// data, the commit area at extent - BINLOG_COMMIT_AREA, and the commits
+// in their slots (sequence % 2)
+static MemoryFile preallocatedFile(const std::vector<uint8_t>& data, size_t extent,
+                                   const BinlogCommit* commits, size_t count) {
+    MemoryFile file;
+    file.bytes = data;
+    file.bytes.resize(extent, 0xA5);  // Whatever the clusters held before
+    memset(&file.bytes[extent - BINLOG_COMMIT_AREA], 0, BINLOG_COMMIT_AREA);
+    for (size_t i = 0; i < count; i++) {
+        binlogPutCommit(&file.bytes[extent - BINLOG_COMMIT_AREA + (commits[i].sequence % 2) * BINLOG_COMMIT_SLOT_SIZE],
+                        commits[i]);
+    }
+    return file;
+}
+
+int main() {
+    const char* binPath = "/data/2026/10/16.bin";
+    const char* csvPath = "/data/2026/10/16.csv";
+    check(!logPathIsCsv(binPath), "a .bin path is binary");
+    check(logPathIsCsv(csvPath), "a .csv path is CSV");
+    check(!logPathIsCsv("csv") && !logPathIsCsv(""), "short paths");
+
+    // A plain binary log cut short by a power cut mid-record
+    std::vector<uint8_t> binary = binaryData(400);
+    binary.resize(binary.size() - 5);
+    check(binary.back() != '\n' && lastNewline(binary) > binary.size() - LOG_RECOVERY_SCAN,
+          "the test data has 0x0A bytes in the scanned tail");
+    MemoryFile plainBin;
+    plainBin.bytes = binary;
+    LogRecovery recovery = logRecover(plainBin, logPathIsCsv(binPath), scratch, sizeof(scratch));
+    checkEnd("plain .bin", recovery, binary.size(), false);
+    check(recovery.lastCommit.sequence == 0 && recovery.lastCommit.logicalEnd == binary.size(),
+          "plain .bin continues from its end");
+    LogRecovery asCsv = logRecover(plainBin, true, scratch, sizeof(scratch));
+    check(asCsv.end < binary.size(), "the CSV scan would have cut the .bin");
+
+    // A plain CSV log with a torn last line
+    const char* lines = "Time,UrmsA,kWh\n2026-10-16 00:00:00,230.12,10.000\n2026-10-16 00:00:10,230.0";
+    MemoryFile plainCsv;
+    plainCsv.bytes.assign(lines, lines + strlen(lines));
+    size_t complete = strrchr(lines, '\n') - lines + 1;
+    checkEnd("plain .csv with a torn line", logRecover(plainCsv, logPathIsCsv(csvPath), scratch, sizeof(scratch)),
+             complete, false);
+    plainCsv.bytes.resize(complete);
+    checkEnd("plain .csv ending in a newline", logRecover(plainCsv, true, scratch, sizeof(scratch)), complete, false);
+
+    // No newline within LOG_RECOVERY_SCAN of the end: nothing is cut
+    MemoryFile longLine;
+    longLine.bytes.assign(LOG_RECOVERY_SCAN + 2000, 'x');
+    longLine.bytes[100] = '\n';
+    checkEnd("CSV with no newline in the scanned tail", logRecover(longLine, true, scratch, sizeof(scratch)),
+             longLine.bytes.size(), false);
+
+    // Preallocated binary log: two flushes, each with its commit
+    std::vector<uint8_t> data = binaryData(300);
+    size_t firstEnd = BINLOG_FILE_HEADER_SIZE + 200 * (BINLOG_RECORD_FIXED_SIZE + 3 * BINLOG_FIELD_SIZE);
+    BinlogCommit commits[2];
+    commits[0].sequence = 7;
+    commits[0].blockStart = 0;
+    commits[0].logicalEnd = (uint32_t)firstEnd;
+    commits[0].blockCrc = binlogCrc32(&data[0], firstEnd);
+    commits[1].sequence = 8;
+    commits[1].blockStart = (uint32_t)firstEnd;
+    commits[1].logicalEnd = (uint32_t)data.size();
+    commits[1].blockCrc = binlogCrc32(&data[firstEnd], data.size() - firstEnd);
+    const size_t extent = 65536;
+
+    MemoryFile intact = preallocatedFile(data, extent, commits, 2);
+    recovery = logRecover(intact, false, scratch, sizeof(scratch));
+    checkEnd("preallocated .bin", recovery, data.size(), true);
+    check(recovery.tornCommit == 0 && recovery.lastCommit.sequence == 8, "preallocated .bin continues after commit 8");
+
+    // The second flush's data torn (its commit was written, the data not all)
+    MemoryFile torn = preallocatedFile(data, extent, commits, 2);
+    torn.bytes[data.size() - 3] ^= 0xFF;
+    recovery = logRecover(torn, false, scratch, sizeof(scratch));
+    checkEnd("preallocated .bin with a torn flush", recovery, firstEnd, true);
+    check(recovery.tornCommit == 8, "the torn commit is reported");
+    check(recovery.lastCommit.sequence == 8, "the sequence continues past the torn commit");
+
+    // A CSV preallocated by older firmware: the commit decides, not the scan
+    std::vector<uint8_t> csvData(plainCsv.bytes);
+    csvData.insert(csvData.end(), lines, lines + 20);  // Uncommitted, torn
+    BinlogCommit csvCommit;
+    csvCommit.sequence = 1;
+    csvCommit.blockStart = 0;
+    csvCommit.logicalEnd = (uint32_t)complete;
+    csvCommit.blockCrc = binlogCrc32(&csvData[0], complete);
+    MemoryFile preallocatedCsv = preallocatedFile(csvData, extent, &csvCommit, 1);
+    checkEnd("preallocated .csv", logRecover(preallocatedCsv, true, scratch, sizeof(scratch)), complete, true);
+
+    printf("Plain .bin of %zu bytes: kept whole (the CSV scan would keep %zu)\n", binary.size(), asCsv.end);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
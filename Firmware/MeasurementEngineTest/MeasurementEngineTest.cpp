@@ -0,0 +1,222 @@
+// Host-side check of MeasurementEngine against the simulated ATM90E32 in
+// Firmware/HostSim: the SPI traffic of the shipped Settings.ini consumers
+// polling the chip each on its own timer, against the same consumers
+// subscribed to the engine, over the same stretch of simulated time.
+//
+//   Logger        LogFields=UrmsA,IrmsA,PmeanA,QmeanA,SmeanA,Freq, SampleInterval=100
+//   Power check   UrmsA every 100 ms
+//   Display       Field0-2=UrmsA,IrmsA,PmeanA every 500 ms
+//
+// Build:  g++ -std=c++11 -O2 -fpermissive -I../HostSim -o MeasurementEngineTest MeasurementEngineTest.cpp
+//             ../WattMeterJR_Firmware_main/ATM90E32.cpp
+//             ../WattMeterJR_Firmware_main/RegisterAccess.cpp
+//             ../WattMeterJR_Firmware_main/RegisterCache.cpp
+//             ../WattMeterJR_Firmware_main/RegisterDescriptors.cpp
+//             ../WattMeterJR_Firmware_main/MeasurementEngine.cpp
+// Usage:  MeasurementEngineTest [seconds]   (prints each failed check; exit status 1 if any)
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../WattMeterJR_Firmware_main/ATM90E32.h"
+#include "../WattMeterJR_Firmware_main/RegisterAccess.h"
+#include "../WattMeterJR_Firmware_main/RegisterCache.h"
+#include "../WattMeterJR_Firmware_main/MeasurementEngine.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+struct Consumer {
+    const char* name;
+    const char* fields[6];
+    size_t count;
+    unsigned long intervalMs;
+    const RegisterDescriptor* regs[6];
+    unsigned long last;
+    int sub;
+    uint8_t slots[6];
+};
+
+static Consumer consumers[] = {
+    { "logger", { "UrmsA", "IrmsA", "PmeanA", "QmeanA", "SmeanA", "Freq" }, 6, 100, {}, 0, -1, {} },
+    { "power check", { "UrmsA" }, 1, 100, {}, 0, -1, {} },
+    { "display", { "UrmsA", "IrmsA", "PmeanA" }, 3, 500, {}, 0, -1, {} },
+};
+static const size_t consumerCount = sizeof(consumers) / sizeof(consumers[0]);
+
+struct Traffic {
+    uint32_t transactions;
+    uint32_t frames;
+    unsigned long busUs;
+};
+
+// Bus traffic since the counters were reset, and the bus time it took
+static Traffic traffic(unsigned long busUs) {
+    Traffic t = { HostSim::state().transactions, HostSim::state().frames, busUs };
+    return t;
+}
+
+// Every consumer on its own timer, reading a register at a time
+// (burst = false) or its whole list in one burst
+static Traffic runSeparate(RegisterAccess& regAccess, unsigned long seconds, bool burst) {
+    HostSim::resetCounters();
+    unsigned long busUs = 0;
+    unsigned long endMs = millis() + seconds * 1000;
+    for (size_t c = 0; c < consumerCount; c++) {
+        consumers[c].last = millis() - consumers[c].intervalMs;
+    }
+    while (millis() < endMs) {
+        for (size_t c = 0; c < consumerCount; c++) {
+            Consumer& consumer = consumers[c];
+            if (millis() - consumer.last < consumer.intervalMs) continue;
+            consumer.last += consumer.intervalMs;
+
+            unsigned long start = micros();
+            float values[6];
+            bool ok[6];
+            if (burst) {
+                regAccess.readRegisters(consumer.regs, values, ok, consumer.count);
+            } else {
+                for (size_t i = 0; i < consumer.count; i++) {
+                    values[i] = regAccess.readRegister(consumer.fields[i], &ok[i]);
+                }
+            }
+            busUs += micros() - start;
+        }
+        HostSim::advance(1000);  // The rest of loop()
+    }
+    return traffic(busUs);
+}
+
+static Traffic runEngine(MeasurementEngine& engine, ATM90E32& chip, unsigned long seconds,
+                         unsigned long budgetUs, unsigned long* worstServiceUs, uint32_t* acquisitions) {
+    HostSim::resetCounters();
+    unsigned long busUs = 0;
+    unsigned long endMs = millis() + seconds * 1000;
+    uint32_t firstSequence = engine.getAcquisitionCount();
+    while (millis() < endMs) {
+        engine.update();
+        unsigned long start = micros();
+        chip.service(budgetUs);
+        unsigned long spent = micros() - start;
+        busUs += spent;
+        if (spent > *worstServiceUs) *worstServiceUs = spent;
+        HostSim::advance(1000);
+    }
+    *acquisitions = engine.getAcquisitionCount() - firstSequence;
+    return traffic(busUs);
+}
+
+int main(int argc, char** argv) {
+    unsigned long seconds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10;
+    if (seconds == 0) seconds = 1;
+
+    HostSim::setWord(0xD9, 23012);   // UrmsA
+    HostSim::setWord(0xDD, 4567);    // IrmsA
+    HostSim::setWord(0xB1, 0x0001);  // PmeanA
+    HostSim::setWord(0xC1, 0x2345);
+    HostSim::setWord(0xB5, 0x0000);  // QmeanA
+    HostSim::setWord(0xC5, 0x1000);
+    HostSim::setWord(0xB9, 0x0001);  // SmeanA
+    HostSim::setWord(0xC9, 0x3000);
+    HostSim::setWord(0xF8, 5998);    // Freq
+
+    ATM90E32 chip(5);
+    chip.begin();
+    RegisterAccess regAccess(chip);
+    RegisterCache regCache(regAccess);
+    MeasurementEngine engine(regCache);
+
+    size_t distinctWords = 0;
+    for (size_t c = 0; c < consumerCount; c++) {
+        for (size_t i = 0; i < consumers[c].count; i++) {
+            consumers[c].regs[i] = regAccess.getRegisterInfo(consumers[c].fields[i]);
+            if (!consumers[c].regs[i]) {
+                printf("FAIL %s is not a register\n", consumers[c].fields[i]);
+                return 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < consumers[0].count; i++) {  // The logger's fields cover everyone's
+        const RegisterDescriptor* reg = consumers[0].regs[i];
+        distinctWords += (reg->regType == DT_UINT32 || reg->regType == DT_INT32) ? 2 : 1;
+    }
+
+    Traffic perRegister = runSeparate(regAccess, seconds, false);
+    Traffic perConsumer = runSeparate(regAccess, seconds, true);
+
+    // The engine: every consumer subscribed, loop() running update() and
+    // the driver's service(), first with the default budget per call, then
+    // with one large enough for a whole burst
+    for (size_t c = 0; c < consumerCount; c++) {
+        Consumer& consumer = consumers[c];
+        consumer.sub = engine.subscribe(consumer.regs, consumer.count, consumer.intervalMs, consumer.slots);
+        check(consumer.sub >= 0, "subscribe()");
+    }
+    unsigned long worstServiceUs = 0;
+    uint32_t acquisitions = 0;
+    Traffic withEngine = runEngine(engine, chip, seconds, ATM_ASYNC_BUDGET_US, &worstServiceUs, &acquisitions);
+    unsigned long unboundedWorstUs = 0;
+    uint32_t unboundedAcquisitions = 0;
+    Traffic unbounded = runEngine(engine, chip, seconds, 1000000, &unboundedWorstUs, &unboundedAcquisitions);
+
+    // Every consumer saw fresh, correct values
+    const MeasurementSnapshot* snap = engine.latest();
+    check(snap != nullptr, "a snapshot was published");
+    if (snap) {
+        for (size_t c = 0; c < consumerCount; c++) {
+            Consumer& consumer = consumers[c];
+            check(engine.getSubscriptionSequence(consumer.sub) != 0, "every subscription served");
+            for (size_t i = 0; i < consumer.count; i++) {
+                uint8_t slot = consumer.slots[i];
+                bool ok = false;
+                float direct = regAccess.readRegister(consumer.fields[i], &ok);
+                if (!snap->valid[slot] || std::fabs(snap->values[slot] - direct) > 1e-4f) {
+                    printf("FAIL %s %s: snapshot %g, chip %g\n", consumer.name, consumer.fields[i],
+                           snap->values[slot], direct);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    // One burst per 100 ms holding each distinct register once
+    unsigned long expectedAcquisitions = seconds * 1000 / 100;
+    check(acquisitions + 1 >= expectedAcquisitions && acquisitions <= expectedAcquisitions + 1,
+          "one acquisition per 100 ms");
+    check(withEngine.frames == acquisitions * distinctWords, "each distinct register read once per acquisition");
+    check(unbounded.frames == unboundedAcquisitions * distinctWords, "the same without a service() budget");
+    check(withEngine.frames < perConsumer.frames, "fewer frames than polling per consumer");
+    check(withEngine.busUs < perConsumer.busUs, "less bus time than polling per consumer");
+    check(unbounded.transactions < perConsumer.transactions, "fewer transactions than polling per consumer");
+    // A budget-sliced burst costs a transaction per slice, but no service()
+    // call runs more than one frame past its budget
+    check(worstServiceUs <= ATM_ASYNC_BUDGET_US + 320, "service() within its budget");
+
+    printf("%lu s of simulated time at 100 kHz:\n", seconds);
+    printf("  %-34s %8s %8s %10s\n", "", "trans.", "frames", "bus ms");
+    printf("  %-34s %8u %8u %10.1f\n", "separate timers, a register each",
+           (unsigned)perRegister.transactions, (unsigned)perRegister.frames, perRegister.busUs / 1000.0);
+    printf("  %-34s %8u %8u %10.1f\n", "separate timers, a burst each",
+           (unsigned)perConsumer.transactions, (unsigned)perConsumer.frames, perConsumer.busUs / 1000.0);
+    printf("  %-34s %8u %8u %10.1f\n", "MeasurementEngine, 1 ms slices",
+           (unsigned)withEngine.transactions, (unsigned)withEngine.frames, withEngine.busUs / 1000.0);
+    printf("  %-34s %8u %8u %10.1f\n", "MeasurementEngine, whole bursts",
+           (unsigned)unbounded.transactions, (unsigned)unbounded.frames, unbounded.busUs / 1000.0);
+    printf("  Engine: %u acquisitions per run; longest service() %lu us sliced, %lu us whole\n",
+           (unsigned)acquisitions, worstServiceUs, unboundedWorstUs);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
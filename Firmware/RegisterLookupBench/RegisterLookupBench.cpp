@@ -0,0 +1,133 @@
+// Host microbenchmark of register lookup: the linear strcmp scan over
+// registers[] that RegisterAccess::findRegister() used to do, against
+// the sorted name index it searches now and the RegisterId handles that
+// skip the name altogether. Also checks that the index finds the same
+// entry as the scan for every name (the first, where names repeat) and
+// that the aliases resolve.
+//
+// Build:  g++ -std=c++11 -O2 -fpermissive -I../HostSim -o RegisterLookupBench RegisterLookupBench.cpp
+//             ../WattMeterJR_Firmware_main/ATM90E32.cpp
+//             ../WattMeterJR_Firmware_main/RegisterAccess.cpp
+//             ../WattMeterJR_Firmware_main/RegisterDescriptors.cpp
+// Usage:  RegisterLookupBench [rounds]   (exit status 1 if a check fails)
+//
+// Times are host nanoseconds per lookup; the ratio between the methods
+// is what carries over to the ESP32.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../WattMeterJR_Firmware_main/ATM90E32.h"
+#include "../WattMeterJR_Firmware_main/RegisterAccess.h"
+
+static int failures = 0;
+
+// The lookup before the index
+static const RegisterDescriptor* linearFind(const char* name) {
+    for (size_t i = 0; i < registerCount; ++i) {
+        if (strcmp(registers[i].name, name) == 0) {
+            return &registers[i];
+        }
+    }
+    return nullptr;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double nanosPerLookup(Clock::time_point start, unsigned long lookups) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / lookups;
+}
+
+int main(int argc, char** argv) {
+    unsigned long rounds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+    if (rounds == 0) rounds = 1;
+
+    ATM90E32 chip(5);
+    RegisterAccess regAccess(chip);
+
+    // Same entry as the scan for every table name
+    for (size_t i = 0; i < registerCount; i++) {
+        const char* name = registers[i].name;
+        if (regAccess.getRegisterInfo(name) != linearFind(name)) {
+            printf("FAIL index and scan disagree on %s\n", name);
+            failures++;
+        }
+        if (regAccess.getRegisterInfo((RegisterId)i) != &registers[i]) {
+            printf("FAIL RegisterId %u is not table entry %u\n", (unsigned)i, (unsigned)i);
+            failures++;
+        }
+    }
+    if (regAccess.getRegisterInfo("NoSuchRegister") != nullptr || regAccess.getRegisterInfo("") != nullptr) {
+        printf("FAIL unknown names resolve\n");
+        failures++;
+    }
+    const char* aliases[] = { "IPeakA", "IPeakB", "IPeakC" };
+    const RegisterId aliased[] = { RegisterId::IPeakA, RegisterId::IPeakB, RegisterId::IPeakC };
+    for (size_t i = 0; i < 3; i++) {
+        if (regAccess.getRegisterInfo(aliases[i]) != &registers[(size_t)aliased[i]]) {
+            printf("FAIL alias %s\n", aliases[i]);
+            failures++;
+        }
+    }
+
+    // The names the logger, display and power-loss check look up most,
+    // spread over the table, then every name in the table
+    const char* hot[] = { "UrmsA", "IrmsA", "PmeanT", "Freq", "PFmeanT", "UangleC", "MeterEn", "CfgRegAccEn" };
+    const size_t hotCount = sizeof(hot) / sizeof(hot[0]);
+    RegisterId hotIds[hotCount];
+    for (size_t i = 0; i < hotCount; i++) {
+        const RegisterDescriptor* reg = linearFind(hot[i]);
+        if (!reg) {
+            printf("FAIL %s is not in the table\n", hot[i]);
+            return 1;
+        }
+        hotIds[i] = (RegisterId)(reg - registers);
+    }
+
+    volatile uintptr_t sink = 0;
+    printf("%u registers, %lu rounds\n", (unsigned)registerCount, rounds);
+    printf("%-24s %12s %12s %12s\n", "ns per lookup", "linear scan", "name index", "RegisterId");
+
+    Clock::time_point start = Clock::now();
+    for (unsigned long r = 0; r < rounds; r++)
+        for (size_t i = 0; i < hotCount; i++) sink = sink + (uintptr_t)linearFind(hot[i]);
+    double hotLinear = nanosPerLookup(start, rounds * hotCount);
+
+    start = Clock::now();
+    for (unsigned long r = 0; r < rounds; r++)
+        for (size_t i = 0; i < hotCount; i++) sink = sink + (uintptr_t)regAccess.getRegisterInfo(hot[i]);
+    double hotIndex = nanosPerLookup(start, rounds * hotCount);
+
+    start = Clock::now();
+    for (unsigned long r = 0; r < rounds; r++)
+        for (size_t i = 0; i < hotCount; i++) sink = sink + (uintptr_t)regAccess.getRegisterInfo(hotIds[i]);
+    double hotId = nanosPerLookup(start, rounds * hotCount);
+    printf("%-24s %12.1f %12.1f %12.1f\n", "logged fields", hotLinear, hotIndex, hotId);
+
+    unsigned long allRounds = rounds / 16 + 1;
+    start = Clock::now();
+    for (unsigned long r = 0; r < allRounds; r++)
+        for (size_t i = 0; i < registerCount; i++) sink = sink + (uintptr_t)linearFind(registers[i].name);
+    double allLinear = nanosPerLookup(start, allRounds * registerCount);
+
+    start = Clock::now();
+    for (unsigned long r = 0; r < allRounds; r++)
+        for (size_t i = 0; i < registerCount; i++) sink = sink + (uintptr_t)regAccess.getRegisterInfo(registers[i].name);
+    double allIndex = nanosPerLookup(start, allRounds * registerCount);
+
+    start = Clock::now();
+    for (unsigned long r = 0; r < allRounds; r++)
+        for (size_t i = 0; i < registerCount; i++) sink = sink + (uintptr_t)regAccess.getRegisterInfo((RegisterId)i);
+    double allId = nanosPerLookup(start, allRounds * registerCount);
+    printf("%-24s %12.1f %12.1f %12.1f\n", "every table name", allLinear, allIndex, allId);
+    (void)sink;
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -3,6 +3,13 @@
 ATM90E32::ATM90E32(int csPin) {
     _csPin = csPin;
     _spiClock = 100000; // default 100 kHz
+    _transactionCount = 0;
+    _nextTicket = 1;
+    _longestServiceUs = 0;
+    for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+        _async[i].state = ASYNC_FREE;
+        _async[i].ticket = 0;
+    }
 }
 
 bool ATM90E32::begin() {
@@ -28,11 +35,12 @@ uint16_t ATM90E32::readBitfield(uint16_t addr, uint8_t pos, uint8_t len) {
     return (regVal & mask) >> pos;
 }
 
-uint16_t ATM90E32::read16(uint16_t addr) {
+// One read frame: CS low, address, 16 bits of response, CS high.
+// Caller must already hold the SPI transaction.
+uint16_t ATM90E32::readFrame(uint16_t addr) {
   // Force MSB = 1 for read
   addr = (addr & 0x7FFF) | 0x8000;
 
-  SPI.beginTransaction(SPISettings(_spiClock, MSBFIRST, SPI_MODE3));
   digitalWrite(_csPin, LOW);
 
   // Send the 16-bit address (two bytes)
@@ -41,18 +49,59 @@ uint16_t ATM90E32::read16(uint16_t addr) {
   uint16_t result = SPI.transfer16(0x0000);
 
   digitalWrite(_csPin, HIGH);
+
+  return result;
+}
+
+uint16_t ATM90E32::read16(uint16_t addr) {
+  SPI.beginTransaction(SPISettings(_spiClock, MSBFIRST, SPI_MODE3));
+  _transactionCount++;
+
+  uint16_t result = readFrame(addr);
+
   SPI.endTransaction();
 
   return result;
 }
 
 uint32_t ATM90E32::read32(uint16_t addrHigh, uint16_t addrLow) {
-  uint32_t highWord = read16(addrHigh);
-  uint32_t lowWord = read16(addrLow);
-  uint32_t value = (highWord << 16) | lowWord;
+  uint16_t addrs[2] = { addrHigh, addrLow };
+  uint16_t words[2];
+  readBurst(addrs, words, 2);
+  uint32_t value = ((uint32_t)words[0] << 16) | words[1];
   return value;
 }
 
+// --- Burst Read (arbitrary address list) ---
+// The chip latches each frame on the CS rising edge, so CS still pulses per
+// word, but the bus is only claimed and configured once for the whole list.
+void ATM90E32::readBurst(const uint16_t* addrs, uint16_t* out, size_t n) {
+  if (n == 0) return;
+
+  SPI.beginTransaction(SPISettings(_spiClock, MSBFIRST, SPI_MODE3));
+  _transactionCount++;
+
+  for (size_t i = 0; i < n; i++) {
+    out[i] = readFrame(addrs[i]);
+  }
+
+  SPI.endTransaction();
+}
+
+// --- Burst Read (contiguous address range) ---
+void ATM90E32::readRange(uint16_t startAddr, uint16_t* out, size_t n) {
+  if (n == 0) return;
+
+  SPI.beginTransaction(SPISettings(_spiClock, MSBFIRST, SPI_MODE3));
+  _transactionCount++;
+
+  for (size_t i = 0; i < n; i++) {
+    out[i] = readFrame(startAddr + i);
+  }
+
+  SPI.endTransaction();
+}
+
 // --- Single Bit Write ---
 void ATM90E32::writeBit(uint16_t addr, uint8_t pos, bool value) {
     uint16_t regVal = read16(addr);
@@ -73,10 +122,156 @@ void ATM90E32::writeBitfield(uint16_t addr, uint8_t pos, uint8_t len, uint16_t v
 }
 
 void ATM90E32::write16(uint16_t addr, uint16_t value) {
-  // Clear MSB to indicate a write
-   addr = addr & 0x7FFF;
+  SPI.beginTransaction(SPISettings(_spiClock, MSBFIRST, SPI_MODE3));
+  _transactionCount++;
+
+  writeFrame(addr, value);
+
+  SPI.endTransaction();
+}
+
+// --- Burst Write (arbitrary address list) ---
+void ATM90E32::writeBurst(const uint16_t* addrs, const uint16_t* values, size_t n) {
+  if (n == 0) return;
 
   SPI.beginTransaction(SPISettings(_spiClock, MSBFIRST, SPI_MODE3));
+  _transactionCount++;
+
+  for (size_t i = 0; i < n; i++) {
+    writeFrame(addrs[i], values[i]);
+  }
+
+  SPI.endTransaction();
+}
+
+// --- Asynchronous reads ---
+uint32_t ATM90E32::queueRead(uint16_t addr, ATM90E32Callback callback, void* context) {
+  return queueBurst(&addr, 1, callback, context);
+}
+
+uint32_t ATM90E32::queueBurst(const uint16_t* addrs, size_t n, ATM90E32Callback callback, void* context) {
+  if (n == 0 || n > ATM_ASYNC_MAX_WORDS) {
+    return 0;
+  }
+
+  // Only a free entry will do: a completed one still holds words its
+  // caller has not collected yet
+  AsyncRequest* req = nullptr;
+  for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+    if (_async[i].state == ASYNC_FREE) {
+      req = &_async[i];
+      break;
+    }
+  }
+  if (req == nullptr) {
+    return 0;
+  }
+
+  memcpy(req->addrs, addrs, n * sizeof(uint16_t));
+  req->count = n;
+  req->done = 0;
+  req->callback = callback;
+  req->context = context;
+  req->ticket = _nextTicket++;
+  req->state = ASYNC_PENDING;
+
+  return req->ticket;
+}
+
+ATM90E32::AsyncRequest* ATM90E32::findRequest(uint32_t ticket) {
+  for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+    if (_async[i].state != ASYNC_FREE && _async[i].ticket == ticket) {
+      return &_async[i];
+    }
+  }
+  return nullptr;
+}
+
+// Oldest pending request, so requests complete in the order queued
+ATM90E32::AsyncRequest* ATM90E32::nextPending() {
+  AsyncRequest* oldest = nullptr;
+  for (size_t i = 0; i < ATM_ASYNC_QUEUE_DEPTH; i++) {
+    if (_async[i].state == ASYNC_PENDING && (oldest == nullptr || _async[i].ticket < oldest->ticket)) {
+      oldest = &_async[i];
+    }
+  }
+  return oldest;
+}
+
+void ATM90E32::service(unsigned long budgetUs) {
+  AsyncRequest* req = nextPending();
+  if (req == nullptr) return;
+
+  AsyncRequest* completed[ATM_ASYNC_QUEUE_DEPTH];
+  size_t completedCount = 0;
+  unsigned long start = micros();
+
+  SPI.beginTransaction(SPISettings(_spiClock, MSBFIRST, SPI_MODE3));
+  _transactionCount++;
+
+  while (req != nullptr) {
+    req->words[req->done] = readFrame(req->addrs[req->done]);
+    req->done++;
+
+    if (req->done == req->count) {
+      req->state = ASYNC_DONE;
+      completed[completedCount++] = req;
+      req = nextPending();
+    }
+
+    if (micros() - start >= budgetUs) {
+      break;
+    }
+  }
+
+  SPI.endTransaction();
+
+  unsigned long elapsed = micros() - start;
+  if (elapsed > _longestServiceUs) {
+    _longestServiceUs = elapsed;
+  }
+
+  // A request with a callback is delivered through it and nobody will
+  // call getResult() for it, so its entry is released afterwards
+  for (size_t i = 0; i < completedCount; i++) {
+    AsyncRequest* done = completed[i];
+    if (done->callback) {
+      uint32_t ticket = done->ticket;
+      done->callback(ticket, done->words, done->count, done->context);
+      if (done->state == ASYNC_DONE && done->ticket == ticket) {
+        done->state = ASYNC_FREE;
+      }
+    }
+  }
+}
+
+bool ATM90E32::isComplete(uint32_t ticket) {
+  AsyncRequest* req = findRequest(ticket);
+  return req == nullptr || req->state == ASYNC_DONE;
+}
+
+bool ATM90E32::getResult(uint32_t ticket, uint16_t* out, size_t n) {
+  AsyncRequest* req = findRequest(ticket);
+  if (req == nullptr || req->state != ASYNC_DONE) {
+    return false;
+  }
+
+  if (n > req->count) n = req->count;
+  memcpy(out, req->words, n * sizeof(uint16_t));
+  req->state = ASYNC_FREE;
+  return true;
+}
+
+void ATM90E32::wait(uint32_t ticket) {
+  while (!isComplete(ticket)) {
+    service();
+  }
+}
+
+// One write frame; caller holds the SPI transaction
+void ATM90E32::writeFrame(uint16_t addr, uint16_t value) {
+  // Clear MSB to indicate a write
+  addr = addr & 0x7FFF;
 
   digitalWrite(_csPin, LOW);
 
@@ -88,7 +283,6 @@ void ATM90E32::write16(uint16_t addr, uint16_t value) {
 
   digitalWrite(_csPin, HIGH);
   //delayMicroseconds(10);
-  SPI.endTransaction();
 }
 
 
@@ -5,7 +5,13 @@
 #include <SPI.h>
 #include "RegisterDescriptors.h"
 
+#define ATM_ASYNC_QUEUE_DEPTH 4     // Requests that can be queued at once
+#define ATM_ASYNC_MAX_WORDS 96      // Words per queued request
+#define ATM_ASYNC_BUDGET_US 1000    // Default bus time per service() call
 
+// Completion callback for queued reads; runs from service() after the
+// SPI transaction has been released
+typedef void (*ATM90E32Callback)(uint32_t ticket, const uint16_t* words, size_t n, void* context);
 
 class ATM90E32 {
 public:
@@ -24,19 +30,70 @@ public:
     void writeBit(uint16_t addr, uint8_t pos, bool value);
     void writeBitfield(uint16_t addr, uint8_t pos, uint8_t len, uint16_t value);
     void write16(uint16_t addr, uint16_t value);
-    
 
+    // Burst reads - every word is clocked inside a single SPI transaction
+    void readBurst(const uint16_t* addrs, uint16_t* out, size_t n);
+    void readRange(uint16_t startAddr, uint16_t* out, size_t n);
+
+    // Burst write - values[i] goes to addrs[i], all in one SPI transaction
+    void writeBurst(const uint16_t* addrs, const uint16_t* values, size_t n);
 
+    // Asynchronous reads. Requests are queued and clocked out by service()
+    // a bounded number of microseconds at a time, so loop() never stalls
+    // for a whole burst. The calls above stay blocking and run immediately.
+    // Returns a non-zero ticket, or 0 if every entry is still pending or
+    // holds a result nobody has collected (the caller then reads blocking).
+    // With a callback the words go to it and the entry frees itself;
+    // without one, getResult() collects them and frees the entry.
+    uint32_t queueRead(uint16_t addr, ATM90E32Callback callback = nullptr, void* context = nullptr);
+    uint32_t queueBurst(const uint16_t* addrs, size_t n, ATM90E32Callback callback = nullptr, void* context = nullptr);
 
+    // Must be called in loop(): clocks queued frames for up to budgetUs
+    // (at least one frame) and runs completion callbacks
+    void service(unsigned long budgetUs = ATM_ASYNC_BUDGET_US);
+    // True while queued frames remain for service() to clock out
+    bool hasPending() { return nextPending() != nullptr; }
 
+    // True once the ticket has been read (or is no longer known)
+    bool isComplete(uint32_t ticket);
+    // Copy a completed request's words and release its queue entry
+    // Returns false if the ticket is still pending or unknown
+    bool getResult(uint32_t ticket, uint16_t* out, size_t n);
+    // Service the queue until the ticket completes
+    void wait(uint32_t ticket);
 
     // Utility
     void setSPIClock(uint32_t hz);
 
+    // Diagnostics: number of SPI bus transactions since boot
+    uint32_t getTransactionCount() { return _transactionCount; }
+    // Longest single service() call, i.e. the worst loop() stall from async reads
+    unsigned long getLongestServiceMicros() { return _longestServiceUs; }
+
 private:
     int _csPin;
     uint32_t _spiClock;
+    uint32_t _transactionCount;
     uint16_t spiTransfer16(uint16_t data);
+    uint16_t readFrame(uint16_t addr);
+    void writeFrame(uint16_t addr, uint16_t value);
+
+    enum AsyncState { ASYNC_FREE, ASYNC_PENDING, ASYNC_DONE };
+    struct AsyncRequest {
+        AsyncState state;
+        uint32_t ticket;
+        size_t count;
+        size_t done;                            // Frames clocked so far
+        uint16_t addrs[ATM_ASYNC_MAX_WORDS];
+        uint16_t words[ATM_ASYNC_MAX_WORDS];
+        ATM90E32Callback callback;
+        void* context;
+    };
+    AsyncRequest _async[ATM_ASYNC_QUEUE_DEPTH];
+    uint32_t _nextTicket;
+    unsigned long _longestServiceUs;
+    AsyncRequest* findRequest(uint32_t ticket);
+    AsyncRequest* nextPending();
 };
 
 #endif
@@ -0,0 +1,266 @@
+#ifndef BINARYLOGFORMAT_H
+#define BINARYLOGFORMAT_H
+
+// Layout of the binary daily log (/data/YYYY/MM/DD.bin), written by
+// SDCardLogger when [DataLogging] LogFormat=binary and read back by the
+// host tool in Firmware/LogDecoder. Plain C++ so both sides can include it.
+//
+// All multi-byte values are little-endian and unaligned.
+//
+// File header (repeated in the stream whenever the field list changes):
+//   char     magic[4]      "WMLG"
+//   uint16_t version       BINLOG_VERSION
+//   uint16_t fieldCount
+//   uint16_t recordSize    bytes per record (the largest, with BINLOG_FLAG_SPARSE)
+//   uint32_t intervalMs    Logging interval (of the fastest field); version 3+
+//   uint32_t maxGapMs      Deadband logging: a record at least this often,
+//                          each one holding until the next. 0 when every
+//                          sample is recorded. Version 3+
+//   uint16_t flags         BINLOG_FLAG_*; version 4+
+//   fieldCount descriptors:
+//     uint8_t  encoding    BINLOG_FIELD_RAW or BINLOG_FIELD_FLOAT
+//     uint8_t  decimals    CSV decimal places
+//     float    scale       value = raw * scale (BINLOG_FIELD_RAW)
+//     uint32_t intervalMs  How often the field is sampled; version 4+
+//     uint8_t  statistic   BINLOG_STAT_*, over the samples taken during
+//                          each interval; version 5+
+//     name, friendly name, unit: each a uint8_t length and the bytes
+//
+// Block (one or more per buffer flush):
+//   char     magic[4]      "WMBK"
+//   uint16_t recordCount
+//   uint32_t sequence      Commit (flush) that wrote the block; version 2+
+//   uint32_t crc           CRC-32 of recordCount, sequence and the records
+//                          (version 1: of the records only)
+//   recordCount records:
+//     uint32_t unixTime
+//     double   kWh
+//     With BINLOG_FLAG_SPARSE (fields at different intervals):
+//       (fieldCount + 7) / 8 bytes: bit i (byte i / 8, LSB first) set if
+//                           field i was sampled for this record
+//     fieldCount (sparse: sampled fields only) x 4 bytes: int32_t raw
+//                           register value (BINLOG_RAW_INVALID if the read
+//                           failed) or float (NaN if invalid)
+//
+// Commit records (CSV and binary logs alike): the logger reserves the
+// day's space up front, so until the file is trimmed its last two
+// BINLOG_COMMIT_SLOT_SIZE sectors are commit slots. After every flush the
+// record for that flush goes to slot (sequence % 2), at
+// size - (2 - slot) * BINLOG_COMMIT_SLOT_SIZE, leaving the previous commit
+// intact in the other slot. The valid record with the highest sequence
+// says where the data ends; its block CRC lets recovery tell a flush that
+// was torn by a power cut and fall back to the previous commit.
+//   char     magic[4]      "WMCM"
+//   uint32_t sequence      Flushes committed to this file
+//   uint32_t logicalEnd    Bytes of real data
+//   uint32_t blockStart    Where the data of this flush starts
+//   uint32_t blockCrc      CRC-32 of [blockStart, logicalEnd)
+//   uint32_t recordCrc     CRC-32 of the 20 bytes above
+//
+// Rollup files (LogRollup): one row per bucket of records, for long-range
+// queries. /rollup/1m/YYYYMMDD.bin, /rollup/15m/YYYYMM.bin and
+// /rollup/1h/YYYY.bin, named for the local date of their rows.
+//   char     magic[4]      "WMRU"
+//   uint16_t version       ROLLUP_VERSION
+//   uint16_t fieldCount
+//   uint16_t recordSize
+//   uint32_t seconds       Bucket length
+//   fieldCount descriptors:
+//     uint8_t  statistic   BINLOG_STAT_* of the log column aggregated
+//     uint8_t  decimals    CSV decimal places
+//     name: a uint8_t length and the bytes
+//   Rows, oldest first; a partial row at the end is a torn write:
+//     uint32_t start       Unix time of the bucket start
+//     uint32_t records     Log records in the bucket
+//     double   kWhFirst    kWh of the first and last record
+//     double   kWhLast
+//     fieldCount x float mean, min, max (NaN: no valid value)
+//
+// Time index (the log's path plus ".idx", e.g. /data/YYYY/MM/DD.csv.idx):
+// where to start reading a daily log for a given time, so a reader can
+// binary search it instead of scanning the log. Appended after the log
+// flushes it points into.
+//   char     magic[4]      "WMIX"
+//   uint16_t version       BINLOG_INDEX_VERSION
+//   uint16_t stride        Records between entries
+//   uint32_t headerSize    Log header at offset 0, before the first entry
+//                          (0: not known)
+//   Entries, in log order; a partial one at the end is a torn write, and
+//   entries at or past the log's logical end are stale:
+//     uint32_t unixTime    Time of the record at offset, never less than
+//                          the previous entry's
+//     uint32_t offset      Start of a CSV line or a binary block
+//     uint32_t headerStart Header describing the records from there on
+//     uint32_t headerSize
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define BINLOG_VERSION 5
+#define BINLOG_FILE_MAGIC "WMLG"
+#define BINLOG_BLOCK_MAGIC "WMBK"
+#define BINLOG_MAGIC_SIZE 4
+#define BINLOG_FILE_HEADER_SIZE 20   // Before the field descriptors
+#define BINLOG_FILE_HEADER_SIZE_V3 18
+#define BINLOG_FILE_HEADER_SIZE_V2 10
+#define BINLOG_FIELD_DESC_SIZE 11    // Before the strings
+#define BINLOG_FIELD_DESC_SIZE_V4 10
+#define BINLOG_FIELD_DESC_SIZE_V3 6
+#define BINLOG_FLAG_SPARSE 0x0001
+#define BINLOG_BLOCK_HEADER_SIZE 14
+#define BINLOG_BLOCK_HEADER_SIZE_V1 10
+#define BINLOG_RECORD_FIXED_SIZE 12  // unixTime + kWh
+#define BINLOG_FIELD_SIZE 4
+#define BINLOG_RAW_INVALID INT32_MIN
+#define BINLOG_COMMIT_MAGIC "WMCM"
+#define BINLOG_COMMIT_SIZE 24
+#define BINLOG_COMMIT_SLOT_SIZE 512       // One sector per slot
+#define BINLOG_COMMIT_AREA (2 * BINLOG_COMMIT_SLOT_SIZE)
+#define ROLLUP_VERSION 1
+#define ROLLUP_MAGIC "WMRU"
+#define ROLLUP_HEADER_SIZE 14        // Before the field descriptors
+#define ROLLUP_FIELD_DESC_SIZE 2     // Before the name
+#define ROLLUP_RECORD_FIXED_SIZE 24  // start, records, kWhFirst, kWhLast
+#define ROLLUP_FIELD_SIZE 12         // mean, min, max
+#define BINLOG_INDEX_VERSION 1
+#define BINLOG_INDEX_MAGIC "WMIX"
+#define BINLOG_INDEX_HEADER_SIZE 12
+#define BINLOG_INDEX_ENTRY_SIZE 16
+
+enum BinaryLogFieldEncoding : uint8_t {
+    BINLOG_FIELD_RAW = 0,    // Signed raw register value, scaled on decode
+    BINLOG_FIELD_FLOAT = 1   // Converted value (registers with a convertFunc)
+};
+
+// What a field's value is, per logging interval
+enum BinaryLogStatistic : uint8_t {
+    BINLOG_STAT_LAST = 0,    // Latest sample (a point sample)
+    BINLOG_STAT_MEAN = 1,
+    BINLOG_STAT_MIN = 2,
+    BINLOG_STAT_MAX = 3,
+    BINLOG_STAT_STDDEV = 4,  // Population standard deviation
+    BINLOG_STAT_COUNT
+};
+
+// Column name suffix for each statistic, as in the CSV header
+inline const char* binlogStatName(uint8_t statistic) {
+    static const char* const names[BINLOG_STAT_COUNT] = { "last", "mean", "min", "max", "sd" };
+    return statistic < BINLOG_STAT_COUNT ? names[statistic] : "?";
+}
+
+inline void binlogPut16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+inline void binlogPut32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+inline uint16_t binlogGet16(const uint8_t* p) {
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+inline uint32_t binlogGet32(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// Floating point values are stored as their IEEE-754 bit patterns
+inline void binlogPutFloat(uint8_t* p, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    binlogPut32(p, bits);
+}
+
+inline float binlogGetFloat(const uint8_t* p) {
+    uint32_t bits = binlogGet32(p);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+inline void binlogPutDouble(uint8_t* p, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    binlogPut32(p, (uint32_t)bits);
+    binlogPut32(p + 4, (uint32_t)(bits >> 32));
+}
+
+inline double binlogGetDouble(const uint8_t* p) {
+    uint64_t bits = binlogGet32(p) | ((uint64_t)binlogGet32(p + 4) << 32);
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// CRC-32 (IEEE 802.3, as used by zip). Bitwise: blocks are small and
+// this avoids a 1 KB table in RAM.
+inline uint32_t binlogCrc32(const uint8_t* data, size_t len, uint32_t crc = 0) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+struct BinlogCommit {
+    uint32_t sequence;
+    uint32_t logicalEnd;
+    uint32_t blockStart;
+    uint32_t blockCrc;
+};
+
+inline void binlogPutCommit(uint8_t* p, const BinlogCommit& commit) {
+    memcpy(p, BINLOG_COMMIT_MAGIC, BINLOG_MAGIC_SIZE);
+    binlogPut32(p + 4, commit.sequence);
+    binlogPut32(p + 8, commit.logicalEnd);
+    binlogPut32(p + 12, commit.blockStart);
+    binlogPut32(p + 16, commit.blockCrc);
+    binlogPut32(p + 20, binlogCrc32(p, 20));
+}
+
+// True (and commit filled in) if p holds an intact commit record
+inline bool binlogGetCommit(const uint8_t* p, BinlogCommit* commit) {
+    if (memcmp(p, BINLOG_COMMIT_MAGIC, BINLOG_MAGIC_SIZE) != 0 ||
+        binlogGet32(p + 20) != binlogCrc32(p, 20)) {
+        return false;
+    }
+    commit->sequence = binlogGet32(p + 4);
+    commit->logicalEnd = binlogGet32(p + 8);
+    commit->blockStart = binlogGet32(p + 12);
+    commit->blockCrc = binlogGet32(p + 16);
+    return commit->blockStart <= commit->logicalEnd;
+}
+
+struct BinlogIndexEntry {
+    uint32_t unixTime;
+    uint32_t offset;
+    uint32_t headerStart;
+    uint32_t headerSize;
+};
+
+inline void binlogPutIndexEntry(uint8_t* p, const BinlogIndexEntry& entry) {
+    binlogPut32(p, entry.unixTime);
+    binlogPut32(p + 4, entry.offset);
+    binlogPut32(p + 8, entry.headerStart);
+    binlogPut32(p + 12, entry.headerSize);
+}
+
+inline void binlogGetIndexEntry(const uint8_t* p, BinlogIndexEntry* entry) {
+    entry->unixTime = binlogGet32(p);
+    entry->offset = binlogGet32(p + 4);
+    entry->headerStart = binlogGet32(p + 8);
+    entry->headerSize = binlogGet32(p + 12);
+}
+
+#endif
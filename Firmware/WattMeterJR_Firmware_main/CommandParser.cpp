@@ -44,6 +44,12 @@ void CommandParser::parseCommand(const String& cmdLine) {
       handleReboot();
     } else if (cmdLower == "uptime") { 
       handleUptime();
+    } else if (cmdLower == "cachestats") {
+      handleCacheStats();
+    } else if (cmdLower == "enginestats") {
+      handleEngineStats();
+    } else if (cmdLower == "configstatus") {
+      handleConfigStatus();
     } else {
       printError("Unknown command. Type 'help' for available commands.");
     }
@@ -166,6 +172,16 @@ void CommandParser::handleWrite(const String& regName, const String& valueStr) {
   }
 
   if (writeSuccess) {
+    // Later cached reads must see the new value
+    if (_regCache) {
+      _regCache->invalidate((RegisterId)(reg - registers));
+    }
+
+    // Keep the write instead of having the config monitor revert it
+    if (_settings) {
+      _settings->noteRegisterWrite(regName.c_str());
+    }
+
     Serial.print("Success: Wrote ");
     Serial.print(valueStr);
     Serial.print(" to ");
@@ -430,10 +446,45 @@ void CommandParser::handleSDStatus() {
             
             Serial.print("Total logs: ");
             Serial.println(_sdLogger->getLogCount());
+
+            Serial.printf("Flushes: %lu (last %lu ms, max %lu ms)\n",
+                          (unsigned long)_sdLogger->getFlushCount(),
+                          _sdLogger->getLastFlushTime(), _sdLogger->getMaxFlushTime());
+            Serial.printf("Flush latency: p50 %lu ms, p99 %lu ms\n",
+                          _sdLogger->getFlushPercentile(50), _sdLogger->getFlushPercentile(99));
+            Serial.printf("Dropped records: %lu, aggregated: %lu, blocked waits: %lu\n",
+                          (unsigned long)_sdLogger->getDroppedRecords(),
+                          (unsigned long)_sdLogger->getAggregatedRecords(),
+                          (unsigned long)_sdLogger->getBlockedWaits());
+            Serial.printf("Inside deadband (not logged): %lu\n",
+                          (unsigned long)_sdLogger->getSuppressedRecords());
+            Serial.printf("Failed field reads: %lu\n",
+                          (unsigned long)_sdLogger->getFailedFieldReads());
+            Serial.printf("Rollups: %s, %lu rows written\n",
+                          _sdLogger->isRollupSynced() ? "up to date" : "rebuilding from the logs",
+                          (unsigned long)_sdLogger->getRollupRows());
+            if (_sdLogger->getFreeBytes() >= 0) {
+                Serial.printf("Free space (estimated): %llu MB%s\n",
+                              (unsigned long long)(_sdLogger->getFreeBytes() / (1024 * 1024)),
+                              _sdLogger->isRetentionActive() ? ", deleting the oldest logs" : "");
+            }
+            Serial.printf("Days of logs deleted for space: %lu\n",
+                          (unsigned long)_sdLogger->getDeletedDays());
         }
+
     } else {
         Serial.println("Card: Not present");
     }
+
+    // Kept after the card is unmounted, so this is where it shows up
+    const EmergencyFlushTiming* emergency = _sdLogger->getLastEmergencyTiming();
+    if (emergency != nullptr) {
+        Serial.printf("Last emergency flush: %lu us (%s)\n", emergency->totalUs,
+                      emergency->fromInterrupt ? "chip interrupt" : "voltage poll");
+        Serial.printf("  detect %lu, checkpoint %lu, writer %lu, %u records %lu, unmount %lu us\n",
+                      emergency->detectUs, emergency->checkpointUs, emergency->writerUs,
+                      emergency->records, emergency->recordsUs, emergency->unmountUs);
+    }
     
     Serial.println("======================\n");
 }
@@ -648,6 +699,64 @@ void CommandParser::handleUptime() {
 }
 
 
+void CommandParser::handleCacheStats() {
+  if (!_regCache) {
+    Serial.println("Error: Register cache not initialized");
+    return;
+  }
+
+  uint32_t hits = _regCache->getHits();
+  uint32_t misses = _regCache->getMisses();
+  uint32_t total = hits + misses;
+
+  Serial.println("\n=== Register Cache ===");
+  Serial.printf("Hits (SPI reads saved): %lu\n", (unsigned long)hits);
+  Serial.printf("Misses (read from chip): %lu\n", (unsigned long)misses);
+  Serial.printf("Hit rate: %.1f%%\n", total > 0 ? 100.0f * hits / total : 0.0f);
+  Serial.println("======================\n");
+}
+
+
+void CommandParser::handleEngineStats() {
+  if (!_engine) {
+    Serial.println("Error: Measurement engine not initialized");
+    return;
+  }
+
+  uint32_t requested = _engine->getRequestedReads();
+  uint32_t performed = _engine->getFieldReads();
+
+  Serial.println("\n=== Measurement Engine ===");
+  Serial.printf("Acquisitions (SPI bursts): %lu\n", (unsigned long)_engine->getAcquisitionCount());
+  Serial.printf("Field reads requested: %lu\n", (unsigned long)requested);
+  Serial.printf("Field reads performed: %lu\n", (unsigned long)performed);
+  Serial.printf("Reads saved by merging: %lu\n", (unsigned long)(requested - performed));
+  Serial.printf("Longest async SPI slice: %lu us\n", _regAccess.getLongestServiceMicros());
+  Serial.printf("Read latency: last %lu ms, worst %lu ms\n",
+                _engine->getLastReadLatency(), _engine->getWorstReadLatency());
+  if (_busArbiter) {
+    Serial.printf("SD bus hold: longest %lu ms, %lu yields to metering\n",
+                  _busArbiter->getLongestHold(BUS_STORAGE), (unsigned long)_busArbiter->getYieldCount());
+  }
+  Serial.println("==========================\n");
+}
+
+
+void CommandParser::handleConfigStatus() {
+  if (!_settings) {
+    Serial.println("Error: Settings manager not initialized");
+    return;
+  }
+
+  Serial.println("\n=== Configuration Monitor ===");
+  Serial.printf("Digest checks: %lu\n", (unsigned long)_settings->getConfigChecks());
+  Serial.printf("Mismatches: %lu\n", (unsigned long)_settings->getConfigMismatches());
+  Serial.printf("Group restores: %lu\n", (unsigned long)_settings->getGroupRestores());
+  Serial.printf("Full restores: %lu\n", (unsigned long)_settings->getFullRestores());
+  Serial.println("=============================\n");
+}
+
+
 void CommandParser::printHelp() {
   Serial.println("\n=== ATM90E32 Energy Monitor Commands ===");
   Serial.println("\n--- Register Access ---");
@@ -678,6 +787,9 @@ void CommandParser::printHelp() {
   Serial.println("\n--- System ---");
   Serial.println("  reboot                 - Reboot system (5 second delay)");
   Serial.println("  uptime                 - Show system uptime");
+  Serial.println("  cachestats             - Show register cache hit/miss counts");
+  Serial.println("  enginestats            - Show measurement engine read counts");
+  Serial.println("  configstatus           - Show chip configuration monitor events");
 
   Serial.println("\n--- General ---");
   Serial.println("  help or ?              - Show this help");
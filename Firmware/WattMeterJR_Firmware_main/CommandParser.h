@@ -6,6 +6,9 @@
 #include "SDCardLogger.h"
 #include "SettingsManager.h"
 #include "RebootManager.h"
+#include "RegisterCache.h"
+#include "MeasurementEngine.h"
+#include "SPIBusArbiter.h"
 
 
 
@@ -23,13 +26,19 @@ public:
           _webServer(nullptr),
           _sdLogger(nullptr),
           _settings(nullptr),
-          _rebootManager(nullptr) {}
+          _rebootManager(nullptr),
+          _regCache(nullptr),
+          _engine(nullptr),
+          _busArbiter(nullptr) {}
     
     // Set references for various subsystems
     void setWebServer(EnergyWebServer* webServer) { _webServer = webServer; }
     void setSDLogger(SDCardLogger* logger) { _sdLogger = logger; }
     void setSettingsManager(SettingsManager* settings) { _settings = settings; }
     void setRebootManager(RebootManager* rebootManager) { _rebootManager = rebootManager; }
+    void setRegisterCache(RegisterCache* regCache) { _regCache = regCache; }
+    void setMeasurementEngine(MeasurementEngine* engine) { _engine = engine; }
+    void setBusArbiter(SPIBusArbiter* arbiter) { _busArbiter = arbiter; }
     
     void parseCommand(const String& cmdLine);
     void printHelp();
@@ -40,12 +49,18 @@ private:
     SDCardLogger* _sdLogger;
     SettingsManager* _settings;
     RebootManager* _rebootManager;
+    RegisterCache* _regCache;
+    MeasurementEngine* _engine;
+    SPIBusArbiter* _busArbiter;
     
     void handleRead(const String& regName);
     void handleWrite(const String& regName, const String& valueStr);
     void handleIP();
     void handleWiFi(const String& args);
     void handleReconnect();
+    void handleCacheStats();
+    void handleEngineStats();
+    void handleConfigStatus();
     
     // SD Card commands
     void handleSDStatus();
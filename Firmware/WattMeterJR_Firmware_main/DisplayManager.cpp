@@ -63,10 +63,11 @@ byte sdNoneChar[8] = {
   0b00000
 };
 
-DisplayManager::DisplayManager(RegisterAccess& regAccess, TimeManager& timeManager,
+DisplayManager::DisplayManager(RegisterAccess& regAccess, MeasurementEngine& engine, TimeManager& timeManager,
                                SDCardLogger& sdLogger, EnergyWebServer& webServer,
                                int buttonPin, uint8_t lcdAddress)
   : _regAccess(regAccess),
+    _engine(engine),
     _timeManager(timeManager),
     _sdLogger(sdLogger),
     _webServer(webServer),
@@ -75,6 +76,7 @@ DisplayManager::DisplayManager(RegisterAccess& regAccess, TimeManager& timeManag
     _field0("UrmsA"),
     _field1("IrmsA"),
     _field2("PmeanA"),
+    _engineSub(-1),
     _backlightOn(true),
     _backlightTimeout(30000),  // 30 seconds default
     _backlightOnTime(0),
@@ -84,6 +86,7 @@ DisplayManager::DisplayManager(RegisterAccess& regAccess, TimeManager& timeManag
     _longPressTime(10000),  // 10 seconds for long press
     _longPressHandled(false),
     _lastDisplayUpdate(0) {
+  resolveFields();
 }
 
 bool DisplayManager::begin() {
@@ -130,6 +133,7 @@ void DisplayManager::setDisplayFields(const String& line0, const String& line1,
   _field0 = line0;
   _field1 = line1;
   _field2 = line2;
+  resolveFields();
 
   Serial.print("Display fields set: ");
   Serial.print(_field0);
@@ -260,14 +264,38 @@ void DisplayManager::forceUpdate() {
   _lastDisplayUpdate = 0;  // Force update on next loop
 }
 
+// Look up the field descriptors once, not on every refresh.
+// The engine subscription is (re)made on the next updateDisplay().
+void DisplayManager::resolveFields() {
+  _fieldRegs[0] = _regAccess.getRegisterInfo(_field0.c_str());
+  _fieldRegs[1] = _regAccess.getRegisterInfo(_field1.c_str());
+  _fieldRegs[2] = _regAccess.getRegisterInfo(_field2.c_str());
+
+  _engine.unsubscribe(_engineSub);
+  _engineSub = -1;
+}
+
 void DisplayManager::updateDisplay() {
+  if (_engineSub < 0) {
+    _engineSub = _engine.subscribe(_fieldRegs, 3, DISPLAY_UPDATE_INTERVAL, _fieldSlots);
+  }
+
+  // Take the three fields from the engine's latest snapshot, once they
+  // have been sampled for this subscription
+  const MeasurementSnapshot* snap = _engine.latest();
+  bool sampled = snap != nullptr && _engine.getSubscriptionSequence(_engineSub) != 0;
+  float values[3];
+  for (int i = 0; i < 3; i++) {
+    bool valid = sampled && _fieldSlots[i] != MeasurementEngine::NO_SLOT && snap->valid[_fieldSlots[i]];
+    values[i] = valid ? snap->values[_fieldSlots[i]] : 0.0f;
+  }
+
   // Line 0: Field 0 + WiFi icon
   _lcd.setCursor(0, 0);
-  bool success = false;
-  float value0 = _regAccess.readRegister(_field0.c_str(), &success);
+  float value0 = values[0];
   
   // Get register info for units
-  const RegisterDescriptor* reg0 = _regAccess.getRegisterInfo(_field0.c_str());
+  const RegisterDescriptor* reg0 = _fieldRegs[0];
   const char* unit0 = (reg0 && reg0->unit) ? reg0->unit : "";
   
   char line0[20];
@@ -286,9 +314,9 @@ void DisplayManager::updateDisplay() {
   
   // Line 1: Field 1 + SD icon
   _lcd.setCursor(0, 1);
-  float value1 = _regAccess.readRegister(_field1.c_str(), &success);
+  float value1 = values[1];
   
-  const RegisterDescriptor* reg1 = _regAccess.getRegisterInfo(_field1.c_str());
+  const RegisterDescriptor* reg1 = _fieldRegs[1];
   const char* unit1 = (reg1 && reg1->unit) ? reg1->unit : "";
   
   char line1[20];
@@ -306,9 +334,9 @@ void DisplayManager::updateDisplay() {
   
   // Line 2: Field 2
   _lcd.setCursor(0, 2);
-  float value2 = _regAccess.readRegister(_field2.c_str(), &success);
+  float value2 = values[2];
   
-  const RegisterDescriptor* reg2 = _regAccess.getRegisterInfo(_field2.c_str());
+  const RegisterDescriptor* reg2 = _fieldRegs[2];
   const char* unit2 = (reg2 && reg2->unit) ? reg2->unit : "";
   
   char line2[20];
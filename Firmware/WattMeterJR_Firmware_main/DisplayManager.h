@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include <LiquidCrystal_I2C.h>
 #include "RegisterAccess.h"
+#include "MeasurementEngine.h"
 #include "TimeManager.h"
 #include "SDCardLogger.h"
 #include "EnergyWebServer.h"
@@ -11,7 +12,7 @@
 
 class DisplayManager {
 public:
-    DisplayManager(RegisterAccess& regAccess, TimeManager& timeManager, 
+    DisplayManager(RegisterAccess& regAccess, MeasurementEngine& engine, TimeManager& timeManager,
                    SDCardLogger& sdLogger, EnergyWebServer& webServer,
                    int buttonPin, uint8_t lcdAddress = 0x27);
     
@@ -30,6 +31,7 @@ public:
     
 private:
     RegisterAccess& _regAccess;
+    MeasurementEngine& _engine;
     TimeManager& _timeManager;
     SDCardLogger& _sdLogger;
     EnergyWebServer& _webServer;
@@ -41,6 +43,9 @@ private:
     String _field0;
     String _field1;
     String _field2;
+    const RegisterDescriptor* _fieldRegs[3];  // Resolved from _field0.._field2
+    uint8_t _fieldSlots[3];                   // MeasurementEngine snapshot slots
+    int _engineSub;                           // -1 until subscribed
     
     // Backlight control
     bool _backlightOn;
@@ -60,6 +65,7 @@ private:
     
     // Helper methods
     void updateDisplay();
+    void resolveFields();
     void updateButton();
     void handleShortPress();
     void handleLongPress();
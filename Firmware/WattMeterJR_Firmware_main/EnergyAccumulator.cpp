@@ -143,14 +143,14 @@ bool EnergyAccumulator::startCalibration(uint8_t phaseMask) {
     Serial.println();
 
     // Unlock calibration registers
-    _regAccess.writeRegister("CfgRegAccEn", 0x55AA);
+    _regAccess.writeRegister(RegisterId::CfgRegAccEn, 0x55AA);
 
     // Set PQGain to 0 (unity) for calibration phases and clear energy registers
     for (uint8_t phase = 0; phase < 3; phase++) {
         if (phaseMask & (1 << phase)) {
-            const char* gainRegisterName = getPhaseRegisterName(phase, true);
-            if (gainRegisterName) {
-                _regAccess.writeRegisterRaw(gainRegisterName, 0);
+            RegisterId gainRegister = getPhaseRegister(phase, true);
+            if (gainRegister != RegisterId::Count) {
+                _regAccess.writeRegisterRaw(gainRegister, 0);
                 Serial.printf("  Set phase %c PQGain to 0 (unity)\n", 'A' + phase);
             }
 
@@ -162,7 +162,12 @@ bool EnergyAccumulator::startCalibration(uint8_t phaseMask) {
     }
 
     // Lock calibration registers
-    _regAccess.writeRegister("CfgRegAccEn", 0x0000);
+    _regAccess.writeRegister(RegisterId::CfgRegAccEn, 0x0000);
+
+    // PQGain stays off-settings until calibration completes
+    if (_settings) {
+        _settings->setConfigMonitorEnabled(false);
+    }
 
     // Enter calibration mode
     _calibState.calibrating = true;
@@ -217,6 +222,10 @@ bool EnergyAccumulator::completeCalibration(uint8_t phase, float loadWatts, floa
         _calibState.calibrating = false;
         Serial.println("EnergyAccumulator: Calibration complete for all phases");
 
+        if (_settings) {
+            _settings->setConfigMonitorEnabled(true);
+        }
+
         // Resume normal operation - clear registers
         for (uint8_t p = 0; p < 3; p++) {
             float dummy;
@@ -255,13 +264,13 @@ bool EnergyAccumulator::saveToSettings() {
 // Private methods
 
 bool EnergyAccumulator::readEnergyRegister(uint8_t phase, float& wattHours) {
-    const char* registerName = getPhaseRegisterName(phase, false);
-    if (!registerName) {
+    RegisterId energyRegister = getPhaseRegister(phase, false);
+    if (energyRegister == RegisterId::Count) {
         return false;
     }
 
     bool success = false;
-    float value = _regAccess.readRegister(registerName, &success);
+    float value = _regAccess.readRegister(energyRegister, &success);
 
     if (success) {
         // The register value is in units of 0.01 CF
@@ -304,19 +313,19 @@ bool EnergyAccumulator::calculateAndApplyGain(uint8_t phase, float expectedWh, f
     Serial.printf("  Calculated gain: %.2f\n", gainCalc);
     Serial.printf("  New PQGain: 0x%04X (%d)\n", (uint16_t)newGain, newGain);
 
-    const char* gainRegisterName = getPhaseRegisterName(phase, true);
-    if (!gainRegisterName) {
+    RegisterId gainRegister = getPhaseRegister(phase, true);
+    if (gainRegister == RegisterId::Count) {
         return false;
     }
 
     // Unlock calibration registers
-    _regAccess.writeRegister("CfgRegAccEn", 0x55AA);
+    _regAccess.writeRegister(RegisterId::CfgRegAccEn, 0x55AA);
 
     // Write new gain to chip
-    bool success = _regAccess.writeRegisterRaw(gainRegisterName, (uint16_t)newGain);
+    bool success = _regAccess.writeRegisterRaw(gainRegister, (uint16_t)newGain);
 
     // Lock calibration registers
-    _regAccess.writeRegister("CfgRegAccEn", 0x0000);
+    _regAccess.writeRegister(RegisterId::CfgRegAccEn, 0x0000);
 
     if (!success) {
         Serial.println("  Error: Failed to write new PQGain to chip");
@@ -334,28 +343,31 @@ bool EnergyAccumulator::calculateAndApplyGain(uint8_t phase, float expectedWh, f
         _settings->setCalibrationRegisters(calRegs);
         _settings->saveSettings();
 
+        // Record the new gain as applied so the config monitor keeps it
+        _settings->applyChangedRegistersToChip();
+
         Serial.println("  Gain saved to settings.ini");
     }
 
     return true;
 }
 
-const char* EnergyAccumulator::getPhaseRegisterName(uint8_t phase, bool isPQGain) {
+RegisterId EnergyAccumulator::getPhaseRegister(uint8_t phase, bool isPQGain) {
     if (isPQGain) {
         // PQGain registers
         switch (phase) {
-            case 0: return "PQGainA";
-            case 1: return "PQGainB";
-            case 2: return "PQGainC";
-            default: return nullptr;
+            case 0: return RegisterId::PQGainA;
+            case 1: return RegisterId::PQGainB;
+            case 2: return RegisterId::PQGainC;
+            default: return RegisterId::Count;
         }
     } else {
         // APenergy registers
         switch (phase) {
-            case 0: return "APenergyA";
-            case 1: return "APenergyB";
-            case 2: return "APenergyC";
-            default: return nullptr;
+            case 0: return RegisterId::APenergyA;
+            case 1: return RegisterId::APenergyB;
+            case 2: return RegisterId::APenergyC;
+            default: return RegisterId::Count;
         }
     }
 }
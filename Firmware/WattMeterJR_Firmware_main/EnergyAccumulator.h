@@ -70,7 +70,7 @@ private:
     // Internal methods
     bool readEnergyRegister(uint8_t phase, float& wattHours);
     bool calculateAndApplyGain(uint8_t phase, float expectedWh, float measuredWh);
-    const char* getPhaseRegisterName(uint8_t phase, bool isPQGain);
+    RegisterId getPhaseRegister(uint8_t phase, bool isPQGain);  // RegisterId::Count if invalid
 };
 
 #endif
@@ -1,13 +1,19 @@
 #include "EnergyWebServer.h"
 #include "RegisterDescriptors.h"
 #include "EnergyAccumulator.h"
+#include "LogDownloadRange.h"
 #include <WiFi.h>
+#include <lwip/sockets.h>
+#include <errno.h>
 
 extern const RegisterDescriptor registers[];
 extern const uint16_t registerCount;
 
-EnergyWebServer::EnergyWebServer(RegisterAccess& regAccess, uint16_t port)
-  : _regAccess(regAccess), _settings(nullptr), _energyAccumulator(nullptr), _server(port), _settingsNeedReload(false) {
+EnergyWebServer::EnergyWebServer(RegisterAccess& regAccess, RegisterCache& regCache, uint16_t port)
+  : _regAccess(regAccess), _regCache(regCache), _settings(nullptr), _energyAccumulator(nullptr),
+    _sdLogger(nullptr), _busArbiter(nullptr), _server(port), _settingsNeedReload(false) {
+  _download.active = false;
+  _download.segmentCount = 0;
 }
 bool EnergyWebServer::begin(const char* ssid, const char* password) {
     // Store credentials for reconnect
@@ -54,10 +60,16 @@ bool EnergyWebServer::begin(const char* ssid, const char* password) {
     _server.on("/api/settings/reload", HTTP_POST, [this]() { handleReloadSettings(); });
     _server.on("/api/registers", HTTP_GET, [this]() { handleGetRegisters(); });
     _server.on("/api/energy", HTTP_GET, [this]() { handleGetEnergy(); });
+    _server.on("/api/cache", HTTP_GET, [this]() { handleGetCacheStats(); });
     _server.on("/api/energy/calibrate/start", HTTP_POST, [this]() { handleStartEnergyCalibration(); });
     _server.on("/api/energy/calibrate/complete", HTTP_POST, [this]() { handleCompleteEnergyCalibration(); });
+    _server.on("/api/log", HTTP_GET, [this]() { handleLogDownload(); });
     _server.onNotFound([this]() { handleNotFound(); });
     
+    // Log downloads resume from a byte offset
+    const char* headerKeys[] = { "Range" };
+    _server.collectHeaders(headerKeys, 1);
+    
     // Enable CORS
     _server.enableCORS(true);
     
@@ -101,6 +113,11 @@ bool EnergyWebServer::reconnect() {
 }
 
 void EnergyWebServer::handleClient() {
+  // A log download in progress goes out a slice at a time alongside
+  // other requests; it keeps its own reference to the connection
+  if (_download.active) {
+    streamDownload();
+  }
   _server.handleClient();
 }
 
@@ -233,6 +250,21 @@ Response: {"success": true, "message": "Settings updated"}</pre>
             <pre>Response: {"success": true, "message": "Settings reloaded from SD card"}</pre>
         </div>
         
+        <h2>Data Logs</h2>
+        
+        <div class="endpoint">
+            <span class="method get">GET</span>
+            <strong>/api/log?date=2024-06-01</strong>
+            <p>Download a day's log as written to the SD card. <code>format=csv</code> or <code>bin</code> picks the file (default: the current log format).</p>
+        </div>
+        
+        <div class="endpoint">
+            <span class="method get">GET</span>
+            <strong>/api/log?from=1717236000&amp;to=1717236300</strong>
+            <p>Download the records between two Unix times (up to 7 days), looked up in each day's time index. Each day's piece starts with the header its records need and may include up to 64 records either side of the range.</p>
+            <p>Both forms accept a <code>Range: bytes=</code> header to resume a download.</p>
+        </div>
+        
         <h2>Calibration</h2>
         
         <div class="endpoint">
@@ -318,7 +350,7 @@ void EnergyWebServer::handleReadRegister() {
 
   String regName = _server.arg("name");
   bool success = false;
-  float value = _regAccess.readRegister(regName.c_str(), &success);
+  float value = _regCache.read(regName.c_str(), getMaxAgeArg(), &success);
 
   JsonDocument doc;
 
@@ -359,21 +391,45 @@ digitalWrite(2, HIGH);  // LED on during processing
   JsonArray dataArray = resDoc["data"].to<JsonArray>();
 
   JsonArray registers = reqDoc["registers"].as<JsonArray>();
+  size_t count = registers.size();
+
+  // Read the whole list in one SPI burst
+  const char** names = new (std::nothrow) const char*[count];
+  float* values = new (std::nothrow) float[count];
+  bool* success = new (std::nothrow) bool[count];
+
+  if (names == nullptr || values == nullptr || success == nullptr) {
+    delete[] names;
+    delete[] values;
+    delete[] success;
+    sendError(500, "Out of memory");
+    return;
+  }
+
+  size_t i = 0;
   for (JsonVariant reg : registers) {
-    String regName = reg.as<String>();
-    bool success = false;
-    float value = _regAccess.readRegister(regName.c_str(), &success);
+    names[i] = reg.as<const char*>();
+    if (names[i] == nullptr) names[i] = "";
+    i++;
+  }
 
+  _regCache.readRegisters(names, values, success, count, getMaxAgeArg());
+
+  for (i = 0; i < count; i++) {
     JsonObject item = dataArray.add<JsonObject>();
-    item["name"] = regName;
+    item["name"] = names[i];
 
-    if (success) {
-      item["value"] = value;
+    if (success[i]) {
+      item["value"] = values[i];
     } else {
       item["error"] = "Not found or not readable";
     }
   }
 
+  delete[] names;
+  delete[] values;
+  delete[] success;
+
   sendJSON(200, resDoc);
   digitalWrite(2, LOW);  // LED off when done
 }
@@ -401,6 +457,11 @@ void EnergyWebServer::handleWriteRegister() {
   float value = doc["value"].as<float>();
 
   bool success = _regAccess.writeRegister(regName.c_str(), value);
+  _regCache.invalidate();
+  if (success && _settings) {
+    // Keep the write instead of having the config monitor revert it
+    _settings->noteRegisterWrite(regName.c_str());
+  }
 
   JsonDocument resDoc;
 
@@ -455,6 +516,10 @@ void EnergyWebServer::handleWriteMultiple() {
         float value = write["value"].as<float>();
         
         bool writeSuccess = _regAccess.writeRegister(regName.c_str(), value);
+        _regCache.invalidate();
+        if (writeSuccess && _settings) {
+            _settings->noteRegisterWrite(regName.c_str());
+        }
         
         JsonObject result = resultsArray.add<JsonObject>();
         result["name"] = regName;
@@ -492,6 +557,249 @@ void EnergyWebServer::sendError(int code, const char* message) {
   sendJSON(code, doc);
 }
 
+// GET /api/log?date=YYYY-MM-DD sends that day's whole log;
+// ?from=<unix>&to=<unix> the stretch of each day's log holding those
+// records, each after the header it needs. &format=csv|bin picks the
+// files (default: the current format). The response comes straight from
+// the card a chunk at a time (streamDownload()), so RAM use doesn't
+// depend on its size; a single "Range: bytes=" request is honoured.
+// One download runs at a time, and none while the writer is flushing:
+// those requests get 503 with Retry-After.
+void EnergyWebServer::handleLogDownload() {
+  if (!_sdLogger) {
+    sendError(500, "SD logger not initialized");
+    return;
+  }
+  if (_download.active) {
+    _server.sendHeader("Retry-After", String(DOWNLOAD_RETRY_AFTER_S));
+    sendError(503, "Another log download is in progress");
+    return;
+  }
+
+  String ext = _server.hasArg("format") ? _server.arg("format") : String("");
+  ext.toLowerCase();
+  if (ext.length() == 0) {
+    ext = _sdLogger->getLogFormat() == LOG_FORMAT_BINARY ? "bin" : "csv";
+  } else if (ext == "binary") {
+    ext = "bin";
+  } else if (ext != "csv" && ext != "bin") {
+    sendError(400, "Invalid format. Use csv or bin");
+    return;
+  }
+
+  _download.segmentCount = 0;
+  String filename;
+  if (_server.hasArg("date")) {
+    int year, month, day;
+    if (sscanf(_server.arg("date").c_str(), "%4d-%2d-%2d", &year, &month, &day) != 3) {
+      sendError(400, "Invalid date. Use YYYY-MM-DD");
+      return;
+    }
+    String path = _sdLogger->getCurrentLogPath(year, month, day);
+    path = path.substring(0, path.lastIndexOf('.') + 1) + ext;
+    size_t length;
+    if (!_sdLogger->getLogLength(path, &length)) {
+      _server.sendHeader("Retry-After", String(DOWNLOAD_RETRY_AFTER_S));
+      sendError(503, "Log writer busy");
+      return;
+    }
+    addDownloadSegment(path, 0, length);
+    filename = _server.arg("date") + "." + ext;
+  } else if (_server.hasArg("from") && _server.hasArg("to")) {
+    time_t from = (time_t)strtoul(_server.arg("from").c_str(), NULL, 10);
+    time_t to = (time_t)strtoul(_server.arg("to").c_str(), NULL, 10);
+    if (to < from || to - from > (time_t)DOWNLOAD_MAX_DAYS * 86400) {
+      sendError(400, "Invalid time range (from <= to, at most 7 days)");
+      return;
+    }
+    LogRange ranges[DOWNLOAD_MAX_LOGS];
+    unsigned int count;
+    if (!_sdLogger->findLogRanges(from, to, ranges, DOWNLOAD_MAX_LOGS, &count)) {
+      _server.sendHeader("Retry-After", String(DOWNLOAD_RETRY_AFTER_S));
+      sendError(503, "Log writer busy");
+      return;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+      const LogRange& range = ranges[i];
+      if (!range.path.endsWith(String(".") + ext)) {
+        continue;
+      }
+      // The header, unless the stretch starts with it
+      if (range.headerSize > 0 && range.start >= range.headerStart + range.headerSize) {
+        addDownloadSegment(range.path, range.headerStart, range.headerSize);
+      }
+      addDownloadSegment(range.path, range.start, range.end - range.start);
+    }
+    filename = String("log-") + _server.arg("from") + "-" + _server.arg("to") + "." + ext;
+  } else {
+    sendError(400, "Missing date or from/to parameters");
+    return;
+  }
+
+  size_t total = 0;
+  for (unsigned int i = 0; i < _download.segmentCount; i++) {
+    total += _download.segments[i].length;
+  }
+  if (total == 0) {
+    sendError(404, "No log data for that date or time range");
+    return;
+  }
+
+  size_t start = 0;
+  size_t end = total;
+  if (!parseByteRange(_server.header("Range").c_str(), total, &start, &end)) {
+    _server.sendHeader("Content-Range", "bytes */" + String((unsigned long)total));
+    sendError(416, "Requested range not satisfiable");
+    return;
+  }
+  bool partial = (start > 0 || end < total);
+
+  _server.sendHeader("Accept-Ranges", "bytes");
+  _server.sendHeader("Content-Disposition", "attachment; filename=\"" + filename + "\"");
+  if (partial) {
+    _server.sendHeader("Content-Range", "bytes " + String((unsigned long)start) + "-" +
+                       String((unsigned long)(end - 1)) + "/" + String((unsigned long)total));
+  }
+  _server.setContentLength(end - start);
+  _server.send(partial ? 206 : 200, ext == "csv" ? "text/csv" : "application/octet-stream", "");
+
+  // Find where the body starts, then let handleClient() send it
+  findSegment(_download.segments, _download.segmentCount, start,
+              &_download.segment, &_download.segmentPos);
+  _download.remaining = end - start;
+  _download.chunkLength = 0;
+  _download.chunkSent = 0;
+  _download.client = _server.client();
+  _download.active = true;
+
+  // Keep retention off the logs being sent; fixed-width names, so the
+  // oldest day sorts first
+  String oldest = _download.segments[_download.segment].path;
+  for (unsigned int i = _download.segment + 1; i < _download.segmentCount; i++) {
+    if (_download.segments[i].path < oldest) {
+      oldest = _download.segments[i].path;
+    }
+  }
+  _sdLogger->setLogsInUse(oldest);
+}
+
+bool EnergyWebServer::addDownloadSegment(const String& path, size_t offset, size_t length) {
+  if (length == 0 || _download.segmentCount >= 2 * DOWNLOAD_MAX_LOGS) {
+    return false;
+  }
+  DownloadSegment& segment = _download.segments[_download.segmentCount++];
+  segment.path = path;
+  segment.offset = offset;
+  segment.length = length;
+  return true;
+}
+
+// Send the download in progress for up to DOWNLOAD_SLICE_MS, a chunk at
+// a time. The socket is written without blocking: whatever it won't take
+// now stays in _downloadChunk for the next call, so a slow client costs
+// loop() nothing. The card is only held while reading; a failed read or
+// a client that goes away ends the response early (the headers are
+// already out).
+void EnergyWebServer::streamDownload() {
+  unsigned long sliceStart = millis();
+  while (_download.remaining > 0 && millis() - sliceStart < DOWNLOAD_SLICE_MS) {
+    if (!_download.client.connected()) {
+      Serial.println("Log download: client disconnected");
+      endDownload();
+      return;
+    }
+
+    if (_download.chunkSent == _download.chunkLength) {
+      if (_download.segment >= _download.segmentCount) {
+        break;
+      }
+      DownloadSegment& segment = _download.segments[_download.segment];
+      size_t n = segment.length - _download.segmentPos;
+      if (n > DOWNLOAD_CHUNK_SIZE) n = DOWNLOAD_CHUNK_SIZE;
+      if (n > _download.remaining) n = _download.remaining;
+
+      if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+      bool ok = true;
+      if (!_download.file) {
+        _download.file = SD.open(segment.path, FILE_READ);
+        ok = _download.file && _download.file.seek(segment.offset + _download.segmentPos);
+      }
+      ok = ok && _download.file.read(_downloadChunk, n) == n;
+      if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+
+      if (!ok) {
+        Serial.printf("Log download of %s failed\n", segment.path.c_str());
+        endDownload();
+        return;
+      }
+      _download.chunkLength = n;
+      _download.chunkSent = 0;
+
+      _download.segmentPos += n;
+      if (_download.segmentPos == segment.length) {
+        _download.file.close();
+        _download.segment++;
+        _download.segmentPos = 0;
+      }
+    }
+
+    int sent = send(_download.client.fd(), _downloadChunk + _download.chunkSent,
+                    _download.chunkLength - _download.chunkSent, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;  // Send buffer full: the rest next call
+      }
+      Serial.printf("Log download: send failed (errno %d)\n", errno);
+      endDownload();
+      return;
+    }
+    _download.chunkSent += sent;
+    _download.remaining -= sent;
+  }
+  if (_download.remaining == 0 ||
+      (_download.segment >= _download.segmentCount && _download.chunkSent == _download.chunkLength)) {
+    endDownload();
+  }
+}
+
+void EnergyWebServer::endDownload() {
+  if (_download.file) {
+    _download.file.close();
+  }
+  _download.client.stop();
+  _download.client = WiFiClient();
+  _download.segmentCount = 0;
+  _download.active = false;
+  if (_sdLogger) {
+    _sdLogger->setLogsInUse("");
+  }
+}
+
+// Freshness for register reads: ?maxAge=<ms>, 0 forces a chip read
+unsigned long EnergyWebServer::getMaxAgeArg() {
+  if (_server.hasArg("maxAge")) {
+    return _server.arg("maxAge").toInt();
+  }
+  return DEFAULT_READ_MAX_AGE;
+}
+
+void EnergyWebServer::handleGetCacheStats() {
+  uint32_t hits = _regCache.getHits();
+  uint32_t misses = _regCache.getMisses();
+
+  JsonDocument doc;
+  doc["success"] = true;
+  doc["hits"] = hits;
+  doc["misses"] = misses;
+  doc["hitRate"] = (hits + misses) > 0 ? (float)hits / (hits + misses) : 0.0f;
+
+  if (_server.hasArg("reset")) {
+    _regCache.resetStats();
+  }
+
+  sendJSON(200, doc);
+}
+
 
 void EnergyWebServer::handleGetSettings() {
     if (!_settings) {
@@ -541,6 +849,15 @@ void EnergyWebServer::handleGetSettings() {
     logging["powerLossThreshold"] = log.powerLossThreshold;
     logging["enablePowerLossDetection"] = log.enablePowerLossDetection;
     logging["logFields"] = log.logFields;
+    logging["maxLogGap"] = log.maxLogGap;
+    logging["sampleInterval"] = log.sampleInterval;
+    logging["overflowPolicy"] = log.overflowPolicy;
+    logging["logFormat"] = log.logFormat;
+    logging["rollupRetention1m"] = log.rollupRetention1m;
+    logging["rollupRetention15m"] = log.rollupRetention15m;
+    logging["rollupRetention1h"] = log.rollupRetention1h;
+    logging["freeSpaceLowMB"] = log.freeSpaceLowMB;
+    logging["freeSpaceHighMB"] = log.freeSpaceHighMB;
     
     // Display
     JsonObject display = doc["display"].to<JsonObject>();
@@ -557,6 +874,18 @@ void EnergyWebServer::handleGetSettings() {
     system["autoRebootEnabled"] = sys.autoRebootEnabled;
     system["rebootIntervalHours"] = sys.rebootIntervalHours;
     system["rebootHour"] = sys.rebootHour;
+
+    // Cost of the most recent register apply
+    JsonObject lastApply = doc["lastRegisterApply"].to<JsonObject>();
+    lastApply["fieldWrites"] = _settings->getLastApplyWrites();
+    lastApply["spiTransactions"] = _settings->getLastApplyTransactions();
+
+    // Configuration monitor events
+    JsonObject configMonitor = doc["configMonitor"].to<JsonObject>();
+    configMonitor["checks"] = _settings->getConfigChecks();
+    configMonitor["mismatches"] = _settings->getConfigMismatches();
+    configMonitor["groupRestores"] = _settings->getGroupRestores();
+    configMonitor["fullRestores"] = _settings->getFullRestores();
     
     sendJSON(200, doc);
 }
@@ -632,6 +961,15 @@ void EnergyWebServer::handleSetSettings() {
         if (logObj.containsKey("powerLossThreshold")) log.powerLossThreshold = logObj["powerLossThreshold"];
         if (logObj.containsKey("enablePowerLossDetection")) log.enablePowerLossDetection = logObj["enablePowerLossDetection"];
         if (logObj.containsKey("logFields")) log.logFields = logObj["logFields"].as<String>();
+        if (logObj.containsKey("maxLogGap")) log.maxLogGap = logObj["maxLogGap"];
+        if (logObj.containsKey("sampleInterval")) log.sampleInterval = logObj["sampleInterval"];
+        if (logObj.containsKey("overflowPolicy")) log.overflowPolicy = logObj["overflowPolicy"].as<String>();
+        if (logObj.containsKey("logFormat")) log.logFormat = logObj["logFormat"].as<String>();
+        if (logObj.containsKey("rollupRetention1m")) log.rollupRetention1m = logObj["rollupRetention1m"];
+        if (logObj.containsKey("rollupRetention15m")) log.rollupRetention15m = logObj["rollupRetention15m"];
+        if (logObj.containsKey("rollupRetention1h")) log.rollupRetention1h = logObj["rollupRetention1h"];
+        if (logObj.containsKey("freeSpaceLowMB")) log.freeSpaceLowMB = logObj["freeSpaceLowMB"];
+        if (logObj.containsKey("freeSpaceHighMB")) log.freeSpaceHighMB = logObj["freeSpaceHighMB"];
         _settings->setDataLoggingSettings(log);
     }
     
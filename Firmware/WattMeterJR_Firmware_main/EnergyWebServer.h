@@ -4,14 +4,17 @@
 #include <WebServer.h>
 #include <ArduinoJson.h>
 #include "RegisterAccess.h"
+#include "RegisterCache.h"
 #include "SettingsManager.h"
+#include "SDCardLogger.h"
+#include "SPIBusArbiter.h"
 
 // Forward declaration
 class EnergyAccumulator;
 
 class EnergyWebServer {
 public:
-    EnergyWebServer(RegisterAccess& regAccess, uint16_t port = 80);
+    EnergyWebServer(RegisterAccess& regAccess, RegisterCache& regCache, uint16_t port = 80);
 
     bool begin(const char* ssid, const char* password);
     bool reconnect();
@@ -19,17 +22,53 @@ public:
     String getIPAddress();
     void setSettingsManager(SettingsManager* settings) { _settings = settings; }
     void setEnergyAccumulator(EnergyAccumulator* accumulator) { _energyAccumulator = accumulator; }
+    void setSDLogger(SDCardLogger* logger) { _sdLogger = logger; }
+    void setBusArbiter(SPIBusArbiter* arbiter) { _busArbiter = arbiter; }
     bool settingsNeedReload();
     
 private:
     RegisterAccess& _regAccess;
+    RegisterCache& _regCache;
     SettingsManager* _settings;
     EnergyAccumulator* _energyAccumulator;
+    SDCardLogger* _sdLogger;
+    SPIBusArbiter* _busArbiter;
     WebServer _server;
     String _lastSSID;
     String _lastPassword;
     bool _settingsNeedReload;
 
+    static const size_t DOWNLOAD_CHUNK_SIZE = 2048;         // Read from the card and written to the socket at once
+    static const unsigned long DOWNLOAD_SLICE_MS = 20;      // Sending per handleClient() call, at most
+    static const unsigned int DOWNLOAD_MAX_DAYS = 7;        // Longest time range served from the raw logs
+    static const unsigned int DOWNLOAD_MAX_LOGS = 2 * (DOWNLOAD_MAX_DAYS + 1);  // Either format, partial days at both ends
+    static const unsigned int DOWNLOAD_RETRY_AFTER_S = 1;   // Retry-After of a download turned away as busy
+
+    // Log download in progress. The response is a list of pieces of log
+    // files, sent a chunk at a time from handleClient() so loop() keeps
+    // metering and logging. Other requests are served in between, once
+    // WebServer lets go of the download's connection (it waits up to
+    // HTTP_MAX_CLOSE_WAIT for the client to close it first).
+    struct DownloadSegment {
+        String path;
+        size_t offset;
+        size_t length;
+    };
+    struct LogDownload {
+        bool active;
+        WiFiClient client;
+        DownloadSegment segments[2 * DOWNLOAD_MAX_LOGS];  // A header and a stretch per log
+        unsigned int segmentCount;
+        unsigned int segment;       // Being sent
+        size_t segmentPos;          // Bytes of it sent
+        size_t remaining;           // Bytes of the response still to send
+        File file;                  // Open for the current segment
+        size_t chunkLength;         // Bytes read into _downloadChunk
+        size_t chunkSent;           // Bytes of it the socket has taken
+    };
+    LogDownload _download;
+    uint8_t _downloadChunk[DOWNLOAD_CHUNK_SIZE];
+
     // Route handlers
     void handleRoot();
     void handleReadRegister();
@@ -46,12 +85,20 @@ private:
     void handleReloadSettings();
     void handleGetRegisters();
     void handleGetEnergy();
+    void handleGetCacheStats();
     void handleStartEnergyCalibration();
     void handleCompleteEnergyCalibration();
+    void handleLogDownload();
     
     // Helper functions
     void sendJSON(int code, JsonDocument& doc);
     void sendError(int code, const char* message);
+    unsigned long getMaxAgeArg();
+    bool addDownloadSegment(const String& path, size_t offset, size_t length);
+    void streamDownload();
+    void endDownload();
+
+    static const unsigned long DEFAULT_READ_MAX_AGE = 250;  // ms, overridable with ?maxAge=
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef LOGDOWNLOADRANGE_H
+#define LOGDOWNLOADRANGE_H
+
+// Byte ranges of a log download (GET /api/log), whose body is a list of
+// pieces of log files sent one after another. Used by EnergyWebServer and
+// checked on the host by Firmware/LogDownloadTest. Plain C++ so both sides
+// can include it.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Apply a "Range:" header value of "bytes=first-last", "bytes=first-" or
+// "bytes=-suffix" to [start, end) of a body of total (> 0) bytes. Anything
+// else (no header, several ranges, other units, last < first) is ignored
+// and start and end left alone, for the whole body. False if the range
+// lies outside the body.
+inline bool parseByteRange(const char* header, size_t total, size_t* start, size_t* end) {
+    if (!header || strncmp(header, "bytes=", 6) != 0 || strchr(header, ',')) {
+        return true;
+    }
+    const char* first = header + 6;
+    const char* dash = strchr(first, '-');
+    if (!dash) {
+        return true;
+    }
+    const char* last = dash + 1;
+    while (*first == ' ') first++;
+    while (*last == ' ') last++;
+
+    if (first == dash) {
+        // The last bytes
+        unsigned long suffix = strtoul(last, NULL, 10);
+        if (suffix == 0) {
+            return false;
+        }
+        *start = suffix < total ? total - suffix : 0;
+        return true;
+    }
+    unsigned long from = strtoul(first, NULL, 10);
+    if (*last != '\0') {
+        unsigned long to = strtoul(last, NULL, 10);
+        if (to < from) {
+            return true;  // Invalid: ignored
+        }
+        if (from >= total) {
+            return false;
+        }
+        *start = from;
+        // Clamped before adding one: a last byte of ULONG_MAX would wrap
+        *end = to >= total - 1 ? total : to + 1;
+        return true;
+    }
+    if (from >= total) {
+        return false;
+    }
+    *start = from;
+    return true;
+}
+
+// Find where byte pos of the body falls: the segment holding it and the
+// offset into that segment. Segments of length 0 are passed over. False
+// if pos is at or past the end of the body.
+template <typename Segment>
+inline bool findSegment(const Segment* segments, unsigned int count, size_t pos,
+                        unsigned int* segment, size_t* offset) {
+    for (unsigned int i = 0; i < count; i++) {
+        if (pos < segments[i].length) {
+            *segment = i;
+            *offset = pos;
+            return true;
+        }
+        pos -= segments[i].length;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,264 @@
+#include "LogIndex.h"
+#include <unistd.h>
+
+LogIndex::LogIndex(LogRetention& retention)
+    : _retention(retention),
+      _headerStart(0),
+      _headerSize(0),
+      _countdown(0),
+      _lastTime(0),
+      _pendingCount(0) {
+}
+
+void LogIndex::open(const String& logPath, File& log, size_t logicalEnd, bool csv, bool created,
+                    size_t headerStart, size_t headerSize, uint8_t* scratch, size_t scratchSize) {
+    String path = logPath + LOG_INDEX_SUFFIX;
+    _logPath = logPath;
+    _pendingCount = 0;
+    _countdown = 0;  // The next record starts an entry
+    _lastTime = 0;
+    _headerStart = 0;
+    _headerSize = 0;
+
+    uint32_t initialHeader = created ? headerSize : 0;
+    bool resumed = false;
+    if (!created && SD.exists(path)) {
+        File index = SD.open(path, FILE_READ);
+        size_t count;
+        if (index && readHeader(index, logicalEnd, &initialHeader, &count)) {
+            BinlogIndexEntry last;
+            if (count > 0 && readEntry(index, count - 1, &last)) {
+                _headerStart = last.headerStart;
+                _headerSize = last.headerSize;
+                _lastTime = last.unixTime;
+            } else {
+                _headerSize = initialHeader;
+            }
+
+            size_t used = BINLOG_INDEX_HEADER_SIZE + count * BINLOG_INDEX_ENTRY_SIZE;
+            size_t size = index.size();
+            index.close();
+            String vfsPath = String(LOG_SD_MOUNT_POINT) + path;
+            if (used < size && truncate(vfsPath.c_str(), used) != 0) {
+                Serial.printf("Failed to trim %s\n", path.c_str());
+            } else {
+                _retention.charge(size, used);
+                _file = SD.open(path, "r+");
+                resumed = _file && _file.seek(used);
+            }
+        } else if (index) {
+            index.close();
+        }
+    }
+
+    if (!resumed) {
+        if (!created && csv) {
+            size_t n = logicalEnd < scratchSize ? logicalEnd : scratchSize;
+            if (log.seek(0) && log.read(scratch, n) == n) {
+                for (size_t i = 0; i < n; i++) {
+                    if (scratch[i] == '\n') {
+                        initialHeader = i + 1;
+                        break;
+                    }
+                }
+            }
+            log.seek(logicalEnd);
+        }
+        _headerSize = initialHeader;
+
+        uint8_t header[BINLOG_INDEX_HEADER_SIZE];
+        memcpy(header, BINLOG_INDEX_MAGIC, BINLOG_MAGIC_SIZE);
+        binlogPut16(&header[4], BINLOG_INDEX_VERSION);
+        binlogPut16(&header[6], LOG_INDEX_STRIDE);
+        binlogPut32(&header[8], initialHeader);
+        if (_file) _file.close();
+        _file = SD.open(path, "w+");
+        if (_file && _file.write(header, sizeof(header)) != sizeof(header)) {
+            _file.close();
+        } else if (_file) {
+            _retention.charge(0, sizeof(header));
+        }
+    }
+
+    if (headerSize > 0) {
+        _headerStart = headerStart;
+        _headerSize = headerSize;
+    }
+    if (!_file) {
+        Serial.printf("WARNING: No time index for %s\n", logPath.c_str());
+    }
+}
+
+void LogIndex::close() {
+    if (_file) {
+        _file.close();
+    }
+    _logPath = "";
+    _pendingCount = 0;
+}
+
+bool LogIndex::wantsEntry(time_t t) {
+    if (_countdown > 0) {
+        _countdown--;
+        return false;
+    }
+    // Else try the next record
+    return _file && _pendingCount < LOG_INDEX_PENDING && t >= _lastTime;
+}
+
+void LogIndex::addEntry(time_t t, size_t offset) {
+    BinlogIndexEntry& entry = _pending[_pendingCount++];
+    entry.unixTime = (uint32_t)t;
+    entry.offset = offset;
+    entry.headerStart = _headerStart;
+    entry.headerSize = _headerSize;
+    _lastTime = t;
+    _countdown = LOG_INDEX_STRIDE - 1;
+}
+
+void LogIndex::writeEntries(size_t logicalEnd) {
+    unsigned int count = _pendingCount;
+    _pendingCount = 0;
+    if (!_file || count == 0) {
+        return;
+    }
+
+    uint8_t entries[LOG_INDEX_PENDING * BINLOG_INDEX_ENTRY_SIZE];
+    size_t len = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        if (_pending[i].offset < logicalEnd) {
+            binlogPutIndexEntry(&entries[len], _pending[i]);
+            len += BINLOG_INDEX_ENTRY_SIZE;
+        }
+    }
+    if (len == 0) {
+        return;
+    }
+    size_t end = _file.position();
+    if (_file.write(entries, len) != len) {
+        Serial.printf("WARNING: Failed to update the time index of %s\n", _logPath.c_str());
+        _file.close();  // A torn entry is dropped when the log is reopened
+        return;
+    }
+    _file.flush();
+    _retention.charge(end, end + len);
+}
+
+bool LogIndex::findRange(const String& path, size_t logEnd, time_t from, time_t to, LogRange& range) {
+    range.path = path;
+    range.headerStart = 0;
+    range.headerSize = 0;
+    range.start = 0;
+    range.end = logEnd;
+
+    File file;
+    File* index;
+    uint32_t headerSize;
+    size_t count;
+    if (openForReading(path, file, &index) && readHeader(*index, logEnd, &headerSize, &count)) {
+        BinlogIndexEntry entry;
+        size_t first = upperBound(*index, count, from);
+        if (first > 0 && readEntry(*index, first - 1, &entry)) {
+            range.headerStart = entry.headerStart;
+            range.headerSize = entry.headerSize;
+            range.start = entry.offset;
+        } else {
+            range.headerSize = headerSize;  // At the top, before the first entry
+            range.start = headerSize;
+        }
+        size_t last = upperBound(*index, count, to);
+        if (last < count && readEntry(*index, last, &entry)) {
+            range.end = entry.offset;
+        }
+    }
+    closeForReading(file);
+    return range.start < range.end;
+}
+
+bool LogIndex::findEntry(const String& path, size_t logEnd, time_t t, BinlogIndexEntry* entry) {
+    File file;
+    File* index;
+    uint32_t headerSize;
+    size_t count;
+    bool found = false;
+    if (openForReading(path, file, &index) && readHeader(*index, logEnd, &headerSize, &count)) {
+        size_t first = upperBound(*index, count, t);
+        found = first > 0 && readEntry(*index, first - 1, entry);
+    }
+    closeForReading(file);
+    return found;
+}
+
+// The index of a log, for reading: the open log's own, or opened into file.
+// Hand file to closeForReading() afterwards either way.
+bool LogIndex::openForReading(const String& logPath, File& file, File** index) {
+    if (_logPath.length() > 0 && logPath == _logPath) {
+        *index = &_file;
+    } else {
+        file = SD.open(logPath + LOG_INDEX_SUFFIX, FILE_READ);
+        *index = &file;
+    }
+    return **index;
+}
+
+void LogIndex::closeForReading(File& file) {
+    if (file) {
+        file.close();
+    }
+    if (_file) {
+        _file.seek(_file.size());  // Where the writer appends
+    }
+}
+
+// Check an index's header; count receives the entries pointing before
+// logEnd (the rest are stale)
+bool LogIndex::readHeader(File& index, size_t logEnd, uint32_t* headerSize, size_t* count) {
+    uint8_t header[BINLOG_INDEX_HEADER_SIZE];
+    size_t size = index.size();
+    if (size < BINLOG_INDEX_HEADER_SIZE || !index.seek(0) ||
+        index.read(header, sizeof(header)) != sizeof(header) ||
+        memcmp(header, BINLOG_INDEX_MAGIC, BINLOG_MAGIC_SIZE) != 0 ||
+        binlogGet16(&header[4]) != BINLOG_INDEX_VERSION) {
+        return false;
+    }
+    *headerSize = binlogGet32(&header[8]);
+
+    // Entries are in log order, so the stale ones are at the end
+    size_t n = (size - BINLOG_INDEX_HEADER_SIZE) / BINLOG_INDEX_ENTRY_SIZE;
+    BinlogIndexEntry entry;
+    while (n > 0 && readEntry(index, n - 1, &entry) && entry.offset >= logEnd) {
+        n--;
+    }
+    *count = n;
+    return true;
+}
+
+bool LogIndex::readEntry(File& index, size_t entry, BinlogIndexEntry* out) {
+    uint8_t record[BINLOG_INDEX_ENTRY_SIZE];
+    if (!index.seek(BINLOG_INDEX_HEADER_SIZE + entry * BINLOG_INDEX_ENTRY_SIZE) ||
+        index.read(record, sizeof(record)) != sizeof(record)) {
+        return false;
+    }
+    binlogGetIndexEntry(record, out);
+    return true;
+}
+
+// How many of the first count entries are at or before t: a binary
+// search, one entry read per step
+size_t LogIndex::upperBound(File& index, size_t count, time_t t) {
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        BinlogIndexEntry entry;
+        if (!readEntry(index, mid, &entry)) {
+            break;
+        }
+        if ((time_t)entry.unixTime <= t) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
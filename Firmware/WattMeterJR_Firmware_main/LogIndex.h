@@ -0,0 +1,84 @@
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include <SD.h>
+#include "BinaryLogFormat.h"
+#include "LogRetention.h"
+
+#define LOG_INDEX_SUFFIX ".idx"       // Time index next to each daily log (BinaryLogFormat.h)
+#define LOG_INDEX_STRIDE 64           // Records per index entry
+#define LOG_INDEX_PENDING 8           // Index entries collected during one flush
+
+// Stretch of a daily log holding the records of a time range
+// (SDCardLogger::findLogRanges)
+struct LogRange {
+    String path;
+    size_t headerStart;        // Header the records need (CSV column names,
+    size_t headerSize;         // binary field layout); 0 bytes: not known
+    size_t start;              // Records from here up to end
+    size_t end;
+};
+
+// Time index of the daily logs. For the open log, every LOG_INDEX_STRIDE
+// records the writer notes the next record's time and offset (binary
+// records start a new block for it), and the entries are appended once
+// the flush has been committed. Readers binary search a log's index to
+// find where a time range starts, reading one entry per step.
+//
+// Locking: this takes no locks. The writing calls (open() to close())
+// run on the writer task during a flush, or on loop() with the writer
+// idle (_writerIdle taken). The reading calls (findRange(), findEntry())
+// run on loop() with the writer idle and BUS_STORAGE acquired: they share
+// the open index's File with the writer, and put it back at its end.
+class LogIndex {
+public:
+    LogIndex(LogRetention& retention);
+
+    // Start the index of the log just opened at logPath: a fresh one for a
+    // new log, else the existing one less any stale entries (from a flush
+    // that never committed) past logicalEnd. headerSize > 0: the log's
+    // header was just written at headerStart. A log without an index
+    // (older firmware) gets one from here on; for CSV its header is the
+    // first line, read from log through scratch.
+    void open(const String& logPath, File& log, size_t logicalEnd, bool csv, bool created,
+              size_t headerStart, size_t headerSize, uint8_t* scratch, size_t scratchSize);
+    void close();
+
+    // Whether the record about to be written at t gets an entry (every
+    // LOG_INDEX_STRIDE records); if so, addEntry() it with the offset it
+    // will be written at
+    bool wantsEntry(time_t t);
+    void addEntry(time_t t, size_t offset);
+    // Append the entries noted since the last call that point before
+    // logicalEnd (committed data). The index is only a shortcut: without
+    // the newest entries, lookups just start further back.
+    void writeEntries(size_t logicalEnd);
+    void dropEntries() { _pendingCount = 0; }
+
+    // The stretch of the log at path (logEnd bytes of data) holding
+    // [from, to]: from the last index entry at or before from to the first
+    // one after to, the whole log if it has no index. False if it has
+    // nothing there.
+    bool findRange(const String& path, size_t logEnd, time_t from, time_t to, LogRange& range);
+    // The last entry of path's index at or before t; false if there is none
+    bool findEntry(const String& path, size_t logEnd, time_t t, BinlogIndexEntry* entry);
+
+private:
+    LogRetention& _retention;
+    String _logPath;                 // Log the writer is indexing ("" if none)
+    File _file;
+    size_t _headerStart;             // Header of the records being written
+    size_t _headerSize;
+    unsigned int _countdown;         // Records until the next entry
+    time_t _lastTime;
+    BinlogIndexEntry _pending[LOG_INDEX_PENDING];
+    unsigned int _pendingCount;
+
+    bool openForReading(const String& logPath, File& file, File** index);
+    void closeForReading(File& file);
+    bool readHeader(File& index, size_t logEnd, uint32_t* headerSize, size_t* count);
+    bool readEntry(File& index, size_t entry, BinlogIndexEntry* out);
+    size_t upperBound(File& index, size_t count, time_t t);
+};
+
+#endif
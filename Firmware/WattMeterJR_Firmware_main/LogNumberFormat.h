@@ -0,0 +1,50 @@
+#ifndef LOGNUMBERFORMAT_H
+#define LOGNUMBERFORMAT_H
+
+// Number formatting for the CSV log. Used by SDCardLogger and timed
+// against printf on the host by Firmware/LogFormatBench, so it depends
+// only on the C library.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#define LOG_MAX_NUMBER_CHARS 48       // Longest formatted CSV value
+
+static const double LOG_POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+// Formats value exactly as printf("%.*f") would, without printf: the value
+// is scaled to a whole number of its last decimal place and written out
+// digit by digit. Values too large for that, and values within rounding
+// error of a .5 tie, are left to snprintf so the CSV text never changes.
+// out must hold LOG_MAX_NUMBER_CHARS; returns the length written.
+inline size_t formatFixed(char* out, double value, uint8_t decimals) {
+    if (decimals < sizeof(LOG_POW10) / sizeof(LOG_POW10[0])) {
+        double scaled = fabs(value) * LOG_POW10[decimals];
+        double rounded = rint(scaled);  // Ties to even, like printf
+        if (scaled < 1e15 && fabs(fabs(scaled - rounded) - 0.5) > 1e-6) {
+            uint64_t n = (uint64_t)rounded;
+            char digits[20];
+            int count = 0;
+            do {
+                digits[count++] = '0' + n % 10;
+                n /= 10;
+            } while (n > 0 || count <= decimals);
+
+            size_t len = 0;
+            if (signbit(value)) out[len++] = '-';
+            for (int i = count - 1; i >= 0; i--) {
+                out[len++] = digits[i];
+                if (i == decimals && decimals > 0) out[len++] = '.';
+            }
+            return len;
+        }
+    }
+
+    int len = snprintf(out, LOG_MAX_NUMBER_CHARS, "%.*f", decimals, value);
+    if (len < 0) return 0;
+    return len < LOG_MAX_NUMBER_CHARS ? len : LOG_MAX_NUMBER_CHARS - 1;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef LOGPATHS_H
+#define LOGPATHS_H
+
+#include <Arduino.h>
+#include <time.h>
+
+#define LOG_SD_MOUNT_POINT "/sd"      // Where SD.begin() mounts the card in the VFS
+
+// The daily logs live in /data/YYYY/MM/DD.csv or DD.bin (local days),
+// each with its time index next to it (LOG_INDEX_SUFFIX).
+
+// Local midnights around t: the day's log file covers [start, end)
+inline void logDayBounds(time_t t, time_t* start, time_t* end) {
+    struct tm boundary;
+    localtime_r(&t, &boundary);
+    boundary.tm_hour = 0;
+    boundary.tm_min = 0;
+    boundary.tm_sec = 0;
+    boundary.tm_isdst = -1;  // Let mktime work out DST for that time
+    *start = mktime(&boundary);
+    boundary.tm_mday++;
+    boundary.tm_hour = 0;    // mktime may have shifted these for DST
+    boundary.tm_min = 0;
+    boundary.tm_sec = 0;
+    boundary.tm_isdst = -1;
+    *end = mktime(&boundary);
+}
+
+// "/data/YYYY/MM/DD" of the local day containing t
+inline String logDayPrefix(time_t t) {
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+    char path[32];
+    sprintf(path, "/data/%04d/%02d/%02d", timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday);
+    return String(path);
+}
+
+#endif
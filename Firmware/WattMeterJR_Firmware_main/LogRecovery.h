@@ -0,0 +1,140 @@
+#ifndef LOGRECOVERY_H
+#define LOGRECOVERY_H
+
+// Where the intact data of a daily log file ends, after a power cut or a
+// reset. Used by SDCardLogger on the SD card's Files and checked on the
+// host by Firmware/LogRecoveryTest on an in-memory file, so it is a
+// template over anything with size(), seek() and read(), and depends only
+// on BinaryLogFormat.h.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "BinaryLogFormat.h"
+
+#define LOG_RECOVERY_SCAN 4096        // Tail of a plain CSV file searched for the last complete line
+
+// Which scan applies is a property of the file, not of the logging
+// settings: at boot, and for the logs of other days, the two differ
+inline bool logPathIsCsv(const char* path) {
+    size_t len = strlen(path);
+    return len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+}
+
+struct LogRecovery {
+    size_t end;                  // Where the intact data ends
+    bool preallocated;           // Commit records found (else a plain file)
+    uint32_t tornCommit;         // Newest commit whose data failed its CRC, 0 if none
+    BinlogCommit lastCommit;     // The commit to continue the sequence from
+};
+
+// CRC-32 of [start, end) of a file, read through buffer
+template <class LogFile>
+uint32_t logCrcOfRange(LogFile& file, size_t start, size_t end, uint8_t* buffer, size_t bufferSize) {
+    uint32_t crc = 0;
+    if (!file.seek(start)) {
+        return ~crc;  // Can't match a stored CRC of real data
+    }
+    while (start < end) {
+        size_t n = end - start;
+        if (n > bufferSize) n = bufferSize;
+        if (file.read(buffer, n) != n) {
+            return ~crc;
+        }
+        crc = binlogCrc32(buffer, n, crc);
+        start += n;
+    }
+    return crc;
+}
+
+// Only the tail is read, so the time taken doesn't depend on the file size:
+// - Preallocated files: the newest commit whose data still matches its
+//   CRC. A flush torn by a power cut fails that check, and the previous
+//   commit (in the other slot) marks the end instead.
+// - Plain CSV files (csv): just past the last complete line within
+//   LOG_RECOVERY_SCAN bytes of the end.
+// - Plain binary files: the whole file. Blocks carry their own CRC, so a
+//   torn one is skipped when decoding; their data is full of '\n' bytes,
+//   which must never be taken for line ends.
+// buffer (bufferSize bytes, at least one sector) is scratch space.
+template <class LogFile>
+LogRecovery logRecover(LogFile& file, bool csv, uint8_t* buffer, size_t bufferSize) {
+    LogRecovery result;
+    size_t size = file.size();
+    result.end = size;
+    result.preallocated = false;
+    result.tornCommit = 0;
+    result.lastCommit.sequence = 0;
+    result.lastCommit.blockCrc = 0;
+
+    if (size >= BINLOG_COMMIT_AREA) {
+        size_t dataLimit = size - BINLOG_COMMIT_AREA;
+        BinlogCommit commits[2];
+        bool valid[2];
+        for (int slot = 0; slot < 2; slot++) {
+            uint8_t record[BINLOG_COMMIT_SIZE];
+            valid[slot] = file.seek(dataLimit + slot * BINLOG_COMMIT_SLOT_SIZE) &&
+                          file.read(record, sizeof(record)) == sizeof(record) &&
+                          binlogGetCommit(record, &commits[slot]) &&
+                          commits[slot].logicalEnd <= dataLimit;
+        }
+
+        if (valid[0] || valid[1]) {
+            result.preallocated = true;
+            int newest = (valid[1] && (!valid[0] || commits[1].sequence > commits[0].sequence)) ? 1 : 0;
+            size_t end = commits[newest].blockStart;  // If nothing verifies
+
+            for (int k = 0; k < 2; k++) {
+                int slot = (k == 0) ? newest : 1 - newest;
+                if (!valid[slot]) continue;
+                if (slot != newest) {
+                    end = commits[slot].blockStart;
+                }
+                if (logCrcOfRange(file, commits[slot].blockStart, commits[slot].logicalEnd,
+                                  buffer, bufferSize) == commits[slot].blockCrc) {
+                    end = commits[slot].logicalEnd;
+                    break;
+                }
+                if (result.tornCommit == 0) {
+                    result.tornCommit = commits[slot].sequence;
+                }
+            }
+
+            // Continue past the newest sequence, so the next commit
+            // replaces the older slot rather than the newest
+            result.end = end;
+            result.lastCommit.sequence = commits[newest].sequence;
+            result.lastCommit.logicalEnd = end;
+            result.lastCommit.blockStart = end;
+            return result;
+        }
+    }
+
+    if (csv && size > 0) {
+        // Back up to the last newline; anything after it is a torn line
+        size_t scanned = 0;
+        bool found = false;
+        while (!found && scanned < LOG_RECOVERY_SCAN && scanned < size) {
+            size_t n = size - scanned;
+            if (n > bufferSize) n = bufferSize;
+            size_t chunkStart = size - scanned - n;
+            if (!file.seek(chunkStart) || file.read(buffer, n) != n) {
+                break;
+            }
+            for (size_t i = n; i > 0; i--) {
+                if (buffer[i - 1] == '\n') {
+                    result.end = chunkStart + i;
+                    found = true;
+                    break;
+                }
+            }
+            scanned += n;
+        }
+    }
+    result.lastCommit.logicalEnd = result.end;
+    result.lastCommit.blockStart = result.end;
+    return result;
+}
+
+#endif
@@ -0,0 +1,221 @@
+#include "LogRetention.h"
+
+// Space taken by a file of size bytes, in whole clusters
+static uint64_t clusterBytes(size_t size) {
+    return ((uint64_t)size + LOG_CLUSTER_SIZE - 1) / LOG_CLUSTER_SIZE * LOG_CLUSTER_SIZE;
+}
+
+LogRetention::LogRetention()
+    : _freeBytes(-1),
+      _lowBytes(100ULL * 1024 * 1024),
+      _highBytes(200ULL * 1024 * 1024),
+      _active(false),
+      _exhausted(false),
+      _deletedDays(0),
+      _lastStep(0) {
+}
+
+void LogRetention::setWatermarks(unsigned int lowMB, unsigned int highMB) {
+    if (highMB < lowMB) {
+        highMB = lowMB;
+    }
+    _lowBytes = (uint64_t)lowMB * 1024 * 1024;
+    _highBytes = (uint64_t)highMB * 1024 * 1024;
+    _exhausted = false;
+}
+
+void LogRetention::setLogsInUse(const String& path) {
+    int dot = path.lastIndexOf('.');
+    _inUsePrefix = dot > 0 ? path.substring(0, dot) : path;
+    if (_inUsePrefix.length() == 0) {
+        _exhausted = false;  // What it held may be deletable now
+    }
+}
+
+void LogRetention::mounted(uint64_t freeBytes) {
+    _freeBytes = (int64_t)freeBytes;
+}
+
+void LogRetention::unmounted() {
+    _freeBytes = -1;
+    _active = false;
+}
+
+void LogRetention::charge(size_t oldSize, size_t newSize) {
+    if (_freeBytes < 0) {
+        return;  // Not mounted
+    }
+    _freeBytes -= (int64_t)clusterBytes(newSize) - (int64_t)clusterBytes(oldSize);
+    if (_freeBytes < 0) {
+        _freeBytes = 0;
+    }
+}
+
+void LogRetention::chargeBytes(int64_t change) {
+    if (_freeBytes < 0) {
+        return;
+    }
+    _freeBytes -= change;
+    if (_freeBytes < 0) {
+        _freeBytes = 0;
+    }
+}
+
+bool LogRetention::due(unsigned long now) {
+    unsigned long interval = _active && !_exhausted ? LOG_RETENTION_STEP_INTERVAL : LOG_RETENTION_CHECK_INTERVAL;
+    if (_lowBytes == 0 || now - _lastStep < interval) {
+        return false;
+    }
+    _lastStep = now;
+    return true;
+}
+
+bool LogRetention::check() {
+    uint64_t freeBytes = _freeBytes >= 0 ? (uint64_t)_freeBytes : 0;
+
+    if (!_active && _freeBytes >= 0 && freeBytes < _lowBytes) {
+        _active = true;
+        Serial.printf("Free space %llu MB is below the low watermark, deleting the oldest logs\n",
+                      freeBytes / (1024 * 1024));
+    }
+    if (_active && freeBytes >= _highBytes) {
+        _active = false;
+        _exhausted = false;
+        Serial.printf("Free space back up to %llu MB\n", freeBytes / (1024 * 1024));
+    }
+    return _active;
+}
+
+void LogRetention::deleteOldest(time_t now, const String& openLogPath, const String& keepFrom) {
+    if (removeOldestDay(now, openLogPath, keepFrom)) {
+        _exhausted = false;
+    } else if (!_exhausted) {
+        _exhausted = true;
+        uint64_t freeBytes = _freeBytes >= 0 ? (uint64_t)_freeBytes : 0;
+        Serial.printf("WARNING: Free space %llu MB and no older logs left to delete\n",
+                      freeBytes / (1024 * 1024));
+    }
+}
+
+// Delete the files of the oldest day under /data (the log and its index,
+// in either format), or the oldest year or month directory if it is
+// empty. Today's log is never deleted, nor are logs the rollups still
+// have to be rebuilt from (keepFrom) or a download is sending
+// (setLogsInUse()). Returns false if there was nothing to delete.
+bool LogRetention::removeOldestDay(time_t now, const String& openLogPath, const String& keepFrom) {
+    bool empty;
+    String year = oldestEntry("/data", true, &empty);
+    if (year.length() == 0) {
+        return false;
+    }
+    String yearPath = String("/data/") + year;
+    String month = oldestEntry(yearPath, true, &empty);
+    if (month.length() == 0) {
+        if (!empty || openLogPath.startsWith(yearPath + "/")) {
+            return false;
+        }
+        return SD.rmdir(yearPath);
+    }
+    String monthPath = yearPath + "/" + month;
+    String day = oldestEntry(monthPath, false, &empty);
+    if (day.length() == 0) {
+        if (!empty || openLogPath.startsWith(monthPath + "/")) {
+            return false;
+        }
+        return SD.rmdir(monthPath);
+    }
+
+    // Fixed-width names: an older day sorts first
+    String prefix = monthPath + "/" + day;
+    if (prefix >= logDayPrefix(now) ||
+        openLogPath.startsWith(prefix + ".") ||
+        (_inUsePrefix.length() > 0 && prefix >= _inUsePrefix) ||
+        (keepFrom.length() > 0 && prefix >= keepFrom)) {
+        return false;
+    }
+
+    // Collect the day's files first; removing while listing can skip entries
+    String names[4];
+    size_t sizes[4];
+    unsigned int count = 0;
+    File dir = SD.open(monthPath);
+    if (!dir) {
+        return false;
+    }
+    for (;;) {
+        File entry = dir.openNextFile();
+        if (!entry) {
+            break;
+        }
+        const char* name = entry.name();
+        const char* slash = strrchr(name, '/');
+        String baseName = slash != nullptr ? slash + 1 : name;
+        bool isDir = entry.isDirectory();
+        size_t size = entry.size();
+        entry.close();
+        if (!isDir && count < 4 && baseName.startsWith(day + ".")) {
+            names[count] = baseName;
+            sizes[count] = size;
+            count++;
+        }
+    }
+    dir.close();
+    if (count == 0) {
+        return false;
+    }
+
+    uint64_t freed = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        String path = monthPath + "/" + names[i];
+        if (!SD.remove(path)) {
+            Serial.printf("Retention: failed to remove %s\n", path.c_str());
+            return false;
+        }
+        charge(sizes[i], 0);
+        freed += sizes[i];
+    }
+    _deletedDays++;
+    Serial.printf("Retention: removed the logs of %s (%llu KB)\n", prefix.c_str(), freed / 1024);
+    return true;
+}
+
+// The first in name order of the directories (or, for files, of the names
+// up to the first '.') in dirPath, "" if there are none. *empty: dirPath
+// has no entries at all.
+String LogRetention::oldestEntry(const String& dirPath, bool directories, bool* empty) {
+    String oldest;
+    *empty = true;
+    File dir = SD.open(dirPath);
+    if (!dir || !dir.isDirectory()) {
+        if (dir) dir.close();
+        *empty = false;
+        return oldest;
+    }
+    for (;;) {
+        File entry = dir.openNextFile();
+        if (!entry) {
+            break;
+        }
+        *empty = false;
+        const char* name = entry.name();
+        const char* slash = strrchr(name, '/');
+        String baseName = slash != nullptr ? slash + 1 : name;
+        bool isDir = entry.isDirectory();
+        entry.close();
+        if (isDir != directories) {
+            continue;
+        }
+        if (!directories) {
+            int dot = baseName.indexOf('.');
+            if (dot <= 0) {
+                continue;
+            }
+            baseName = baseName.substring(0, dot);
+        }
+        if (oldest.length() == 0 || baseName < oldest) {
+            oldest = baseName;
+        }
+    }
+    dir.close();
+    return oldest;
+}
@@ -0,0 +1,75 @@
+#ifndef LOGRETENTION_H
+#define LOGRETENTION_H
+
+#include <SD.h>
+#include "LogPaths.h"
+
+#define LOG_CLUSTER_SIZE 32768UL      // Allocation unit the free space estimate rounds file sizes to (SDHC default)
+#define LOG_RETENTION_CHECK_INTERVAL 1000  // ms between free space checks
+#define LOG_RETENTION_STEP_INTERVAL 50     // ms between deletions while freeing space
+
+// Free space retention for the SD card. The free space is read from the
+// card once at mount (SD.usedBytes() walks the whole FAT) and from then
+// on kept up to date from the files the logger grows, trims and deletes,
+// rounded to LOG_CLUSTER_SIZE. Below the low watermark, step() deletes
+// the oldest day's logs, one day per call, until the high watermark is
+// free again.
+//
+// Locking: this takes no locks; SDCardLogger holds _writerIdle around
+// every call that changes the estimate or touches the card, so loop()
+// and the writer task never do so at once. charge() runs on the writer
+// task during a flush, or on loop() with the writer idle. check() runs on
+// loop() with the writer idle, deleteOldest() the same with BUS_STORAGE
+// acquired as well. The getters are read unlocked, for status only.
+class LogRetention {
+public:
+    LogRetention();
+
+    // Once free space falls below lowMB, delete until highMB is free
+    // (lowMB 0: never delete)
+    void setWatermarks(unsigned int lowMB, unsigned int highMB);
+    // A reader (the web server's log download) is sending logs starting
+    // with path: that day's logs and every later day's are kept until
+    // it's called again with ""
+    void setLogsInUse(const String& path);
+
+    // Free space as read at mount; unmounted() stops the estimate
+    void mounted(uint64_t freeBytes);
+    void unmounted();
+
+    // A file went from oldSize to newSize bytes (0: created or deleted)
+    void charge(size_t oldSize, size_t newSize);
+    // Bytes other files grew by, already counted in bytes rather than
+    // clusters (LogRollup::takeSizeChange())
+    void chargeBytes(int64_t change);
+
+    // Whether a step is due: every LOG_RETENTION_CHECK_INTERVAL, or every
+    // LOG_RETENTION_STEP_INTERVAL while deleting
+    bool due(unsigned long now);
+    // Check the watermarks; true while logs should be deleted
+    bool check();
+    // Delete the oldest day's logs (or an emptied year or month
+    // directory). Never deleted: today's logs (now), those of openLogPath's
+    // day, those from keepFrom on (a logDayPrefix() or "/data" for all, ""
+    // for none) and those in use by a reader.
+    void deleteOldest(time_t now, const String& openLogPath, const String& keepFrom);
+
+    int64_t getFreeBytes() { return _freeBytes; }     // Estimate; -1 when not mounted
+    bool isActive() { return _active; }               // Deleting logs to free space
+    uint32_t getDeletedDays() { return _deletedDays; }
+
+private:
+    int64_t _freeBytes;
+    uint64_t _lowBytes;
+    uint64_t _highBytes;
+    bool _active;
+    bool _exhausted;                 // Nothing left to delete (warned once)
+    uint32_t _deletedDays;
+    unsigned long _lastStep;
+    String _inUsePrefix;             // /data/YYYY/MM/DD of the oldest log being read ("" if none)
+
+    bool removeOldestDay(time_t now, const String& openLogPath, const String& keepFrom);
+    String oldestEntry(const String& dirPath, bool directories, bool* empty);
+};
+
+#endif
@@ -0,0 +1,538 @@
+#include "LogRollup.h"
+
+static const unsigned long LEVEL_SECONDS[ROLLUP_LEVELS] = { 60, 900, 3600 };
+static const char* const LEVEL_NAMES[ROLLUP_LEVELS] = { "1m", "15m", "1h" };
+
+LogRollup::LogRollup()
+    : _aggregates(nullptr),
+      _names(nullptr),
+      _fieldCount(0),
+      _nextRetention(0),
+      _retentionDue(false),
+      _retentionTime(0),
+      _rowsWritten(0),
+      _queue(nullptr),
+      _queueHead(0),
+      _queueCount(0),
+      _sizeChange(0) {
+    for (unsigned int i = 0; i < ROLLUP_LEVELS; i++) {
+        Level& level = _levels[i];
+        level.start = 0;
+        level.count = 0;
+        level.fields = nullptr;
+        level.writtenUntil = 0;
+        level.headerSize = 0;
+        level.recordSize = 0;
+        level.fileFieldCount = 0;
+    }
+    _levels[0].retentionDays = 31;   // A month of minutes
+    _levels[1].retentionDays = 400;  // A year and a bit of quarters
+    _levels[2].retentionDays = 0;    // Hours forever
+}
+
+LogRollup::~LogRollup() {
+    freeFields();
+}
+
+unsigned long LogRollup::levelSeconds(unsigned int level) {
+    return LEVEL_SECONDS[level];
+}
+
+const char* LogRollup::levelName(unsigned int level) {
+    return LEVEL_NAMES[level];
+}
+
+void LogRollup::freeFields() {
+    if (_aggregates != nullptr) {
+        delete[] _aggregates;
+        _aggregates = nullptr;
+    }
+    if (_names != nullptr) {
+        delete[] _names;
+        _names = nullptr;
+    }
+    if (_queue != nullptr) {
+        delete[] _queue;
+        _queue = nullptr;
+    }
+    _queueHead = 0;
+    _queueCount = 0;
+    for (unsigned int i = 0; i < ROLLUP_LEVELS; i++) {
+        _levels[i].fields = nullptr;
+    }
+    _fieldCount = 0;
+}
+
+bool LogRollup::configure(unsigned int fieldCount, const String* names, const uint8_t* statistics,
+                          const uint8_t* decimals) {
+    freeFields();
+    if (fieldCount > ROLLUP_MAX_FIELDS) {
+        Serial.printf("ERROR: Rollups take at most %u fields\n", ROLLUP_MAX_FIELDS);
+        return false;
+    }
+
+    _names = new (std::nothrow) String[fieldCount > 0 ? fieldCount : 1];
+    _aggregates = new (std::nothrow) FieldAggregate[ROLLUP_LEVELS * (fieldCount > 0 ? fieldCount : 1)];
+    _queue = new (std::nothrow) uint8_t[ROLLUP_QUEUE_ROWS * (ROLLUP_RECORD_FIXED_SIZE + fieldCount * ROLLUP_FIELD_SIZE)];
+    if (_names == nullptr || _aggregates == nullptr || _queue == nullptr) {
+        Serial.println("ERROR: Failed to allocate rollup aggregates");
+        freeFields();
+        return false;
+    }
+
+    _fieldCount = fieldCount;
+    for (unsigned int j = 0; j < fieldCount; j++) {
+        _names[j] = names[j];
+        _statistics[j] = statistics[j];
+        _decimals[j] = decimals[j];
+    }
+    for (unsigned int i = 0; i < ROLLUP_LEVELS; i++) {
+        _levels[i].fields = &_aggregates[i * fieldCount];
+        _levels[i].count = 0;
+        _levels[i].path = "";  // Column mapping is for the old fields
+    }
+    return true;
+}
+
+void LogRollup::setRetentionDays(unsigned int level, unsigned int days) {
+    if (level < ROLLUP_LEVELS) {
+        _levels[level].retentionDays = days;
+    }
+}
+
+time_t LogRollup::begin(time_t now) {
+    time_t resume = 0;
+    time_t finerEnd = 0;
+    for (unsigned int i = 0; i < ROLLUP_LEVELS; i++) {
+        Level& level = _levels[i];
+        level.count = 0;
+        level.path = "";
+
+        // This period's file, or the last one's early in a period
+        level.writtenUntil = lastRowEnd(i, filePath(i, now));
+        if (level.writtenUntil == 0) {
+            level.writtenUntil = lastRowEnd(i, filePath(i, periodStart(i, now) - 1));
+        }
+
+        // A level without rows yet needs its bucket in progress, which
+        // started before the rows of the level below ended
+        time_t needed = level.writtenUntil;
+        if (needed == 0 && finerEnd > 0) {
+            needed = finerEnd - finerEnd % LEVEL_SECONDS[i];
+        }
+        if (needed > 0 && (resume == 0 || needed < resume)) {
+            resume = needed;
+        }
+        finerEnd = needed;
+    }
+
+    time_t oldest = now - (time_t)ROLLUP_REBUILD_MAX_DAYS * 86400;
+    if (resume > 0 && resume < oldest) {
+        resume = oldest;
+    }
+
+    applyRetention(now);
+    _nextRetention = now + 86400;
+    _retentionDue = false;
+    return resume;
+}
+
+void LogRollup::add(time_t t, double kWh, const float* values, uint64_t present) {
+    if (t >= _nextRetention) {
+        _retentionDue = true;  // Left to writeQueued()
+        _retentionTime = t;
+        _nextRetention = t + 86400;
+    }
+
+    Level& level = _levels[0];
+    time_t start = t - t % LEVEL_SECONDS[0];
+    if (level.count > 0 && start != level.start) {
+        if (start < level.start) {
+            return;  // Clock went back; keep the rows in order
+        }
+        closeBucket(0);
+    }
+    if (level.count == 0) {
+        startBucket(level, start, kWh);
+    }
+
+    level.count++;
+    level.kWhLast = kWh;
+    for (unsigned int j = 0; j < _fieldCount; j++) {
+        float value = values[j];
+        if (!(present & ((uint64_t)1 << j)) || isnan(value)) {
+            continue;
+        }
+        FieldAggregate& field = level.fields[j];
+        if (field.count == 0 || value < field.min) field.min = value;
+        if (field.count == 0 || value > field.max) field.max = value;
+        field.sum += value;
+        field.count++;
+    }
+}
+
+void LogRollup::startBucket(Level& level, time_t start, double kWh) {
+    level.start = start;
+    level.count = 0;
+    level.kWhFirst = kWh;
+    level.kWhLast = kWh;
+    for (unsigned int j = 0; j < _fieldCount; j++) {
+        level.fields[j].count = 0;
+        level.fields[j].sum = 0.0;
+    }
+}
+
+// A bucket is complete: queue its row, unless the files have it from
+// before a restart, and fold it into the next level up
+void LogRollup::closeBucket(unsigned int index) {
+    Level& level = _levels[index];
+    if (level.count == 0) {
+        return;
+    }
+    if (level.start >= level.writtenUntil && queueRow(index)) {
+        level.writtenUntil = level.start + LEVEL_SECONDS[index];
+    }
+    if (index + 1 < ROLLUP_LEVELS) {
+        mergeBucket(index + 1, level);
+    }
+    level.count = 0;
+}
+
+void LogRollup::mergeBucket(unsigned int index, const Level& from) {
+    Level& level = _levels[index];
+    time_t start = from.start - from.start % LEVEL_SECONDS[index];
+    if (level.count > 0 && start != level.start) {
+        closeBucket(index);
+    }
+    if (level.count == 0) {
+        startBucket(level, start, from.kWhFirst);
+    }
+
+    level.count += from.count;
+    level.kWhLast = from.kWhLast;
+    for (unsigned int j = 0; j < _fieldCount; j++) {
+        const FieldAggregate& src = from.fields[j];
+        FieldAggregate& dst = level.fields[j];
+        if (src.count == 0) {
+            continue;
+        }
+        if (dst.count == 0 || src.min < dst.min) dst.min = src.min;
+        if (dst.count == 0 || src.max > dst.max) dst.max = src.max;
+        dst.sum += src.sum;
+        dst.count += src.count;
+    }
+}
+
+// Queue the row of the bucket in progress, in our column order. With the
+// queue full (the owner hasn't been able to keep up) the queued rows are
+// written out here first, so rows still reach the files in order.
+bool LogRollup::queueRow(unsigned int index) {
+    if (_queue == nullptr) {
+        return false;
+    }
+    if (_queueCount == ROLLUP_QUEUE_ROWS) {
+        writeQueuedRows(ROLLUP_QUEUE_ROWS);
+    }
+
+    Level& level = _levels[index];
+    unsigned int slot = (_queueHead + _queueCount) % ROLLUP_QUEUE_ROWS;
+    uint8_t* row = &_queue[slot * queueRowSize()];
+    binlogPut32(&row[0], (uint32_t)level.start);
+    binlogPut32(&row[4], level.count);
+    binlogPutDouble(&row[8], level.kWhFirst);
+    binlogPutDouble(&row[16], level.kWhLast);
+    uint8_t* p = &row[ROLLUP_RECORD_FIXED_SIZE];
+    for (unsigned int j = 0; j < _fieldCount; j++) {
+        const FieldAggregate& field = level.fields[j];
+        if (field.count == 0) {
+            binlogPutFloat(p, NAN);
+            binlogPutFloat(p + 4, NAN);
+            binlogPutFloat(p + 8, NAN);
+        } else {
+            binlogPutFloat(p, field.sum / field.count);
+            binlogPutFloat(p + 4, field.min);
+            binlogPutFloat(p + 8, field.max);
+        }
+        p += ROLLUP_FIELD_SIZE;
+    }
+    _queueLevels[slot] = index;
+    _queueCount++;
+    return true;
+}
+
+bool LogRollup::writeQueued(unsigned int maxRows) {
+    if (_queueCount > 0) {
+        writeQueuedRows(maxRows);
+    } else if (_retentionDue) {
+        _retentionDue = false;
+        applyRetention(_retentionTime);
+    }
+    return hasQueued();
+}
+
+// The oldest maxRows queued rows. A row that can't be written is dropped
+// (the failure is reported), as it was before the queue.
+void LogRollup::writeQueuedRows(unsigned int maxRows) {
+    for (unsigned int n = 0; n < maxRows && _queueCount > 0; n++) {
+        writeRow(_queueLevels[_queueHead], &_queue[_queueHead * queueRowSize()]);
+        _queueHead = (_queueHead + 1) % ROLLUP_QUEUE_ROWS;
+        _queueCount--;
+    }
+}
+
+// Append a queued row to its level's file, over any torn row at the end,
+// with its columns mapped onto those of the file
+bool LogRollup::writeRow(unsigned int index, const uint8_t* row) {
+    Level& level = _levels[index];
+    String path = filePath(index, (time_t)binlogGet32(row));
+    if (!openLayout(index, path)) {
+        return false;
+    }
+
+    memcpy(_row, row, ROLLUP_RECORD_FIXED_SIZE);
+    uint8_t* p = &_row[ROLLUP_RECORD_FIXED_SIZE];
+    for (unsigned int f = 0; f < level.fileFieldCount; f++) {
+        uint8_t column = level.columns[f];
+        if (column == ROLLUP_NO_COLUMN) {
+            binlogPutFloat(p, NAN);
+            binlogPutFloat(p + 4, NAN);
+            binlogPutFloat(p + 8, NAN);
+        } else {
+            memcpy(p, &row[ROLLUP_RECORD_FIXED_SIZE + column * ROLLUP_FIELD_SIZE], ROLLUP_FIELD_SIZE);
+        }
+        p += ROLLUP_FIELD_SIZE;
+    }
+
+    File file = SD.open(path, "r+");
+    if (!file) {
+        Serial.printf("Failed to open %s for writing\n", path.c_str());
+        return false;
+    }
+    size_t size = file.size();
+    size_t rows = (size - level.headerSize) / level.recordSize;
+    size_t end = level.headerSize + (rows + 1) * level.recordSize;
+    bool ok = file.seek(end - level.recordSize) &&
+              file.write(_row, level.recordSize) == level.recordSize;
+    file.close();
+    if (!ok) {
+        Serial.printf("Failed to write rollup row to %s\n", path.c_str());
+        return false;
+    }
+    if (end > size) {
+        _sizeChange += end - size;
+    }
+    _rowsWritten++;
+    return true;
+}
+
+// Make path the level's file, creating it with a header for our columns,
+// or mapping our columns onto those of an existing one by name and
+// statistic (the field list may have changed since it was started)
+bool LogRollup::openLayout(unsigned int index, const String& path) {
+    Level& level = _levels[index];
+    if (level.path == path) {
+        return true;
+    }
+    level.path = "";
+
+    if (SD.exists(path)) {
+        File file = SD.open(path, FILE_READ);
+        bool ok = file && readHeader(file, level);
+        if (file) file.close();
+        if (!ok) {
+            Serial.printf("WARNING: %s is not a rollup file of this level\n", path.c_str());
+            return false;
+        }
+        level.path = path;
+        return true;
+    }
+
+    String dir = String(ROLLUP_ROOT) + "/" + LEVEL_NAMES[index];
+    if ((!SD.exists(ROLLUP_ROOT) && !SD.mkdir(ROLLUP_ROOT)) || (!SD.exists(dir) && !SD.mkdir(dir))) {
+        Serial.printf("Failed to create %s\n", dir.c_str());
+        return false;
+    }
+    File file = SD.open(path, FILE_WRITE);
+    if (!file) {
+        Serial.printf("Failed to create %s\n", path.c_str());
+        return false;
+    }
+
+    uint8_t header[ROLLUP_HEADER_SIZE];
+    memcpy(header, ROLLUP_MAGIC, BINLOG_MAGIC_SIZE);
+    binlogPut16(&header[4], ROLLUP_VERSION);
+    binlogPut16(&header[6], _fieldCount);
+    binlogPut16(&header[8], ROLLUP_RECORD_FIXED_SIZE + _fieldCount * ROLLUP_FIELD_SIZE);
+    binlogPut32(&header[10], LEVEL_SECONDS[index]);
+    bool ok = file.write(header, sizeof(header)) == sizeof(header);
+    for (unsigned int j = 0; j < _fieldCount && ok; j++) {
+        size_t len = _names[j].length();
+        if (len > 255) len = 255;
+        uint8_t desc[ROLLUP_FIELD_DESC_SIZE + 1] = { _statistics[j], _decimals[j], (uint8_t)len };
+        ok = file.write(desc, sizeof(desc)) == sizeof(desc) &&
+             file.write((const uint8_t*)_names[j].c_str(), len) == len;
+        level.columns[j] = j;
+    }
+    level.headerSize = file.position();
+    file.close();
+    if (!ok) {
+        Serial.printf("Failed to write header to %s\n", path.c_str());
+        SD.remove(path);
+        return false;
+    }
+
+    _sizeChange += level.headerSize;
+    level.recordSize = ROLLUP_RECORD_FIXED_SIZE + _fieldCount * ROLLUP_FIELD_SIZE;
+    level.fileFieldCount = _fieldCount;
+    level.path = path;
+    return true;
+}
+
+bool LogRollup::readHeader(File& file, Level& level) {
+    uint8_t header[ROLLUP_HEADER_SIZE];
+    if (file.read(header, sizeof(header)) != sizeof(header) ||
+        memcmp(header, ROLLUP_MAGIC, BINLOG_MAGIC_SIZE) != 0 ||
+        binlogGet16(&header[4]) != ROLLUP_VERSION) {
+        return false;
+    }
+    unsigned int fieldCount = binlogGet16(&header[6]);
+    size_t recordSize = binlogGet16(&header[8]);
+    unsigned int index = &level - _levels;
+    if (fieldCount > ROLLUP_MAX_FIELDS ||
+        recordSize != ROLLUP_RECORD_FIXED_SIZE + fieldCount * ROLLUP_FIELD_SIZE ||
+        binlogGet32(&header[10]) != LEVEL_SECONDS[index]) {
+        return false;
+    }
+
+    for (unsigned int f = 0; f < fieldCount; f++) {
+        uint8_t desc[ROLLUP_FIELD_DESC_SIZE + 1];
+        char name[256];
+        if (file.read(desc, sizeof(desc)) != sizeof(desc) ||
+            file.read((uint8_t*)name, desc[2]) != desc[2]) {
+            return false;
+        }
+        name[desc[2]] = '\0';
+
+        level.columns[f] = ROLLUP_NO_COLUMN;
+        for (unsigned int j = 0; j < _fieldCount; j++) {
+            if (_statistics[j] == desc[0] && _names[j] == name) {
+                level.columns[f] = j;
+                break;
+            }
+        }
+    }
+    level.headerSize = file.position();
+    level.recordSize = recordSize;
+    level.fileFieldCount = fieldCount;
+    return true;
+}
+
+// End of the bucket of the last whole row in path (0: no rows)
+time_t LogRollup::lastRowEnd(unsigned int index, const String& path) {
+    if (!SD.exists(path)) {
+        return 0;
+    }
+    Level& level = _levels[index];
+    File file = SD.open(path, FILE_READ);
+    if (!file) {
+        return 0;
+    }
+
+    time_t end = 0;
+    if (readHeader(file, level)) {
+        level.path = path;
+        size_t rows = (file.size() - level.headerSize) / level.recordSize;
+        uint8_t start[4];
+        if (rows > 0 && file.seek(level.headerSize + (rows - 1) * level.recordSize) &&
+            file.read(start, sizeof(start)) == sizeof(start)) {
+            end = (time_t)binlogGet32(start) + LEVEL_SECONDS[index];
+        }
+    }
+    file.close();
+    return end;
+}
+
+// Delete the files of levels with a retention whose last row is older
+// than that. Runs at begin() and then once a day.
+void LogRollup::applyRetention(time_t now) {
+    for (unsigned int i = 0; i < ROLLUP_LEVELS; i++) {
+        Level& level = _levels[i];
+        if (level.retentionDays == 0) {
+            continue;
+        }
+        time_t cutoff = now - (time_t)level.retentionDays * 86400;
+
+        String dirPath = String(ROLLUP_ROOT) + "/" + LEVEL_NAMES[i];
+        File dir = SD.open(dirPath);
+        if (!dir || !dir.isDirectory()) {
+            continue;
+        }
+        for (;;) {
+            File entry = dir.openNextFile();
+            if (!entry) {
+                break;
+            }
+            const char* name = entry.name();
+            const char* slash = strrchr(name, '/');
+            String baseName = slash != nullptr ? slash + 1 : name;
+            bool isDir = entry.isDirectory();
+            size_t size = entry.size();
+            entry.close();
+            if (isDir) {
+                continue;
+            }
+
+            // The period named (YYYYMMDD, YYYYMM or YYYY) ends when?
+            int year = 0, month = 1, day = 1;
+            if (sscanf(baseName.c_str(), "%4d%2d%2d", &year, &month, &day) != 3 - (int)i) {
+                continue;
+            }
+            struct tm end = {};
+            end.tm_year = year - 1900 + (i == 2 ? 1 : 0);
+            end.tm_mon = month - 1 + (i == 1 ? 1 : 0);
+            end.tm_mday = day + (i == 0 ? 1 : 0);
+            end.tm_isdst = -1;
+            if (mktime(&end) <= cutoff) {
+                String path = dirPath + "/" + baseName;
+                if (path == level.path) {
+                    level.path = "";
+                }
+                if (SD.remove(path)) {
+                    _sizeChange -= size;
+                    Serial.printf("Rollup retention: removed %s\n", path.c_str());
+                }
+            }
+        }
+        dir.close();
+    }
+}
+
+// Local midnight starting the day (minutes), month (quarters) or year
+// (hours) of a level's file containing t
+time_t LogRollup::periodStart(unsigned int level, time_t t) {
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+    timeinfo.tm_hour = 0;
+    timeinfo.tm_min = 0;
+    timeinfo.tm_sec = 0;
+    if (level >= 1) timeinfo.tm_mday = 1;
+    if (level >= 2) timeinfo.tm_mon = 0;
+    timeinfo.tm_isdst = -1;
+    return mktime(&timeinfo);
+}
+
+String LogRollup::filePath(unsigned int level, time_t t) {
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+    char path[48];
+    if (level == 0) {
+        sprintf(path, "%s/%s/%04d%02d%02d.bin", ROLLUP_ROOT, LEVEL_NAMES[level],
+                timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday);
+    } else if (level == 1) {
+        sprintf(path, "%s/%s/%04d%02d.bin", ROLLUP_ROOT, LEVEL_NAMES[level],
+                timeinfo.tm_year + 1900, timeinfo.tm_mon + 1);
+    } else {
+        sprintf(path, "%s/%s/%04d.bin", ROLLUP_ROOT, LEVEL_NAMES[level], timeinfo.tm_year + 1900);
+    }
+    return String(path);
+}
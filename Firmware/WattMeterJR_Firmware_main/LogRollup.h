@@ -0,0 +1,124 @@
+#ifndef LOGROLLUP_H
+#define LOGROLLUP_H
+
+#include <SD.h>
+#include "BinaryLogFormat.h"
+
+#define ROLLUP_LEVELS 3
+#define ROLLUP_MAX_FIELDS 64
+#define ROLLUP_ROOT "/rollup"
+#define ROLLUP_REBUILD_MAX_DAYS 7     // Furthest back a rebuild replays the raw logs
+#define ROLLUP_NO_COLUMN 0xFF
+#define ROLLUP_QUEUE_ROWS 32          // Closed buckets waiting to be written
+
+// Aggregates of the logged records at three levels: 1-minute buckets of
+// the records, 15-minute buckets of the minutes and hourly buckets of the
+// quarters. Each level goes to its own compact files (BinaryLogFormat.h)
+// with its own retention, so a long-range query reads a row per bucket
+// rather than every record.
+//
+// Buckets in progress live in RAM only. begin() finds where each level's
+// files end and returns the earliest of those; the owner then adds the
+// logged records from there on, replaying the raw logs if that's in the
+// past (after a restart). Rows a level already has are not written again.
+//
+// add() only aggregates in RAM. Closed buckets are queued, and the files
+// are only touched by writeQueued() (and begin()), which the owner calls
+// where the file I/O won't hold anything up.
+class LogRollup {
+public:
+    LogRollup();
+    ~LogRollup();
+
+    // Columns of the records to be added. Starts over, dropping any queued
+    // rows (writeQueued() them first): call begin() next.
+    bool configure(unsigned int fieldCount, const String* names, const uint8_t* statistics,
+                   const uint8_t* decimals);
+    // Days a level's files are kept (0: forever)
+    void setRetentionDays(unsigned int level, unsigned int days);
+    unsigned int getRetentionDays(unsigned int level) { return _levels[level].retentionDays; }
+
+    // Drop the buckets in progress and find the end of each level's files.
+    // Returns when the records to add next should start (0: from now on).
+    time_t begin(time_t now);
+
+    // A logged record; values has a column per field, present a bit per
+    // column sampled for it. Records must come in time order.
+    void add(time_t t, double kWh, const float* values, uint64_t present);
+
+    // One step of file work: write up to maxRows queued rows or, once
+    // they're all out, apply the retention if a day has passed. Returns
+    // true while work remains.
+    bool writeQueued(unsigned int maxRows);
+    bool hasQueued() { return _queueCount > 0 || _retentionDue; }
+
+    uint32_t getRowsWritten() { return _rowsWritten; }
+    // Bytes the rollup files grew by (less those of files removed) since
+    // the last call, for the owner's free space estimate
+    int64_t takeSizeChange() { int64_t change = _sizeChange; _sizeChange = 0; return change; }
+    static unsigned long levelSeconds(unsigned int level);
+    static const char* levelName(unsigned int level);
+
+private:
+    struct FieldAggregate {
+        uint32_t count;
+        float min;
+        float max;
+        double sum;
+    };
+
+    struct Level {
+        time_t start;                 // Bucket in progress
+        uint32_t count;               // Records in it; 0: none yet
+        double kWhFirst;
+        double kWhLast;
+        FieldAggregate* fields;
+        time_t writtenUntil;          // The files have every row before this
+        unsigned int retentionDays;
+
+        // File the last row went to, and where its columns come from
+        String path;
+        size_t headerSize;
+        size_t recordSize;
+        unsigned int fileFieldCount;
+        uint8_t columns[ROLLUP_MAX_FIELDS];  // Our column, or ROLLUP_NO_COLUMN
+    };
+
+    Level _levels[ROLLUP_LEVELS];
+    FieldAggregate* _aggregates;      // ROLLUP_LEVELS x _fieldCount
+    String* _names;
+    uint8_t _statistics[ROLLUP_MAX_FIELDS];
+    uint8_t _decimals[ROLLUP_MAX_FIELDS];
+    unsigned int _fieldCount;
+    uint8_t _row[ROLLUP_RECORD_FIXED_SIZE + ROLLUP_MAX_FIELDS * ROLLUP_FIELD_SIZE];
+    time_t _nextRetention;
+    bool _retentionDue;
+    time_t _retentionTime;
+    uint32_t _rowsWritten;
+
+    // Closed buckets, each a row as in a file of exactly our columns,
+    // and the level it goes to
+    uint8_t* _queue;
+    uint8_t _queueLevels[ROLLUP_QUEUE_ROWS];
+    unsigned int _queueHead;
+    unsigned int _queueCount;
+    size_t queueRowSize() { return ROLLUP_RECORD_FIXED_SIZE + _fieldCount * ROLLUP_FIELD_SIZE; }
+    int64_t _sizeChange;
+
+    void startBucket(Level& level, time_t start, double kWh);
+    void closeBucket(unsigned int level);
+    void mergeBucket(unsigned int level, const Level& from);
+    bool queueRow(unsigned int level);
+    void writeQueuedRows(unsigned int maxRows);
+    bool writeRow(unsigned int level, const uint8_t* row);
+    bool openLayout(unsigned int level, const String& path);
+    bool readHeader(File& file, Level& level);
+    time_t lastRowEnd(unsigned int level, const String& path);
+    void applyRetention(time_t now);
+
+    time_t periodStart(unsigned int level, time_t t);
+    String filePath(unsigned int level, time_t t);
+    void freeFields();
+};
+
+#endif
@@ -0,0 +1,334 @@
+#include "LogRollupSync.h"
+#include "LogRecovery.h"
+
+LogRollupSync::LogRollupSync(LogRollup& rollup, LogIndex& index, uint8_t* scratch, size_t scratchSize)
+    : _rollup(rollup),
+      _index(index),
+      _scratch(scratch),
+      _scratchSize(scratchSize),
+      _started(false),
+      _synced(false),
+      _lastStep(0),
+      _binary(false),
+      _fieldCount(0),
+      _fieldNames(nullptr),
+      _time(0),
+      _path(""),
+      _dayEnd(0),
+      _offset(0),
+      _end(0),
+      _endKnown(false),
+      _layout(false),
+      _seek(false),
+      _skipTo(0),
+      _sparse(false),
+      _logFieldCount(0) {
+}
+
+void LogRollupSync::reset() {
+    _started = false;
+    _synced = false;
+}
+
+bool LogRollupSync::due(unsigned long now) {
+    if (_synced || now - _lastStep < LOG_ROLLUP_REPLAY_INTERVAL) {
+        return false;
+    }
+    _lastStep = now;
+    return true;
+}
+
+void LogRollupSync::start(time_t now, bool binary, unsigned int fieldCount, const String* names,
+                          const uint8_t* statistics, const uint8_t* decimals, const String& csvHeader) {
+    // Rows closed under the old fields go out in their layout
+    _rollup.writeQueued(ROLLUP_QUEUE_ROWS);
+    _rollup.configure(fieldCount, names, statistics, decimals);
+    _binary = binary;
+    _fieldCount = fieldCount;
+    _fieldNames = names;
+    memcpy(_statistics, statistics, fieldCount);
+    _csvHeader = csvHeader;
+
+    _time = _rollup.begin(now);
+    _path = "";
+    _started = true;
+    _synced = (_time == 0);  // No rollups yet: start from now
+    if (!_synced) {
+        Serial.printf("Rebuilding log rollups from %lu\n", (unsigned long)_time);
+    }
+}
+
+void LogRollupSync::replayBlock(time_t now, File& openLog, const String& openLogPath, size_t openLogEnd) {
+    if (_path.length() == 0) {
+        time_t dayStart;
+        logDayBounds(_time, &dayStart, &_dayEnd);
+        if (dayStart > now) {
+            _synced = true;
+            return;
+        }
+        _path = logDayPrefix(_time) + (_binary ? ".bin" : ".csv");
+        _offset = 0;
+        _endKnown = false;
+        _layout = false;
+        _seek = (_time > dayStart);
+        _skipTo = 0;
+    }
+
+    // Today's log may be the open one: read it through that, and only up
+    // to what has been committed
+    bool isOpen = openLogPath.length() > 0 && _path == openLogPath;
+    File file;
+    if (!isOpen) {
+        file = SD.open(_path, FILE_READ);
+        if (file && !_endKnown) {
+            LogRecovery recovery = logRecover(file, !_binary, _scratch, _scratchSize);
+            if (recovery.tornCommit != 0) {
+                Serial.printf("WARNING: Log commit %lu of %s is torn, falling back\n",
+                              (unsigned long)recovery.tornCommit, _path.c_str());
+            }
+            _end = recovery.end;
+            _endKnown = true;
+        }
+    } else {
+        _endKnown = false;  // It may be closed and trimmed by the next step
+    }
+    File& src = isOpen ? openLog : file;
+    size_t end = isOpen ? openLogEnd : _end;
+
+    // Resuming mid-day: read the header of the index entry before _time,
+    // then go straight to that entry
+    if (_seek && src) {
+        _seek = false;
+        BinlogIndexEntry entry;
+        if (_index.findEntry(_path, end, _time, &entry)) {
+            _offset = entry.headerStart;
+            _skipTo = entry.offset;
+        }
+    }
+
+    bool more = false;
+    if (src && _offset < end) {
+        more = _binary ? replayBinary(src, end) : replayCsv(src, end);
+        if (more && _offset < _skipTo) {
+            _offset = _skipTo;
+        }
+    }
+    if (isOpen) {
+        openLog.seek(openLogEnd);  // Where the writer continues
+    } else if (file) {
+        file.close();
+    }
+
+    if (!more) {
+        if (_dayEnd > now) {
+            // Caught up with today's log: the writer feeds the rest
+            _synced = true;
+            Serial.printf("Log rollups rebuilt (%lu rows written)\n", (unsigned long)_rollup.getRowsWritten());
+        } else if (_dayEnd > _time) {
+            _time = _dayEnd;
+        }
+        _path = "";
+    }
+}
+
+String LogRollupSync::keepFrom() {
+    if (_synced) {
+        return String("");
+    }
+    return _started ? logDayPrefix(_time) : String("/data");
+}
+
+// Replay the complete CSV lines in the next block; false at the end of
+// the data
+bool LogRollupSync::replayCsv(File& file, size_t end) {
+    size_t n = end - _offset;
+    if (n > _scratchSize) n = _scratchSize;
+    if (!file.seek(_offset) || file.read(_scratch, n) != n) {
+        return false;
+    }
+
+    size_t lineStart = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (_scratch[i] == '\n') {
+            _scratch[i] = '\0';
+            replayCsvLine((char*)&_scratch[lineStart], _offset + lineStart == 0);
+            lineStart = i + 1;
+        }
+    }
+    // A line longer than the block can't be replayed; skip it
+    _offset += lineStart > 0 ? lineStart : n;
+    return true;
+}
+
+void LogRollupSync::replayCsvLine(char* line, bool header) {
+    size_t len = strlen(line);
+    if (len > 0 && line[len - 1] == '\r') {
+        line[--len] = '\0';
+    }
+    if (header) {
+        // Values only count if the columns are the current fields
+        _layout = (_csvHeader == line);
+        return;
+    }
+
+    char* cells[ROLLUP_MAX_FIELDS + 2];
+    unsigned int count = 0;
+    char* p = line;
+    while (count < ROLLUP_MAX_FIELDS + 2) {
+        cells[count++] = p;
+        char* comma = strchr(p, ',');
+        if (comma == nullptr) break;
+        *comma = '\0';
+        p = comma + 1;
+    }
+    if (count < 2) {
+        return;
+    }
+
+    // kWh and UnixTime are always the last two
+    time_t t = (time_t)strtoul(cells[count - 1], NULL, 10);
+    if (t < _time) {
+        return;
+    }
+    double kWh = strtod(cells[count - 2], NULL);
+
+    float row[ROLLUP_MAX_FIELDS];
+    uint64_t present = 0;
+    if (_layout && count == _fieldCount + 2) {
+        for (unsigned int j = 0; j < _fieldCount; j++) {
+            if (cells[j][0] != '\0') {  // Empty: not sampled for this record
+                row[j] = strtof(cells[j], NULL);  // Also takes "NaN"
+                present |= (uint64_t)1 << j;
+            }
+        }
+    }
+    _rollup.add(t, kWh, row, present);
+}
+
+// Replay the file header or block at the replay offset; false at the end
+// of the data or anything this can't read
+bool LogRollupSync::replayBinary(File& file, size_t end) {
+    uint8_t magic[BINLOG_MAGIC_SIZE];
+    if (!file.seek(_offset) || file.read(magic, sizeof(magic)) != sizeof(magic)) {
+        return false;
+    }
+    if (memcmp(magic, BINLOG_FILE_MAGIC, BINLOG_MAGIC_SIZE) == 0) {
+        return readHeader(file);
+    }
+    if (memcmp(magic, BINLOG_BLOCK_MAGIC, BINLOG_MAGIC_SIZE) != 0 || !_layout) {
+        return false;
+    }
+
+    // Blocks never exceed the write block
+    size_t n = end - _offset;
+    if (n > _scratchSize) n = _scratchSize;
+    if (n < BINLOG_BLOCK_HEADER_SIZE || !file.seek(_offset) || file.read(_scratch, n) != n) {
+        return false;
+    }
+    unsigned int records = binlogGet16(&_scratch[4]);
+    size_t maskSize = _sparse ? (_logFieldCount + 7) / 8 : 0;
+
+    // Find the block's length, then check its CRC before using it
+    size_t pos = BINLOG_BLOCK_HEADER_SIZE;
+    for (unsigned int r = 0; r < records; r++) {
+        if (pos + BINLOG_RECORD_FIXED_SIZE + maskSize > n) {
+            return false;
+        }
+        const uint8_t* mask = &_scratch[pos + BINLOG_RECORD_FIXED_SIZE];
+        unsigned int values = _logFieldCount;
+        if (_sparse) {
+            values = 0;
+            for (unsigned int f = 0; f < _logFieldCount; f++) {
+                if (mask[f / 8] & (1 << (f % 8))) values++;
+            }
+        }
+        pos += BINLOG_RECORD_FIXED_SIZE + maskSize + values * BINLOG_FIELD_SIZE;
+        if (pos > n) {
+            return false;  // Torn
+        }
+    }
+    _offset += pos;
+    uint32_t crc = binlogCrc32(&_scratch[4], 6);
+    if (binlogCrc32(&_scratch[BINLOG_BLOCK_HEADER_SIZE], pos - BINLOG_BLOCK_HEADER_SIZE, crc) !=
+        binlogGet32(&_scratch[10])) {
+        Serial.printf("WARNING: Bad block in %s, not in the rollups\n", _path.c_str());
+        return true;
+    }
+
+    pos = BINLOG_BLOCK_HEADER_SIZE;
+    for (unsigned int r = 0; r < records; r++) {
+        const uint8_t* p = &_scratch[pos];
+        time_t t = (time_t)binlogGet32(p);
+        double kWh = binlogGetDouble(p + 4);
+        const uint8_t* mask = p + BINLOG_RECORD_FIXED_SIZE;
+        p += BINLOG_RECORD_FIXED_SIZE + maskSize;
+
+        float row[ROLLUP_MAX_FIELDS];
+        uint64_t present = 0;
+        for (unsigned int f = 0; f < _logFieldCount; f++) {
+            if (_sparse && !(mask[f / 8] & (1 << (f % 8)))) {
+                continue;
+            }
+            uint8_t column = _columns[f];
+            if (column != ROLLUP_NO_COLUMN) {
+                if (_scale[f] == 0.0f) {
+                    row[column] = binlogGetFloat(p);
+                } else {
+                    int32_t raw = (int32_t)binlogGet32(p);
+                    row[column] = raw == BINLOG_RAW_INVALID ? NAN : raw * _scale[f];
+                }
+                present |= (uint64_t)1 << column;
+            }
+            p += BINLOG_FIELD_SIZE;
+        }
+        pos = p - _scratch;
+
+        if (t >= _time) {
+            _rollup.add(t, kWh, row, present);
+        }
+    }
+    return true;
+}
+
+// Map the fields of a binary header (just past its magic) onto ours by
+// name and statistic. Headers of older versions aren't replayed.
+bool LogRollupSync::readHeader(File& file) {
+    uint8_t header[BINLOG_FILE_HEADER_SIZE];
+    if (file.read(&header[BINLOG_MAGIC_SIZE], BINLOG_FILE_HEADER_SIZE - BINLOG_MAGIC_SIZE) !=
+            BINLOG_FILE_HEADER_SIZE - BINLOG_MAGIC_SIZE ||
+        binlogGet16(&header[4]) != BINLOG_VERSION || binlogGet16(&header[6]) > ROLLUP_MAX_FIELDS) {
+        return false;
+    }
+    _logFieldCount = binlogGet16(&header[6]);
+    _sparse = (binlogGet16(&header[18]) & BINLOG_FLAG_SPARSE) != 0;
+
+    for (unsigned int f = 0; f < _logFieldCount; f++) {
+        uint8_t desc[BINLOG_FIELD_DESC_SIZE];
+        uint8_t len;
+        char name[256];
+        if (file.read(desc, sizeof(desc)) != sizeof(desc) ||
+            file.read(&len, 1) != 1 || file.read((uint8_t*)name, len) != len) {
+            return false;
+        }
+        name[len] = '\0';
+        // Friendly name and unit
+        for (int k = 0; k < 2; k++) {
+            if (file.read(&len, 1) != 1 || !file.seek(file.position() + len)) {
+                return false;
+            }
+        }
+
+        _scale[f] = desc[0] == BINLOG_FIELD_RAW ? binlogGetFloat(&desc[2]) : 0.0f;
+        _columns[f] = ROLLUP_NO_COLUMN;
+        for (unsigned int j = 0; j < _fieldCount; j++) {
+            if (_statistics[j] == desc[10] && _fieldNames[j] == name) {
+                _columns[f] = j;
+                break;
+            }
+        }
+    }
+
+    _offset = file.position();
+    _layout = true;
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef LOGROLLUPSYNC_H
+#define LOGROLLUPSYNC_H
+
+#include <SD.h>
+#include "BinaryLogFormat.h"
+#include "LogRollup.h"
+#include "LogIndex.h"
+#include "LogPaths.h"
+
+#define LOG_ROLLUP_REPLAY_INTERVAL 20 // ms between steps of a rollup rebuild
+
+// Keeps the rollups (LogRollup) in step with the raw daily logs. Once in
+// step, the owner feeds them the records it writes. When they're out of
+// step (boot, remount, new fields), start() finds where the rollup files
+// end and replayBlock() then replays the raw logs from there, a block per
+// call, up to the end of what has been written. Logs of the current
+// format only.
+//
+// Locking: this takes no locks. start() and replayBlock() run on loop()
+// with the writer idle (_writerIdle taken) and BUS_STORAGE acquired: they
+// read the open log through the writer's File and use its scratch block.
+// reset() runs with the writer idle; isSynced() is also read by the
+// writer task, which only feeds the rollups once it's true.
+class LogRollupSync {
+public:
+    // scratch: the owner's write block, free whenever the writer is idle
+    LogRollupSync(LogRollup& rollup, LogIndex& index, uint8_t* scratch, size_t scratchSize);
+
+    // Out of step (fields, format or card changed): start() again
+    void reset();
+    bool isStarted() { return _started; }
+    bool isSynced() { return _synced; }
+    // Whether a replay step is due, every LOG_ROLLUP_REPLAY_INTERVAL
+    bool due(unsigned long now);
+
+    // Configure the rollups for the current fields and find where to
+    // replay from. names must stay valid until reset(); csvHeader is the
+    // header line of a CSV log of these fields.
+    void start(time_t now, bool binary, unsigned int fieldCount, const String* names,
+               const uint8_t* statistics, const uint8_t* decimals, const String& csvHeader);
+    // Replay the next block of the day's log being replayed, moving on to
+    // the next day at its end. The day being written is read through
+    // openLog (at openLogPath, "" if none, committed up to openLogEnd),
+    // which is left at openLogEnd for the writer.
+    void replayBlock(time_t now, File& openLog, const String& openLogPath, size_t openLogEnd);
+
+    // logDayPrefix() of the first day the replay still needs ("/data" for
+    // all of them, "" once in step), for LogRetention::deleteOldest()
+    String keepFrom();
+
+private:
+    LogRollup& _rollup;
+    LogIndex& _index;
+    uint8_t* _scratch;
+    size_t _scratchSize;
+    bool _started;                   // start() done for the current fields
+    bool _synced;                    // Fed by the writer
+    unsigned long _lastStep;
+    bool _binary;
+    unsigned int _fieldCount;
+    const String* _fieldNames;
+    uint8_t _statistics[ROLLUP_MAX_FIELDS];
+    String _csvHeader;
+    time_t _time;                    // Records before this are in the rollups
+    String _path;                    // Log being replayed ("" between days)
+    time_t _dayEnd;
+    size_t _offset;
+    size_t _end;                     // Logical end of a log that isn't open
+    bool _endKnown;
+    bool _layout;                    // CSV: columns are the fields; binary: header read
+    bool _seek;                      // Look the start up in the day's index first
+    size_t _skipTo;                  // Where the index says _time is
+    bool _sparse;
+    uint16_t _logFieldCount;
+    uint8_t _columns[ROLLUP_MAX_FIELDS];  // Binary field -> our field (ROLLUP_NO_COLUMN)
+    float _scale[ROLLUP_MAX_FIELDS];      // 0: stored as a float
+
+    bool replayCsv(File& file, size_t end);
+    void replayCsvLine(char* line, bool header);
+    bool replayBinary(File& file, size_t end);
+    bool readHeader(File& file);
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "MeasurementEngine.h"
+
+MeasurementEngine::MeasurementEngine(RegisterCache& regCache)
+  : _regCache(regCache), _sequence(0), _requestedReads(0), _fieldReads(0),
+    _pendingTicket(0), _pendingCount(0), _pendingDueTime(0), _lastLatency(0), _worstLatency(0) {
+    for (size_t i = 0; i < MAX_ENGINE_SUBSCRIPTIONS; i++) {
+        _subs[i].active = false;
+        _pendingDue[i] = false;
+    }
+    for (size_t i = 0; i < MAX_ENGINE_FIELDS; i++) {
+        _slotRegs[i] = nullptr;
+        _slotRefs[i] = 0;
+    }
+    memset(_ring, 0, sizeof(_ring));
+}
+
+uint8_t MeasurementEngine::acquireSlot(const RegisterDescriptor* reg) {
+    uint8_t freeSlot = NO_SLOT;
+
+    for (uint8_t i = 0; i < MAX_ENGINE_FIELDS; i++) {
+        if (_slotRefs[i] > 0 && _slotRegs[i] == reg) {
+            _slotRefs[i]++;
+            return i;
+        }
+        if (_slotRefs[i] == 0 && freeSlot == NO_SLOT) {
+            freeSlot = i;
+        }
+    }
+
+    if (freeSlot != NO_SLOT) {
+        _slotRegs[freeSlot] = reg;
+        _slotRefs[freeSlot] = 1;
+    }
+    return freeSlot;
+}
+
+void MeasurementEngine::releaseSlot(uint8_t slot) {
+    if (slot < MAX_ENGINE_FIELDS && _slotRefs[slot] > 0) {
+        _slotRefs[slot]--;
+    }
+}
+
+int MeasurementEngine::subscribe(const RegisterDescriptor* const* regs, size_t count,
+                                 unsigned long intervalMs, uint8_t* slots) {
+    if (intervalMs == 0 || count > MAX_ENGINE_FIELDS) {
+        Serial.println("ERROR: Invalid measurement subscription");
+        return -1;
+    }
+
+    int id = -1;
+    for (int i = 0; i < MAX_ENGINE_SUBSCRIPTIONS; i++) {
+        if (!_subs[i].active) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0) {
+        Serial.println("ERROR: No free measurement subscriptions");
+        return -1;
+    }
+
+    Subscription& sub = _subs[id];
+    for (size_t i = 0; i < count; i++) {
+        if (regs[i] == nullptr || regs[i]->rwType == RW_WRITE) {
+            slots[i] = NO_SLOT;
+        } else {
+            slots[i] = acquireSlot(regs[i]);
+            if (slots[i] == NO_SLOT) {
+                Serial.println("ERROR: Too many distinct measurement fields");
+                for (size_t j = 0; j < i; j++) {
+                    releaseSlot(slots[j]);
+                }
+                return -1;
+            }
+        }
+        sub.slots[i] = slots[i];
+    }
+
+    sub.count = count;
+    sub.interval = intervalMs;
+    sub.lastTick = millis() / intervalMs - 1;  // Due on the next update()
+    sub.sequence = 0;
+    sub.active = true;
+
+    return id;
+}
+
+void MeasurementEngine::unsubscribe(int id) {
+    if (id < 0 || id >= MAX_ENGINE_SUBSCRIPTIONS || !_subs[id].active) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < _subs[id].count; i++) {
+        releaseSlot(_subs[id].slots[i]);
+    }
+    _subs[id].active = false;
+    _pendingDue[id] = false;  // Don't credit an in-flight read to a reused id
+}
+
+void MeasurementEngine::update() {
+    float values[MAX_ENGINE_FIELDS];
+    bool ok[MAX_ENGINE_FIELDS];
+
+    // Publish the acquisition in flight once the SPI queue has clocked it out
+    if (_pendingTicket != 0) {
+        if (!_regCache.isComplete(_pendingTicket)) {
+            return;
+        }
+        _regCache.collectRegisters(_pendingTicket, _pendingRegs, values, ok, _pendingCount);
+        _pendingTicket = 0;
+        publish(values, ok);
+    }
+
+    unsigned long now = millis();
+    bool wanted[MAX_ENGINE_FIELDS] = { false };
+    bool anyDue = false;
+
+    // Merge the fields of every subscription whose interval rolled over
+    for (int i = 0; i < MAX_ENGINE_SUBSCRIPTIONS; i++) {
+        Subscription& sub = _subs[i];
+        _pendingDue[i] = false;
+        if (!sub.active) continue;
+
+        unsigned long tick = now / sub.interval;
+        if (tick == sub.lastTick) continue;
+
+        sub.lastTick = tick;
+        _pendingDue[i] = true;
+
+        unsigned long dueTime = tick * sub.interval;
+        if (!anyDue || (long)(dueTime - _pendingDueTime) < 0) {
+            _pendingDueTime = dueTime;
+        }
+        anyDue = true;
+
+        for (uint8_t j = 0; j < sub.count; j++) {
+            if (sub.slots[j] != NO_SLOT) {
+                wanted[sub.slots[j]] = true;
+                _requestedReads++;
+            }
+        }
+    }
+
+    if (!anyDue) {
+        return;
+    }
+
+    size_t n = 0;
+    for (uint8_t slot = 0; slot < MAX_ENGINE_FIELDS; slot++) {
+        if (wanted[slot] && _slotRefs[slot] > 0) {
+            _pendingRegs[n] = _slotRegs[slot];
+            _pendingSlots[n] = slot;
+            n++;
+        }
+    }
+    _pendingCount = n;
+    _fieldReads += n;
+
+    // Queue the burst so loop() keeps running while it is clocked out
+    _pendingTicket = _regCache.queueRegisters(_pendingRegs, n);
+    if (_pendingTicket == 0) {
+        // Queue full (or nothing to read): fall back to a blocking read.
+        // maxAge 0: always read the chip, and leave the results in the
+        // cache for ad-hoc readers such as the web API
+        _regCache.readRegisters(_pendingRegs, values, ok, n, 0);
+        publish(values, ok);
+    }
+}
+
+void MeasurementEngine::publish(const float* values, const bool* ok) {
+    unsigned long now = millis();
+
+    // Start from the previous snapshot so untouched fields carry over
+    const MeasurementSnapshot* prev = latest();
+    MeasurementSnapshot& snap = _ring[(_sequence + 1) % SNAPSHOT_RING_SIZE];
+    if (prev != nullptr) {
+        memcpy(&snap, prev, sizeof(snap));
+    }
+
+    for (size_t i = 0; i < _pendingCount; i++) {
+        uint8_t slot = _pendingSlots[i];
+        // Skip slots released (and possibly reused) while the read was in flight
+        if (_slotRefs[slot] == 0 || _slotRegs[slot] != _pendingRegs[i]) {
+            continue;
+        }
+        snap.values[slot] = values[i];
+        snap.valid[slot] = ok[i];
+        snap.readTime[slot] = now;
+    }
+    snap.timestamp = now;
+    snap.sequence = ++_sequence;
+
+    _lastLatency = now - _pendingDueTime;
+    if (_lastLatency > _worstLatency) {
+        _worstLatency = _lastLatency;
+    }
+
+    for (int i = 0; i < MAX_ENGINE_SUBSCRIPTIONS; i++) {
+        if (_pendingDue[i]) {
+            _subs[i].sequence = _sequence;
+        }
+    }
+    _pendingCount = 0;
+}
+
+const MeasurementSnapshot* MeasurementEngine::latest() const {
+    if (_sequence == 0) {
+        return nullptr;
+    }
+    return &_ring[_sequence % SNAPSHOT_RING_SIZE];
+}
+
+const MeasurementSnapshot* MeasurementEngine::getSnapshot(uint32_t sequence) const {
+    if (sequence == 0 || sequence > _sequence || _sequence - sequence >= SNAPSHOT_RING_SIZE) {
+        return nullptr;
+    }
+    return &_ring[sequence % SNAPSHOT_RING_SIZE];
+}
+
+uint32_t MeasurementEngine::getSubscriptionSequence(int id) const {
+    if (id < 0 || id >= MAX_ENGINE_SUBSCRIPTIONS || !_subs[id].active) {
+        return 0;
+    }
+    return _subs[id].sequence;
+}
@@ -0,0 +1,101 @@
+#ifndef MEASUREMENTENGINE_H
+#define MEASUREMENTENGINE_H
+
+#include <Arduino.h>
+#include "RegisterCache.h"
+
+#define MAX_ENGINE_FIELDS 48      // Distinct registers sampled across all consumers
+#define MAX_ENGINE_SUBSCRIPTIONS 8
+#define SNAPSHOT_RING_SIZE 4
+
+// One acquisition. Fields not read this time carry their previous value,
+// and readTime[] says when each one was actually sampled.
+struct MeasurementSnapshot {
+    uint32_t sequence;                          // Increments with every acquisition
+    unsigned long timestamp;                    // millis() of this acquisition
+    float values[MAX_ENGINE_FIELDS];
+    bool valid[MAX_ENGINE_FIELDS];
+    unsigned long readTime[MAX_ENGINE_FIELDS];  // millis() each slot was last read
+};
+
+// Owns periodic register acquisition for the logger, display and other
+// consumers. Each consumer subscribes a field list at a rate; on every
+// update() the fields of all due subscriptions are merged, read in one
+// burst, and published as a new snapshot. Rates are phase-aligned to
+// multiples of the interval, so e.g. 100/500/1000 ms subscriptions share
+// one burst whenever they coincide. The burst goes out on the chip
+// driver's async queue and is published on a later update(), once
+// ATM90E32::service() has clocked it out.
+class MeasurementEngine {
+public:
+    static const uint8_t NO_SLOT = 0xFF;
+
+    MeasurementEngine(RegisterCache& regCache);
+
+    // Register interest in regs at intervalMs. slots[i] receives the
+    // snapshot index for regs[i] (NO_SLOT if regs[i] is nullptr).
+    // Returns a subscription id, or -1 if out of slots/subscriptions.
+    int subscribe(const RegisterDescriptor* const* regs, size_t count,
+                  unsigned long intervalMs, uint8_t* slots);
+    void unsubscribe(int id);
+
+    // Must be called in loop()
+    void update();
+
+    // Latest snapshot, or nullptr before the first acquisition
+    const MeasurementSnapshot* latest() const;
+    // A recent snapshot by sequence, or nullptr if already overwritten
+    const MeasurementSnapshot* getSnapshot(uint32_t sequence) const;
+
+    // Sequence of the last snapshot that served this subscription
+    // (0 until its fields have been read once)
+    uint32_t getSubscriptionSequence(int id) const;
+
+    // Statistics
+    uint32_t getAcquisitionCount() const { return _sequence; }
+    uint32_t getRequestedReads() const { return _requestedReads; }  // Sum of due subscription fields
+    uint32_t getFieldReads() const { return _fieldReads; }          // Registers actually read
+    // Time from a subscription falling due to its snapshot being published
+    unsigned long getLastReadLatency() const { return _lastLatency; }   // ms
+    unsigned long getWorstReadLatency() const { return _worstLatency; } // ms
+    void resetLatencyStats() { _worstLatency = 0; }
+
+private:
+    RegisterCache& _regCache;
+
+    struct Subscription {
+        bool active;
+        unsigned long interval;
+        unsigned long lastTick;  // millis() / interval at the last read
+        uint32_t sequence;
+        uint8_t count;
+        uint8_t slots[MAX_ENGINE_FIELDS];
+    };
+    Subscription _subs[MAX_ENGINE_SUBSCRIPTIONS];
+
+    // Slot table shared by all subscriptions
+    const RegisterDescriptor* _slotRegs[MAX_ENGINE_FIELDS];
+    uint8_t _slotRefs[MAX_ENGINE_FIELDS];
+
+    MeasurementSnapshot _ring[SNAPSHOT_RING_SIZE];
+    uint32_t _sequence;
+
+    uint32_t _requestedReads;
+    uint32_t _fieldReads;
+
+    // Acquisition queued on the SPI driver, published when complete
+    uint32_t _pendingTicket;
+    const RegisterDescriptor* _pendingRegs[MAX_ENGINE_FIELDS];
+    uint8_t _pendingSlots[MAX_ENGINE_FIELDS];
+    size_t _pendingCount;
+    bool _pendingDue[MAX_ENGINE_SUBSCRIPTIONS];
+    unsigned long _pendingDueTime;    // Earliest interval boundary among the due subscriptions
+    unsigned long _lastLatency;
+    unsigned long _worstLatency;
+    void publish(const float* values, const bool* ok);
+
+    uint8_t acquireSlot(const RegisterDescriptor* reg);
+    void releaseSlot(uint8_t slot);
+};
+
+#endif
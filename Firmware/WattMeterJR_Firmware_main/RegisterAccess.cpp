@@ -1,11 +1,61 @@
 #include "RegisterAccess.h"
 #include <string.h>
 
-// Private method - moved from RegistorTableUtils
+// Sort registers[] positions by name once so lookups can binary search.
+// Insertion sort is stable, so duplicate names keep table order and the
+// first table entry still wins, as with the old linear scan.
+void RegisterAccess::buildIndex() {
+    for (uint16_t i = 0; i < registerCount; i++) {
+        uint16_t j = i;
+        while (j > 0 && strcmp(registers[_sortedIndex[j - 1]].name, registers[i].name) > 0) {
+            _sortedIndex[j] = _sortedIndex[j - 1];
+            j--;
+        }
+        _sortedIndex[j] = i;
+    }
+    _indexBuilt = true;
+}
+
+// Names for registers whose table name is taken by an earlier entry:
+// the peak currents are listed as UPeakA-C, which find the peak voltages
+static const struct {
+    const char* name;
+    RegisterId id;
+} REGISTER_ALIASES[] = {
+    { "IPeakA", RegisterId::IPeakA },
+    { "IPeakB", RegisterId::IPeakB },
+    { "IPeakC", RegisterId::IPeakC },
+};
+
+// Private method - binary search over the sorted name index, then the aliases
 const RegisterDescriptor* RegisterAccess::findRegister(const char* name) {
-    for (size_t i = 0; i < registerCount; ++i) {
-        if (strcmp(registers[i].name, name) == 0) {
-            return &registers[i];
+    if (name == nullptr) {
+        return nullptr;
+    }
+
+    if (!_indexBuilt) {
+        buildIndex();
+    }
+
+    // Lower bound: first entry whose name is >= the one we want
+    uint16_t lo = 0;
+    uint16_t hi = registerCount;
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (strcmp(registers[_sortedIndex[mid]].name, name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < registerCount && strcmp(registers[_sortedIndex[lo]].name, name) == 0) {
+        return &registers[_sortedIndex[lo]];
+    }
+
+    for (size_t i = 0; i < sizeof(REGISTER_ALIASES) / sizeof(REGISTER_ALIASES[0]); i++) {
+        if (strcmp(REGISTER_ALIASES[i].name, name) == 0) {
+            return &registers[(size_t)REGISTER_ALIASES[i].id];
         }
     }
     return nullptr;
@@ -16,6 +66,13 @@ const RegisterDescriptor* RegisterAccess::getRegisterInfo(const char* name) {
     return findRegister(name);
 }
 
+const RegisterDescriptor* RegisterAccess::getRegisterInfo(RegisterId id) {
+    if (id >= RegisterId::Count) {
+        return nullptr;
+    }
+    return &registers[(size_t)id];
+}
+
 float RegisterAccess::convertRegisterValue(const char* name, uint32_t rawValue) {
     const RegisterDescriptor* reg = findRegister(name);
 
@@ -23,6 +80,10 @@ float RegisterAccess::convertRegisterValue(const char* name, uint32_t rawValue)
         return 0.0f;
     }
 
+    return scaleValue(reg, rawValue);
+}
+
+float RegisterAccess::scaleValue(const RegisterDescriptor* reg, uint32_t rawValue) {
     // Apply conversion function if present
     if (reg->convertFunc && reg->regCount == 1) {
         return reg->convertFunc(rawValue);
@@ -45,9 +106,11 @@ float RegisterAccess::convertRegisterValue(const char* name, uint32_t rawValue)
 }
 
 float RegisterAccess::readRegister(const char* name, bool* success) {
+    const RegisterDescriptor* reg = findRegister(name);
+
     // Read raw value first
     bool readSuccess = false;
-    uint32_t rawValue = readRegisterRaw(name, &readSuccess);
+    uint32_t rawValue = readRaw(reg, &readSuccess);
 
     if (success) *success = readSuccess;
 
@@ -56,36 +119,224 @@ float RegisterAccess::readRegister(const char* name, bool* success) {
     }
 
     // Convert the raw value to scaled float
-    return convertRegisterValue(name, rawValue);
+    return scaleValue(reg, rawValue);
+}
+
+float RegisterAccess::readRegister(RegisterId id, bool* success) {
+    const RegisterDescriptor* reg = getRegisterInfo(id);
+
+    bool readSuccess = false;
+    uint32_t rawValue = readRaw(reg, &readSuccess);
+
+    if (success) *success = readSuccess;
+
+    if (!readSuccess) {
+        return 0.0f;
+    }
+
+    return scaleValue(reg, rawValue);
+}
+
+size_t RegisterAccess::readRegisters(const char* const* names, float* values, bool* success, size_t count) {
+    const RegisterDescriptor* regs[MAX_BURST_WORDS];
+    size_t readCount = 0;
+
+    // Resolve names in chunks so the descriptor list stays on the stack
+    for (size_t start = 0; start < count; start += MAX_BURST_WORDS) {
+        size_t n = count - start;
+        if (n > MAX_BURST_WORDS) n = MAX_BURST_WORDS;
+
+        for (size_t i = 0; i < n; i++) {
+            regs[i] = findRegister(names[start + i]);
+        }
+
+        readCount += readRegisters(regs, &values[start], &success[start], n);
+    }
+
+    return readCount;
+}
+
+size_t RegisterAccess::readRegisters(const RegisterDescriptor* const* regs, float* values, bool* success, size_t count) {
+    return readBurst(regs, nullptr, values, success, count);
+}
+
+size_t RegisterAccess::readRegistersRaw(const RegisterDescriptor* const* regs, uint32_t* rawValues, bool* success, size_t count) {
+    return readBurst(regs, rawValues, nullptr, success, count);
+}
+
+uint32_t RegisterAccess::queueRegisters(const RegisterDescriptor* const* regs, size_t count) {
+    uint16_t addrs[ATM_ASYNC_MAX_WORDS];
+    size_t wordCount = 0;
+
+    // Reads must see staged writes
+    if (_stagedCount > 0) {
+        flushStaged();
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const RegisterDescriptor* reg = regs[i];
+        if (!reg || reg->rwType == RW_WRITE) {
+            continue;
+        }
+
+        size_t needed = (reg->regType == DT_UINT32 || reg->regType == DT_INT32) ? 2 : 1;
+        if (wordCount + needed > ATM_ASYNC_MAX_WORDS) {
+            return 0;
+        }
+
+        addrs[wordCount++] = reg->address[0];
+        if (needed == 2) {
+            addrs[wordCount++] = reg->address[1];
+        }
+    }
+
+    if (wordCount == 0) {
+        return 0;
+    }
+    return _chip.queueBurst(addrs, wordCount);
+}
+
+// regs must be the same list passed to queueRegisters()
+size_t RegisterAccess::collectRegisters(uint32_t ticket, const RegisterDescriptor* const* regs,
+                                        float* values, bool* success, size_t count) {
+    uint16_t words[ATM_ASYNC_MAX_WORDS];
+    bool ready = _chip.getResult(ticket, words, ATM_ASYNC_MAX_WORDS);
+    size_t w = 0;
+    size_t readCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const RegisterDescriptor* reg = regs[i];
+        values[i] = 0.0f;
+        success[i] = false;
+
+        if (!ready || !reg || reg->rwType == RW_WRITE) {
+            continue;
+        }
+
+        values[i] = scaleValue(reg, decodeValue(reg, &words[w]));
+        success[i] = true;
+        readCount++;
+        w += (reg->regType == DT_UINT32 || reg->regType == DT_INT32) ? 2 : 1;
+    }
+
+    return readCount;
+}
+
+size_t RegisterAccess::readBurst(const RegisterDescriptor* const* regs, uint32_t* rawValues, float* values,
+                                 bool* success, size_t count) {
+    size_t regIndex[MAX_BURST_WORDS];
+    uint16_t addrs[MAX_BURST_WORDS];
+    uint16_t words[MAX_BURST_WORDS];
+    size_t pending = 0;
+    size_t wordCount = 0;
+    size_t readCount = 0;
+
+    // Reads must see staged writes
+    if (_stagedCount > 0) {
+        flushStaged();
+    }
+
+    for (size_t i = 0; i <= count; i++) {
+        const RegisterDescriptor* reg = nullptr;
+        size_t needed = 0;
+
+        if (i < count) {
+            reg = regs[i];
+            if (rawValues) rawValues[i] = 0;
+            if (values) values[i] = 0.0f;
+            success[i] = false;
+
+            if (!reg || reg->rwType == RW_WRITE) {
+                continue;
+            }
+            needed = (reg->regType == DT_UINT32 || reg->regType == DT_INT32) ? 2 : 1;
+        }
+
+        // Flush the pending burst at the end or when the next register won't fit
+        if (pending > 0 && (i == count || wordCount + needed > MAX_BURST_WORDS)) {
+            _chip.readBurst(addrs, words, wordCount);
+
+            size_t w = 0;
+            for (size_t p = 0; p < pending; p++) {
+                const RegisterDescriptor* done = regs[regIndex[p]];
+                uint32_t raw = decodeValue(done, &words[w]);
+                w += (done->regType == DT_UINT32 || done->regType == DT_INT32) ? 2 : 1;
+
+                if (rawValues) rawValues[regIndex[p]] = raw;
+                if (values) values[regIndex[p]] = scaleValue(done, raw);
+                success[regIndex[p]] = true;
+                readCount++;
+            }
+
+            pending = 0;
+            wordCount = 0;
+        }
+
+        if (i == count) {
+            break;
+        }
+
+        regIndex[pending++] = i;
+
+        addrs[wordCount++] = reg->address[0];
+        if (needed == 2) {
+            addrs[wordCount++] = reg->address[1];
+        }
+    }
+
+    return readCount;
 }
 
 bool RegisterAccess::writeRegister(const char* name, float value) {
-    const RegisterDescriptor* reg = findRegister(name);
-    
-    if (!reg) return false;
-    if (reg->rwType == RW_READ) return false;  // Read-only
-    
-    // Reverse scaling
-    uint32_t rawValue = (uint32_t)(value / reg->scale);
-    
-    return writeValue(reg, rawValue);
+    return writeScaled(findRegister(name), value);
+}
+
+bool RegisterAccess::writeRegister(RegisterId id, float value) {
+    return writeScaled(getRegisterInfo(id), value);
 }
 
 uint32_t RegisterAccess::readRegisterRaw(const char* name, bool* success) {
-    const RegisterDescriptor* reg = findRegister(name);
-    
+    return readRaw(findRegister(name), success);
+}
+
+uint32_t RegisterAccess::readRegisterRaw(RegisterId id, bool* success) {
+    return readRaw(getRegisterInfo(id), success);
+}
+
+bool RegisterAccess::writeRegisterRaw(const char* name, uint32_t value) {
+    return writeRaw(findRegister(name), value);
+}
+
+bool RegisterAccess::writeRegisterRaw(RegisterId id, uint32_t value) {
+    return writeRaw(getRegisterInfo(id), value);
+}
+
+uint32_t RegisterAccess::readRaw(const RegisterDescriptor* reg, bool* success) {
     if (!reg || reg->rwType == RW_WRITE) {
         if (success) *success = false;
         return 0;
     }
+
+    // Reads must see staged writes
+    if (_stagedCount > 0) {
+        flushStaged();
+    }
     
     if (success) *success = true;
     return readValue(reg);
 }
 
-bool RegisterAccess::writeRegisterRaw(const char* name, uint32_t value) {
-    const RegisterDescriptor* reg = findRegister(name);
+bool RegisterAccess::writeScaled(const RegisterDescriptor* reg, float value) {
+    if (!reg) return false;
+    if (reg->rwType == RW_READ) return false;  // Read-only
+    
+    // Reverse scaling
+    uint32_t rawValue = (uint32_t)(value / reg->scale);
     
+    return writeValue(reg, rawValue);
+}
+
+bool RegisterAccess::writeRaw(const RegisterDescriptor* reg, uint32_t value) {
     if (!reg || reg->rwType == RW_READ) return false;
     
     return writeValue(reg, value);
@@ -118,8 +369,51 @@ uint32_t RegisterAccess::readValue(const RegisterDescriptor* reg) {
     }
 }
 
+uint32_t RegisterAccess::decodeValue(const RegisterDescriptor* reg, const uint16_t* words) {
+    uint16_t regVal = words[0];
+
+    switch (reg->regType) {
+        case DT_BIT:
+            return (regVal >> reg->bitPos) & 0x01;
+
+        case DT_BITFIELD:
+            return (regVal >> reg->bitPos) & ((1 << reg->bitLen) - 1);
+
+        case DT_UINT8:
+        case DT_INT8:
+            return (regVal >> reg->bitPos) & 0xFF;
+
+        case DT_UINT16:
+        case DT_INT16:
+            return regVal;
+
+        case DT_UINT32:
+        case DT_INT32:
+            return ((uint32_t)words[0] << 16) | words[1];
+
+        default:
+            return 0;
+    }
+}
+
 bool RegisterAccess::writeValue(const RegisterDescriptor* reg, uint32_t value) {
     uint16_t addr = reg->address[0];
+
+    if (_batchActive) {
+        if (stageValue(reg, value)) {
+            return true;
+        }
+        // Not a batchable word: write through, after everything staged so far
+        flushStaged();
+    }
+
+    // Writing back the other bits of a write-1-to-clear status word would
+    // acknowledge every flag latched in it, so only this field's bits go out
+    if (reg->rwType == RW_READWRITE1CLEAR && (reg->regType == DT_BIT || reg->regType == DT_BITFIELD)) {
+        uint8_t len = reg->regType == DT_BIT ? 1 : reg->bitLen;
+        _chip.write16(addr, (uint16_t)((value & ((1UL << len) - 1)) << reg->bitPos));
+        return true;
+    }
     
     switch (reg->regType) {
         case DT_BIT:
@@ -150,4 +444,122 @@ bool RegisterAccess::writeValue(const RegisterDescriptor* reg, uint32_t value) {
         default:
             return false;
     }
-}
\ No newline at end of file
+}
+void RegisterAccess::beginWriteBatch() {
+    if (_batchActive) {
+        return;
+    }
+    memset(_shadowMask, 0, sizeof(_shadowMask));
+    _stagedCount = 0;
+    _batchActive = true;
+}
+
+void RegisterAccess::commitWriteBatch() {
+    flushStaged();
+    _batchActive = false;
+}
+
+bool RegisterAccess::stageValue(const RegisterDescriptor* reg, uint32_t value) {
+    uint16_t addr = reg->address[0];
+    uint16_t mask;
+
+    // Reset, write-1-to-clear status and read-only words are never staged
+    if (reg->rwType != RW_READWRITE) {
+        return false;
+    }
+
+    switch (reg->regType) {
+        case DT_BIT:
+            mask = 1 << reg->bitPos;
+            break;
+
+        case DT_BITFIELD:
+            mask = ((1 << reg->bitLen) - 1) << reg->bitPos;
+            break;
+
+        case DT_UINT8:
+        case DT_INT8:
+            mask = 0xFF << reg->bitPos;
+            break;
+
+        case DT_UINT16:
+        case DT_INT16:
+            mask = 0xFFFF;
+            break;
+
+        case DT_UINT32:
+        case DT_INT32:
+            if (reg->address[0] >= BATCH_ADDR_LIMIT || reg->address[1] >= BATCH_ADDR_LIMIT) {
+                return false;
+            }
+            // High word first, then low word
+            stageWord(reg->address[0], 0xFFFF, (value >> 16) & 0xFFFF);
+            stageWord(reg->address[1], 0xFFFF, value & 0xFFFF);
+            return true;
+
+        default:
+            return false;
+    }
+
+    if (addr >= BATCH_ADDR_LIMIT) {
+        return false;
+    }
+
+    uint16_t bits = (reg->regType == DT_BIT) ? (value ? mask : 0) : ((value << reg->bitPos) & mask);
+    stageWord(addr, mask, bits);
+    return true;
+}
+
+void RegisterAccess::stageWord(uint16_t addr, uint16_t mask, uint16_t bits) {
+    if (_shadowMask[addr] == 0) {
+        _stagedCount++;
+    }
+    _shadowValue[addr] = (_shadowValue[addr] & ~mask) | (bits & mask);
+    _shadowMask[addr] |= mask;
+}
+
+// Write every staged word once. Words where only some bits were staged
+// are read first (one burst per MAX_BURST_WORDS) so the other bits survive.
+void RegisterAccess::flushStaged() {
+    if (_stagedCount == 0) {
+        return;
+    }
+
+    uint16_t addrs[MAX_BURST_WORDS];
+    uint16_t words[MAX_BURST_WORDS];
+    size_t n = 0;
+
+    // Read-modify for partly-written words
+    for (uint16_t addr = 0; addr <= BATCH_ADDR_LIMIT; addr++) {
+        bool partial = addr < BATCH_ADDR_LIMIT && _shadowMask[addr] != 0 && _shadowMask[addr] != 0xFFFF;
+        if (partial) {
+            addrs[n++] = addr;
+        }
+
+        if (n > 0 && (n == MAX_BURST_WORDS || addr == BATCH_ADDR_LIMIT)) {
+            _chip.readBurst(addrs, words, n);
+            for (size_t i = 0; i < n; i++) {
+                uint16_t mask = _shadowMask[addrs[i]];
+                _shadowValue[addrs[i]] = (words[i] & ~mask) | (_shadowValue[addrs[i]] & mask);
+            }
+            n = 0;
+        }
+    }
+
+    // Write each dirty word once
+    for (uint16_t addr = 0; addr <= BATCH_ADDR_LIMIT; addr++) {
+        if (addr < BATCH_ADDR_LIMIT && _shadowMask[addr] != 0) {
+            addrs[n] = addr;
+            words[n] = _shadowValue[addr];
+            n++;
+            _shadowMask[addr] = 0;
+        }
+
+        if (n > 0 && (n == MAX_BURST_WORDS || addr == BATCH_ADDR_LIMIT)) {
+            _chip.writeBurst(addrs, words, n);
+            n = 0;
+        }
+    }
+
+    _stagedCount = 0;
+}
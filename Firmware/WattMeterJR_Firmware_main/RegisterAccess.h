@@ -6,7 +6,7 @@
 
 class RegisterAccess {
 public:
-    RegisterAccess(ATM90E32& chip) : _chip(chip) {}
+    RegisterAccess(ATM90E32& chip) : _chip(chip), _indexBuilt(false), _batchActive(false), _stagedCount(0) {}
     
     // Read a register by name, returning scaled float value
     float readRegister(const char* name, bool* success = nullptr);
@@ -19,24 +19,97 @@ public:
     
     // Read raw value without scaling
     uint32_t readRegisterRaw(const char* name, bool* success = nullptr);
+
+    // Read several registers by name in one SPI burst
+    // values[i] and success[i] receive the scaled result for names[i]
+    // Returns the number of registers read successfully
+    size_t readRegisters(const char* const* names, float* values, bool* success, size_t count);
+
+    // Same, for descriptors already resolved with getRegisterInfo()
+    // A nullptr entry is reported as a failed read
+    size_t readRegisters(const RegisterDescriptor* const* regs, float* values, bool* success, size_t count);
+
+    // Same, returning unscaled values as written by writeRegisterRaw()
+    size_t readRegistersRaw(const RegisterDescriptor* const* regs, uint32_t* rawValues, bool* success, size_t count);
+
+    // Asynchronous readRegisters(): queue the words of regs on the chip
+    // driver, then decode them with collectRegisters() once isComplete().
+    // Returns 0 if the driver queue is full or the words don't fit one request.
+    uint32_t queueRegisters(const RegisterDescriptor* const* regs, size_t count);
+    bool isComplete(uint32_t ticket) { return _chip.isComplete(ticket); }
+    size_t collectRegisters(uint32_t ticket, const RegisterDescriptor* const* regs, float* values, bool* success, size_t count);
     
     // Write raw value without scaling
     bool writeRegisterRaw(const char* name, uint32_t value);
     
     // Optional: Get register info for debugging/display
     const RegisterDescriptor* getRegisterInfo(const char* name);
+
+    // Same operations addressed by RegisterId (no name lookup)
+    float readRegister(RegisterId id, bool* success = nullptr);
+    bool writeRegister(RegisterId id, float value);
+    uint32_t readRegisterRaw(RegisterId id, bool* success = nullptr);
+    bool writeRegisterRaw(RegisterId id, uint32_t value);
+    const RegisterDescriptor* getRegisterInfo(RegisterId id);
+
+    // Write batching: between begin and commit, writes to plain read/write
+    // words below BATCH_ADDR_LIMIT are staged in a word shadow. commit reads
+    // partly-written words once and writes every dirty word once, in
+    // bursts. Writes to other addresses flush the shadow first, so
+    // ordering against e.g. CfgRegAccEn is preserved.
+    void beginWriteBatch();
+    void commitWriteBatch();
+    bool isWriteBatchActive() { return _batchActive; }
+
+    // Diagnostics: SPI transactions issued by the chip driver
+    uint32_t getTransactionCount() { return _chip.getTransactionCount(); }
+    unsigned long getLongestServiceMicros() { return _chip.getLongestServiceMicros(); }
     
 private:
     ATM90E32& _chip;
+
+    // Name index: registers[] positions sorted by name, built on first lookup
+    uint16_t _sortedIndex[(size_t)RegisterId::Count];
+    bool _indexBuilt;
+    void buildIndex();
     
-    // Moved from RegistorTableUtils
+    // Binary search over the sorted name index
     const RegisterDescriptor* findRegister(const char* name);
+
+    // Descriptor-based helpers shared by the name and ID APIs
+    uint32_t readRaw(const RegisterDescriptor* reg, bool* success);
+    bool writeScaled(const RegisterDescriptor* reg, float value);
+    bool writeRaw(const RegisterDescriptor* reg, uint32_t value);
     
     // Helper to read based on descriptor
     uint32_t readValue(const RegisterDescriptor* reg);
+
+    // Helper to extract a raw value from already-read register words
+    uint32_t decodeValue(const RegisterDescriptor* reg, const uint16_t* words);
+
+    // Burst read shared by readRegisters() and readRegistersRaw();
+    // either output array may be nullptr
+    size_t readBurst(const RegisterDescriptor* const* regs, uint32_t* rawValues, float* values,
+                     bool* success, size_t count);
+
+    // Helper to scale a raw value based on descriptor
+    float scaleValue(const RegisterDescriptor* reg, uint32_t rawValue);
+
+    // Max 16-bit words fetched per burst in readRegisters()
+    static const size_t MAX_BURST_WORDS = 32;
     
     // Helper to write based on descriptor
     bool writeValue(const RegisterDescriptor* reg, uint32_t value);
+
+    // Write batch shadow, indexed by word address
+    static const uint16_t BATCH_ADDR_LIMIT = 0x77;  // Up to the interrupt enables; CRC and lock stay immediate
+    uint16_t _shadowValue[BATCH_ADDR_LIMIT];
+    uint16_t _shadowMask[BATCH_ADDR_LIMIT];  // Bits staged since the last flush
+    bool _batchActive;
+    size_t _stagedCount;                     // Words with a non-zero mask
+    bool stageValue(const RegisterDescriptor* reg, uint32_t value);
+    void stageWord(uint16_t addr, uint16_t mask, uint16_t bits);
+    void flushStaged();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "RegisterCache.h"
+
+// Clear-on-read registers (the energy counters) give up their value to
+// whoever reads them, and the latched interrupt status words are cleared
+// by writes from anyone; a cached copy would hand a second reader a value
+// the chip no longer holds. These always go to the chip and are never
+// stored.
+static bool isCacheable(const RegisterDescriptor* reg) {
+    return reg->rwType != RW_READCLEAR && reg->rwType != RW_READWRITE1CLEAR;
+}
+
+RegisterCache::RegisterCache(RegisterAccess& regAccess)
+  : _regAccess(regAccess), _hits(0), _misses(0) {
+    invalidate();
+}
+
+float RegisterCache::read(RegisterId id, unsigned long maxAgeMs, bool* success) {
+    const RegisterDescriptor* reg = _regAccess.getRegisterInfo(id);
+    float value = 0.0f;
+    bool ok = false;
+    readRegisters(&reg, &value, &ok, 1, maxAgeMs);
+    if (success) *success = ok;
+    return value;
+}
+
+float RegisterCache::read(const char* name, unsigned long maxAgeMs, bool* success) {
+    const RegisterDescriptor* reg = _regAccess.getRegisterInfo(name);
+    float value = 0.0f;
+    bool ok = false;
+    readRegisters(&reg, &value, &ok, 1, maxAgeMs);
+    if (success) *success = ok;
+    return value;
+}
+
+size_t RegisterCache::readRegisters(const char* const* names, float* values, bool* success,
+                                    size_t count, unsigned long maxAgeMs) {
+    const RegisterDescriptor* regs[MAX_MISSES_PER_BURST];
+    size_t readCount = 0;
+
+    // Resolve names in chunks so the descriptor list stays on the stack
+    for (size_t start = 0; start < count; start += MAX_MISSES_PER_BURST) {
+        size_t n = count - start;
+        if (n > MAX_MISSES_PER_BURST) n = MAX_MISSES_PER_BURST;
+
+        for (size_t i = 0; i < n; i++) {
+            regs[i] = _regAccess.getRegisterInfo(names[start + i]);
+        }
+
+        readCount += readRegisters(regs, &values[start], &success[start], n, maxAgeMs);
+    }
+
+    return readCount;
+}
+
+size_t RegisterCache::readRegisters(const RegisterDescriptor* const* regs, float* values, bool* success,
+                                    size_t count, unsigned long maxAgeMs) {
+    const RegisterDescriptor* missRegs[MAX_MISSES_PER_BURST];
+    size_t missIndex[MAX_MISSES_PER_BURST];
+    size_t pending = 0;
+    size_t readCount = 0;
+    unsigned long now = millis();
+
+    for (size_t i = 0; i < count; i++) {
+        const RegisterDescriptor* reg = regs[i];
+        values[i] = 0.0f;
+        success[i] = false;
+
+        if (!reg || reg->rwType == RW_WRITE) {
+            continue;
+        }
+
+        // Serve from the snapshot if it is fresh enough
+        const Entry& entry = _entries[reg - registers];
+        if (entry.valid && (now - entry.readTime) < maxAgeMs) {
+            values[i] = entry.value;
+            success[i] = true;
+            _hits++;
+            readCount++;
+            continue;
+        }
+
+        missRegs[pending] = reg;
+        missIndex[pending] = i;
+        pending++;
+
+        if (pending == MAX_MISSES_PER_BURST) {
+            readCount += fetch(missRegs, missIndex, pending, values, success);
+            pending = 0;
+        }
+    }
+
+    if (pending > 0) {
+        readCount += fetch(missRegs, missIndex, pending, values, success);
+    }
+
+    return readCount;
+}
+
+size_t RegisterCache::fetch(const RegisterDescriptor* const* regs, const size_t* index, size_t count,
+                            float* values, bool* success) {
+    float fetched[MAX_MISSES_PER_BURST];
+    bool ok[MAX_MISSES_PER_BURST];
+
+    size_t readCount = _regAccess.readRegisters(regs, fetched, ok, count);
+    unsigned long now = millis();
+    _misses += count;
+
+    for (size_t i = 0; i < count; i++) {
+        values[index[i]] = fetched[i];
+        success[index[i]] = ok[i];
+
+        if (!isCacheable(regs[i])) {
+            continue;
+        }
+        Entry& entry = _entries[regs[i] - registers];
+        entry.value = fetched[i];
+        entry.readTime = now;
+        entry.valid = ok[i];
+    }
+
+    return readCount;
+}
+
+size_t RegisterCache::collectRegisters(uint32_t ticket, const RegisterDescriptor* const* regs, float* values,
+                                       bool* success, size_t count) {
+    size_t readCount = _regAccess.collectRegisters(ticket, regs, values, success, count);
+    unsigned long now = millis();
+
+    for (size_t i = 0; i < count; i++) {
+        if (!regs[i] || regs[i]->rwType == RW_WRITE) {
+            continue;
+        }
+        _misses++;
+        if (!isCacheable(regs[i])) {
+            continue;
+        }
+
+        Entry& entry = _entries[regs[i] - registers];
+        entry.value = values[i];
+        entry.readTime = now;
+        entry.valid = success[i];
+    }
+
+    return readCount;
+}
+
+void RegisterCache::invalidate() {
+    for (size_t i = 0; i < (size_t)RegisterId::Count; i++) {
+        _entries[i].valid = false;
+    }
+}
+
+void RegisterCache::invalidate(RegisterId id) {
+    if (id < RegisterId::Count) {
+        _entries[(size_t)id].valid = false;
+    }
+}
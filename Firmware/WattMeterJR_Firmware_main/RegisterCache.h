@@ -0,0 +1,66 @@
+#ifndef REGISTERCACHE_H
+#define REGISTERCACHE_H
+
+#include <Arduino.h>
+#include "RegisterAccess.h"
+
+// Shared snapshot of recently read registers.
+// Callers ask for a value younger than maxAgeMs (0 always reads); older
+// values are re-read from the chip, and all stale registers in one
+// request go out as a single SPI burst. Writes made through RegisterAccess are not seen
+// here, so a cached value can lag a write by up to the caller's maxAgeMs
+// unless invalidate() is called. Clear-on-read and write-1-to-clear
+// registers are never cached: every read of them goes to the chip.
+class RegisterCache {
+public:
+    RegisterCache(RegisterAccess& regAccess);
+
+    // Read one register, using the cached value if it is fresh enough
+    float read(RegisterId id, unsigned long maxAgeMs, bool* success = nullptr);
+    float read(const char* name, unsigned long maxAgeMs, bool* success = nullptr);
+
+    // Read several registers; stale ones are fetched in one burst
+    // Returns the number of registers read successfully
+    size_t readRegisters(const RegisterDescriptor* const* regs, float* values, bool* success,
+                         size_t count, unsigned long maxAgeMs);
+    size_t readRegisters(const char* const* names, float* values, bool* success,
+                         size_t count, unsigned long maxAgeMs);
+
+    // Asynchronous refresh through RegisterAccess::queueRegisters();
+    // collectRegisters() stores the results once the ticket is complete
+    uint32_t queueRegisters(const RegisterDescriptor* const* regs, size_t count) { return _regAccess.queueRegisters(regs, count); }
+    bool isComplete(uint32_t ticket) { return _regAccess.isComplete(ticket); }
+    size_t collectRegisters(uint32_t ticket, const RegisterDescriptor* const* regs, float* values, bool* success,
+                            size_t count);
+
+    // Drop cached values (e.g. after writing to the chip)
+    void invalidate();
+    void invalidate(RegisterId id);
+
+    // Statistics: a hit is a register read served without SPI traffic
+    uint32_t getHits() const { return _hits; }
+    uint32_t getMisses() const { return _misses; }
+    void resetStats() { _hits = 0; _misses = 0; }
+
+private:
+    RegisterAccess& _regAccess;
+
+    struct Entry {
+        float value;
+        unsigned long readTime;  // millis() when value was read
+        bool valid;
+    };
+    Entry _entries[(size_t)RegisterId::Count];
+
+    uint32_t _hits;
+    uint32_t _misses;
+
+    // Max stale registers gathered before issuing a burst
+    static const size_t MAX_MISSES_PER_BURST = 32;
+
+    // Read the stale registers from the chip and store them
+    size_t fetch(const RegisterDescriptor* const* regs, const size_t* index, size_t count,
+                 float* values, bool* success);
+};
+
+#endif
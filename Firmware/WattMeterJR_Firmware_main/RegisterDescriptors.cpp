@@ -299,4 +299,7 @@ const RegisterDescriptor registers[] = {
  { "Phase C Voltage Phase Angle"                                     ,           "UangleC", {0xFF, 0x0}, 1, RW_READ			    , DT_INT16   , 0 , 0, 0.1f             , NULL          , "°" },
 };
 
-const uint16_t registerCount = sizeof(registers) / sizeof(registers[0]);
\ No newline at end of file
+const uint16_t registerCount = sizeof(registers) / sizeof(registers[0]);
+
+static_assert(sizeof(registers) / sizeof(registers[0]) == (size_t)RegisterId::Count,
+              "RegisterId enum is out of sync with registers[]");
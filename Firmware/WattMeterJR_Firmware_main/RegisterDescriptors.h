@@ -12,5 +12,303 @@ float calculatePeakI(uint16_t raw);
 extern const RegisterDescriptor registers[];
 extern const uint16_t registerCount;
 
+// Strongly typed register IDs - one per entry of registers[], in table order.
+// Lets hot paths address a register directly instead of looking it up by name.
+// Keep in sync with RegisterDescriptors.cpp (checked by static_assert there).
+enum class RegisterId : uint16_t {
+    MeterEn,
+    IA_SRC,
+    IB_SRC,
+    IC_SRC,
+    UA_SRC,
+    UB_SRC,
+    UC_SRC,
+    Sag_Period,
+    PeakDet_period,
+    Ovth,
+    Zxdis,
+    ZX0Con,
+    ZX1Con,
+    ZX2Con,
+    ZX0Src,
+    ZX1Src,
+    ZX2Src,
+    SagTh,
+    PhaseLossTh,
+    InWarnTh,
+    Olth,
+    FreqLoTh,
+    FreqHiTh,
+    IRQ1_OR,
+    WARN_OR,
+    IDCoffsetA,
+    IDCoffsetB,
+    IDCoffsetC,
+    UDCoffsetA,
+    UDCoffsetB,
+    UDCoffsetC,
+    UGAINTA,
+    UGAINTB,
+    UGAINTC,
+    PhiF,
+    LogIrms0,
+    LogIrms1,
+    F0,
+    T0,
+    PhiIrms0A,
+    PhiIrms1A,
+    PhiIrms2A,
+    GainIrms0A,
+    GainIrms1A,
+    GainIrms2A,
+    PhiIrms0B,
+    PhiIrms1B,
+    PhiIrms2B,
+    GainIrms0B,
+    GainIrms1B,
+    GainIrms2B,
+    PhiIrms0C,
+    PhiIrms1C,
+    PhiIrms2C,
+    GainIrms0C,
+    GainIrms1C,
+    GainIrms2C,
+    PL_Constant,
+    EnPC,
+    EnPB,
+    EnPA,
+    ABSEnP,
+    ABSEnQ,
+    CF2varh,
+    _3P3W,
+    didtEn,
+    HPFoff,
+    Freq60Hz,
+    PGA_GAIN,
+    PStartTh,
+    QStartTh,
+    SStartTh,
+    PPhaseTh,
+    QPhaseTh,
+    SPhaseTh,
+    PoffsetA,
+    QoffsetA,
+    PoffsetB,
+    QoffsetB,
+    PoffsetC,
+    QoffsetC,
+    PQGainA,
+    PhiA_DelayCycles,
+    PhiA_DelayV,
+    PQGainB,
+    PhiB_DelayCycles,
+    PhiB_DelayV,
+    PQGainC,
+    PhiC_DelayCycles,
+    PhiC_DelayV,
+    PoffsetAF,
+    PoffsetBF,
+    PoffsetCF,
+    PGainAF,
+    PGainBF,
+    PGainCF,
+    UgainA,
+    IgainA,
+    UoffsetA,
+    IoffsetA,
+    UgainB,
+    IgainB,
+    UoffsetB,
+    IoffsetB,
+    UgainC,
+    IgainC,
+    UoffsetC,
+    IoffsetC,
+    SoftReset,
+    CF4RevST,
+    CF3RevST,
+    CF2RevST,
+    CF1RevST,
+    TASNoloadST,
+    TPNoloadST,
+    TQNoloadST,
+    INOv0ST,
+    IRevWnST,
+    URevWnST,
+    OVPhaseAST,
+    OVPhaseBST,
+    OVPhaseCST,
+    OIPhaseAST,
+    OIPhaseBST,
+    OIPhaseCST,
+    PERegCPST,
+    PERegBPST,
+    PERegAPST,
+    PERegTPST,
+    QERegCPST,
+    QERegBPST,
+    QERegAPST,
+    QERgTPST,
+    PhaseLossCST,
+    PhaseLossBST,
+    PhaseLossAST,
+    FreqLoST,
+    SagPhaseCST,
+    SagPhaseBST,
+    SagPhaseAST,
+    FreqHiST,
+    CF4RevIntST,
+    CF3RevIntST,
+    CF2RevIntST,
+    CF1RevIntST,
+    TASNoloadIntST,
+    TPNoloadIntST,
+    TQNoloadIntST,
+    INOv0IntST,
+    IRevWnIntST,
+    URevWnIntST,
+    OVPhaseCIntST,
+    OVPhaseBIntST,
+    OVPhaseAIntST,
+    OIPhaseCIntST,
+    OIPhaseBIntST,
+    OIPhaseAIntST,
+    PERegAPIntST,
+    PERegBPIntST,
+    PERegCPIntST,
+    PERegTPIntST,
+    QERegAPIntST,
+    QERegBPIntST,
+    QERegCPIntST,
+    QERgTPIntST,
+    PhaseLossCIntST,
+    PhaseLossBIntST,
+    PhaseLossAIntST,
+    FreqLoIntST,
+    SagPhaseCIntST,
+    SagPhaseBIntST,
+    SagPhaseAIntST,
+    FreqHiIntST,
+    CF4RevIntEN,
+    CF3RevIntEN,
+    CF2RevIntEN,
+    CF1RevIntEN,
+    TASNoloadIntEN,
+    TPNoloadIntEN,
+    TQNoloadIntEN,
+    INOv0IntEN,
+    IRevWnIntEN,
+    URevWnIntEN,
+    OVPhaseCIntEN,
+    OVPhaseBIntEN,
+    OVPhaseAIntEN,
+    OIPhaseCIntEN,
+    OIPhaseBIntEN,
+    OIPhaseAIntEN,
+    PERegAPIntEn,
+    PERegBPIntEn,
+    PERegCPIntEn,
+    PERegTPIntEn,
+    QERegAPIntEn,
+    QERegBPIntEn,
+    QERegCPIntEn,
+    QERgTPIntEn,
+    PhaseLossCIntEn,
+    PhaseLossBIntEn,
+    PhaseLossAIntEn,
+    FreqLoIntEn,
+    SagPhaseCIntEn,
+    SagPhaseBIntEn,
+    SagPhaseAIntEn,
+    FreqHiIntEn,
+    LastSPIData,
+    CFG_CRC_ERR,
+    INT_ERR,
+    CRCDigest,
+    CfgRegAccEn,
+    APenergyT,
+    APenergyA,
+    APenergyB,
+    APenergyC,
+    ANenergyT,
+    ANenergyA,
+    ANenergyB,
+    ANenergyC,
+    RPenergyT,
+    RPenergyA,
+    RPenergyB,
+    RPenergyC,
+    RNenergyT,
+    RNenergyA,
+    RNenergyB,
+    RNenergyC,
+    SAenergyT,
+    SenergyA,
+    SenergyB,
+    SenergyC,
+    APenergyTF,
+    APenergyAF,
+    APenergyBF,
+    APenergyCF,
+    ANenergyTF,
+    ANenergyAF,
+    ANenergyBF,
+    ANenergyCF,
+    RPenergyTH,
+    RPenergyAH,
+    RPenergyBH,
+    RPenergyCH,
+    RNenergyTH,
+    RNenergyAH,
+    RNenergyBH,
+    RNenergyCH,
+    PmeanT,
+    PmeanA,
+    PmeanB,
+    PmeanC,
+    QmeanT,
+    QmeanA,
+    QmeanB,
+    QmeanC,
+    SmeanT,
+    SmeanA,
+    SmeanB,
+    SmeanC,
+    PFmeanT,
+    PFmeanA,
+    PFmeanB,
+    PFmeanC,
+    PmeanTF,
+    PmeanAF,
+    PmeanBF,
+    PmeanCF,
+    PmeanTH,
+    PmeanAH,
+    PmeanBH,
+    PmeanCH,
+    UrmsA,
+    UrmsB,
+    UrmsC,
+    IrmsN,
+    IrmsA,
+    IrmsB,
+    IrmsC,
+    UPeakA,
+    UPeakB,
+    UPeakC,
+    IPeakA,     // Peak currents: UPeakA-C in the table, like the peak voltages; IPeakA-C by alias
+    IPeakB,
+    IPeakC,
+    Freq,
+    PAngleA,
+    PAngleB,
+    PAngleC,
+    Temp,
+    UangleA,
+    UangleB,
+    UangleC,
+    Count
+};
+
 
 #endif // REGISTERDESCRIPTORS_H
\ No newline at end of file
@@ -1,10 +1,15 @@
 #include "SDCardLogger.h"
 #include "EnergyAccumulator.h"
+#include <unistd.h>
 
-SDCardLogger::SDCardLogger(RegisterAccess& regAccess, TimeManager& timeManager, int csPin, int cdPin, int wpPin)
+SDCardLogger::SDCardLogger(RegisterAccess& regAccess, MeasurementEngine& engine, TimeManager& timeManager,
+                           int csPin, int cdPin, int wpPin)
     : _regAccess(regAccess),
+      _engine(engine),
       _timeManager(timeManager),
       _energyAccumulator(nullptr),
+      _busArbiter(nullptr),
+      _yieldDuringWrite(false),
       _csPin(csPin),
       _cdPin(cdPin),
       _wpPin(wpPin),
@@ -13,20 +18,83 @@ SDCardLogger::SDCardLogger(RegisterAccess& regAccess, TimeManager& timeManager,
       _writeProtected(false),
       _loggingEnabled(false),
       _settingsNeedReload(false),
-      _buffer(nullptr),
+      _fill(&_buffers[0]),
+      _pending(&_buffers[1]),
       _bufferSize(60),
-      _bufferIndex(0),
+      _writerTask(nullptr),
+      _writerIdle(nullptr),
+      _overflowPolicy(LOG_OVERFLOW_DROP_OLDEST),
+      _aggregateCount(0),
+      _logFormat(LOG_FORMAT_CSV),
+      _binaryHeaderDirty(true),
+      _binaryBlockRecords(0),
+      _binaryBlockBytes(0),
+      _blockLength(0),
+      _blockFileOffset(0),
+      _logFilePath(""),
+      _dayStart(0),
+      _nextMidnight(0),
+      _logicalEnd(0),
+      _extentSize(0),
+      _commitStart(0),
+      _commitCrc(0),
+      _lastFlushMs(0),
+      _maxFlushMs(0),
+      _flushCount(0),
+      _droppedRecords(0),
+      _aggregatedRecords(0),
+      _blockedWaits(0),
+      _flushHistoryCount(0),
       _powerLossDetectionEnabled(true),
       _powerLossThreshold(100.0),
       _powerLost(false),
-      _lastPowerCheck(0),
+      _powerFailPin(-1),
+      _powerFailArmed(false),
+      _powerFailTriggered(false),
+      _powerFailMicros(0),
+      _emergencyCount(0),
+      _checkpointSequence(0),
       _loggingInterval(1000),
       _lastLogTime(0),
       _logCount(0),
       _lastCardCheck(0),
       _fieldNames(nullptr),
-      _fieldCount(0) {
-    
+      _fieldRegs(nullptr),
+      _fieldDecimals(nullptr),
+      _fieldSlots(nullptr),
+      _fieldIntervals(nullptr),
+      _fieldStatistics(nullptr),
+      _fieldDeadband(nullptr),
+      _fieldDeadbandRelative(nullptr),
+      _fieldCount(0),
+      _deadbandEnabled(false),
+      _deadbandPrimed(false),
+      _deadbandRef(nullptr),
+      _deadbandRefTime(0),
+      _maxLogGap(60000),
+      _suppressedRecords(0),
+      _failedFieldReads(0),
+      _rateGroupCount(0),
+      _multiRate(false),
+      _fieldsSubscribed(false),
+      _fieldAccumulators(nullptr),
+      _sampleInterval(100),
+      _index(_retention),
+      _rollupSync(_rollup, _index, _writeBlock, LOG_WRITE_BLOCK_SIZE),
+      _powerSub(-1),
+      _powerSlot(MeasurementEngine::NO_SLOT),
+      _lastPowerSequence(0),
+      _subscriptionsDirty(true) {
+    
+    for (int i = 0; i < 2; i++) {
+        _buffers[i].block = nullptr;
+        _buffers[i].count = 0;
+    }
+    portMUX_INITIALIZE(&_statsMux);
+    memset(&_lastCommit, 0, sizeof(_lastCommit));
+    memset(&_lastEmergency, 0, sizeof(_lastEmergency));
+    memset(_checkpointSector, 0, sizeof(_checkpointSector));
+
     // Set default fields
     setLogFields("UrmsA,IrmsA,PmeanA,SmeanA,QmeanA,Freq");
     
@@ -45,52 +113,64 @@ bool SDCardLogger::allocateBuffer(unsigned int size) {
     if (size < 1) size = 1;
     if (size > 1000) size = 1000;
     
-    // Free existing buffer if any
-    freeBuffer();
+    // The writer must be done with the old buffers
+    waitForWriter();
     
-    // Allocate new buffer
-    _buffer = new (std::nothrow) Measurement[size];
+    // Free existing buffers if any
+    freeBuffer();
     
-    if (_buffer == nullptr) {
-        Serial.printf("ERROR: Failed to allocate buffer for %u measurements\n", size);
-        _bufferSize = 0;
-        _bufferIndex = 0;
-        return false;
-    }
+    // One block per buffer; uint64_t keeps the kWh and mask columns aligned
+    size_t rowBytes = sizeof(double) + sizeof(uint64_t) + sizeof(time_t) + _fieldCount * sizeof(float);
+    size_t words = (size * rowBytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    
+    for (int i = 0; i < 2; i++) {
+        LogBuffer& buf = _buffers[i];
+        buf.block = new (std::nothrow) uint64_t[words];
+        if (buf.block == nullptr) {
+            Serial.printf("ERROR: Failed to allocate buffer for %u measurements\n", size);
+            freeBuffer();
+            releaseWriter();
+            return false;
+        }
     
-    // Initialize all measurements
-    for (unsigned int i = 0; i < size; i++) {
-        _buffer[i].fields = nullptr;
-        _buffer[i].fieldCount = 0;
-        _buffer[i].timestamp = 0;
-        _buffer[i].kWh = 0.0;
+        // Carve out the columns, widest element first
+        buf.kWh = (double*)buf.block;
+        buf.present = (uint64_t*)(buf.kWh + size);
+        buf.time = (time_t*)(buf.present + size);
+        buf.values = (float*)(buf.time + size);
+        buf.count = 0;
     }
     
     _bufferSize = size;
-    _bufferIndex = 0;
+    _fill = &_buffers[0];
+    _pending = &_buffers[1];
+    _aggregateCount = 0;
+    releaseWriter();
     
-    Serial.printf("Buffer allocated: %u measurements\n", size);
+    Serial.printf("Buffer allocated: 2 x %u measurements x %u fields (%u bytes)\n",
+                  size, _fieldCount, (unsigned)(2 * words * sizeof(uint64_t)));
     
     return true;
 }
 
 void SDCardLogger::freeBuffer() {
-    if (_buffer != nullptr) {
-        // Free all measurement fields
-        for (unsigned int i = 0; i < _bufferSize; i++) {
-            freeMeasurementFields(_buffer[i]);
+    for (int i = 0; i < 2; i++) {
+        if (_buffers[i].block != nullptr) {
+            delete[] _buffers[i].block;
+            _buffers[i].block = nullptr;
         }
-        delete[] _buffer;
-        _buffer = nullptr;
+        _buffers[i].count = 0;
     }
     _bufferSize = 0;
-    _bufferIndex = 0;
 }
 
 
 void SDCardLogger::setBufferSize(unsigned int size) {
+    if (size == _bufferSize && _buffers[0].block != nullptr) {
+        return;
+    }
     // Don't reallocate if logging is active
-    if (_loggingEnabled && _bufferIndex > 0) {
+    if (_loggingEnabled && _fill->count > 0) {
         Serial.println("Cannot change buffer size while logging with buffered data");
         Serial.println("Flush buffer first or disable logging");
         return;
@@ -100,44 +180,173 @@ void SDCardLogger::setBufferSize(unsigned int size) {
 }
 
 bool SDCardLogger::setLogFields(const String& fieldList) {
+    // Settings are applied again on every save; keep today's log open
+    if (_fieldCount > 0 && fieldList == _fieldSpec) {
+        return true;
+    }
+    
     // Don't change fields while logging with buffered data
-    if (_loggingEnabled && _bufferIndex > 0) {
+    if (_loggingEnabled && _fill->count > 0) {
         Serial.println("Cannot change log fields while logging with buffered data");
         return false;
     }
     
-    return parseFieldList(fieldList);
+    // The writer task reads the field list while writing. Reopen the log
+    // file afterwards, so a binary one gets a header for the new fields.
+    waitForWriter();
+    closeLogFile(true);
+    bool success = parseFieldList(fieldList);
+    _fieldSpec = success ? fieldList : String("");
+    releaseWriter();
+    
+    // The buffers have one column per field
+    if (success && _buffers[0].block != nullptr) {
+        success = allocateBuffer(_bufferSize);
+    }
+    
+    return success;
+}
+
+bool SDCardLogger::setOverflowPolicy(const String& policy) {
+    if (policy.equalsIgnoreCase("block")) {
+        _overflowPolicy = LOG_OVERFLOW_BLOCK;
+    } else if (policy.equalsIgnoreCase("drop")) {
+        _overflowPolicy = LOG_OVERFLOW_DROP_OLDEST;
+    } else if (policy.equalsIgnoreCase("aggregate")) {
+        _overflowPolicy = LOG_OVERFLOW_AGGREGATE;
+    } else {
+        Serial.print("WARNING: Unknown log overflow policy '");
+        Serial.print(policy);
+        Serial.println("', keeping the current one");
+        return false;
+    }
+    return true;
+}
+
+bool SDCardLogger::setLogFormat(const String& format) {
+    LogFormat newFormat;
+    if (format.equalsIgnoreCase("csv")) {
+        newFormat = LOG_FORMAT_CSV;
+    } else if (format.equalsIgnoreCase("binary")) {
+        newFormat = LOG_FORMAT_BINARY;
+    } else {
+        Serial.print("WARNING: Unknown log format '");
+        Serial.print(format);
+        Serial.println("', keeping the current one");
+        return false;
+    }
+    if (newFormat == _logFormat) {
+        return true;
+    }
+
+    // The writer task picks the file and encoding while writing
+    waitForWriter();
+    closeLogFile(true);
+    _logFormat = newFormat;
+    _binaryHeaderDirty = true;
+    releaseWriter();
+    return true;
 }
 
 String SDCardLogger::getLogFields() {
     String result = "";
     for (unsigned int i = 0; i < _fieldCount; i++) {
+        // The statistics of one field are consecutive columns
+        uint8_t statistic = _fieldStatistics[i];
+        if (i > 0 && statistic != LOG_STAT_DEFAULT && _fieldStatistics[i - 1] != LOG_STAT_DEFAULT &&
+            _fieldNames[i] == _fieldNames[i - 1]) {
+            result += "+";
+            result += binlogStatName(statistic);
+            continue;
+        }
+
         if (i > 0) result += ",";
         result += _fieldNames[i];
+        if (_fieldIntervals[i] > 0) {
+            result += "@" + String(_fieldIntervals[i]);
+        }
+        if (_fieldDeadband[i] > 0.0f) {
+            result += "~" + String(_fieldDeadband[i], 3);
+            if (_fieldDeadbandRelative[i]) result += "%";
+        }
+        if (statistic != LOG_STAT_DEFAULT) {
+            result += ":";
+            result += binlogStatName(statistic);
+        }
     }
     return result;
 }
 
+// Remove a "<marker>text" option from a field spec, up to the next
+// option or the end; true (and text set) if it was there
+static bool takeFieldOption(String& spec, char marker, String& text) {
+    int start = spec.indexOf(marker);
+    if (start < 0) {
+        return false;
+    }
+    int end = start + 1;
+    while (end < (int)spec.length() && strchr("@~:", spec.charAt(end)) == nullptr) {
+        end++;
+    }
+    text = spec.substring(start + 1, end);
+    text.trim();
+    spec.remove(start, end - start);
+    spec.trim();
+    return true;
+}
+
+// Statistic named in a field spec ("mean", "sd", ...), or LOG_STAT_DEFAULT
+static uint8_t parseStatistic(const String& name) {
+    for (uint8_t s = 0; s < BINLOG_STAT_COUNT; s++) {
+        if (name.equalsIgnoreCase(binlogStatName(s))) {
+            return s;
+        }
+    }
+    if (name.equalsIgnoreCase("stddev")) {
+        return BINLOG_STAT_STDDEV;
+    }
+    return LOG_STAT_DEFAULT;
+}
+
 bool SDCardLogger::parseFieldList(const String& fieldList) {
     // Free existing field names
     freeFieldNames();
     
-    // Count fields
-    _fieldCount = 1;
+    // Count columns: one per field, plus one per extra statistic
+    unsigned int maxColumns = 1;
     for (unsigned int i = 0; i < fieldList.length(); i++) {
-        if (fieldList.charAt(i) == ',') {
-            _fieldCount++;
+        if (fieldList.charAt(i) == ',' || fieldList.charAt(i) == '+') {
+            maxColumns++;
         }
     }
+    if (maxColumns > LOG_MAX_FIELDS) {
+        Serial.printf("ERROR: At most %u log fields\n", LOG_MAX_FIELDS);
+        return false;
+    }
     
-    // Allocate array
-    _fieldNames = new (std::nothrow) String[_fieldCount];
-    if (_fieldNames == nullptr) {
+    // Allocate arrays
+    _fieldNames = new (std::nothrow) String[maxColumns];
+    _fieldRegs = new (std::nothrow) const RegisterDescriptor*[maxColumns];
+    _fieldDecimals = new (std::nothrow) uint8_t[maxColumns];
+    _fieldSlots = new (std::nothrow) uint8_t[maxColumns];
+    _fieldIntervals = new (std::nothrow) unsigned long[maxColumns];
+    _fieldStatistics = new (std::nothrow) uint8_t[maxColumns];
+    _fieldDeadband = new (std::nothrow) float[maxColumns];
+    _fieldDeadbandRelative = new (std::nothrow) bool[maxColumns];
+    _deadbandRef = new (std::nothrow) float[maxColumns];
+    _fieldAccumulators = new (std::nothrow) FieldAccumulator[maxColumns];
+    if (_fieldNames == nullptr || _fieldRegs == nullptr || _fieldDecimals == nullptr ||
+        _fieldSlots == nullptr || _fieldIntervals == nullptr || _fieldStatistics == nullptr ||
+        _fieldDeadband == nullptr || _fieldDeadbandRelative == nullptr || _deadbandRef == nullptr ||
+        _fieldAccumulators == nullptr) {
         Serial.println("ERROR: Failed to allocate field names array");
-        _fieldCount = 0;
+        freeFieldNames();
         return false;
     }
     
+    // Binary logs describe the fields in a header, so a new one is due
+    _binaryHeaderDirty = true;
+
     // Parse field names
     unsigned int fieldIndex = 0;
     int startPos = 0;
@@ -146,6 +355,65 @@ bool SDCardLogger::parseFieldList(const String& fieldList) {
         if (i == fieldList.length() || fieldList.charAt(i) == ',') {
             String fieldName = fieldList.substring(startPos, i);
             fieldName.trim();
+
+            // Optional interval ("Name@60000"), deadband ("Name~0.5",
+            // "Name~1%") and statistics ("Name:min+max"), in any order
+            unsigned long interval = 0;
+            String intervalText;
+            if (takeFieldOption(fieldName, '@', intervalText)) {
+                interval = strtoul(intervalText.c_str(), NULL, 0);
+                if (interval == 0) {
+                    Serial.print("WARNING: Ignoring invalid interval for field '");
+                    Serial.print(fieldName);
+                    Serial.println("'");
+                }
+            }
+
+            float band = 0.0f;
+            bool relative = false;
+            String bandText;
+            if (takeFieldOption(fieldName, '~', bandText)) {
+                if (bandText.endsWith("%")) {
+                    relative = true;
+                    bandText.remove(bandText.length() - 1);
+                }
+                band = bandText.toFloat();
+                if (band <= 0.0f) {
+                    Serial.print("WARNING: Ignoring invalid deadband for field '");
+                    Serial.print(fieldName);
+                    Serial.println("'");
+                    band = 0.0f;
+                    relative = false;
+                }
+            }
+            
+            uint8_t statistics[BINLOG_STAT_COUNT];
+            unsigned int statCount = 0;
+            String statText;
+            if (takeFieldOption(fieldName, ':', statText)) {
+                int from = 0;
+                while (from <= (int)statText.length()) {
+                    int plus = statText.indexOf('+', from);
+                    if (plus < 0) plus = statText.length();
+                    String name = statText.substring(from, plus);
+                    name.trim();
+                    uint8_t statistic = parseStatistic(name);
+                    if (statistic == LOG_STAT_DEFAULT) {
+                        Serial.print("WARNING: Ignoring unknown statistic '");
+                        Serial.print(name);
+                        Serial.print("' for field '");
+                        Serial.print(fieldName);
+                        Serial.println("'");
+                    } else if (statCount < BINLOG_STAT_COUNT &&
+                               memchr(statistics, statistic, statCount) == nullptr) {
+                        statistics[statCount++] = statistic;
+                    }
+                    from = plus + 1;
+                }
+            }
+            if (statCount == 0) {
+                statistics[statCount++] = LOG_STAT_DEFAULT;
+            }
             
             // Validate field exists
             const RegisterDescriptor* reg = _regAccess.getRegisterInfo(fieldName.c_str());
@@ -158,13 +426,64 @@ bool SDCardLogger::parseFieldList(const String& fieldList) {
                 Serial.print(fieldName);
                 Serial.println("' is write-only and cannot be logged");
             }
-            
-            _fieldNames[fieldIndex++] = fieldName;
+
+            // Decide CSV formatting now so flushes don't have to
+            uint8_t decimals = 2;  // Default (2 decimals)
+            if (reg != nullptr) {
+                if (reg->regType == DT_INT16 || reg->regType == DT_INT32) {
+                    decimals = 0;  // Integer types
+                } else if (fieldName.indexOf("rms") >= 0) {
+                    decimals = 3;  // Current (3 decimals)
+                }
+            }
+
+            // A column per statistic
+            for (unsigned int s = 0; s < statCount; s++) {
+                _fieldRegs[fieldIndex] = reg;
+                _fieldDecimals[fieldIndex] = decimals;
+                _fieldIntervals[fieldIndex] = interval;
+                _fieldStatistics[fieldIndex] = statistics[s];
+                _fieldDeadband[fieldIndex] = band;
+                _fieldDeadbandRelative[fieldIndex] = relative;
+                _fieldNames[fieldIndex++] = fieldName;
+            }
+            if (band > 0.0f) _deadbandEnabled = true;
             startPos = i + 1;
         }
     }
     
-    Serial.printf("Log fields configured: %u fields\n", _fieldCount);
+    // The engine samples each distinct register once, however many
+    // statistic columns it feeds
+    unsigned int registers = 0;
+    for (unsigned int i = 0; i < fieldIndex; i++) {
+        if (_fieldRegs[i] == nullptr) {
+            continue;
+        }
+        unsigned int j = 0;
+        while (j < i && _fieldRegs[j] != _fieldRegs[i]) {
+            j++;
+        }
+        if (j == i) {
+            registers++;
+        }
+    }
+    if (registers > MAX_ENGINE_FIELDS) {
+        Serial.printf("ERROR: At most %u distinct registers can be logged (%u given)\n",
+                      MAX_ENGINE_FIELDS, registers);
+        freeFieldNames();
+        return false;
+    }
+    
+    _fieldCount = fieldIndex;
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        _fieldAccumulators[i].readFailed = false;
+    }
+    buildRateGroups();
+    restartStatistics();
+    _rollupSync.reset();  // Rollup columns follow the fields
+    
+    Serial.printf("Log fields configured: %u fields%s%s\n", _fieldCount,
+                  _multiRate ? " (multi-rate)" : "", _deadbandEnabled ? " (deadband logging)" : "");
     Serial.print("Fields: ");
     Serial.println(getLogFields());
     
@@ -172,29 +491,195 @@ bool SDCardLogger::parseFieldList(const String& fieldList) {
 }
 
 void SDCardLogger::freeFieldNames() {
+    // The engine subscriptions refer to the old field list
+    unsubscribeFields();
+    _rateGroupCount = 0;
+    _multiRate = false;
+    _subscriptionsDirty = true;
+
     if (_fieldNames != nullptr) {
         delete[] _fieldNames;
         _fieldNames = nullptr;
     }
+    if (_fieldRegs != nullptr) {
+        delete[] _fieldRegs;
+        _fieldRegs = nullptr;
+    }
+    if (_fieldDecimals != nullptr) {
+        delete[] _fieldDecimals;
+        _fieldDecimals = nullptr;
+    }
+    if (_fieldSlots != nullptr) {
+        delete[] _fieldSlots;
+        _fieldSlots = nullptr;
+    }
+    if (_fieldIntervals != nullptr) {
+        delete[] _fieldIntervals;
+        _fieldIntervals = nullptr;
+    }
+    if (_fieldStatistics != nullptr) {
+        delete[] _fieldStatistics;
+        _fieldStatistics = nullptr;
+    }
+    if (_fieldDeadband != nullptr) {
+        delete[] _fieldDeadband;
+        _fieldDeadband = nullptr;
+    }
+    if (_fieldDeadbandRelative != nullptr) {
+        delete[] _fieldDeadbandRelative;
+        _fieldDeadbandRelative = nullptr;
+    }
+    if (_deadbandRef != nullptr) {
+        delete[] _deadbandRef;
+        _deadbandRef = nullptr;
+    }
+    if (_fieldAccumulators != nullptr) {
+        delete[] _fieldAccumulators;
+        _fieldAccumulators = nullptr;
+    }
     _fieldCount = 0;
+    _deadbandEnabled = false;
+    _deadbandPrimed = false;
 }
 
-bool SDCardLogger::allocateMeasurementFields(Measurement& m) {
-    m.fields = new (std::nothrow) FieldValue[_fieldCount];
-    if (m.fields == nullptr) {
-        m.fieldCount = 0;
-        return false;
+// Group the fields by interval, fastest first. A field needing more than
+// LOG_MAX_RATES groups joins the logging interval's group, or else the
+// fastest one.
+void SDCardLogger::buildRateGroups() {
+    _rateGroupCount = 0;
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        unsigned long interval = fieldInterval(i);
+        unsigned int g = 0;
+        while (g < _rateGroupCount && _rateGroups[g].interval != interval) {
+            g++;
+        }
+        if (g == LOG_MAX_RATES) {
+            Serial.print("WARNING: Too many log intervals, field '");
+            Serial.print(_fieldNames[i]);
+            Serial.println("' moved to another one");
+            g = 0;
+            while (g < _rateGroupCount && _rateGroups[g].interval != _loggingInterval) {
+                g++;
+            }
+            if (g == _rateGroupCount) {
+                g = 0;
+            }
+            _fieldIntervals[i] = _rateGroups[g].interval == _loggingInterval ? 0 : _rateGroups[g].interval;
+        } else if (g == _rateGroupCount) {
+            // Keep the groups sorted by interval
+            while (g > 0 && _rateGroups[g - 1].interval > interval) {
+                _rateGroups[g] = _rateGroups[g - 1];
+                g--;
+            }
+            _rateGroups[g].interval = interval;
+            _rateGroups[g].fields = 0;
+            _rateGroups[g].sub = -1;
+            _rateGroups[g].lastSequence = 0;
+            _rateGroups[g].tickValid = false;
+            _rateGroupCount++;
+        }
+        _rateGroups[g].fields |= (uint64_t)1 << i;
     }
-    m.fieldCount = _fieldCount;
-    return true;
+    _multiRate = _rateGroupCount > 1;
+
+    // Groups slower than the sample interval are sampled at it
+    for (unsigned int g = 0; g < _rateGroupCount; g++) {
+        RateGroup& group = _rateGroups[g];
+        group.sampleInterval = (_sampleInterval > 0 && _sampleInterval < group.interval)
+                               ? _sampleInterval : group.interval;
+    }
+}
+
+unsigned long SDCardLogger::recordInterval() {
+    return _rateGroupCount > 0 ? _rateGroups[0].interval : _loggingInterval;
+}
+
+void SDCardLogger::unsubscribeFields() {
+    for (unsigned int g = 0; g < _rateGroupCount; g++) {
+        _engine.unsubscribe(_rateGroups[g].sub);
+        _rateGroups[g].sub = -1;
+    }
+    // The slots may be handed to other subscribers
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        _fieldSlots[i] = MeasurementEngine::NO_SLOT;
+    }
+    _fieldsSubscribed = false;
+}
+
+// Keep the engine subscriptions in line with the logging and power-check
+// configuration. Fields are only sampled while logging is enabled.
+void SDCardLogger::updateSubscriptions() {
+    unsubscribeFields();
+    _engine.unsubscribe(_powerSub);
+    _powerSub = -1;
+
+    if (_loggingEnabled && _fieldCount > 0) {
+        for (unsigned int g = 0; g < _rateGroupCount; g++) {
+            RateGroup& group = _rateGroups[g];
+            // The statistic columns of a field share its register: one
+            // engine field each, mapped back onto every column
+            const RegisterDescriptor* regs[LOG_MAX_FIELDS];
+            uint8_t slots[LOG_MAX_FIELDS];
+            uint8_t regIndex[LOG_MAX_FIELDS];
+            unsigned int n = 0;
+            for (unsigned int i = 0; i < _fieldCount; i++) {
+                if (!(group.fields & ((uint64_t)1 << i)) || _fieldRegs[i] == nullptr) {
+                    continue;  // An unknown field never gets a slot
+                }
+                unsigned int k = 0;
+                while (k < n && regs[k] != _fieldRegs[i]) {
+                    k++;
+                }
+                if (k == n) {
+                    regs[n++] = _fieldRegs[i];
+                }
+                regIndex[i] = k;
+            }
+            warnSingleSampleStatistics(group);
+            group.sub = _engine.subscribe(regs, n, group.sampleInterval, slots);
+            group.lastSequence = 0;
+            if (group.sub >= 0) {
+                for (unsigned int i = 0; i < _fieldCount; i++) {
+                    if ((group.fields & ((uint64_t)1 << i)) && _fieldRegs[i] != nullptr) {
+                        _fieldSlots[i] = slots[regIndex[i]];
+                    }
+                }
+            } else if (n > 0) {
+                Serial.printf("ERROR: Measurement engine refused %u log fields at %lu ms, they won't be logged\n",
+                              n, group.sampleInterval);
+            }
+        }
+        _fieldsSubscribed = true;
+    }
+    restartStatistics();
+
+    if (_powerLossDetectionEnabled) {
+        const RegisterDescriptor* urms = _regAccess.getRegisterInfo(RegisterId::UrmsA);
+        _powerSub = _engine.subscribe(&urms, 1, POWER_CHECK_INTERVAL, &_powerSlot);
+        _lastPowerSequence = 0;
+    }
+
+    _subscriptionsDirty = false;
 }
 
-void SDCardLogger::freeMeasurementFields(Measurement& m) {
-    if (m.fields != nullptr) {
-        delete[] m.fields;
-        m.fields = nullptr;
+// Min, max and sd of a group sampled once per interval are all of the
+// one sample, though the columns are still labelled with the statistic.
+// Checked here rather than in parseFieldList: settings apply the field
+// list before the sample interval.
+void SDCardLogger::warnSingleSampleStatistics(const RateGroup& group) {
+    if (group.sampleInterval < group.interval) {
+        return;
+    }
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        uint8_t statistic = _fieldStatistics[i];
+        if (!(group.fields & ((uint64_t)1 << i)) ||
+            (statistic != BINLOG_STAT_MIN && statistic != BINLOG_STAT_MAX && statistic != BINLOG_STAT_STDDEV)) {
+            continue;
+        }
+        Serial.printf("WARNING: '%s:%s' is taken from one sample per %lu ms interval; "
+                      "set SampleInterval below that\n",
+                      _fieldNames[i].c_str(), binlogStatName(statistic), group.interval);
     }
-    m.fieldCount = 0;
 }
 
 String SDCardLogger::generateCSVHeader() {
@@ -203,19 +688,78 @@ String SDCardLogger::generateCSVHeader() {
         if (i > 0) header += ",";
 
         // Get friendly name if available
-        const RegisterDescriptor* reg = _regAccess.getRegisterInfo(_fieldNames[i].c_str());
+        const RegisterDescriptor* reg = _fieldRegs[i];
         if (reg != nullptr && reg->friendlyName != nullptr && strlen(reg->friendlyName) > 0) {
             header += reg->friendlyName;
         } else {
             header += _fieldNames[i];
         }
+
+        // Mean and last are the field's value; the others are marked
+        uint8_t statistic = fieldStatistic(i);
+        if (statistic != BINLOG_STAT_LAST && statistic != BINLOG_STAT_MEAN) {
+            header += " (";
+            header += binlogStatName(statistic);
+            header += ")";
+        }
     }
     header += ",kWh,UnixTime";
     return header;
 }
 
 void SDCardLogger::setLoggingInterval(unsigned long intervalMs) {
+    if (intervalMs == _loggingInterval) {
+        return;
+    }
+    // Binary headers record the intervals; start a new one
+    waitForWriter();
+    closeLogFile(true);
+    unsubscribeFields();
     _loggingInterval = intervalMs;
+    buildRateGroups();
+    _binaryHeaderDirty = true;
+    _rollupSync.reset();  // Fields may log another statistic now
+    releaseWriter();
+    _subscriptionsDirty = true;
+}
+
+void SDCardLogger::setMaxLogGap(unsigned long gapMs) {
+    if (gapMs < 1000) {
+        gapMs = 1000;  // Records carry whole seconds
+    }
+    if (gapMs == _maxLogGap) {
+        return;
+    }
+    // Binary headers record the gap readers may fill in
+    waitForWriter();
+    closeLogFile(true);
+    _maxLogGap = gapMs;
+    _binaryHeaderDirty = true;
+    releaseWriter();
+}
+
+void SDCardLogger::setSampleInterval(unsigned long intervalMs) {
+    if (intervalMs == _sampleInterval) {
+        return;
+    }
+    // Binary headers record each field's statistic, which may change
+    waitForWriter();
+    closeLogFile(true);
+    unsubscribeFields();
+    _sampleInterval = intervalMs;
+    buildRateGroups();
+    _binaryHeaderDirty = true;
+    _rollupSync.reset();
+    releaseWriter();
+    _subscriptionsDirty = true;
+}
+
+void SDCardLogger::setFreeSpaceWatermarks(unsigned int lowMB, unsigned int highMB) {
+    _retention.setWatermarks(lowMB, highMB);
+}
+
+void SDCardLogger::setLogsInUse(const String& path) {
+    _retention.setLogsInUse(path);
 }
 
 void SDCardLogger::setPowerLossThreshold(float voltage) {
@@ -229,6 +773,21 @@ void SDCardLogger::enablePowerLossDetection(bool enable) {
 bool SDCardLogger::begin() {
     Serial.println("\n=== SD Card Logger Initialization ===");
     
+    // Writer task drains full buffers so loop() doesn't wait on the card
+    if (_writerIdle == nullptr) {
+        _writerIdle = xSemaphoreCreateBinary();
+        if (_writerIdle != nullptr) {
+            xSemaphoreGive(_writerIdle);
+            if (xTaskCreate(writerTaskEntry, "sdWriter", LOG_WRITER_STACK_SIZE, this,
+                            LOG_WRITER_PRIORITY, &_writerTask) != pdPASS) {
+                _writerTask = nullptr;
+            }
+        }
+        if (_writerTask == nullptr) {
+            Serial.println("WARNING: SD writer task not started, buffers will be written inline");
+        }
+    }
+    
     // Setup card detect and write protect pins
     if (_cdPin >= 0) {
         pinMode(_cdPin, INPUT_PULLUP);
@@ -249,7 +808,14 @@ bool SDCardLogger::begin() {
     
     // Try to mount if card is present
     if (_cardPresent) {
-        return mountCard();
+        if (!mountCard()) {
+            return false;
+        }
+        // Repair a flush torn by a power cut before logging resumes
+        if (_timeManager.isRTCValid()) {
+            recoverTodaysLog();
+        }
+        return true;
     } else {
         Serial.println("No SD card detected on startup");
         return false;
@@ -308,25 +874,27 @@ bool SDCardLogger::mountCard() {
     
     // Method 1: Default initialization with slower clock
     Serial.println("Method 1: Trying default init with 400kHz clock...");
-    if (SD.begin(_csPin, SPI, 400000)) {
+    if (SD.begin(_csPin, SPI, 400000, LOG_SD_MOUNT_POINT, LOG_SD_MAX_FILES)) {
         Serial.println("SD Card mounted successfully!");
         _initialized = true;
         printCardInfo();
+        openCheckpointFile();
         return true;
     }
     
     Serial.println("Method 1 failed");
     delay(100);
     
-    // Method 2: Initialize SPI bus first
-    Serial.println("Method 2: Initializing SPI bus first...");
-    SPI.begin(18, 19, 23, _csPin);  // SCK, MISO, MOSI, CS
-    delay(10);
+    // Method 2: Retry once the card has had time to settle. The bus itself
+    // is set up in setup() and shared with the energy chip, so it is not
+    // re-initialized here.
+    Serial.println("Method 2: Retrying at 400kHz...");
     
-    if (SD.begin(_csPin, SPI, 400000)) {
+    if (SD.begin(_csPin, SPI, 400000, LOG_SD_MOUNT_POINT, LOG_SD_MAX_FILES)) {
         Serial.println("SD Card mounted successfully!");
         _initialized = true;
         printCardInfo();
+        openCheckpointFile();
         return true;
     }
     
@@ -335,10 +903,11 @@ bool SDCardLogger::mountCard() {
     
     // Method 3: Try default clock speed
     Serial.println("Method 3: Trying default clock speed...");
-    if (SD.begin(_csPin, SPI)) {
+    if (SD.begin(_csPin, SPI, 4000000, LOG_SD_MOUNT_POINT, LOG_SD_MAX_FILES)) {
         Serial.println("SD Card mounted successfully!");
         _initialized = true;
         printCardInfo();
+        openCheckpointFile();
         return true;
     }
     
@@ -352,7 +921,17 @@ bool SDCardLogger::mountCard() {
 void SDCardLogger::unmountCard() {
     if (_initialized) {
         Serial.println("Unmounting SD card...");
+        // Let an in-progress background write finish first
+        // Keep the preallocation: the trailer lets a remount resume in place
+        waitForWriter();
+        closeLogFile();
+        if (_checkpointFile) {
+            _checkpointFile.close();
+        }
         SD.end();
+        _retention.unmounted();
+        _rollupSync.reset();  // Rebuilt from the card once it's back
+        releaseWriter();
         _initialized = false;
         
         // Disable logging since card is gone
@@ -368,21 +947,19 @@ void SDCardLogger::checkPowerStatus() {
         return;
     }
     
-    // Read voltage from energy IC
-    bool success = false;
-    float voltage = _regAccess.readRegister("UrmsA", &success);
-    
-    if (!success) {
+    // Voltage from the latest engine snapshot
+    const MeasurementSnapshot* snap = _engine.latest();
+    if (snap == nullptr || _powerSlot == MeasurementEngine::NO_SLOT || !snap->valid[_powerSlot]) {
         return;  // Can't check, skip this cycle
     }
+    float voltage = snap->values[_powerSlot];
     
     // Check if voltage dropped below threshold
     if (voltage < _powerLossThreshold && !_powerLost) {
-        Serial.println("\n!!! POWER LOSS DETECTED !!!");
-        Serial.printf("Voltage: %.2f V (threshold: %.2f V)\n", voltage, _powerLossThreshold);
-        
         _powerLost = true;
+        armPowerFailInterrupt(false);
         handlePowerLoss();
+        Serial.printf("Voltage: %.2f V (threshold: %.2f V)\n", voltage, _powerLossThreshold);
     }
     
     // Check if power restored
@@ -422,7 +999,10 @@ bool SDCardLogger::handlePowerRestoration() {
     Serial.println("SD card remounted successfully");
     
     // Reset buffer to start fresh
-    _bufferIndex = 0;
+    _fill->count = 0;
+    _aggregateCount = 0;
+    _deadbandPrimed = false;  // Record the first sample after the outage
+    restartStatistics();      // Don't mix samples from before it in
     
     // Set flag to indicate settings should be reloaded
     _settingsNeedReload = true;
@@ -441,39 +1021,76 @@ bool SDCardLogger::settingsNeedReload() {
     return result;
 }
 
+// Emergency flush, cheapest and most important step first: the energy
+// totals (one sector into the pre-opened checkpoint file, not a rewrite of
+// settings.ini), then the buffered records, then closing the card. Nothing
+// is printed until the card is safe, since at 115200 baud every line costs
+// milliseconds the hold-up capacitor may not have.
 bool SDCardLogger::handlePowerLoss() {
-    Serial.println("Emergency buffer flush initiated...");
-    Serial.printf("Current buffer usage: %u / %u measurements\n", _bufferIndex, _bufferSize);
+    EmergencyFlushTiming& timing = _lastEmergency;
+    unsigned long start = micros();
+    timing.fromInterrupt = _powerFailTriggered;
+    timing.detectUs = timing.fromInterrupt ? start - _powerFailMicros : 0;
 
-    // Save accumulated energy data before power loss
-    if (_energyAccumulator) {
-        Serial.println("Saving accumulated energy data...");
-        if (_energyAccumulator->saveToSettings()) {
-            Serial.println("Energy data saved successfully");
-        } else {
-            Serial.println("WARNING: Failed to save energy data!");
-        }
+    // Energy totals
+    timing.checkpointSaved = writeEnergyCheckpoint();
+    unsigned long checkpointDone = micros();
+
+    // A background write in progress finishes first
+    waitForWriter();
+    unsigned long writerDone = micros();
+
+    // Take one final measurement if there's room (the statistics so far,
+    // no chip access)
+    collectValues(ALL_FIELDS);
+    if (_fill->count < _bufferSize && takeMeasurement(*_fill, _fill->count, ALL_FIELDS)) {
+        _fill->count++;
     }
 
-    // Take one final measurement if there's room
-    if (_bufferIndex < _bufferSize && takeMeasurement(_buffer[_bufferIndex])) {
-        _bufferIndex++;
-        Serial.println("Final measurement captured");
+    // Buffered records, written and committed without yielding the bus
+    timing.records = _fill->count;
+    bool success = true;
+    if (_fill->count > 0) {
+        if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+        success = _initialized && !_writeProtected && writeBufferToFile(*_fill, false);
+        if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+        if (success) {
+            _fill->count = 0;
+            _aggregateCount = 0;
+        }
     }
+    timing.recordsSaved = success;
+    releaseWriter();
+    unsigned long recordsDone = micros();
 
-    // Flush whatever is in the buffer
-    Serial.println("Flushing buffer to SD card...");
-    bool success = flushBuffer();
+    // Close the files and release the card
+    unmountCard();
+    unsigned long end = micros();
 
-    if (success) {
-        Serial.printf("Emergency flush complete.\n");
-    } else {
+    timing.checkpointUs = checkpointDone - start;
+    timing.writerUs = writerDone - checkpointDone;
+    timing.recordsUs = recordsDone - writerDone;
+    timing.unmountUs = end - recordsDone;
+    timing.totalUs = end - start + timing.detectUs;
+    _emergencyCount++;
+
+    if (_powerLost) {
+        Serial.println("\n!!! POWER LOSS DETECTED !!!");
+    }
+    Serial.printf("Emergency flush (%s) complete in %lu us:\n",
+                  timing.fromInterrupt ? "chip interrupt" : "voltage poll", timing.totalUs);
+    if (timing.fromInterrupt) {
+        Serial.printf("  Interrupt to flush: %lu us\n", timing.detectUs);
+    }
+    Serial.printf("  Energy checkpoint:  %lu us%s\n", timing.checkpointUs,
+                  timing.checkpointSaved ? "" : " (FAILED)");
+    Serial.printf("  Writer drain:       %lu us\n", timing.writerUs);
+    Serial.printf("  %u records:         %lu us%s\n", timing.records, timing.recordsUs,
+                  success ? "" : " (FAILED)");
+    Serial.printf("  Close and unmount:  %lu us\n", timing.unmountUs);
+    if (!success) {
         Serial.println("ERROR: Emergency flush failed!");
     }
-
-    // Unmount SD card safely
-    Serial.println("Unmounting SD card for safety...");
-    unmountCard();
     
     Serial.println("=================================");
     Serial.println("System in safe state");
@@ -483,6 +1100,151 @@ bool SDCardLogger::handlePowerLoss() {
     return success;
 }
 
+void IRAM_ATTR SDCardLogger::powerFailISR(void* arg) {
+    SDCardLogger* logger = (SDCardLogger*)arg;
+    if (!logger->_powerFailTriggered) {
+        logger->_powerFailMicros = micros();
+        logger->_powerFailTriggered = true;
+    }
+}
+
+// Attach or detach the IRQ0 interrupt. Arming acknowledges the chip's
+// sag and phase-loss flags so IRQ0 drops and the next event is a new
+// rising edge; if the condition is still there the chip latches it again
+// straight away and the ISR fires. Only those two bits are written, so
+// other flags latched in the same status word stay set.
+void SDCardLogger::armPowerFailInterrupt(bool arm) {
+    if (_powerFailPin < 0) {
+        return;
+    }
+    if (!arm) {
+        detachInterrupt(digitalPinToInterrupt(_powerFailPin));
+        _powerFailArmed = false;
+        return;
+    }
+
+    pinMode(_powerFailPin, INPUT);
+    attachInterruptArg(digitalPinToInterrupt(_powerFailPin), powerFailISR, this, RISING);
+    _regAccess.writeRegisterRaw(RegisterId::SagPhaseAIntST, 1);
+    _regAccess.writeRegisterRaw(RegisterId::PhaseLossAIntST, 1);
+    _powerFailArmed = true;
+}
+
+// Open (creating if needed) the energy checkpoint file on a fresh mount.
+// At boot any checkpoint is left for restoreEnergyCheckpoint(); once the
+// accumulator is running its totals are newer, so a checkpoint left by an
+// earlier flush (power dip, safe-removal button) is cleared.
+void SDCardLogger::openCheckpointFile() {
+    if (!_initialized) {
+        return;
+    }
+    
+    if (!SD.exists(LOG_CHECKPOINT_PATH)) {
+        File file = SD.open(LOG_CHECKPOINT_PATH, FILE_WRITE);
+        if (file) {
+            memset(_checkpointSector, 0, sizeof(_checkpointSector));
+            file.write(_checkpointSector, sizeof(_checkpointSector));
+            file.write(_checkpointSector, sizeof(_checkpointSector));
+            file.close();
+        }
+    }
+    
+    _checkpointFile = SD.open(LOG_CHECKPOINT_PATH, "r+");
+    if (!_checkpointFile) {
+        Serial.println("WARNING: Failed to open energy checkpoint file");
+        return;
+    }
+    if (_energyAccumulator) {
+        clearEnergyCheckpoint();
+    }
+}
+
+// One sector holding the current energy totals. _checkpointSector is zero
+// past the record, so the sector is written whole and the card doesn't
+// have to read it first.
+bool SDCardLogger::writeEnergyCheckpoint() {
+    if (!_energyAccumulator || !_checkpointFile) {
+        return false;
+    }
+    
+    uint32_t sequence = _checkpointSequence + 1;
+    uint8_t* p = _checkpointSector;
+    memcpy(p, LOG_CHECKPOINT_MAGIC, BINLOG_MAGIC_SIZE);
+    binlogPut32(p + 4, sequence);
+    binlogPut32(p + 8, _timeManager.isRTCValid() ? (uint32_t)_timeManager.getUnixTime() : 0);
+    for (uint8_t phase = 0; phase < 3; phase++) {
+        binlogPutDouble(p + 12 + phase * 8, _energyAccumulator->getAccumulatedEnergy(phase));
+    }
+    binlogPut32(p + 36, binlogCrc32(p, 36));
+    
+    if (!_checkpointFile.seek((sequence % 2) * LOG_SECTOR_SIZE) ||
+        _checkpointFile.write(_checkpointSector, LOG_SECTOR_SIZE) != LOG_SECTOR_SIZE) {
+        return false;
+    }
+    _checkpointFile.flush();
+    _checkpointSequence = sequence;
+    return true;
+}
+
+bool SDCardLogger::clearEnergyCheckpoint() {
+    memset(_checkpointSector, 0, sizeof(_checkpointSector));
+    bool ok = _checkpointFile.seek(0) &&
+              _checkpointFile.write(_checkpointSector, LOG_SECTOR_SIZE) == LOG_SECTOR_SIZE &&
+              _checkpointFile.write(_checkpointSector, LOG_SECTOR_SIZE) == LOG_SECTOR_SIZE;
+    _checkpointFile.flush();
+    _checkpointSequence = 0;
+    return ok;
+}
+
+// Apply the newest checkpoint left by an emergency flush before the last
+// reset. The checkpoint is only cleared once settings.ini has the totals.
+bool SDCardLogger::restoreEnergyCheckpoint() {
+    if (!_energyAccumulator || !_checkpointFile) {
+        return false;
+    }
+    
+    bool found = false;
+    uint32_t newest = 0;
+    uint32_t savedTime = 0;
+    double kWh[3];
+    uint8_t record[LOG_CHECKPOINT_SIZE];
+    for (int slot = 0; slot < 2; slot++) {
+        if (!_checkpointFile.seek(slot * LOG_SECTOR_SIZE) ||
+            _checkpointFile.read(record, sizeof(record)) != sizeof(record)) {
+            continue;
+        }
+        if (memcmp(record, LOG_CHECKPOINT_MAGIC, BINLOG_MAGIC_SIZE) != 0 ||
+            binlogGet32(record + 36) != binlogCrc32(record, 36)) {
+            continue;
+        }
+        uint32_t sequence = binlogGet32(record + 4);
+        if (found && sequence <= newest) {
+            continue;
+        }
+        found = true;
+        newest = sequence;
+        savedTime = binlogGet32(record + 8);
+        for (uint8_t phase = 0; phase < 3; phase++) {
+            kWh[phase] = binlogGetDouble(record + 12 + phase * 8);
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    
+    Serial.printf("Restoring energy checkpoint from emergency flush at %lu\n", (unsigned long)savedTime);
+    for (uint8_t phase = 0; phase < 3; phase++) {
+        _energyAccumulator->setAccumulatedEnergy(phase, kWh[phase]);
+        Serial.printf("  Phase %c: %.3f kWh\n", 'A' + phase, kWh[phase]);
+    }
+    if (!_energyAccumulator->saveToSettings()) {
+        Serial.println("WARNING: Failed to save restored energy data, checkpoint kept");
+        return false;
+    }
+    clearEnergyCheckpoint();
+    return true;
+}
+
 
 bool SDCardLogger::isCardPresent() {
     return _cardPresent && _initialized;
@@ -519,11 +1281,13 @@ void SDCardLogger::printCardInfo() {
     uint64_t cardSize = SD.cardSize() / (1024 * 1024);
     Serial.printf("SD Card Size: %llu MB\n", cardSize);
     
-    uint64_t usedBytes = SD.usedBytes() / (1024 * 1024);
-    Serial.printf("Used Space: %llu MB\n", usedBytes);
-    
-    uint64_t freeBytes = (SD.cardSize() - SD.usedBytes()) / (1024 * 1024);
-    Serial.printf("Free Space: %llu MB\n", freeBytes);
+    // The only usedBytes() call: retention keeps count from here on
+    uint64_t totalBytes = SD.totalBytes();
+    uint64_t usedBytes = SD.usedBytes();
+    _retention.mounted(totalBytes > usedBytes ? totalBytes - usedBytes : 0);
+    _rollup.takeSizeChange();
+    Serial.printf("Used Space: %llu MB\n", usedBytes / (1024 * 1024));
+    Serial.printf("Free Space: %llu MB\n", (uint64_t)_retention.getFreeBytes() / (1024 * 1024));
     
     if (_writeProtected) {
         Serial.println("*** WRITE PROTECTED ***");
@@ -548,19 +1312,25 @@ void SDCardLogger::enableLogging(bool enable) {
         return;
     }
     
-    if (enable && (_buffer == nullptr || _bufferSize == 0)) {
+    if (enable && (_fill->block == nullptr || _bufferSize == 0)) {
         Serial.println("Cannot enable logging: Buffer not allocated");
         _loggingEnabled = false;
         return;
     }
     
     // If disabling and buffer has data, flush it first
-    if (!enable && _loggingEnabled && _bufferIndex > 0) {
+    if (!enable && _loggingEnabled && _fill->count > 0) {
         Serial.println("Flushing buffer before disabling logging...");
         flushBuffer();
     }
+    if (!enable) {
+        waitForWriter();
+        closeLogFile(true);
+        releaseWriter();
+    }
     
     _loggingEnabled = enable;
+    _deadbandPrimed = false;
     if (enable) {
         Serial.println("Data logging enabled");
     } else {
@@ -569,7 +1339,27 @@ void SDCardLogger::enableLogging(bool enable) {
 }
 
 void SDCardLogger::update() {
+    // Power-fail interrupt: flush before anything else gets the bus
+    if (_powerFailTriggered) {
+        if (_powerLossDetectionEnabled && !_powerLost) {
+            _powerLost = true;
+            armPowerFailInterrupt(false);
+            handlePowerLoss();
+        }
+        _powerFailTriggered = false;
+    }
+    bool wantArmed = _powerFailPin >= 0 && _powerLossDetectionEnabled && !_powerLost;
+    if (wantArmed != _powerFailArmed) {
+        armPowerFailInterrupt(wantArmed);
+    }
+
     unsigned long now = millis();
+
+    bool wantFieldSub = _loggingEnabled && _fieldCount > 0;
+    if (_subscriptionsDirty || _fieldsSubscribed != wantFieldSub ||
+        (_powerSub >= 0) != _powerLossDetectionEnabled) {
+        updateSubscriptions();
+    }
     
     // Periodically check card status
     if (now - _lastCardCheck >= CARD_CHECK_INTERVAL) {
@@ -577,10 +1367,11 @@ void SDCardLogger::update() {
         _lastCardCheck = now;
     }
     
-    // Check power status more frequently
-    if (now - _lastPowerCheck >= POWER_CHECK_INTERVAL) {
+    // Check power status whenever the engine has a new voltage sample
+    uint32_t powerSequence = _engine.getSubscriptionSequence(_powerSub);
+    if (powerSequence != _lastPowerSequence) {
         checkPowerStatus();
-        _lastPowerCheck = now;
+        _lastPowerSequence = powerSequence;
     }
     
     // Don't log if power is lost
@@ -588,128 +1379,561 @@ void SDCardLogger::update() {
         return;
     }
     
+    // A buffer left full by an overflow goes out as soon as the writer is free
+    if (_fill->count >= _bufferSize && _bufferSize > 0) {
+        handOff(0);
+    }
+    
     // Only log if everything is ready
     if (!_initialized || !_loggingEnabled || _writeProtected || !_timeManager.isRTCValid()) {
         return;
     }
     
-    // Check if it's time to log
-    if (now - _lastLogTime >= _loggingInterval) {
-        if (logMeasurement()) {
-            _lastLogTime = now;
-        }
-    }
-}
-
-
-bool SDCardLogger::takeMeasurement(Measurement& m) {
-    // Free existing fields if any (safety check)
-    if (m.fields != nullptr) {
-        freeMeasurementFields(m);
+    // Bring the rollups into step with the raw logs, a block at a time
+    if (_rollupSync.due(now)) {
+        replayRollupStep();
+    } else if (_rollup.hasQueued()) {
+        writeRollupStep();
     }
     
-    // Allocate field storage for this measurement
-    if (!allocateMeasurementFields(m)) {
-        Serial.println("ERROR: Failed to allocate measurement fields");
-        return false;
+    // Keep free space above the low watermark, a day of logs per step
+    if (_retention.due(now)) {
+        retentionStep();
     }
     
-    // Read all configured fields
-    for (unsigned int i = 0; i < _fieldCount; i++) {
-        m.fields[i].name = _fieldNames[i];
-        m.fields[i].valid = false;
-
-        bool success = false;
-        m.fields[i].value = _regAccess.readRegister(_fieldNames[i].c_str(), &success);
-        m.fields[i].valid = success;
-
-        if (!success) {
-            Serial.print("WARNING: Failed to read field: ");
-            Serial.println(_fieldNames[i]);
+    // Log each time the engine samples a group of our fields. Groups due
+    // at the same time were read in one burst and share a record. Groups
+    // sampled within their interval log once the first sample of the next
+    // interval arrives, and that sample starts the next statistics.
+    uint64_t present = 0;
+    uint64_t pointFields = 0;
+    uint64_t intervalFields = 0;
+    const MeasurementSnapshot* snap = _engine.latest();
+    for (unsigned int g = 0; g < _rateGroupCount; g++) {
+        RateGroup& group = _rateGroups[g];
+        uint32_t sequence = _engine.getSubscriptionSequence(group.sub);
+        if (sequence == 0 || sequence == group.lastSequence) {
+            continue;
+        }
+        group.lastSequence = sequence;
+        if (group.sampleInterval == group.interval) {
+            pointFields |= group.fields;
+            present |= group.fields;
+            continue;
         }
+        unsigned long tick = (snap != nullptr ? snap->timestamp : now) / group.interval;
+        if (group.tickValid && tick != group.tick) {
+            present |= group.fields;
+        }
+        group.tick = tick;
+        group.tickValid = true;
+        intervalFields |= group.fields;
     }
-
-    m.timestamp = _timeManager.getUnixTime();
-
-    // Capture current kWh value (Phase A)
-    if (_energyAccumulator) {
-        m.kWh = _energyAccumulator->getAccumulatedEnergy(0);
-    } else {
-        m.kWh = 0.0;
+    accumulateSamples(pointFields);
+    if (present != 0 && logMeasurement(present)) {
+        _lastLogTime = now;
     }
-
-    return true;
+    accumulateSamples(intervalFields);
 }
 
 
-bool SDCardLogger::logMeasurement() {
-    if (!_initialized || _writeProtected || !_timeManager.isRTCValid()) {
-        return false;
+bool SDCardLogger::fieldValid(const MeasurementSnapshot* snap, unsigned int field) {
+    uint8_t slot = _fieldSlots[field];
+    return snap != nullptr && slot != MeasurementEngine::NO_SLOT && snap->valid[slot];
+}
+
+// Add the engine's latest sample of each of fields to its statistics
+void SDCardLogger::accumulateSamples(uint64_t fields) {
+    if (fields == 0) {
+        return;
+    }
+    const MeasurementSnapshot* snap = _engine.latest();
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        if (!(fields & ((uint64_t)1 << i))) {
+            continue;
+        }
+        FieldAccumulator& acc = _fieldAccumulators[i];
+        if (acc.stale) {
+            acc.count = 0;
+            acc.stale = false;
+        }
+        if (!fieldValid(snap, i)) {
+            // Unknown fields were reported when configured and never get
+            // a slot. A known one that fails is reported the first time
+            // and counted after that.
+            if (_fieldSlots[i] != MeasurementEngine::NO_SLOT) {
+                _failedFieldReads++;
+                if (!acc.readFailed) {
+                    acc.readFailed = true;
+                    Serial.printf("WARNING: Failed to read field %s, further failures are only counted\n",
+                                  _fieldNames[i].c_str());
+                }
+            }
+            continue;
+        }
+
+        float value = snap->values[_fieldSlots[i]];
+        if (acc.count == 0) {
+            acc.min = value;
+            acc.max = value;
+            acc.mean = 0.0;
+            acc.m2 = 0.0;
+        } else {
+            if (value < acc.min) acc.min = value;
+            if (value > acc.max) acc.max = value;
+        }
+        acc.last = value;
+        acc.count++;
+        double delta = value - acc.mean;
+        acc.mean += delta / acc.count;
+        acc.m2 += delta * (value - acc.mean);
+    }
+}
+
+// Put each present field's statistic into _rowValues (NaN without a valid
+// sample) and start its next statistics with the next sample
+void SDCardLogger::collectValues(uint64_t present) {
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        if (!(present & ((uint64_t)1 << i))) {
+            continue;
+        }
+        FieldAccumulator& acc = _fieldAccumulators[i];
+        float value = NAN;
+        if (acc.count > 0) {
+            switch (fieldStatistic(i)) {
+                case BINLOG_STAT_MEAN:   value = acc.mean; break;
+                case BINLOG_STAT_MIN:    value = acc.min; break;
+                case BINLOG_STAT_MAX:    value = acc.max; break;
+                case BINLOG_STAT_STDDEV: value = sqrt(acc.m2 / acc.count); break;
+                default:                 value = acc.last; break;
+            }
+        }
+        _rowValues[i] = value;
+        acc.stale = true;
+    }
+}
+
+void SDCardLogger::restartStatistics() {
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        _fieldAccumulators[i].count = 0;
+        _fieldAccumulators[i].stale = false;
+    }
+    for (unsigned int g = 0; g < _rateGroupCount; g++) {
+        _rateGroups[g].tickValid = false;
+    }
+}
+
+// A field's statistic as logged. Unless the field names one, it is the
+// mean when the field is sampled within its interval and the sample
+// otherwise.
+uint8_t SDCardLogger::fieldStatistic(unsigned int field) {
+    uint8_t statistic = _fieldStatistics[field];
+    if (statistic != LOG_STAT_DEFAULT) {
+        return statistic;
+    }
+    return _sampleInterval > 0 && _sampleInterval < fieldInterval(field)
+           ? BINLOG_STAT_MEAN : BINLOG_STAT_LAST;
+}
+
+// Store _rowValues of the present fields in row index of buf. With
+// merged > 0 the row already holds that many records and the new one is
+// folded in by statistic: means are averaged, minimums and maximums kept,
+// and point samples and standard deviations (which can't be combined
+// without the means) take the newest value.
+bool SDCardLogger::takeMeasurement(LogBuffer& buf, unsigned int index, uint64_t present,
+                                   unsigned int merged) {
+    present &= allFields();
+    uint64_t had = merged > 0 ? buf.present[index] : 0;
+
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        uint64_t bit = (uint64_t)1 << i;
+        float& cell = fieldColumn(buf, i)[index];
+        if (!(present & bit)) {
+            if (!(had & bit)) cell = NAN;  // Not sampled for this row
+            continue;
+        }
+
+        float value = _rowValues[i];
+        if (isnan(value)) {
+            if (!(had & bit)) cell = NAN;
+        } else if (!(had & bit) || isnan(cell)) {
+            cell = value;
+        } else {
+            switch (fieldStatistic(i)) {
+                case BINLOG_STAT_MEAN: cell += (value - cell) / (merged + 1); break;
+                case BINLOG_STAT_MIN:  if (value < cell) cell = value; break;
+                case BINLOG_STAT_MAX:  if (value > cell) cell = value; break;
+                default:               cell = value; break;
+            }
+        }
+    }
+    buf.present[index] = had | present;
+
+    buf.time[index] = _timeManager.getUnixTime();
+
+    // Capture current kWh value (Phase A)
+    if (_energyAccumulator) {
+        buf.kWh[index] = _energyAccumulator->getAccumulatedEnergy(0);
+    } else {
+        buf.kWh[index] = 0.0;
+    }
+
+    return true;
+}
+
+// Shift every column down one row, discarding the oldest record
+void SDCardLogger::dropOldest(LogBuffer& buf) {
+    unsigned int n = buf.count - 1;
+    memmove(buf.kWh, buf.kWh + 1, n * sizeof(double));
+    memmove(buf.present, buf.present + 1, n * sizeof(uint64_t));
+    memmove(buf.time, buf.time + 1, n * sizeof(time_t));
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        float* column = fieldColumn(buf, i);
+        memmove(column, column + 1, n * sizeof(float));
+    }
+    buf.count = n;
+}
+
+
+void SDCardLogger::countDropped(uint32_t count) {
+    portENTER_CRITICAL(&_statsMux);
+    _droppedRecords += count;
+    portEXIT_CRITICAL(&_statsMux);
+}
+
+bool SDCardLogger::logMeasurement(uint64_t present) {
+    if (!_initialized || _writeProtected || !_timeManager.isRTCValid()) {
+        return false;
     }
     
     // Check if buffer is allocated
-    if (_buffer == nullptr || _bufferSize == 0) {
+    if (_fill->block == nullptr || _bufferSize == 0) {
         Serial.println("ERROR: Buffer not allocated");
         return false;
     }
     
+    collectValues(present);
+
+    // Deadband logging: a sample inside every field's band is not recorded
+    if (_deadbandEnabled) {
+        time_t now = _timeManager.getUnixTime();
+        if (!leavesDeadband(now, present)) {
+            _suppressedRecords++;
+            return true;
+        }
+        updateDeadbandRef(now, present);
+    }
+    
+    // Still full: the writer hasn't taken the previous buffer yet
+    if (_fill->count >= _bufferSize) {
+        switch (_overflowPolicy) {
+            case LOG_OVERFLOW_BLOCK:
+                _blockedWaits++;
+                handOff(portMAX_DELAY);
+                break;
+    
+            case LOG_OVERFLOW_DROP_OLDEST:
+                dropOldest(*_fill);
+                countDropped(1);
+                break;
+    
+            case LOG_OVERFLOW_AGGREGATE:
+                _aggregateCount++;
+                _aggregatedRecords++;
+                _logCount++;
+                return takeMeasurement(*_fill, _fill->count - 1, present, _aggregateCount);
+        }
+    }
+    
     // Take measurement and add to buffer
-    if (!takeMeasurement(_buffer[_bufferIndex])) {
+    if (!takeMeasurement(*_fill, _fill->count, present)) {
         return false;
     }
     
-    _bufferIndex++;
+    _fill->count++;
+    _aggregateCount = 0;
     _logCount++;
     
-    // If buffer is full, flush it
-    if (_bufferIndex >= _bufferSize) {
-        Serial.printf("Buffer full (%u measurements), flushing to SD card...\n", _bufferIndex);
-        return flushBuffer();
+    // If buffer is full, hand it to the writer
+    if (_fill->count >= _bufferSize) {
+        handOff(0);
     }
     
     return true;
 }
 
+// Whether the record in _rowValues has to be logged: the first one,
+// one with a present field outside its band around the last recorded
+// value (or changing between valid and invalid), or the heartbeat after
+// _maxLogGap
+bool SDCardLogger::leavesDeadband(time_t now, uint64_t present) {
+    if (!_deadbandPrimed || now < _deadbandRefTime) {
+        return true;
+    }
+    if ((unsigned long)(now - _deadbandRefTime) * 1000UL >= _maxLogGap) {
+        return true;
+    }
+    
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        if (!(present & ((uint64_t)1 << i))) {
+            continue;
+        }
+        float value = _rowValues[i];
+        float ref = _deadbandRef[i];
+        if (isnan(value) || isnan(ref)) {
+            if (isnan(value) != isnan(ref)) return true;
+            continue;
+        }
+        
+        float band = _fieldDeadband[i];
+        if (_fieldDeadbandRelative[i]) {
+            band = fabsf(ref) * band / 100.0f;
+        }
+        if (band > 0.0f ? fabsf(value - ref) > band : value != ref) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The fields being recorded are the new centres of their bands
+void SDCardLogger::updateDeadbandRef(time_t now, uint64_t present) {
+    for (unsigned int i = 0; i < _fieldCount; i++) {
+        if (present & ((uint64_t)1 << i)) {
+            _deadbandRef[i] = _rowValues[i];
+        } else if (!_deadbandPrimed) {
+            _deadbandRef[i] = NAN;
+        }
+    }
+    _deadbandRefTime = now;
+    _deadbandPrimed = true;
+}
+
+// Swap buffers and start writing the full one, waiting up to wait ticks
+// for the writer to finish the previous buffer. Without a writer task the
+// buffer is written here.
+bool SDCardLogger::handOff(TickType_t wait) {
+    if (_fill->count == 0) {
+        return true;
+    }
+    if (_writerIdle != nullptr && xSemaphoreTake(_writerIdle, wait) != pdTRUE) {
+        return false;  // Writer still busy
+    }
+    
+    LogBuffer* full = _fill;
+    _fill = _pending;
+    _pending = full;
+    _aggregateCount = 0;
+    
+    if (_writerTask != nullptr) {
+        xTaskNotifyGive(_writerTask);  // Writer releases _writerIdle when done
+    } else {
+        writePending();
+        releaseWriter();
+    }
+    return true;
+}
+
+void SDCardLogger::waitForWriter() {
+    if (_writerIdle != nullptr) {
+        xSemaphoreTake(_writerIdle, portMAX_DELAY);
+    }
+}
+
+// Same, giving up after wait ticks; false if the writer is still busy
+bool SDCardLogger::waitForWriter(TickType_t wait) {
+    return _writerIdle == nullptr || xSemaphoreTake(_writerIdle, wait) == pdTRUE;
+}
+
+void SDCardLogger::releaseWriter() {
+    if (_writerIdle != nullptr) {
+        xSemaphoreGive(_writerIdle);
+    }
+}
+
+void SDCardLogger::writerTaskEntry(void* arg) {
+    SDCardLogger* logger = (SDCardLogger*)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        logger->writePending();
+        logger->releaseWriter();
+    }
+}
+
+// Write _pending to the card; runs on the writer task (or inline without one)
+void SDCardLogger::writePending() {
+    unsigned int count = _pending->count;
+    if (count == 0) {
+        return;
+    }
+    
+    // The bus is held like on loop(), so a metering read queued meanwhile
+    // gets it at the next sector rather than after the whole flush
+    unsigned long startTime = millis();
+    if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+    bool success = _initialized && !_writeProtected && writeBufferToFile(*_pending, true);
+    if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+    unsigned long duration = millis() - startTime;
+    
+    recordFlushTime(duration);
+    
+    if (success) {
+        Serial.printf("Flushed %u measurements to SD card in %lu ms\n", count, duration);
+        feedRollup(*_pending);
+    } else {
+        Serial.printf("ERROR: Failed to write %u measurements to SD card\n", count);
+        countDropped(count);
+    }
+    _pending->count = 0;
+}
+
+// Write everything buffered right now, on the calling task (power loss,
+// logging stopped). Waits for a background write in progress first.
 bool SDCardLogger::flushBuffer() {
-    if (_bufferIndex == 0) {
+    waitForWriter();
+    
+    if (_fill->count == 0) {
+        releaseWriter();
         return true;  // Nothing to flush
     }
     
     if (!_initialized || _writeProtected) {
         Serial.println("Cannot flush: SD card not ready or write protected");
+        releaseWriter();
         return false;
     }
     
     unsigned long startTime = millis();
-    bool success = writeBufferToFile(_buffer, _bufferIndex);
+    if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+    bool success = writeBufferToFile(*_fill, true);
+    if (success) feedRollup(*_fill);
+    if (_busArbiter) _busArbiter->release(BUS_STORAGE);
     unsigned long duration = millis() - startTime;
     
     if (success) {
-        Serial.printf("Flushed %u measurements to SD card in %lu ms\n", _bufferIndex, duration);
-        
-        for (unsigned int i = 0; i < _bufferIndex; i++) {
-            freeMeasurementFields(_buffer[i]);
-        }
-        
-        _bufferIndex = 0;  // Reset buffer
+        Serial.printf("Flushed %u measurements to SD card in %lu ms\n", _fill->count, duration);
+        _fill->count = 0;  // Reset buffer
+        _aggregateCount = 0;
     } else {
         Serial.println("ERROR: Failed to flush buffer to SD card");
     }
     
+    releaseWriter();
+    return success;
+}
+
+// yieldToMetering: give the bus up between records and sectors; callers
+// hold BUS_STORAGE (on loop() or the writer task) and _writerIdle, which
+// also guards the open log file.
+bool SDCardLogger::writeBufferToFile(LogBuffer& buf, bool yieldToMetering) {
+    _yieldDuringWrite = yieldToMetering;
+    bool success = writeRecords(buf, yieldToMetering);
+    _yieldDuringWrite = false;
     return success;
 }
 
-bool SDCardLogger::writeBufferToFile(Measurement* data, unsigned int count) {
+bool SDCardLogger::writeRecords(LogBuffer& buf, bool yieldToMetering) {
+    unsigned int count = buf.count;
     if (count == 0) {
         return true;
     }
     
-    // Get date from first measurement
-    time_t firstTime = data[0].timestamp;
-    struct tm* timeinfo = localtime(&firstTime);
-    int year = timeinfo->tm_year + 1900;
-    int month = timeinfo->tm_mon + 1;
-    int day = timeinfo->tm_mday;
+    bool binary = (_logFormat == LOG_FORMAT_BINARY);
+    
+    // Write all measurements in buffer
+    for (unsigned int i = 0; i < count; i++) {
+        // Switch files when the record falls outside the open file's day
+        time_t t = buf.time[i];
+        if (!_logFile || t >= _nextMidnight || t < _dayStart) {
+            if (!openLogFile(t)) {
+                return false;
+            }
+            if (yieldToMetering) yieldBus();
+        }
+        if (!indexRecord(t)) {
+            closeLogFile();
+            return false;
+        }
+        
+        if (binary) {
+            if (!appendBinaryRecord(_logFile, buf, i)) {
+                closeLogFile();
+                return false;
+            }
+            if (yieldToMetering) yieldBus();
+            continue;
+        }
+
+        // Format the CSV line into the write block - dynamic fields; fields
+        // not sampled for this record (multi-rate) are left empty
+        char text[LOG_MAX_NUMBER_CHARS + 1];
+        bool ok = true;
+        for (unsigned int j = 0; j < _fieldCount && ok; j++) {
+            size_t len = 0;
+            if (j > 0) text[len++] = ',';
+
+            float value = fieldColumn(buf, j)[i];
+            if (!(buf.present[i] & ((uint64_t)1 << j))) {
+                // Empty cell
+            } else if (!isnan(value)) {
+                // Decimal places were chosen in setLogFields()
+                len += formatFixed(&text[len], value, _fieldDecimals[j]);
+            } else {
+                memcpy(&text[len], "NaN", 3);  // Invalid reading
+                len += 3;
+            }
+            ok = appendToBlock(_logFile, text, len);
+        }
+
+        // kWh (3 decimal places) from buffered measurement
+        text[0] = ',';
+        size_t len = 1 + formatFixed(&text[1], buf.kWh[i], 3);
+        ok = ok && appendToBlock(_logFile, text, len);
+
+        // Timestamp
+        text[0] = ',';
+        len = 1 + formatFixed(&text[1], (double)buf.time[i], 0);
+        text[len++] = '\n';
+        ok = ok && appendToBlock(_logFile, text, len);
+
+        if (!ok) {
+            closeLogFile();
+            return false;
+        }
+
+        // Let due metering reads in between records
+        if (yieldToMetering) yieldBus();
+    }
+    
+    if (binary ? !flushBinaryBlock(_logFile) : !writeBlock(_logFile, true)) {
+        closeLogFile();
+        return false;
+    }
+    // The file stays open: record the new logical end and push it to the
+    // card now, so a reset doesn't lose what was written
+    if (!commitLogicalEnd()) {
+        closeLogFile();
+        return false;
+    }
+    _logFile.flush();
+    writeIndexEntries();
+    return true;
+}
+
+// Open (creating if needed) the log file for the day containing t, closing
+// the previous one. Apart from the rollups, the only place that walks the
+// directory tree or calls localtime_r (this may run on the writer task).
+bool SDCardLogger::openLogFile(time_t t) {
+    closeLogFile(true);
+    
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+    int year = timeinfo.tm_year + 1900;
+    int month = timeinfo.tm_mon + 1;
+    int day = timeinfo.tm_mday;
+    
+    // Records outside the day go to another file
+    logDayBounds(t, &_dayStart, &_nextMidnight);
     
     // Ensure folder structure exists
     if (!ensureFolderStructure(year, month, day)) {
@@ -720,90 +1944,688 @@ bool SDCardLogger::writeBufferToFile(Measurement* data, unsigned int count) {
     String filepath = getCurrentLogPath(year, month, day);
     
     // Check if file exists, create with header if not
-    if (!SD.exists(filepath)) {
+    bool created = !SD.exists(filepath);
+    if (created) {
         if (!writeHeaderIfNeeded(filepath)) {
             return false;
         }
+
+        // A new day: trim yesterday's file in case it was never closed
+        // cleanly (power loss before midnight)
+        time_t yesterday = _dayStart - 1;
+        struct tm prev;
+        localtime_r(&yesterday, &prev);
+        trimLogFile(getCurrentLogPath(prev.tm_year + 1900, prev.tm_mon + 1, prev.tm_mday));
+    } else if (_logFormat != LOG_FORMAT_BINARY) {
+        // Appending to a CSV: drop a torn last line first (or the extent
+        // of a preallocated one from older firmware)
+        trimLogFile(filepath);
+    }
+    
+    // Open for update: writes go to the logical end, not the end of the extent
+    _logFile = SD.open(filepath, "r+");
+    if (!_logFile) {
+        Serial.printf("Failed to open %s for writing\n", filepath.c_str());
+        return false;
+    }
+    _logFilePath = filepath;
+    if (created) {
+        _retention.charge(0, _logFile.size());
+    }
+    
+    // Resume after the last intact commit (or line, for a plain file)
+    bool preallocated;
+    _extentSize = _logFile.size();
+    _logicalEnd = recoverLogicalEnd(_logFile, filepath, &_lastCommit, &preallocated);
+    if (!preallocated) {
+        _extentSize = 0;  // Commit area still to be written
+    }
+    _commitStart = _logicalEnd;
+    _commitCrc = 0;
+    
+    // Reserve the rest of the day in one go. CSV logs stay plain files:
+    // they are opened straight off the card, where the unwritten part of
+    // an extent would read as garbage after the last line.
+    bool reserved = _logFormat != LOG_FORMAT_BINARY || reserveExtent(estimateExtent(t));
+    if (!reserved || !_logFile.seek(_logicalEnd)) {
+        closeLogFile();
+        return false;
+    }
+    startBlock(_logFile);
+    
+    // Field list changed on a day whose binary file already existed
+    size_t headerStart = 0;
+    size_t headerSize = created ? _logicalEnd : 0;
+    if (_logFormat == LOG_FORMAT_BINARY && _binaryHeaderDirty) {
+        headerStart = _logFile.position();
+        if (!writeBinaryHeader(_logFile)) {
+            closeLogFile();
+            return false;
+        }
+        headerSize = _logFile.position() - headerStart;
+    }
+    // Staging is empty whenever this runs, so _writeBlock is free
+    _index.open(filepath, _logFile, _logicalEnd, _logFormat == LOG_FORMAT_CSV, created,
+                headerStart, headerSize, _writeBlock, LOG_WRITE_BLOCK_SIZE);
+    return true;
+}
+
+// Write out anything staged and close the open log file, if any. With
+// trim, the preallocated space past the data is released (rollover,
+// logging stopped); otherwise it stays reserved for a later reopen.
+// Callers hold _writerIdle.
+void SDCardLogger::closeLogFile(bool trim) {
+    if (!_logFile) {
+        return;
+    }
+    if (_logFormat == LOG_FORMAT_BINARY) {
+        flushBinaryBlock(_logFile);
+    } else {
+        writeBlock(_logFile, true);
+    }
+    commitLogicalEnd();
+    _logFile.close();
+    writeIndexEntries();
+    _index.close();
+    
+    if (trim) {
+        trimLogFile(_logFilePath);
+    }
+}
+
+// File size to reserve for the binary log of the day containing t: the
+// data so far plus the records still to come at the current interval,
+// rounded up to whole allocation units
+size_t SDCardLogger::estimateExtent(time_t t) {
+    size_t recordBytes = binaryRecordSize() + 1;  // + a share of the block header
+    
+    // One record per interval of the fastest field (sparse records take
+    // less, and the extent is trimmed at rollover anyway)
+    unsigned long interval = recordInterval();
+    unsigned long records = (unsigned long)(_nextMidnight - t) * 1000UL / (interval > 0 ? interval : 1000);
+    uint64_t size = (uint64_t)_logicalEnd + (uint64_t)records * recordBytes + BINLOG_COMMIT_AREA;
+    if (size > LOG_PREALLOC_MAX) {
+        size = LOG_PREALLOC_MAX;
+    }
+    if (size < _logicalEnd + LOG_PREALLOC_ALIGN + BINLOG_COMMIT_AREA) {
+        size = _logicalEnd + LOG_PREALLOC_ALIGN + BINLOG_COMMIT_AREA;
+    }
+    return ((size + LOG_PREALLOC_ALIGN - 1) / LOG_PREALLOC_ALIGN) * LOG_PREALLOC_ALIGN;
+}
+
+// Grow the open file to size bytes. Writing the commit area at the new
+// end makes FAT allocate the whole cluster chain now rather than one
+// cluster at a time during the day. The last commit moves along; the
+// other slot is cleared so stale sectors can't pass for a commit.
+bool SDCardLogger::reserveExtent(size_t size) {
+    if (size <= _extentSize) {
+        return true;
+    }
+    
+    // Staging is empty whenever this runs, so _writeBlock is free
+    size_t oldSize = _logFile.size();
+    memset(_writeBlock, 0, BINLOG_COMMIT_AREA);
+    binlogPutCommit(&_writeBlock[(_lastCommit.sequence % 2) * BINLOG_COMMIT_SLOT_SIZE], _lastCommit);
+    if (!_logFile.seek(size - BINLOG_COMMIT_AREA) ||
+        _logFile.write(_writeBlock, BINLOG_COMMIT_AREA) != BINLOG_COMMIT_AREA) {
+        Serial.printf("Failed to preallocate %s\n", _logFilePath.c_str());
+        return false;
+    }
+    _retention.charge(oldSize, size);
+    _extentSize = size;
+    return true;
+}
+
+// Commit everything written since the last commit: record the current
+// position as the logical end, with the CRC of the new data, in the next
+// commit slot. Grows the extent first if the data is getting close to
+// it. Leaves the file positioned at the logical end.
+bool SDCardLogger::commitLogicalEnd() {
+    _logicalEnd = _logFile.position();
+    if (_logicalEnd == _commitStart) {
+        return true;  // Nothing new
+    }
+    if (_extentSize == 0) {
+        // A plain CSV file ends where its data does
+        _retention.charge(_commitStart, _logicalEnd);
+        _commitStart = _logicalEnd;
+        return true;
+    }
+    
+    if (_logicalEnd + LOG_PREALLOC_ALIGN + BINLOG_COMMIT_AREA > _extentSize) {
+        // More data than estimated (e.g. a shorter interval)
+        if (!reserveExtent(_extentSize + LOG_PREALLOC_ALIGN)) {
+            return false;
+        }
+    }
+    
+    BinlogCommit commit;
+    commit.sequence = _lastCommit.sequence + 1;
+    commit.logicalEnd = _logicalEnd;
+    commit.blockStart = _commitStart;
+    commit.blockCrc = _commitCrc;
+    
+    uint8_t record[BINLOG_COMMIT_SIZE];
+    binlogPutCommit(record, commit);
+    size_t slot = _extentSize - BINLOG_COMMIT_AREA + (commit.sequence % 2) * BINLOG_COMMIT_SLOT_SIZE;
+    if (!_logFile.seek(slot) || _logFile.write(record, sizeof(record)) != sizeof(record) ||
+        !_logFile.seek(_logicalEnd)) {
+        return false;
     }
     
-    // Open file for appending
-    File file = SD.open(filepath, FILE_APPEND);
+    _lastCommit = commit;
+    _commitStart = _logicalEnd;
+    _commitCrc = 0;
+    return true;
+}
+
+// Where the intact data of a log file ends (LogRecovery.h). The scan
+// follows the file's extension: at boot _logFormat is still the default,
+// and the logs of other days may be in the other format.
+// lastCommit receives the commit to continue the sequence from.
+size_t SDCardLogger::recoverLogicalEnd(File& file, const String& path, BinlogCommit* lastCommit,
+                                       bool* preallocated) {
+    LogRecovery recovery = logRecover(file, logPathIsCsv(path.c_str()), _writeBlock, LOG_WRITE_BLOCK_SIZE);
+    if (recovery.tornCommit != 0) {
+        Serial.printf("WARNING: Log commit %lu of %s is torn, falling back\n",
+                      (unsigned long)recovery.tornCommit, path.c_str());
+    }
+    *lastCommit = recovery.lastCommit;
+    *preallocated = recovery.preallocated;
+    return recovery.end;
+}
+
+// Write log data; what goes to the open log file counts towards the CRC
+// of the next commit. A sector at a time, yielding the bus in between
+// during a buffer write.
+bool SDCardLogger::writeData(File& file, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        size_t n = (len > LOG_SECTOR_SIZE) ? LOG_SECTOR_SIZE : len;
+        if (file.write(data, n) != n) {
+            return false;
+        }
+        if (&file == &_logFile) {
+            _commitCrc = binlogCrc32(data, n, _commitCrc);
+        }
+        data += n;
+        len -= n;
+        if (len > 0 && _yieldDuringWrite) yieldBus();
+    }
+    return true;
+}
+
+// Cut a closed log file back to its intact data: a preallocated one to
+// its last commit, releasing the extent, and a plain CSV one to its last
+// complete line. Plain binary files are left alone.
+void SDCardLogger::trimLogFile(const String& path) {
+    File file = SD.open(path, FILE_READ);
     if (!file) {
-        Serial.printf("Failed to open %s for appending\n", filepath.c_str());
+        return;
+    }
+    
+    size_t size = file.size();
+    BinlogCommit commit;
+    bool preallocated;
+    size_t end = recoverLogicalEnd(file, path, &commit, &preallocated);
+    file.close();
+    
+    if ((!preallocated && !logPathIsCsv(path.c_str())) || end >= size) {
+        return;
+    }
+    // The Arduino File API has no truncate; go through the VFS path
+    String vfsPath = String(LOG_SD_MOUNT_POINT) + path;
+    if (truncate(vfsPath.c_str(), end) != 0) {
+        Serial.printf("Failed to trim %s\n", path.c_str());
+        return;
+    }
+    _retention.charge(size, end);
+}
+
+// Note an index entry for the record about to be written, every
+// LOG_INDEX_STRIDE records. A binary entry has to point at a block, so
+// the block in progress goes out first.
+bool SDCardLogger::indexRecord(time_t t) {
+    if (!_index.wantsEntry(t)) {
+        return true;
+    }
+    
+    size_t offset;
+    if (_logFormat == LOG_FORMAT_BINARY) {
+        if (!flushBinaryBlock(_logFile)) {
+            return false;
+        }
+        offset = _logFile.position();
+    } else {
+        offset = _blockFileOffset + _blockLength;
+    }
+    _index.addEntry(t, offset);
+    return true;
+}
+
+// Append the index entries noted during a flush that point into
+// committed data
+void SDCardLogger::writeIndexEntries() {
+    if (_powerLost) {
+        _index.dropEntries();  // The emergency flush has more important writes
+        return;
+    }
+    _index.writeEntries(_logicalEnd);
+}
+
+bool SDCardLogger::findLogRanges(time_t from, time_t to, LogRange* ranges, unsigned int maxRanges,
+                                 unsigned int* count) {
+    *count = 0;
+    if (!_initialized || from > to) {
+        return true;
+    }
+    
+    // The writer appends to the open log and its index. This runs in a
+    // web request on loop(), so a long flush isn't waited out.
+    if (!waitForWriter(pdMS_TO_TICKS(LOG_READER_WAIT_MS))) {
         return false;
     }
+    if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
     
-    // Write all measurements in buffer
-    for (unsigned int i = 0; i < count; i++) {
-        // Check if we need to switch to a new file (date changed)
-        struct tm* currentTime = localtime(&data[i].timestamp);
-        int currentDay = currentTime->tm_mday;
+    time_t dayStart, dayEnd;
+    for (time_t day = from; day <= to && *count < maxRanges; day = dayEnd) {
+        logDayBounds(day, &dayStart, &dayEnd);
+        struct tm timeinfo;
+        localtime_r(&day, &timeinfo);
+        String path = getCurrentLogPath(timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday);
         
-        if (currentDay != day) {
-            // Close current file and open new one for new day
-            file.close();
-            
-            year = currentTime->tm_year + 1900;
-            month = currentTime->tm_mon + 1;
-            day = currentDay;
-            
-            if (!ensureFolderStructure(year, month, day)) {
-                return false;
-            }
-            
-            filepath = getCurrentLogPath(year, month, day);
-            
-            if (!SD.exists(filepath)) {
-                if (!writeHeaderIfNeeded(filepath)) {
-                    return false;
-                }
-            }
-            
-            file = SD.open(filepath, FILE_APPEND);
-            if (!file) {
-                return false;
-            }
+        // The day may have been logged in the other format too
+        String other = path.substring(0, path.length() - 3) + (_logFormat == LOG_FORMAT_BINARY ? "csv" : "bin");
+        if (resolveLogRange(path, from, to, ranges[*count])) {
+            (*count)++;
+        }
+        if (*count < maxRanges && resolveLogRange(other, from, to, ranges[*count])) {
+            (*count)++;
+        }
+    }
+    
+    if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+    releaseWriter();
+    return true;
+}
+
+bool SDCardLogger::getLogLength(const String& path, size_t* length) {
+    *length = 0;
+    if (!_initialized) {
+        return true;
+    }
+    if (!waitForWriter(pdMS_TO_TICKS(LOG_READER_WAIT_MS))) {
+        return false;
+    }
+    if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+    if (!findLogicalEnd(path, length)) {
+        *length = 0;
+    }
+    if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+    releaseWriter();
+    return true;
+}
+
+// Where the committed data of a log ends; false if there's no such file.
+// Callers hold _writerIdle.
+bool SDCardLogger::findLogicalEnd(const String& path, size_t* end) {
+    if (_logFile && path == _logFilePath) {
+        *end = _logicalEnd;
+        return true;
+    }
+    File log = SD.open(path, FILE_READ);
+    if (!log) {
+        return false;
+    }
+    BinlogCommit commit;
+    bool preallocated;
+    *end = recoverLogicalEnd(log, path, &commit, &preallocated);
+    log.close();
+    return true;
+}
+
+// The stretch of one log holding [from, to] (LogIndex::findRange()).
+// False if the log doesn't exist or has nothing there. Callers hold
+// _writerIdle.
+bool SDCardLogger::resolveLogRange(const String& path, time_t from, time_t to, LogRange& range) {
+    size_t end;
+    if (!findLogicalEnd(path, &end)) {
+        return false;
+    }
+    return _index.findRange(path, end, from, to, range);
+}
+
+// Boot-time check of today's logs, in either format (this runs before
+// the settings say which one is in use). A preallocated binary log keeps
+// its extent: openLogFile() resumes after the last intact commit and
+// writes over whatever a power cut left past it. A CSV file is cut back
+// to its last complete line (or last commit, if older firmware
+// preallocated it); a plain binary one is left as it is.
+void SDCardLogger::recoverTodaysLog() {
+    static const char* const extensions[] = { "csv", "bin" };
+    time_t now = _timeManager.getUnixTime();
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+    
+    waitForWriter();
+    for (unsigned int i = 0; i < 2; i++) {
+        char path[64];
+        sprintf(path, "/data/%04d/%02d/%02d.%s", timeinfo.tm_year + 1900, timeinfo.tm_mon + 1,
+                timeinfo.tm_mday, extensions[i]);
+        File file = SD.open(path, FILE_READ);
+        if (!file) {
+            continue;  // Nothing logged today in this format
         }
         
-        // Write CSV line - dynamic fields
-        for (unsigned int j = 0; j < data[i].fieldCount; j++) {
-            if (j > 0) file.print(",");
-
-            if (data[i].fields[j].valid) {
-                // Get register info for proper formatting
-                const RegisterDescriptor* reg = _regAccess.getRegisterInfo(data[i].fields[j].name.c_str());
-
-                if (reg != nullptr) {
-                    // Format based on register type
-                    if (reg->regType == DT_INT16 || reg->regType == DT_INT32) {
-                        file.printf("%.0f", data[i].fields[j].value);  // Integer types
-                    } else {
-                        // Determine decimal places based on typical values
-                        if (data[i].fields[j].name.indexOf("rms") >= 0) {
-                            file.printf("%.3f", data[i].fields[j].value);  // Current (3 decimals)
-                        } else {
-                            file.printf("%.2f", data[i].fields[j].value);  // Default (2 decimals)
-                        }
-                    }
-                } else {
-                    file.printf("%.2f", data[i].fields[j].value);  // Default format
-                }
+        unsigned long start = millis();
+        size_t size = file.size();
+        BinlogCommit commit;
+        bool preallocated;
+        size_t end = recoverLogicalEnd(file, path, &commit, &preallocated);
+        file.close();
+        
+        if (preallocated && !logPathIsCsv(path)) {
+            Serial.printf("Recovered %s: %u bytes of data, resuming in place (%lu ms)\n", path,
+                          (unsigned)end, millis() - start);
+        } else if (end < size) {
+            String vfsPath = String(LOG_SD_MOUNT_POINT) + path;
+            if (truncate(vfsPath.c_str(), end) != 0) {
+                Serial.printf("ERROR: Failed to truncate %s\n", path);
             } else {
-                file.print("NaN");  // Invalid reading
+                _retention.charge(size, end);
+                Serial.printf("Recovered %s: kept %u bytes, cut %u torn or unused in %lu ms\n", path,
+                              (unsigned)end, (unsigned)(size - end), millis() - start);
             }
         }
+    }
+    releaseWriter();
+}
+
+// One step of free space retention: below the low watermark, delete the
+// oldest day's logs (or an emptied directory) until the high watermark is
+// reached. Runs on loop() while the writer is idle, so a deletion never
+// holds up a flush for longer than one step.
+void SDCardLogger::retentionStep() {
+    if (_writerIdle != nullptr && xSemaphoreTake(_writerIdle, 0) != pdTRUE) {
+        return;  // Writing; try again next time
+    }
+    
+    _retention.chargeBytes(_rollup.takeSizeChange());
+    if (_retention.check()) {
+        // Keep the logs the rollups still have to be rebuilt from
+        if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+        _retention.deleteOldest(_timeManager.getUnixTime(), _logFilePath, _rollupSync.keepFrom());
+        if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+    }
+    
+    releaseWriter();
+}
+
+// Add the records just written to the rollups, once they're in step
+void SDCardLogger::feedRollup(LogBuffer& buf) {
+    if (!_rollupSync.isSynced()) {
+        return;  // The replay will get to them
+    }
+    for (unsigned int i = 0; i < buf.count; i++) {
+        for (unsigned int j = 0; j < _fieldCount; j++) {
+            _rollupRow[j] = fieldColumn(buf, j)[i];
+        }
+        _rollup.add(buf.time[i], buf.kWh[i], _rollupRow, buf.present[i]);
+    }
+}
+
+// One step of bringing the rollups into step: the first finds where the
+// rollup files end, each later one replays a block of the raw logs. Runs
+// on loop() while the writer is idle, which keeps the open log file and
+// _writeBlock to itself.
+void SDCardLogger::replayRollupStep() {
+    if (_writerIdle != nullptr && xSemaphoreTake(_writerIdle, 0) != pdTRUE) {
+        return;  // Writing; try again next time
+    }
+    if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+    
+    time_t now = _timeManager.getUnixTime();
+    if (!_rollupSync.isStarted()) {
+        uint8_t statistics[LOG_MAX_FIELDS];
+        for (unsigned int i = 0; i < _fieldCount; i++) {
+            statistics[i] = fieldStatistic(i);
+        }
+        _rollupSync.start(now, _logFormat == LOG_FORMAT_BINARY, _fieldCount, _fieldNames, statistics,
+                          _fieldDecimals, generateCSVHeader());
+    } else {
+        _rollupSync.replayBlock(now, _logFile, _logFile ? _logFilePath : String(""), _logicalEnd);
+        _rollup.writeQueued(ROLLUP_QUEUE_ROWS);
+    }
+    
+    if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+    releaseWriter();
+}
 
-        // Write kWh (3 decimal places) from buffered measurement
-        file.printf(",%.3f", data[i].kWh);
+// Write a few of the rollup rows the writer has queued, on loop() while
+// the writer is idle, so the rollup files never hold up a flush
+void SDCardLogger::writeRollupStep() {
+    if (_writerIdle != nullptr && xSemaphoreTake(_writerIdle, 0) != pdTRUE) {
+        return;  // Writing; try again next time
+    }
+    if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+    _rollup.writeQueued(LOG_ROLLUP_ROWS_PER_STEP);
+    if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+    releaseWriter();
+}
 
-        // Write timestamp
-        file.printf(",%ld\n", data[i].timestamp);
+void SDCardLogger::recordFlushTime(unsigned long ms) {
+    _lastFlushMs = ms;
+    if (ms > _maxFlushMs) {
+        _maxFlushMs = ms;
     }
+    _flushCount++;
     
-    file.close();
+    _flushHistory[_flushHistoryCount % LOG_FLUSH_HISTORY] = ms > 0xFFFF ? 0xFFFF : ms;
+    _flushHistoryCount++;
+}
+
+// Nearest-rank percentile of the recent flush durations
+unsigned long SDCardLogger::getFlushPercentile(uint8_t percent) {
+    unsigned int n = _flushHistoryCount < LOG_FLUSH_HISTORY ? _flushHistoryCount : LOG_FLUSH_HISTORY;
+    if (n == 0) {
+        return 0;
+    }
+    
+    // Insertion sort of a copy; the writer task may be adding to the ring
+    uint16_t sorted[LOG_FLUSH_HISTORY];
+    for (unsigned int i = 0; i < n; i++) {
+        uint16_t v = _flushHistory[i];
+        unsigned int j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+    
+    unsigned int rank = (percent * n + 99) / 100;
+    if (rank == 0) rank = 1;
+    return sorted[rank - 1];
+}
+
+// Begin staging CSV text for a freshly positioned file
+void SDCardLogger::startBlock(File& file) {
+    _blockLength = 0;
+    _blockFileOffset = file.position();
+}
+
+bool SDCardLogger::appendToBlock(File& file, const char* text, size_t len) {
+    while (len > 0) {
+        size_t space = LOG_WRITE_BLOCK_SIZE - _blockLength;
+        size_t n = len < space ? len : space;
+        memcpy(&_writeBlock[_blockLength], text, n);
+        _blockLength += n;
+        text += n;
+        len -= n;
+
+        if (_blockLength == LOG_WRITE_BLOCK_SIZE && !writeBlock(file, false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Write the staged text. Unless all is set, only up to the last sector
+// boundary of the file; the partial sector stays staged for the next line.
+bool SDCardLogger::writeBlock(File& file, bool all) {
+    size_t n = _blockLength;
+    if (!all) {
+        n -= (_blockFileOffset + _blockLength) % LOG_SECTOR_SIZE;
+    }
+    if (n == 0) {
+        return true;
+    }
+
+    if (!writeData(file, _writeBlock, n)) {
+        _blockLength = 0;
+        return false;
+    }
+    memmove(_writeBlock, &_writeBlock[n], _blockLength - n);
+    _blockLength -= n;
+    _blockFileOffset += n;
+    return true;
+}
+
+// Fields with a plain linear scale are stored as the raw register value;
+// anything else (conversion functions, unresolved names, means and
+// deviations) as the float
+bool SDCardLogger::fieldStoresRaw(unsigned int field) {
+    const RegisterDescriptor* reg = _fieldRegs[field];
+    if (reg == nullptr || reg->scale == 0.0f) {
+        return false;
+    }
+    uint8_t statistic = fieldStatistic(field);
+    if (statistic == BINLOG_STAT_MEAN || statistic == BINLOG_STAT_STDDEV) {
+        return false;
+    }
+    return !(reg->convertFunc && reg->regCount == 1);
+}
+
+bool SDCardLogger::writeBinaryHeader(File& file) {
+    uint8_t header[BINLOG_FILE_HEADER_SIZE];
+    memcpy(header, BINLOG_FILE_MAGIC, BINLOG_MAGIC_SIZE);
+    binlogPut16(&header[4], BINLOG_VERSION);
+    binlogPut16(&header[6], _fieldCount);
+    binlogPut16(&header[8], binaryRecordSize());
+    binlogPut32(&header[10], recordInterval());
+    binlogPut32(&header[14], _deadbandEnabled ? _maxLogGap : 0);
+    binlogPut16(&header[18], _multiRate ? BINLOG_FLAG_SPARSE : 0);
+    if (!writeData(file, header, sizeof(header))) {
+        return false;
+    }
+
+    for (unsigned int j = 0; j < _fieldCount; j++) {
+        const RegisterDescriptor* reg = _fieldRegs[j];
+        uint8_t desc[BINLOG_FIELD_DESC_SIZE];
+        desc[0] = fieldStoresRaw(j) ? BINLOG_FIELD_RAW : BINLOG_FIELD_FLOAT;
+        desc[1] = _fieldDecimals[j];
+        binlogPutFloat(&desc[2], reg != nullptr ? reg->scale : 0.0f);
+        binlogPut32(&desc[6], fieldInterval(j));
+        desc[10] = fieldStatistic(j);
+        if (!writeData(file, desc, sizeof(desc))) {
+            return false;
+        }
+
+        const char* strings[3] = {
+            _fieldNames[j].c_str(),
+            reg != nullptr && reg->friendlyName != nullptr ? reg->friendlyName : "",
+            reg != nullptr && reg->unit != nullptr ? reg->unit : ""
+        };
+        for (int k = 0; k < 3; k++) {
+            size_t len = strlen(strings[k]);
+            if (len > 255) len = 255;
+            uint8_t lenByte = len;
+            if (!writeData(file, &lenByte, 1) ||
+                !writeData(file, (const uint8_t*)strings[k], len)) {
+                return false;
+            }
+        }
+    }
+
+    _binaryHeaderDirty = false;
     return true;
 }
 
+// Returns the bytes written, at most binaryRecordSize()
+size_t SDCardLogger::encodeBinaryRecord(LogBuffer& buf, unsigned int index, uint8_t* out) {
+    uint8_t* start = out;
+    binlogPut32(out, (uint32_t)buf.time[index]);
+    binlogPutDouble(out + 4, buf.kWh[index]);
+    out += BINLOG_RECORD_FIXED_SIZE;
+
+    uint64_t present = buf.present[index];
+    if (_multiRate) {
+        for (unsigned int b = 0; b < (_fieldCount + 7) / 8; b++) {
+            *out++ = (present >> (8 * b)) & 0xFF;
+        }
+    }
+
+    for (unsigned int j = 0; j < _fieldCount; j++) {
+        if (_multiRate && !(present & ((uint64_t)1 << j))) {
+            continue;
+        }
+        float value = fieldColumn(buf, j)[index];
+        if (!fieldStoresRaw(j)) {
+            binlogPutFloat(out, value);
+        } else if (isnan(value)) {
+            binlogPut32(out, (uint32_t)BINLOG_RAW_INVALID);
+        } else {
+            // The buffer holds raw * scale; this recovers raw exactly
+            // for anything a register can hold below 2^24
+            binlogPut32(out, (uint32_t)(int32_t)lroundf(value / _fieldRegs[j]->scale));
+        }
+        out += BINLOG_FIELD_SIZE;
+    }
+    return out - start;
+}
+
+// Add a record to the pending block, writing the block out when the
+// largest record might not fit
+bool SDCardLogger::appendBinaryRecord(File& file, LogBuffer& buf, unsigned int index) {
+    unsigned int recordSize = binaryRecordSize();
+    if (BINLOG_BLOCK_HEADER_SIZE + recordSize > LOG_WRITE_BLOCK_SIZE) {
+        Serial.println("ERROR: Too many log fields for a binary record");
+        return false;
+    }
+
+    if (BINLOG_BLOCK_HEADER_SIZE + _binaryBlockBytes + recordSize > LOG_WRITE_BLOCK_SIZE &&
+        !flushBinaryBlock(file)) {
+        return false;
+    }
+    _binaryBlockBytes += encodeBinaryRecord(buf, index,
+                                            &_writeBlock[BINLOG_BLOCK_HEADER_SIZE + _binaryBlockBytes]);
+    _binaryBlockRecords++;
+    return true;
+}
+
+bool SDCardLogger::flushBinaryBlock(File& file) {
+    if (_binaryBlockRecords == 0) {
+        return true;
+    }
+
+    size_t payload = _binaryBlockBytes;
+    memcpy(_writeBlock, BINLOG_BLOCK_MAGIC, BINLOG_MAGIC_SIZE);
+    binlogPut16(&_writeBlock[4], _binaryBlockRecords);
+    binlogPut32(&_writeBlock[6], _lastCommit.sequence + 1);  // The commit this block goes into
+    uint32_t crc = binlogCrc32(&_writeBlock[4], 6);
+    binlogPut32(&_writeBlock[10], binlogCrc32(&_writeBlock[BINLOG_BLOCK_HEADER_SIZE], payload, crc));
+    _binaryBlockRecords = 0;
+    _binaryBlockBytes = 0;
+
+    return writeData(file, _writeBlock, BINLOG_BLOCK_HEADER_SIZE + payload);
+}
+
+
+// Hand the bus to metering if this write has held it long enough
+void SDCardLogger::yieldBus() {
+    if (_busArbiter) {
+        _busArbiter->yieldBus(BUS_STORAGE);
+    }
+}
 
 bool SDCardLogger::ensureFolderStructure(int year, int month, int day) {
     String basePath = "/data";
@@ -812,6 +2634,7 @@ bool SDCardLogger::ensureFolderStructure(int year, int month, int day) {
             Serial.println("Failed to create /data");
             return false;
         }
+        _retention.charge(0, 1);  // A cluster for the directory
     }
     
     String yearPath = basePath + "/" + String(year);
@@ -820,6 +2643,7 @@ bool SDCardLogger::ensureFolderStructure(int year, int month, int day) {
             Serial.printf("Failed to create %s\n", yearPath.c_str());
             return false;
         }
+        _retention.charge(0, 1);  // A cluster for the directory
     }
     
     char monthStr[3];
@@ -830,6 +2654,7 @@ bool SDCardLogger::ensureFolderStructure(int year, int month, int day) {
             Serial.printf("Failed to create %s\n", monthPath.c_str());
             return false;
         }
+        _retention.charge(0, 1);  // A cluster for the directory
     }
     
     return true;
@@ -837,7 +2662,8 @@ bool SDCardLogger::ensureFolderStructure(int year, int month, int day) {
 
 String SDCardLogger::getCurrentLogPath(int year, int month, int day) {
     char path[64];
-    sprintf(path, "/data/%04d/%02d/%02d.csv", year, month, day);
+    sprintf(path, "/data/%04d/%02d/%02d.%s", year, month, day,
+            _logFormat == LOG_FORMAT_BINARY ? "bin" : "csv");
     return String(path);
 }
 
@@ -848,8 +2674,17 @@ bool SDCardLogger::writeHeaderIfNeeded(const String& filepath) {
         return false;
     }
     
-    // Write CSV header with configured fields
-    file.println(generateCSVHeader());
+    if (_logFormat == LOG_FORMAT_BINARY) {
+        // Self-describing header: field descriptors, scales and units
+        if (!writeBinaryHeader(file)) {
+            Serial.printf("Failed to write header to %s\n", filepath.c_str());
+            file.close();
+            return false;
+        }
+    } else {
+        // Write CSV header with configured fields
+        file.println(generateCSVHeader());
+    }
     file.close();
     
     Serial.printf("Created new log file: %s\n", filepath.c_str());
@@ -3,31 +3,71 @@
 
 #include <SD.h>
 #include "RegisterAccess.h"
+#include "MeasurementEngine.h"
 #include "TimeManager.h"
+#include "SPIBusArbiter.h"
+#include "BinaryLogFormat.h"
+#include "LogRecovery.h"
+#include "LogNumberFormat.h"
+#include "LogRollup.h"
+#include "LogRetention.h"
+#include "LogIndex.h"
+#include "LogRollupSync.h"
 
 // Forward declaration
 class EnergyAccumulator;
 
-// Structure to hold a single measurement
+#define LOG_WRITER_STACK_SIZE 6144
+#define LOG_WRITER_PRIORITY 1
+#define LOG_SECTOR_SIZE 512
+#define LOG_WRITE_BLOCK_SIZE 1024     // RAM block records are formatted into, a multiple of LOG_SECTOR_SIZE
+#define LOG_PREALLOC_ALIGN 65536UL    // Log files are reserved in multiples of this (any FAT cluster size up to 64 KB)
+#define LOG_PREALLOC_MAX (16UL * 1024 * 1024)
+#define LOG_SD_MAX_FILES 8            // Open at once: log, index, checkpoint, rollup, downloads
+#define LOG_FLUSH_HISTORY 128         // Flush durations kept for the percentiles
+#define LOG_CHECKPOINT_PATH "/energy.chk"  // Energy totals saved by the emergency flush
+#define LOG_CHECKPOINT_MAGIC "WMEC"
+#define LOG_CHECKPOINT_SIZE 40        // magic, sequence, unixTime, 3 x kWh, CRC-32 of the rest
+#define LOG_MAX_FIELDS 64             // One bit each in a record's presence mask
+#define LOG_MAX_RATES 4               // Distinct field intervals (one engine subscription each)
+#define LOG_STAT_DEFAULT 0xFF         // No statistic given: mean when sampling within the interval, else last
+#define LOG_ROLLUP_ROWS_PER_STEP 4    // Queued rollup rows written per update()
+#define LOG_READER_WAIT_MS 100        // Longest a download request waits for the writer before giving up
 
-struct FieldValue {
-    String name;
-    float value;
-    bool valid;
+// Daily log file format
+enum LogFormat {
+    LOG_FORMAT_CSV,     // DD.csv, human readable
+    LOG_FORMAT_BINARY   // DD.bin, see BinaryLogFormat.h
 };
 
-struct Measurement {
-    FieldValue* fields;
-    unsigned int fieldCount;
-    time_t timestamp;
-    double kWh;
+// What to do with a new record when the fill buffer is full and the
+// writer task is still busy with the other one
+enum LogOverflowPolicy {
+    LOG_OVERFLOW_BLOCK,        // Wait for the writer (stalls loop())
+    LOG_OVERFLOW_DROP_OLDEST,  // Discard the oldest buffered record
+    LOG_OVERFLOW_AGGREGATE     // Fold into the newest buffered record (mean, min, max per statistic)
 };
 
-
+// Time spent in each step of the last emergency flush, in microseconds
+struct EmergencyFlushTiming {
+    bool fromInterrupt;        // Triggered by the chip's IRQ0 rather than the voltage poll
+    unsigned long detectUs;    // Interrupt to start of the flush (interrupt only)
+    unsigned long checkpointUs;
+    unsigned long writerUs;    // Waiting for a background write in progress
+    unsigned long recordsUs;
+    unsigned long unmountUs;
+    unsigned long totalUs;     // From the interrupt when there was one
+    unsigned int records;
+    bool checkpointSaved;
+    bool recordsSaved;
+};
 
 class SDCardLogger {
 public:
-    SDCardLogger(RegisterAccess& regAccess, TimeManager& timeManager, int csPin, int cdPin = -1, int wpPin = -1);
+    static const uint64_t ALL_FIELDS = ~(uint64_t)0;
+
+    SDCardLogger(RegisterAccess& regAccess, MeasurementEngine& engine, TimeManager& timeManager,
+                 int csPin, int cdPin = -1, int wpPin = -1);
     ~SDCardLogger();  // Destructor to free buffer
     
     // Initialization
@@ -41,6 +81,24 @@ public:
     void setPowerLossThreshold(float voltage);
     void enablePowerLossDetection(bool enable);
     void setEnergyAccumulator(EnergyAccumulator* accumulator) { _energyAccumulator = accumulator; }
+    void setBusArbiter(SPIBusArbiter* arbiter) { _busArbiter = arbiter; }
+    // GPIO wired to the energy chip's IRQ0 (-1: voltage polling only)
+    void setPowerFailPin(int pin) { _powerFailPin = pin; }
+    // Longest time between records when fields have a deadband (ms)
+    void setMaxLogGap(unsigned long gapMs);
+    // Sample fields this often and log statistics of the samples once per
+    // interval (ms, 0: one point sample per interval)
+    void setSampleInterval(unsigned long intervalMs);
+    // Days the 1-minute (0), 15-minute (1) and hourly (2) rollups are kept
+    // (0: forever)
+    void setRollupRetention(unsigned int level, unsigned int days) { _rollup.setRetentionDays(level, days); }
+    // Once free space falls below lowMB, delete the oldest daily logs a day
+    // at a time until highMB is free again (lowMB 0: never delete)
+    void setFreeSpaceWatermarks(unsigned int lowMB, unsigned int highMB);
+    // A reader (the web server's log download) is sending logs starting
+    // with path: retention keeps that day's logs and every later day's
+    // until it's called again with "" (loop() only)
+    void setLogsInUse(const String& path);
     
     // Card detection and handling
     void checkCardStatus();
@@ -48,11 +106,22 @@ public:
     void unmountCard();
     
     // Data logging
-    bool logMeasurement();
+    bool logMeasurement(uint64_t present = ALL_FIELDS);  // Bit per field sampled
     void enableLogging(bool enable);
     bool isLoggingEnabled() { return _loggingEnabled; }
+    // Comma-separated register names. "Name@ms" samples a field at its
+    // own interval instead of the logging interval. "Name~band" gives a
+    // field an absolute deadband, "Name~band%" one relative to the last
+    // logged value. "Name:min+mean+max" logs those statistics of the
+    // field's samples in the interval (last, mean, min, max, sd), one
+    // column each.
     bool setLogFields(const String& fieldList);
     String getLogFields();
+    // "block", "drop" (oldest) or "aggregate"
+    bool setOverflowPolicy(const String& policy);
+    // "csv" or "binary"
+    bool setLogFormat(const String& format);
+    LogFormat getLogFormat() { return _logFormat; }
     
     // Power loss handling
     void checkPowerStatus();
@@ -61,23 +130,54 @@ public:
     bool isPowerLost() { return _powerLost; }
     bool isWaitingForPowerRestoration() { return _powerLost && !_initialized; }
     bool settingsNeedReload();
+    // Apply totals left by an emergency flush; call once the accumulator is set
+    bool restoreEnergyCheckpoint();
+    const EmergencyFlushTiming* getLastEmergencyTiming() { return _emergencyCount > 0 ? &_lastEmergency : nullptr; }
     
     // Must be called in loop()
     void update();
     
     // Manual operations
     String getCurrentLogPath(int year, int month, int day);
+    // The stretches of the daily logs holding the records in [from, to],
+    // one per log file, found with a binary search of each file's time
+    // index. A stretch may take in up to LOG_INDEX_STRIDE records either
+    // side of the range; a log without an index is returned whole.
+    // count receives how many of ranges were filled in. Both calls wait
+    // up to LOG_READER_WAIT_MS for a flush in progress and return false
+    // if it is still running (the caller answers "busy").
+    bool findLogRanges(time_t from, time_t to, LogRange* ranges, unsigned int maxRanges, unsigned int* count);
+    // Bytes of data in a log file, without the preallocated space (0 if
+    // there is no such file)
+    bool getLogLength(const String& path, size_t* length);
     
     // Statistics
     unsigned long getLogCount() { return _logCount; }
     unsigned long getLastLogTime() { return _lastLogTime; }
-    unsigned int getBufferUsage() { return _bufferIndex; }
+    unsigned int getBufferUsage() { return _fill->count; }
     unsigned int getBufferSize() { return _bufferSize; }
+    unsigned long getLastFlushTime() { return _lastFlushMs; }   // ms, as seen by the writer
+    unsigned long getMaxFlushTime() { return _maxFlushMs; }
+    uint32_t getFlushCount() { return _flushCount; }
+    uint32_t getDroppedRecords() { return _droppedRecords; }    // Overflow or failed writes
+    uint32_t getAggregatedRecords() { return _aggregatedRecords; }
+    uint32_t getBlockedWaits() { return _blockedWaits; }
+    uint32_t getSuppressedRecords() { return _suppressedRecords; }  // Inside every deadband
+    uint32_t getFailedFieldReads() { return _failedFieldReads; }    // Samples a field had no valid value in
+    unsigned long getFlushPercentile(uint8_t percent);          // ms, over the last LOG_FLUSH_HISTORY flushes
+    bool isRollupSynced() { return _rollupSync.isSynced(); }    // false while rebuilding from the raw logs
+    uint32_t getRollupRows() { return _rollup.getRowsWritten(); }
+    int64_t getFreeBytes() { return _retention.getFreeBytes(); }  // Estimate; -1 when not mounted
+    bool isRetentionActive() { return _retention.isActive(); }    // Deleting logs to free space
+    uint32_t getDeletedDays() { return _retention.getDeletedDays(); }
     
 private:
     RegisterAccess& _regAccess;
+    MeasurementEngine& _engine;
     TimeManager& _timeManager;
     EnergyAccumulator* _energyAccumulator;
+    SPIBusArbiter* _busArbiter;
+    bool _yieldDuringWrite;          // writeData() may yield the bus between sectors
     int _csPin;
     int _cdPin;
     int _wpPin;
@@ -88,21 +188,181 @@ private:
     bool _loggingEnabled;
     bool _settingsNeedReload;
     
-    // Buffering
-    Measurement* _buffer;
+    // Double buffering: loop() fills one buffer while the writer task
+    // drains the other. Each is one block allocated in allocateBuffer()
+    // and laid out as columns (struct of arrays), so logging itself never
+    // touches the heap. Invalid readings are stored as NaN.
+    struct LogBuffer {
+        uint64_t* block;
+        double* kWh;
+        uint64_t* present;   // Fields sampled for each row; the rest are empty
+        time_t* time;
+        float* values;       // _fieldCount columns of _bufferSize values
+        unsigned int count;
+    };
+    LogBuffer _buffers[2];
+    LogBuffer* _fill;        // Filled by loop()
+    LogBuffer* _pending;     // Handed to the writer
     unsigned int _bufferSize;
-    unsigned int _bufferIndex;
+    float* fieldColumn(LogBuffer& buf, unsigned int field) { return &buf.values[field * _bufferSize]; }
+
+    // Writer task; _writerIdle is held while _pending is being written
+    TaskHandle_t _writerTask;
+    SemaphoreHandle_t _writerIdle;
+    LogOverflowPolicy _overflowPolicy;
+    unsigned int _aggregateCount;    // Extra records folded into the newest row
+
+    // Log file output (writer side). Records are formatted into
+    // _writeBlock and reach the card in few large writes: whole binary
+    // blocks, or CSV text in whole sectors of the file.
+    LogFormat _logFormat;
+    bool _binaryHeaderDirty;         // Field list changed since the last header was written
+    uint8_t _writeBlock[LOG_WRITE_BLOCK_SIZE];
+    unsigned int _binaryBlockRecords;
+    size_t _binaryBlockBytes;        // Record bytes staged after the block header
+    size_t _blockLength;             // CSV bytes staged in _writeBlock
+    size_t _blockFileOffset;         // File position of _writeBlock[0]
+
+    // The current day's log file stays open between flushes. It covers
+    // records in [_dayStart, _nextMidnight), so a flush only has to
+    // compare timestamps until the day rolls over.
+    File _logFile;
+    String _logFilePath;
+    time_t _dayStart;
+    time_t _nextMidnight;
+
+    // A binary log is preallocated to _extentSize bytes (a multiple of
+    // LOG_PREALLOC_ALIGN), so writes land in clusters FAT has already
+    // chained. Data ends at _logicalEnd, recorded after every flush by a
+    // commit record in the last sectors of the extent (BinaryLogFormat.h)
+    // until the file is trimmed at rollover. A CSV log is a plain file
+    // (_extentSize 0), readable as it stands whenever the card is pulled.
+    size_t _logicalEnd;
+    size_t _extentSize;
+    BinlogCommit _lastCommit;
+    size_t _commitStart;             // Data written since here is not committed yet
+    uint32_t _commitCrc;             // CRC-32 of that data
+
+    // Writer statistics. _droppedRecords is counted by both loop() and
+    // the writer task, possibly on the other core: only under _statsMux.
+    volatile unsigned long _lastFlushMs;
+    volatile unsigned long _maxFlushMs;
+    volatile uint32_t _flushCount;
+    volatile uint32_t _droppedRecords;
+    portMUX_TYPE _statsMux;
+    uint32_t _aggregatedRecords;
+    uint32_t _blockedWaits;
+    uint16_t _flushHistory[LOG_FLUSH_HISTORY];  // ms, ring
+    unsigned int _flushHistoryCount;            // Total recorded; ring index is count % size
     
     // Power loss detection
     bool _powerLossDetectionEnabled;
     float _powerLossThreshold;
     bool _powerLost;
-    unsigned long _lastPowerCheck;
     static const unsigned long POWER_CHECK_INTERVAL = 100;  // Check every 100ms
 
-    // Field configuration
+    // Power-fail interrupt: the chip raises IRQ0 on a voltage sag or phase
+    // loss (SagTh / PhaseLossTh, enabled in EMM_Status_Registers). The ISR
+    // only sets a flag; update() runs the emergency flush.
+    int _powerFailPin;
+    bool _powerFailArmed;
+    volatile bool _powerFailTriggered;
+    volatile unsigned long _powerFailMicros;   // micros() at the interrupt
+    EmergencyFlushTiming _lastEmergency;
+    uint32_t _emergencyCount;
+
+    // Energy checkpoint, kept open so the emergency flush is one sector
+    // write: slot (sequence % 2) of two LOG_SECTOR_SIZE slots
+    File _checkpointFile;
+    uint32_t _checkpointSequence;
+    uint8_t _checkpointSector[LOG_SECTOR_SIZE];
+
+    // Field configuration (resolved once in setLogFields)
     String* _fieldNames;
+    const RegisterDescriptor** _fieldRegs;  // nullptr if the name did not resolve
+    uint8_t* _fieldDecimals;                // Decimal places written to the CSV
+    uint8_t* _fieldSlots;                   // MeasurementEngine snapshot slots
+    unsigned long* _fieldIntervals;         // 0: the logging interval
+    uint8_t* _fieldStatistics;              // BINLOG_STAT_* or LOG_STAT_DEFAULT
+    float* _fieldDeadband;                  // 0: any change counts
+    bool* _fieldDeadbandRelative;           // Deadband is a percentage
     unsigned int _fieldCount;
+    String _fieldSpec;                      // As last given to setLogFields
+
+    // Deadband logging: with a band on any field, a sample is only
+    // recorded once some field leaves its band around the last recorded
+    // value (_deadbandRef), or _maxLogGap after the last record. Readers
+    // hold each record until the next (LogDecoder fills the rows back in).
+    bool _deadbandEnabled;
+    bool _deadbandPrimed;                   // _deadbandRef holds a recorded sample
+    float* _deadbandRef;
+    time_t _deadbandRefTime;
+    unsigned long _maxLogGap;
+    uint32_t _suppressedRecords;
+    uint32_t _failedFieldReads;
+
+    // Fields sharing an interval are one engine subscription. The engine
+    // reads groups that fall due together in one burst, and they go into
+    // one record. With more than one group (_multiRate) records are
+    // sparse: only the fields just sampled have a value.
+    //
+    // With a sample interval shorter than a group's interval the group is
+    // subscribed at the sample interval. Every sample goes into the
+    // fields' accumulators, and the statistics are logged once the first
+    // sample of the next interval arrives.
+    struct RateGroup {
+        unsigned long interval;
+        uint64_t fields;          // Bit per field
+        int sub;                  // -1 when not subscribed
+        uint32_t lastSequence;
+        unsigned long sampleInterval;
+        unsigned long tick;       // millis() / interval of the samples accumulated
+        bool tickValid;
+    };
+    RateGroup _rateGroups[LOG_MAX_RATES];
+    unsigned int _rateGroupCount;
+    bool _multiRate;
+    bool _fieldsSubscribed;
+
+    // Streaming statistics of each field's samples since it was last
+    // logged (Welford). Once logged a field is stale, and its next sample
+    // starts over; until then it still reports what was logged.
+    struct FieldAccumulator {
+        uint32_t count;
+        float last;
+        float min;
+        float max;
+        double mean;
+        double m2;                // Sum of squared differences from the mean
+        bool stale;
+        bool readFailed;          // Failure already reported
+    };
+    FieldAccumulator* _fieldAccumulators;
+    float _rowValues[LOG_MAX_FIELDS];  // Values of the record being taken
+    unsigned long _sampleInterval;
+
+    // Rollups are fed the records the writer has written. That only
+    // aggregates in RAM: update() writes the closed buckets to the rollup
+    // files (and applies their retention) between flushes. When they're
+    // out of step (boot, remount, new fields), update() first replays the
+    // raw logs from where the rollup files end (_rollupSync, declared
+    // after _index).
+    LogRollup _rollup;
+    float _rollupRow[LOG_MAX_FIELDS];  // feedRollup() scratch, kept off the writer's stack
+
+    // Free space estimate and retention; charged under _writerIdle
+    LogRetention _retention;
+
+    // Time index of the open log file, and lookups in any log's; declared
+    // after _retention, which it charges
+    LogIndex _index;
+    LogRollupSync _rollupSync;
+
+    // MeasurementEngine subscriptions (-1 when not subscribed)
+    int _powerSub;
+    uint8_t _powerSlot;
+    uint32_t _lastPowerSequence;
+    bool _subscriptionsDirty;
     
     unsigned long _loggingInterval;
     unsigned long _lastLogTime;
@@ -114,17 +374,74 @@ private:
     // Helper functions
     bool allocateBuffer(unsigned int size);
     void freeBuffer();
-    bool takeMeasurement(Measurement& m);
+    bool takeMeasurement(LogBuffer& buf, unsigned int index, uint64_t present, unsigned int merged = 0);
+    bool fieldValid(const MeasurementSnapshot* snap, unsigned int field);
+    void accumulateSamples(uint64_t fields);
+    void collectValues(uint64_t present);
+    void restartStatistics();
+    uint8_t fieldStatistic(unsigned int field);
+    bool leavesDeadband(time_t now, uint64_t present);
+    void updateDeadbandRef(time_t now, uint64_t present);
+    void dropOldest(LogBuffer& buf);
+    void countDropped(uint32_t count);
+    bool handOff(TickType_t wait);
+    void waitForWriter();
+    bool waitForWriter(TickType_t wait);
+    void releaseWriter();
+    static void writerTaskEntry(void* arg);
+    void writePending();
     bool flushBuffer();
-    bool writeBufferToFile(Measurement* data, unsigned int count);
+    bool writeBufferToFile(LogBuffer& buf, bool yieldToMetering);
+    bool writeRecords(LogBuffer& buf, bool yieldToMetering);
+    bool openLogFile(time_t t);
+    void closeLogFile(bool trim = false);
+    size_t estimateExtent(time_t t);
+    bool reserveExtent(size_t size);
+    bool commitLogicalEnd();
+    size_t recoverLogicalEnd(File& file, const String& path, BinlogCommit* lastCommit, bool* preallocated);
+    bool writeData(File& file, const uint8_t* data, size_t len);
+    void trimLogFile(const String& path);
+    bool indexRecord(time_t t);
+    void writeIndexEntries();
+    bool resolveLogRange(const String& path, time_t from, time_t to, LogRange& range);
+    bool findLogicalEnd(const String& path, size_t* end);
+    void recoverTodaysLog();
+    void recordFlushTime(unsigned long ms);
+    void retentionStep();
+    void feedRollup(LogBuffer& buf);
+    void replayRollupStep();
+    void writeRollupStep();
+    static void powerFailISR(void* arg);
+    void armPowerFailInterrupt(bool arm);
+    void openCheckpointFile();
+    bool writeEnergyCheckpoint();
+    bool clearEnergyCheckpoint();
     bool ensureFolderStructure(int year, int month, int day);
     bool writeHeaderIfNeeded(const String& filepath);
     void printCardInfo();
+    void yieldBus();
     bool parseFieldList(const String& fieldList);
     void freeFieldNames();
-    bool allocateMeasurementFields(Measurement& m);
-    void freeMeasurementFields(Measurement& m);
+    void buildRateGroups();
+    void unsubscribeFields();
+    void updateSubscriptions();
+    void warnSingleSampleStatistics(const RateGroup& group);
+    unsigned long fieldInterval(unsigned int field) { return _fieldIntervals[field] ? _fieldIntervals[field] : _loggingInterval; }
+    unsigned long recordInterval();   // Shortest field interval
+    uint64_t allFields() { return _fieldCount >= 64 ? ALL_FIELDS : ((uint64_t)1 << _fieldCount) - 1; }
     String generateCSVHeader();
+    bool fieldStoresRaw(unsigned int field);
+    // Largest record; sparse ones carry a presence mask and the values present
+    unsigned int binaryRecordSize() {
+        return BINLOG_RECORD_FIXED_SIZE + (_multiRate ? (_fieldCount + 7) / 8 : 0) + _fieldCount * BINLOG_FIELD_SIZE;
+    }
+    bool writeBinaryHeader(File& file);
+    size_t encodeBinaryRecord(LogBuffer& buf, unsigned int index, uint8_t* out);
+    bool appendBinaryRecord(File& file, LogBuffer& buf, unsigned int index);
+    bool flushBinaryBlock(File& file);
+    void startBlock(File& file);  // At the file's current position
+    bool appendToBlock(File& file, const char* text, size_t len);
+    bool writeBlock(File& file, bool all);
     
 };
 
@@ -0,0 +1,168 @@
+#include "SPIBusArbiter.h"
+
+SPIBusArbiter::SPIBusArbiter()
+  : _callbackTask(nullptr), _lock(nullptr), _waitingMux(portMUX_INITIALIZER_UNLOCKED),
+    _holderTask(nullptr), _holder(-1), _depth(0), _holdStart(0), _servicing(false), _yields(0) {
+    for (int i = 0; i < BUS_CLIENT_COUNT; i++) {
+        _callbacks[i] = nullptr;
+        _contexts[i] = nullptr;
+        _maxHold[i] = SPI_BUS_DEFAULT_MAX_HOLD_MS;
+        _longestHold[i] = 0;
+        _waiting[i] = 0;
+    }
+}
+
+bool SPIBusArbiter::begin() {
+    if (_lock == nullptr) {
+        _lock = xSemaphoreCreateRecursiveMutex();
+    }
+    return _lock != nullptr;
+}
+
+void SPIBusArbiter::setServiceCallback(SPIBusClient client, ServiceCallback callback, void* context) {
+    _callbacks[client] = callback;
+    _contexts[client] = context;
+    _callbackTask = xTaskGetCurrentTaskHandle();
+}
+
+void SPIBusArbiter::setMaxHold(SPIBusClient client, unsigned long ms) {
+    _maxHold[client] = ms;
+}
+
+void SPIBusArbiter::acquire(SPIBusClient client) {
+    if (_lock != nullptr) {
+        setWaiting(client, true);
+        xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+        setWaiting(client, false);
+    }
+    if (_depth > 0) {
+        // Nested hold (the outer one is up this task's call stack): close
+        // out its accounting and track the inner one
+        endHold();
+    }
+    if (_depth < SPI_BUS_MAX_NESTING) {
+        _held[_depth] = client;
+    }
+    _depth++;
+    _holderTask = xTaskGetCurrentTaskHandle();
+    _holder = client;
+    _holdStart = millis();
+}
+
+void SPIBusArbiter::release(SPIBusClient client) {
+    if (_holder != client || _holderTask != xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+    endHold();
+    _depth--;
+    if (_depth > 0) {
+        _holder = _held[(_depth <= SPI_BUS_MAX_NESTING ? _depth : SPI_BUS_MAX_NESTING) - 1];
+        _holdStart = millis();
+    } else {
+        _holder = -1;
+        _holderTask = nullptr;
+    }
+    if (_lock != nullptr) {
+        xSemaphoreGiveRecursive(_lock);
+    }
+}
+
+bool SPIBusArbiter::yieldBus(SPIBusClient client) {
+    if (_holder != client || _holderTask != xTaskGetCurrentTaskHandle() || _servicing) {
+        return false;
+    }
+
+    if (_holderTask != _callbackTask) {
+        // Another task's clients can only be let in
+        if (_lock == nullptr || !higherWaiting(client)) {
+            return false;
+        }
+        endHold();
+        _yields++;
+        handOver();
+        _holdStart = millis();
+        return true;
+    }
+
+    if (millis() - _holdStart < _maxHold[client]) {
+        return false;
+    }
+
+    endHold();
+    _yields++;
+
+    // Let every higher-priority client do its pending work
+    _servicing = true;
+    for (int i = 0; i < client; i++) {
+        if (_callbacks[i]) {
+            _callbacks[i](_contexts[i]);
+        }
+    }
+    _servicing = false;
+
+    _holder = client;
+    _holdStart = millis();
+    return true;
+}
+
+void SPIBusArbiter::resetStats() {
+    _yields = 0;
+    for (int i = 0; i < BUS_CLIENT_COUNT; i++) {
+        _longestHold[i] = 0;
+    }
+}
+
+void SPIBusArbiter::endHold() {
+    unsigned long held = millis() - _holdStart;
+    if (held > _longestHold[_holder]) {
+        _longestHold[_holder] = held;
+    }
+}
+
+void SPIBusArbiter::setWaiting(SPIBusClient client, bool waiting) {
+    portENTER_CRITICAL(&_waitingMux);
+    if (waiting) {
+        _waiting[client]++;
+    } else {
+        _waiting[client]--;
+    }
+    portEXIT_CRITICAL(&_waitingMux);
+}
+
+bool SPIBusArbiter::higherWaiting(SPIBusClient client) {
+    for (int i = 0; i < client; i++) {
+        if (_waiting[i] > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Give the bus up entirely (every nested hold), let the waiting
+// higher-priority clients through, then take it back as it was. The
+// sleep lets them run even on this core at the same task priority.
+void SPIBusArbiter::handOver() {
+    SPIBusClient client = (SPIBusClient)_holder;
+    uint8_t depth = _depth;
+    int8_t held[SPI_BUS_MAX_NESTING];
+    memcpy(held, _held, sizeof(held));
+    TaskHandle_t self = _holderTask;
+
+    _holder = -1;
+    _depth = 0;
+    _holderTask = nullptr;
+    for (uint8_t i = 0; i < depth; i++) {
+        xSemaphoreGiveRecursive(_lock);
+    }
+    while (higherWaiting(client)) {
+        vTaskDelay(1);
+    }
+    for (uint8_t i = 0; i < depth; i++) {
+        xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+    }
+
+    memcpy(_held, held, sizeof(held));
+    _depth = depth;
+    _holderTask = self;
+    _holder = client;
+}
@@ -0,0 +1,84 @@
+#ifndef SPIBUSARBITER_H
+#define SPIBUSARBITER_H
+
+#include <Arduino.h>
+
+#define SPI_BUS_DEFAULT_MAX_HOLD_MS 5
+#define SPI_BUS_MAX_NESTING 4
+
+// Clients of the shared SPI bus, highest priority first
+enum SPIBusClient : uint8_t {
+    BUS_METERING = 0,   // ATM90E32 reads scheduled by MeasurementEngine
+    BUS_STORAGE,        // SD card: log flushes, settings saves
+    BUS_CLIENT_COUNT
+};
+
+// Arbitrates the SPI bus shared by the energy chip and the SD card.
+// A long storage operation can't be interrupted outright; instead it is
+// split into chunks (a sector at most) and calls yieldBus() between them.
+//
+// The bus is a mutex, so it can be held from the loop() task and the SD
+// writer task alike; a task acquiring it while another holds it waits.
+// yieldBus() gives way in one of two ways:
+// - On the task that registered the service callbacks (loop()), once the
+//   holder has used up its hold budget, it runs the callbacks of every
+//   higher-priority client (e.g. due metering reads) before carrying on.
+// - On any other task (the SD writer), whenever a higher-priority client
+//   is waiting in acquire(), it hands the bus over until that client is
+//   done, then takes it back.
+class SPIBusArbiter {
+public:
+    typedef void (*ServiceCallback)(void* context);
+
+    SPIBusArbiter();
+
+    // Create the bus mutex; call from setup() before any other task uses
+    // the bus. Without it the arbiter is for the loop() task only.
+    bool begin();
+
+    // Work run for a client when a lower-priority holder yields on the
+    // task registering it
+    void setServiceCallback(SPIBusClient client, ServiceCallback callback, void* context = nullptr);
+    // Longest a client may hold the bus between yields
+    void setMaxHold(SPIBusClient client, unsigned long ms);
+
+    // Blocks while another task holds the bus. Holds nest on one task.
+    void acquire(SPIBusClient client);
+    void release(SPIBusClient client);
+
+    // Called by the holder between chunks. Returns true if the bus was
+    // handed to higher-priority clients.
+    bool yieldBus(SPIBusClient client);
+
+    // Statistics
+    uint32_t getYieldCount() { return _yields; }
+    unsigned long getLongestHold(SPIBusClient client) { return _longestHold[client]; }  // ms without yielding
+    void resetStats();
+
+private:
+    ServiceCallback _callbacks[BUS_CLIENT_COUNT];
+    void* _contexts[BUS_CLIENT_COUNT];
+    TaskHandle_t _callbackTask;  // Where the callbacks may run
+    unsigned long _maxHold[BUS_CLIENT_COUNT];
+    unsigned long _longestHold[BUS_CLIENT_COUNT];
+
+    SemaphoreHandle_t _lock;     // Recursive mutex; nullptr before begin()
+    portMUX_TYPE _waitingMux;
+    volatile uint8_t _waiting[BUS_CLIENT_COUNT];  // Tasks blocked in acquire()
+
+    // Touched only by the task holding _lock
+    TaskHandle_t _holderTask;
+    int _holder;                 // -1 when the bus is free
+    uint8_t _depth;              // Nested holds
+    int8_t _held[SPI_BUS_MAX_NESTING];  // Client of each nested hold
+    unsigned long _holdStart;    // millis() of acquire or the last yield
+    bool _servicing;             // Inside yieldBus(), don't recurse
+    uint32_t _yields;
+
+    void endHold();
+    void setWaiting(SPIBusClient client, bool waiting);
+    bool higherWaiting(SPIBusClient client);
+    void handOver();
+};
+
+#endif
@@ -3,7 +3,9 @@
 const char* SettingsManager::SETTINGS_FILE = "/settings.ini";
 
 SettingsManager::SettingsManager(RegisterAccess& regAccess)
-: _regAccess(regAccess) {
+: _regAccess(regAccess), _busArbiter(nullptr), _registersApplied(false), _lastApplyWrites(0), _lastApplyTransactions(0),
+  _configMonitorEnabled(true), _digestValid(false), _expectedDigest(0), _lastCrcError(false), _lastConfigCheck(0),
+  _configChecks(0), _configMismatches(0), _groupRestores(0), _fullRestores(0) {
     // Initialize WiFi with defaults
     _wifi.ssid = "";
     _wifi.password = "";
@@ -38,6 +40,15 @@ SettingsManager::SettingsManager(RegisterAccess& regAccess)
     _dataLogging.powerLossThreshold = 100.0;       // 100V
     _dataLogging.enablePowerLossDetection = true;
     _dataLogging.logFields = "UrmsA,IrmsA,PmeanA,SmeanA,QmeanA,Freq";
+    _dataLogging.maxLogGap = 60000;                // 1 minute
+    _dataLogging.sampleInterval = 100;             // Mean of 100 ms samples, as in Settings.ini
+    _dataLogging.overflowPolicy = "drop";
+    _dataLogging.logFormat = "csv";
+    _dataLogging.rollupRetention1m = 31;
+    _dataLogging.rollupRetention15m = 400;
+    _dataLogging.rollupRetention1h = 0;            // Keep
+    _dataLogging.freeSpaceLowMB = 100;
+    _dataLogging.freeSpaceHighMB = 200;
 
     // Display defaults
     _display.field0 = "UrmsA";
@@ -213,8 +224,31 @@ bool SettingsManager::saveSettings() {
         return false;
     }
     
-    file.print(content);
+    if (_busArbiter) _busArbiter->acquire(BUS_STORAGE);
+
+    // Write a sector at a time so due metering reads can run in between
+    const char* data = content.c_str();
+    size_t remaining = content.length();
+    bool success = true;
+    while (remaining > 0) {
+        size_t chunk = remaining < SAVE_CHUNK_SIZE ? remaining : SAVE_CHUNK_SIZE;
+        if (file.write((const uint8_t*)data, chunk) != chunk) {
+            success = false;
+            break;
+        }
+        data += chunk;
+        remaining -= chunk;
+
+        if (_busArbiter) _busArbiter->yieldBus(BUS_STORAGE);
+    }
     file.close();
+
+    if (_busArbiter) _busArbiter->release(BUS_STORAGE);
+
+    if (!success) {
+        Serial.println("Failed to write settings file");
+        return false;
+    }
     
     Serial.println("Settings saved successfully");
     return true;
@@ -345,6 +379,33 @@ bool SettingsManager::parseSettings(const String& content) {
     val = readIniValue(content, "DataLogging", "LogFields");
     if (val.length() > 0) _dataLogging.logFields = val;
 
+    val = readIniValue(content, "DataLogging", "MaxLogGap");
+    if (val.length() > 0) _dataLogging.maxLogGap = strtoul(val.c_str(), NULL, 0);
+
+    val = readIniValue(content, "DataLogging", "SampleInterval");
+    if (val.length() > 0) _dataLogging.sampleInterval = strtoul(val.c_str(), NULL, 0);
+
+    val = readIniValue(content, "DataLogging", "OverflowPolicy");
+    if (val.length() > 0) _dataLogging.overflowPolicy = val;
+
+    val = readIniValue(content, "DataLogging", "LogFormat");
+    if (val.length() > 0) _dataLogging.logFormat = val;
+
+    val = readIniValue(content, "DataLogging", "RollupRetention1m");
+    if (val.length() > 0) _dataLogging.rollupRetention1m = strtoul(val.c_str(), NULL, 0);
+
+    val = readIniValue(content, "DataLogging", "RollupRetention15m");
+    if (val.length() > 0) _dataLogging.rollupRetention15m = strtoul(val.c_str(), NULL, 0);
+
+    val = readIniValue(content, "DataLogging", "RollupRetention1h");
+    if (val.length() > 0) _dataLogging.rollupRetention1h = strtoul(val.c_str(), NULL, 0);
+
+    val = readIniValue(content, "DataLogging", "FreeSpaceLowMB");
+    if (val.length() > 0) _dataLogging.freeSpaceLowMB = strtoul(val.c_str(), NULL, 0);
+
+    val = readIniValue(content, "DataLogging", "FreeSpaceHighMB");
+    if (val.length() > 0) _dataLogging.freeSpaceHighMB = strtoul(val.c_str(), NULL, 0);
+
     // Parse Display section
     val = readIniValue(content, "Display", "Field0");
     if (val.length() > 0) _display.field0 = val;
@@ -757,6 +818,15 @@ String SettingsManager::generateSettingsINI() {
     ini += "PowerLossThreshold=" + String(_dataLogging.powerLossThreshold, 1) + "\n";
     ini += "EnablePowerLossDetection=" + String(_dataLogging.enablePowerLossDetection ? "1" : "0") + "\n";
     ini += "LogFields=" + _dataLogging.logFields + "\n";
+    ini += "MaxLogGap=" + String(_dataLogging.maxLogGap) + "\n";
+    ini += "SampleInterval=" + String(_dataLogging.sampleInterval) + "\n";
+    ini += "OverflowPolicy=" + _dataLogging.overflowPolicy + "\n";
+    ini += "LogFormat=" + _dataLogging.logFormat + "\n";
+    ini += "RollupRetention1m=" + String(_dataLogging.rollupRetention1m) + "\n";
+    ini += "RollupRetention15m=" + String(_dataLogging.rollupRetention15m) + "\n";
+    ini += "RollupRetention1h=" + String(_dataLogging.rollupRetention1h) + "\n";
+    ini += "FreeSpaceLowMB=" + String(_dataLogging.freeSpaceLowMB) + "\n";
+    ini += "FreeSpaceHighMB=" + String(_dataLogging.freeSpaceHighMB) + "\n";
     ini += "\n";
 
     // Display section
@@ -917,183 +987,437 @@ String SettingsManager::generateSettingsINI() {
     return ini;
 }
 
+// Chip registers backed by the register settings structs, in apply order.
+// Each entry maps a register name to the struct member holding its value.
+struct RegisterField {
+    const char* name;   // Register name in registers[]
+    uint16_t offset;    // offsetof() the struct member
+    uint8_t size;       // sizeof() the struct member (2 or 4)
+};
+
+#define REGISTER_FIELD(name, type, member) { name, offsetof(type, member), sizeof(((type*)0)->member) }
+
+static const RegisterField statusAndSpecialFields[] = {
+    REGISTER_FIELD("IA_SRC",         StatusAndSpecialRegisters, IA_SRC),
+    REGISTER_FIELD("IB_SRC",         StatusAndSpecialRegisters, IB_SRC),
+    REGISTER_FIELD("IC_SRC",         StatusAndSpecialRegisters, IC_SRC),
+    REGISTER_FIELD("UA_SRC",         StatusAndSpecialRegisters, UA_SRC),
+    REGISTER_FIELD("UB_SRC",         StatusAndSpecialRegisters, UB_SRC),
+    REGISTER_FIELD("UC_SRC",         StatusAndSpecialRegisters, UC_SRC),
+    REGISTER_FIELD("Sag_Period",     StatusAndSpecialRegisters, Sag_Period),
+    REGISTER_FIELD("PeakDet_period", StatusAndSpecialRegisters, PeakDet_period),
+    REGISTER_FIELD("Ovth",           StatusAndSpecialRegisters, OVth),
+    REGISTER_FIELD("Zxdis",          StatusAndSpecialRegisters, Zxdis),
+    REGISTER_FIELD("ZX0Con",         StatusAndSpecialRegisters, ZX0Con),
+    REGISTER_FIELD("ZX1Con",         StatusAndSpecialRegisters, ZX1Con),
+    REGISTER_FIELD("ZX2Con",         StatusAndSpecialRegisters, ZX2Con),
+    REGISTER_FIELD("ZX0Src",         StatusAndSpecialRegisters, ZX0Src),
+    REGISTER_FIELD("ZX1Src",         StatusAndSpecialRegisters, ZX1Src),
+    REGISTER_FIELD("ZX2Src",         StatusAndSpecialRegisters, ZX2Src),
+    REGISTER_FIELD("SagTh",          StatusAndSpecialRegisters, SagTh),
+    REGISTER_FIELD("PhaseLossTh",    StatusAndSpecialRegisters, PhaseLossTh),
+    REGISTER_FIELD("InWarnTh",       StatusAndSpecialRegisters, InWarnTh),
+    REGISTER_FIELD("Olth",           StatusAndSpecialRegisters, OIth),
+    REGISTER_FIELD("FreqLoTh",       StatusAndSpecialRegisters, FreqLoTh),
+    REGISTER_FIELD("FreqHiTh",       StatusAndSpecialRegisters, FreqHiTh),
+    REGISTER_FIELD("IRQ1_OR",        StatusAndSpecialRegisters, IRQ1_OR),
+    REGISTER_FIELD("WARN_OR",        StatusAndSpecialRegisters, WARN_OR),
+};
+
+static const RegisterField configurationFields[] = {
+    REGISTER_FIELD("PL_Constant", ConfigurationRegisters, PL_Constant),
+    REGISTER_FIELD("EnPC",        ConfigurationRegisters, EnPC),
+    REGISTER_FIELD("EnPB",        ConfigurationRegisters, EnPB),
+    REGISTER_FIELD("EnPA",        ConfigurationRegisters, EnPA),
+    REGISTER_FIELD("ABSEnP",      ConfigurationRegisters, ABSEnP),
+    REGISTER_FIELD("ABSEnQ",      ConfigurationRegisters, ABSEnQ),
+    REGISTER_FIELD("CF2varh",     ConfigurationRegisters, CF2varh),
+    REGISTER_FIELD("3P3W",        ConfigurationRegisters, _3P3W),
+    REGISTER_FIELD("didtEn",      ConfigurationRegisters, didtEn),
+    REGISTER_FIELD("HPFoff",      ConfigurationRegisters, HPFoff),
+    REGISTER_FIELD("Freq60Hz",    ConfigurationRegisters, Freq60Hz),
+    REGISTER_FIELD("PGA_GAIN",    ConfigurationRegisters, PGA_GAIN),
+    REGISTER_FIELD("PStartTh",    ConfigurationRegisters, PStartTh),
+    REGISTER_FIELD("QStartTh",    ConfigurationRegisters, QStartTh),
+    REGISTER_FIELD("SStartTh",    ConfigurationRegisters, SStartTh),
+    REGISTER_FIELD("PPhaseTh",    ConfigurationRegisters, PPhaseTh),
+    REGISTER_FIELD("QPhaseTh",    ConfigurationRegisters, QPhaseTh),
+    REGISTER_FIELD("SPhaseTh",    ConfigurationRegisters, SPhaseTh),
+};
+
+static const RegisterField calibrationFields[] = {
+    REGISTER_FIELD("PoffsetA",         CalibrationRegisters, PoffsetA),
+    REGISTER_FIELD("QoffsetA",         CalibrationRegisters, QoffsetA),
+    REGISTER_FIELD("PoffsetB",         CalibrationRegisters, PoffsetB),
+    REGISTER_FIELD("QoffsetB",         CalibrationRegisters, QoffsetB),
+    REGISTER_FIELD("PoffsetC",         CalibrationRegisters, PoffsetC),
+    REGISTER_FIELD("QoffsetC",         CalibrationRegisters, QoffsetC),
+    REGISTER_FIELD("PQGainA",          CalibrationRegisters, PQGainA),
+    REGISTER_FIELD("PhiA_DelayCycles", CalibrationRegisters, PhiA),
+    REGISTER_FIELD("PQGainB",          CalibrationRegisters, PQGainB),
+    REGISTER_FIELD("PhiB_DelayCycles", CalibrationRegisters, PhiB),
+    REGISTER_FIELD("PQGainC",          CalibrationRegisters, PQGainC),
+    REGISTER_FIELD("PhiC_DelayCycles", CalibrationRegisters, PhiC),
+};
+
+static const RegisterField fundamentalHarmonicFields[] = {
+    REGISTER_FIELD("PoffsetAF", FundamentalHarmonicCalibrationRegisters, PoffsetAF),
+    REGISTER_FIELD("PoffsetBF", FundamentalHarmonicCalibrationRegisters, PoffsetBF),
+    REGISTER_FIELD("PoffsetCF", FundamentalHarmonicCalibrationRegisters, PoffsetCF),
+    REGISTER_FIELD("PGainAF",   FundamentalHarmonicCalibrationRegisters, PGainAF),
+    REGISTER_FIELD("PGainBF",   FundamentalHarmonicCalibrationRegisters, PGainBF),
+    REGISTER_FIELD("PGainCF",   FundamentalHarmonicCalibrationRegisters, PGainCF),
+};
+
+static const RegisterField measurementCalibrationFields[] = {
+    REGISTER_FIELD("UgainA",   MeasurementCalibrationRegisters, UgainA),
+    REGISTER_FIELD("IgainA",   MeasurementCalibrationRegisters, IgainA),
+    REGISTER_FIELD("UoffsetA", MeasurementCalibrationRegisters, UoffsetA),
+    REGISTER_FIELD("IoffsetA", MeasurementCalibrationRegisters, IoffsetA),
+    REGISTER_FIELD("UgainB",   MeasurementCalibrationRegisters, UgainB),
+    REGISTER_FIELD("IgainB",   MeasurementCalibrationRegisters, IgainB),
+    REGISTER_FIELD("UoffsetB", MeasurementCalibrationRegisters, UoffsetB),
+    REGISTER_FIELD("IoffsetB", MeasurementCalibrationRegisters, IoffsetB),
+    REGISTER_FIELD("UgainC",   MeasurementCalibrationRegisters, UgainC),
+    REGISTER_FIELD("IgainC",   MeasurementCalibrationRegisters, IgainC),
+    REGISTER_FIELD("UoffsetC", MeasurementCalibrationRegisters, UoffsetC),
+    REGISTER_FIELD("IoffsetC", MeasurementCalibrationRegisters, IoffsetC),
+};
+
+static const RegisterField emmStatusFields[] = {
+    REGISTER_FIELD("CF4RevIntEN",     EMMStatusRegisters, CF4RevIntEN),
+    REGISTER_FIELD("CF3RevIntEN",     EMMStatusRegisters, CF3RevIntEN),
+    REGISTER_FIELD("CF2RevIntEN",     EMMStatusRegisters, CF2RevIntEN),
+    REGISTER_FIELD("CF1RevIntEN",     EMMStatusRegisters, CF1RevIntEN),
+    REGISTER_FIELD("TASNoloadIntEN",  EMMStatusRegisters, TASNoloadIntEN),
+    REGISTER_FIELD("TPNoloadIntEN",   EMMStatusRegisters, TPNoloadIntEN),
+    REGISTER_FIELD("TQNoloadIntEN",   EMMStatusRegisters, TQNoloadIntEN),
+    REGISTER_FIELD("INOv0IntEN",      EMMStatusRegisters, INOv0IntEN),
+    REGISTER_FIELD("IRevWnIntEN",     EMMStatusRegisters, IRevWnIntEN),
+    REGISTER_FIELD("URevWnIntEN",     EMMStatusRegisters, URevWnIntEN),
+    REGISTER_FIELD("OVPhaseCIntEN",   EMMStatusRegisters, OVPhaseCIntEN),
+    REGISTER_FIELD("OVPhaseBIntEN",   EMMStatusRegisters, OVPhaseBIntEN),
+    REGISTER_FIELD("OVPhaseAIntEN",   EMMStatusRegisters, OVPhaseAIntEN),
+    REGISTER_FIELD("OIPhaseCIntEN",   EMMStatusRegisters, OIPhaseCIntEN),
+    REGISTER_FIELD("OIPhaseBIntEN",   EMMStatusRegisters, OIPhaseBIntEN),
+    REGISTER_FIELD("OIPhaseAIntEN",   EMMStatusRegisters, OIPhaseAIntEN),
+    REGISTER_FIELD("PERegAPIntEn",    EMMStatusRegisters, PERegAPIntEn),
+    REGISTER_FIELD("PERegBPIntEn",    EMMStatusRegisters, PERegBPIntEn),
+    REGISTER_FIELD("PERegCPIntEn",    EMMStatusRegisters, PERegCPIntEn),
+    REGISTER_FIELD("PERegTPIntEn",    EMMStatusRegisters, PERegTPIntEn),
+    REGISTER_FIELD("QERegAPIntEn",    EMMStatusRegisters, QERegAPIntEn),
+    REGISTER_FIELD("QERegBPIntEn",    EMMStatusRegisters, QERegBPIntEn),
+    REGISTER_FIELD("QERegCPIntEn",    EMMStatusRegisters, QERegCPIntEn),
+    REGISTER_FIELD("QERgTPIntEn",     EMMStatusRegisters, QERgTPIntEn),
+    REGISTER_FIELD("PhaseLossCIntEn", EMMStatusRegisters, PhaseLossCIntEn),
+    REGISTER_FIELD("PhaseLossBIntEn", EMMStatusRegisters, PhaseLossBIntEn),
+    REGISTER_FIELD("PhaseLossAIntEn", EMMStatusRegisters, PhaseLossAIntEn),
+    REGISTER_FIELD("FreqLoIntEn",     EMMStatusRegisters, FreqLoIntEn),
+    REGISTER_FIELD("SagPhaseCIntEn",  EMMStatusRegisters, SagPhaseCIntEn),
+    REGISTER_FIELD("SagPhaseBIntEn",  EMMStatusRegisters, SagPhaseBIntEn),
+    REGISTER_FIELD("SagPhaseAIntEn",  EMMStatusRegisters, SagPhaseAIntEn),
+    REGISTER_FIELD("FreqHiIntEn",     EMMStatusRegisters, FreqHiIntEn),
+};
+
+struct RegisterGroup {
+    const char* label;
+    const RegisterField* fields;
+    size_t count;
+    size_t structSize;
+};
+
+static const RegisterGroup registerGroups[] = {
+    { "Status and Special Registers", statusAndSpecialFields, sizeof(statusAndSpecialFields) / sizeof(statusAndSpecialFields[0]), sizeof(StatusAndSpecialRegisters) },
+    { "Configuration Registers", configurationFields, sizeof(configurationFields) / sizeof(configurationFields[0]), sizeof(ConfigurationRegisters) },
+    { "Calibration Registers", calibrationFields, sizeof(calibrationFields) / sizeof(calibrationFields[0]), sizeof(CalibrationRegisters) },
+    { "Fundamental Harmonic Calibration Registers", fundamentalHarmonicFields, sizeof(fundamentalHarmonicFields) / sizeof(fundamentalHarmonicFields[0]), sizeof(FundamentalHarmonicCalibrationRegisters) },
+    { "Measurement Calibration Registers", measurementCalibrationFields, sizeof(measurementCalibrationFields) / sizeof(measurementCalibrationFields[0]), sizeof(MeasurementCalibrationRegisters) },
+    { "EMM Status Registers", emmStatusFields, sizeof(emmStatusFields) / sizeof(emmStatusFields[0]), sizeof(EMMStatusRegisters) },
+};
+
+static const size_t registerGroupCount = sizeof(registerGroups) / sizeof(registerGroups[0]);
+
+// Largest group (EMM Status Registers); bounds the read-back buffers
+static const size_t MAX_GROUP_FIELDS = sizeof(emmStatusFields) / sizeof(emmStatusFields[0]);
+
+static uint32_t readField(const uint8_t* base, const RegisterField& field) {
+    if (field.size == sizeof(uint32_t)) {
+        return *(const uint32_t*)(base + field.offset);
+    }
+    return *(const uint16_t*)(base + field.offset);
+}
+
+static void writeField(uint8_t* base, const RegisterField& field, uint32_t value) {
+    if (field.size == sizeof(uint32_t)) {
+        *(uint32_t*)(base + field.offset) = value;
+    } else {
+        *(uint16_t*)(base + field.offset) = (uint16_t)value;
+    }
+}
+
+// Settings struct behind each entry of registerGroups[], either the
+// current settings or the copy last written to the chip
+uint8_t* SettingsManager::getRegisterGroupData(size_t group, bool applied) {
+    switch (group) {
+        case 0: return applied ? (uint8_t*)&_appliedStatusAndSpecialRegisters : (uint8_t*)&_statusAndSpecialRegisters;
+        case 1: return applied ? (uint8_t*)&_appliedConfigurationRegisters : (uint8_t*)&_configurationRegisters;
+        case 2: return applied ? (uint8_t*)&_appliedCalibrationRegisters : (uint8_t*)&_calibrationRegisters;
+        case 3: return applied ? (uint8_t*)&_appliedFundamentalHarmonicCalibrationRegisters : (uint8_t*)&_fundamentalHarmonicCalibrationRegisters;
+        case 4: return applied ? (uint8_t*)&_appliedMeasurementCalibrationRegisters : (uint8_t*)&_measurementCalibrationRegisters;
+        case 5: return applied ? (uint8_t*)&_appliedEMMStatusRegisters : (uint8_t*)&_emmStatusRegisters;
+        default: return nullptr;
+    }
+}
+
 bool SettingsManager::applyAllRegistersToChip() {
-    // Unlock calibration registers
+    return applyRegisterFields(false);
+}
+
+// Write only the register fields that differ from what was last applied.
+// Falls back to a full apply until one has succeeded.
+bool SettingsManager::applyChangedRegistersToChip() {
+    return applyRegisterFields(_registersApplied);
+}
+
+bool SettingsManager::applyRegisterFields(bool changedOnly) {
+    uint32_t startTransactions = _regAccess.getTransactionCount();
+    uint16_t writes = 0;
     bool success = true;
-    success &= _regAccess.writeRegister("CfgRegAccEn", 0x55AA);
+    bool unlocked = false;
 
-    Serial.println("Applying all registers to ATM90E32...");
-
-    // Enable the meter
-    success &= _regAccess.writeRegister("MeterEn", 1);
-
-    // Apply Status and Special Registers
-    success &= _regAccess.writeRegisterRaw("IA_SRC", _statusAndSpecialRegisters.IA_SRC);
-    success &= _regAccess.writeRegisterRaw("IB_SRC", _statusAndSpecialRegisters.IB_SRC);
-    success &= _regAccess.writeRegisterRaw("IC_SRC", _statusAndSpecialRegisters.IC_SRC);
-    success &= _regAccess.writeRegisterRaw("UA_SRC", _statusAndSpecialRegisters.UA_SRC);
-    success &= _regAccess.writeRegisterRaw("UB_SRC", _statusAndSpecialRegisters.UB_SRC);
-    success &= _regAccess.writeRegisterRaw("UC_SRC", _statusAndSpecialRegisters.UC_SRC);
-    success &= _regAccess.writeRegisterRaw("Sag_Period", _statusAndSpecialRegisters.Sag_Period);
-    success &= _regAccess.writeRegisterRaw("PeakDet_period", _statusAndSpecialRegisters.PeakDet_period);
-    success &= _regAccess.writeRegisterRaw("Ovth", _statusAndSpecialRegisters.OVth);
-    success &= _regAccess.writeRegisterRaw("Zxdis", _statusAndSpecialRegisters.Zxdis);
-    success &= _regAccess.writeRegisterRaw("ZX0Con", _statusAndSpecialRegisters.ZX0Con);
-    success &= _regAccess.writeRegisterRaw("ZX1Con", _statusAndSpecialRegisters.ZX1Con);
-    success &= _regAccess.writeRegisterRaw("ZX2Con", _statusAndSpecialRegisters.ZX2Con);
-    success &= _regAccess.writeRegisterRaw("ZX0Src", _statusAndSpecialRegisters.ZX0Src);
-    success &= _regAccess.writeRegisterRaw("ZX1Src", _statusAndSpecialRegisters.ZX1Src);
-    success &= _regAccess.writeRegisterRaw("ZX2Src", _statusAndSpecialRegisters.ZX2Src);
-    success &= _regAccess.writeRegisterRaw("SagTh", _statusAndSpecialRegisters.SagTh);
-    success &= _regAccess.writeRegisterRaw("PhaseLossTh", _statusAndSpecialRegisters.PhaseLossTh);
-    success &= _regAccess.writeRegisterRaw("InWarnTh", _statusAndSpecialRegisters.InWarnTh);
-    success &= _regAccess.writeRegisterRaw("Olth", _statusAndSpecialRegisters.OIth);
-    success &= _regAccess.writeRegisterRaw("FreqLoTh", _statusAndSpecialRegisters.FreqLoTh);
-    success &= _regAccess.writeRegisterRaw("FreqHiTh", _statusAndSpecialRegisters.FreqHiTh);
-    success &= _regAccess.writeRegisterRaw("IRQ1_OR", _statusAndSpecialRegisters.IRQ1_OR);
-    success &= _regAccess.writeRegisterRaw("WARN_OR", _statusAndSpecialRegisters.WARN_OR);
+    if (!changedOnly) {
+        Serial.println("Applying all registers to ATM90E32...");
+    }
 
-    if (success) {
-        Serial.println("Applied Status and Special Registers");
-    } else {
-        Serial.println("Failed to apply Status and Special Registers");
+    for (size_t g = 0; g < registerGroupCount; g++) {
+        const RegisterGroup& group = registerGroups[g];
+        const uint8_t* current = getRegisterGroupData(g, false);
+        const uint8_t* applied = getRegisterGroupData(g, true);
+
+        for (size_t i = 0; i < group.count; i++) {
+            uint32_t value = readField(current, group.fields[i]);
+            if (changedOnly && value == readField(applied, group.fields[i])) {
+                continue;
+            }
+
+            if (!unlocked) {
+                // Unlock calibration registers
+                success &= _regAccess.writeRegister("CfgRegAccEn", 0x55AA);
+
+                // Enable the meter
+                if (!changedOnly) {
+                    success &= _regAccess.writeRegister("MeterEn", 1);
+                }
+
+                // Stage field writes so each register word is written once
+                _regAccess.beginWriteBatch();
+                unlocked = true;
+            }
+
+            success &= _regAccess.writeRegisterRaw(group.fields[i].name, value);
+            writes++;
+        }
+
+        if (!changedOnly) {
+            if (success) {
+                Serial.print("Applied ");
+            } else {
+                Serial.print("Failed to apply ");
+            }
+            Serial.println(group.label);
+        }
+    }
+
+    if (unlocked) {
+        // Write out staged words, then lock calibration registers
+        _regAccess.commitWriteBatch();
+        success &= _regAccess.writeRegister("CfgRegAccEn", 0x0000);
     }
 
-    // Apply Configuration Registers
-    success &= _regAccess.writeRegisterRaw("PL_Constant", _configurationRegisters.PL_Constant);
-    success &= _regAccess.writeRegisterRaw("EnPC", _configurationRegisters.EnPC);
-    success &= _regAccess.writeRegisterRaw("EnPB", _configurationRegisters.EnPB);
-    success &= _regAccess.writeRegisterRaw("EnPA", _configurationRegisters.EnPA);
-    success &= _regAccess.writeRegisterRaw("ABSEnP", _configurationRegisters.ABSEnP);
-    success &= _regAccess.writeRegisterRaw("ABSEnQ", _configurationRegisters.ABSEnQ);
-    success &= _regAccess.writeRegisterRaw("CF2varh", _configurationRegisters.CF2varh);
-    success &= _regAccess.writeRegisterRaw("3P3W", _configurationRegisters._3P3W);
-    success &= _regAccess.writeRegisterRaw("didtEn", _configurationRegisters.didtEn);
-    success &= _regAccess.writeRegisterRaw("HPFoff", _configurationRegisters.HPFoff);
-    success &= _regAccess.writeRegisterRaw("Freq60Hz", _configurationRegisters.Freq60Hz);
-    success &= _regAccess.writeRegisterRaw("PGA_GAIN", _configurationRegisters.PGA_GAIN);
-    success &= _regAccess.writeRegisterRaw("PStartTh", _configurationRegisters.PStartTh);
-    success &= _regAccess.writeRegisterRaw("QStartTh", _configurationRegisters.QStartTh);
-    success &= _regAccess.writeRegisterRaw("SStartTh", _configurationRegisters.SStartTh);
-    success &= _regAccess.writeRegisterRaw("PPhaseTh", _configurationRegisters.PPhaseTh);
-    success &= _regAccess.writeRegisterRaw("QPhaseTh", _configurationRegisters.QPhaseTh);
-    success &= _regAccess.writeRegisterRaw("SPhaseTh", _configurationRegisters.SPhaseTh);
+    // Remember what the chip now holds; a failed apply forces a full one next time
+    for (size_t g = 0; g < registerGroupCount; g++) {
+        memcpy(getRegisterGroupData(g, true), getRegisterGroupData(g, false), registerGroups[g].structSize);
+    }
+    _registersApplied = success;
 
+    // New reference for the configuration monitor
     if (success) {
-        Serial.println("Applied Configuration Registers");
+        captureConfigDigest();
     } else {
-        Serial.println("Failed to apply Configuration Registers");
+        _digestValid = false;
     }
 
-    // Apply Calibration Registers (energy calibration)
-    success &= _regAccess.writeRegisterRaw("PoffsetA", _calibrationRegisters.PoffsetA);
-    success &= _regAccess.writeRegisterRaw("QoffsetA", _calibrationRegisters.QoffsetA);
-    success &= _regAccess.writeRegisterRaw("PoffsetB", _calibrationRegisters.PoffsetB);
-    success &= _regAccess.writeRegisterRaw("QoffsetB", _calibrationRegisters.QoffsetB);
-    success &= _regAccess.writeRegisterRaw("PoffsetC", _calibrationRegisters.PoffsetC);
-    success &= _regAccess.writeRegisterRaw("QoffsetC", _calibrationRegisters.QoffsetC);
-    success &= _regAccess.writeRegisterRaw("PQGainA", _calibrationRegisters.PQGainA);
-    success &= _regAccess.writeRegisterRaw("PhiA_DelayCycles", _calibrationRegisters.PhiA);
-    success &= _regAccess.writeRegisterRaw("PQGainB", _calibrationRegisters.PQGainB);
-    success &= _regAccess.writeRegisterRaw("PhiB_DelayCycles", _calibrationRegisters.PhiB);
-    success &= _regAccess.writeRegisterRaw("PQGainC", _calibrationRegisters.PQGainC);
-    success &= _regAccess.writeRegisterRaw("PhiC_DelayCycles", _calibrationRegisters.PhiC);
+    _lastApplyWrites = writes;
+    _lastApplyTransactions = _regAccess.getTransactionCount() - startTransactions;
+    Serial.printf("Register apply: %u field writes, %lu SPI transactions\n",
+                  _lastApplyWrites, (unsigned long)_lastApplyTransactions);
 
     if (success) {
-        Serial.println("Applied Calibration Registers");
+        Serial.println(changedOnly ? "Changed registers applied to chip successfully"
+                                   : "All registers applied to chip successfully");
     } else {
-        Serial.println("Failed to apply Calibration Registers");
+        Serial.println("Failed to apply all registers to chip");
     }
 
-    // Apply Fundamental Harmonic Calibration Registers
-    success &= _regAccess.writeRegisterRaw("PoffsetAF", _fundamentalHarmonicCalibrationRegisters.PoffsetAF);
-    success &= _regAccess.writeRegisterRaw("PoffsetBF", _fundamentalHarmonicCalibrationRegisters.PoffsetBF);
-    success &= _regAccess.writeRegisterRaw("PoffsetCF", _fundamentalHarmonicCalibrationRegisters.PoffsetCF);
-    success &= _regAccess.writeRegisterRaw("PGainAF", _fundamentalHarmonicCalibrationRegisters.PGainAF);
-    success &= _regAccess.writeRegisterRaw("PGainBF", _fundamentalHarmonicCalibrationRegisters.PGainBF);
-    success &= _regAccess.writeRegisterRaw("PGainCF", _fundamentalHarmonicCalibrationRegisters.PGainCF);
+    return success;
+}
 
-    if (success) {
-        Serial.println("Applied Fundamental Harmonic Calibration Registers");
-    } else {
-        Serial.println("Failed to apply Fundamental Harmonic Calibration Registers");
+void SettingsManager::captureConfigDigest() {
+    const RegisterDescriptor* regs[2] = {
+        _regAccess.getRegisterInfo(RegisterId::CRCDigest),
+        _regAccess.getRegisterInfo(RegisterId::CFG_CRC_ERR)
+    };
+    uint32_t raw[2];
+    bool ok[2];
+
+    _digestValid = _regAccess.readRegistersRaw(regs, raw, ok, 2) == 2;
+    _expectedDigest = (uint16_t)raw[0];
+    _lastCrcError = raw[1] != 0;
+}
+
+void SettingsManager::noteRegisterWrite(const char* name) {
+    const RegisterDescriptor* written = _regAccess.getRegisterInfo(name);
+    if (written != nullptr) {
+        // Bitfields share their register's address
+        for (size_t g = 0; g < registerGroupCount; g++) {
+            const RegisterGroup& group = registerGroups[g];
+            uint8_t* applied = getRegisterGroupData(g, true);
+            for (size_t i = 0; i < group.count; i++) {
+                const RegisterDescriptor* reg = _regAccess.getRegisterInfo(group.fields[i].name);
+                if (reg == nullptr || reg->address[0] != written->address[0]) {
+                    continue;
+                }
+                bool ok = false;
+                uint32_t raw = _regAccess.readRegisterRaw(group.fields[i].name, &ok);
+                if (ok) {
+                    writeField(applied, group.fields[i], raw);
+                }
+            }
+        }
     }
+    captureConfigDigest();
+}
 
+void SettingsManager::update() {
+    if (!_configMonitorEnabled || !_registersApplied) {
+        return;
+    }
 
+    unsigned long now = millis();
+    if (now - _lastConfigCheck < CONFIG_CHECK_INTERVAL) {
+        return;
+    }
+    _lastConfigCheck = now;
+
+    // One burst: digest, CRC error flag and MeterEn (cleared by a chip reset)
+    const RegisterDescriptor* regs[3] = {
+        _regAccess.getRegisterInfo(RegisterId::CRCDigest),
+        _regAccess.getRegisterInfo(RegisterId::CFG_CRC_ERR),
+        _regAccess.getRegisterInfo(RegisterId::MeterEn)
+    };
+    uint32_t raw[3];
+    bool ok[3];
+
+    if (_regAccess.readRegistersRaw(regs, raw, ok, 3) != 3) {
+        Serial.println("ERROR: Configuration check read failed");
+        return;
+    }
+    _configChecks++;
 
+    uint16_t digest = (uint16_t)raw[0];
+    bool crcError = raw[1] != 0;
+    bool meterEnabled = raw[2] != 0;
 
-    Serial.print("Applying Voltage Gain: ");
-    Serial.println(_measurementCalibrationRegisters.UgainA);
+    // The CRC error flag stays set, so only its rising edge counts
+    bool crcErrorRaised = crcError && !_lastCrcError;
+    _lastCrcError = crcError;
 
-    // Apply Measurement Calibration Registers (RMS calibration)
-    success &= _regAccess.writeRegisterRaw("UgainA", _measurementCalibrationRegisters.UgainA);
-    success &= _regAccess.writeRegisterRaw("IgainA", _measurementCalibrationRegisters.IgainA);
-    success &= _regAccess.writeRegisterRaw("UoffsetA", _measurementCalibrationRegisters.UoffsetA);
-    success &= _regAccess.writeRegisterRaw("IoffsetA", _measurementCalibrationRegisters.IoffsetA);
-    success &= _regAccess.writeRegisterRaw("UgainB", _measurementCalibrationRegisters.UgainB);
-    success &= _regAccess.writeRegisterRaw("IgainB", _measurementCalibrationRegisters.IgainB);
-    success &= _regAccess.writeRegisterRaw("UoffsetB", _measurementCalibrationRegisters.UoffsetB);
-    success &= _regAccess.writeRegisterRaw("IoffsetB", _measurementCalibrationRegisters.IoffsetB);
-    success &= _regAccess.writeRegisterRaw("UgainC", _measurementCalibrationRegisters.UgainC);
-    success &= _regAccess.writeRegisterRaw("IgainC", _measurementCalibrationRegisters.IgainC);
-    success &= _regAccess.writeRegisterRaw("UoffsetC", _measurementCalibrationRegisters.UoffsetC);
-    success &= _regAccess.writeRegisterRaw("IoffsetC", _measurementCalibrationRegisters.IoffsetC);
+    if (!_digestValid) {
+        _expectedDigest = digest;
+        _digestValid = true;
+    }
 
-    if (success) {
-        Serial.println("Applied Measurement Calibration Registers");
-    } else {
-        Serial.println("Failed to apply Measurement Calibration Registers");
+    if (meterEnabled && digest == _expectedDigest && !crcErrorRaised) {
+        return;
     }
 
-    // Apply EMM Status Registers (interrupt enables)
-    success &= _regAccess.writeRegisterRaw("CF4RevIntEN", _emmStatusRegisters.CF4RevIntEN);
-    success &= _regAccess.writeRegisterRaw("CF3RevIntEN", _emmStatusRegisters.CF3RevIntEN);
-    success &= _regAccess.writeRegisterRaw("CF2RevIntEN", _emmStatusRegisters.CF2RevIntEN);
-    success &= _regAccess.writeRegisterRaw("CF1RevIntEN", _emmStatusRegisters.CF1RevIntEN);
-    success &= _regAccess.writeRegisterRaw("TASNoloadIntEN", _emmStatusRegisters.TASNoloadIntEN);
-    success &= _regAccess.writeRegisterRaw("TPNoloadIntEN", _emmStatusRegisters.TPNoloadIntEN);
-    success &= _regAccess.writeRegisterRaw("TQNoloadIntEN", _emmStatusRegisters.TQNoloadIntEN);
-    success &= _regAccess.writeRegisterRaw("INOv0IntEN", _emmStatusRegisters.INOv0IntEN);
-    success &= _regAccess.writeRegisterRaw("IRevWnIntEN", _emmStatusRegisters.IRevWnIntEN);
-    success &= _regAccess.writeRegisterRaw("URevWnIntEN", _emmStatusRegisters.URevWnIntEN);
-    success &= _regAccess.writeRegisterRaw("OVPhaseCIntEN", _emmStatusRegisters.OVPhaseCIntEN);
-    success &= _regAccess.writeRegisterRaw("OVPhaseBIntEN", _emmStatusRegisters.OVPhaseBIntEN);
-    success &= _regAccess.writeRegisterRaw("OVPhaseAIntEN", _emmStatusRegisters.OVPhaseAIntEN);
-    success &= _regAccess.writeRegisterRaw("OIPhaseCIntEN", _emmStatusRegisters.OIPhaseCIntEN);
-    success &= _regAccess.writeRegisterRaw("OIPhaseBIntEN", _emmStatusRegisters.OIPhaseBIntEN);
-    success &= _regAccess.writeRegisterRaw("OIPhaseAIntEN", _emmStatusRegisters.OIPhaseAIntEN);
-    success &= _regAccess.writeRegisterRaw("PERegAPIntEn", _emmStatusRegisters.PERegAPIntEn);
-    success &= _regAccess.writeRegisterRaw("PERegBPIntEn", _emmStatusRegisters.PERegBPIntEn);
-    success &= _regAccess.writeRegisterRaw("PERegCPIntEn", _emmStatusRegisters.PERegCPIntEn);
-    success &= _regAccess.writeRegisterRaw("PERegTPIntEn", _emmStatusRegisters.PERegTPIntEn);
-    success &= _regAccess.writeRegisterRaw("QERegAPIntEn", _emmStatusRegisters.QERegAPIntEn);
-    success &= _regAccess.writeRegisterRaw("QERegBPIntEn", _emmStatusRegisters.QERegBPIntEn);
-    success &= _regAccess.writeRegisterRaw("QERegCPIntEn", _emmStatusRegisters.QERegCPIntEn);
-    success &= _regAccess.writeRegisterRaw("QERgTPIntEn", _emmStatusRegisters.QERgTPIntEn);
-    success &= _regAccess.writeRegisterRaw("PhaseLossCIntEn", _emmStatusRegisters.PhaseLossCIntEn);
-    success &= _regAccess.writeRegisterRaw("PhaseLossBIntEn", _emmStatusRegisters.PhaseLossBIntEn);
-    success &= _regAccess.writeRegisterRaw("PhaseLossAIntEn", _emmStatusRegisters.PhaseLossAIntEn);
-    success &= _regAccess.writeRegisterRaw("FreqLoIntEn", _emmStatusRegisters.FreqLoIntEn);
-    success &= _regAccess.writeRegisterRaw("SagPhaseCIntEn", _emmStatusRegisters.SagPhaseCIntEn);
-    success &= _regAccess.writeRegisterRaw("SagPhaseBIntEn", _emmStatusRegisters.SagPhaseBIntEn);
-    success &= _regAccess.writeRegisterRaw("SagPhaseAIntEn", _emmStatusRegisters.SagPhaseAIntEn);
-    success &= _regAccess.writeRegisterRaw("FreqHiIntEn", _emmStatusRegisters.FreqHiIntEn);
+    _configMismatches++;
 
-    if (success) {
-        Serial.println("Applied EMM Status Registers");
-    } else {
-        Serial.println("Failed to apply EMM Status Registers");
+    if (!meterEnabled) {
+        Serial.println("Config monitor: meter disabled (chip reset?), restoring all registers");
+        _fullRestores++;
+        applyAllRegistersToChip();
+        return;
     }
 
-    // Lock calibration registers
-    success &= _regAccess.writeRegister("CfgRegAccEn", 0x0000);
+    Serial.printf("Config monitor: digest 0x%04X (expected 0x%04X)%s, checking register groups\n",
+                  digest, _expectedDigest, crcErrorRaised ? ", CRC error flagged" : "");
 
-    if (success) {
-        Serial.println("All registers applied to chip successfully");
-    } else {
-        Serial.println("Failed to apply all registers to chip");
+    for (size_t g = 0; g < registerGroupCount; g++) {
+        bool readOk = false;
+        if (groupMatchesChip(g, &readOk) || !readOk) {
+            continue;
+        }
+
+        Serial.print("Config monitor: restoring ");
+        Serial.println(registerGroups[g].label);
+        if (restoreRegisterGroup(g)) {
+            _groupRestores++;
+        }
     }
 
+    // A digest change with every group intact (e.g. the chip was still
+    // recomputing after the last apply) just moves the reference
+    captureConfigDigest();
+}
+
+// Compare one group as read back from the chip with the values last applied
+bool SettingsManager::groupMatchesChip(size_t group, bool* readOk) {
+    const RegisterGroup& info = registerGroups[group];
+    const uint8_t* applied = getRegisterGroupData(group, true);
+    const RegisterDescriptor* regs[MAX_GROUP_FIELDS];
+    uint32_t raw[MAX_GROUP_FIELDS];
+    bool ok[MAX_GROUP_FIELDS];
+
+    for (size_t i = 0; i < info.count; i++) {
+        regs[i] = _regAccess.getRegisterInfo(info.fields[i].name);
+    }
+
+    *readOk = _regAccess.readRegistersRaw(regs, raw, ok, info.count) == info.count;
+    if (!*readOk) {
+        Serial.print("ERROR: Failed to read back ");
+        Serial.println(info.label);
+        return false;
+    }
+
+    for (size_t i = 0; i < info.count; i++) {
+        if (raw[i] != readField(applied, info.fields[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rewrite every field of one group with the values last applied
+bool SettingsManager::restoreRegisterGroup(size_t group) {
+    const RegisterGroup& info = registerGroups[group];
+    const uint8_t* applied = getRegisterGroupData(group, true);
+    bool success = true;
+
+    success &= _regAccess.writeRegister("CfgRegAccEn", 0x55AA);
+    _regAccess.beginWriteBatch();
+
+    for (size_t i = 0; i < info.count; i++) {
+        success &= _regAccess.writeRegisterRaw(info.fields[i].name, readField(applied, info.fields[i]));
+    }
+
+    _regAccess.commitWriteBatch();
+    success &= _regAccess.writeRegister("CfgRegAccEn", 0x0000);
+
+    if (!success) {
+        Serial.print("ERROR: Failed to restore ");
+        Serial.println(info.label);
+    }
     return success;
 }
 
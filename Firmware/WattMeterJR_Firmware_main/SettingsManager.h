@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include <SD.h>
 #include "RegisterAccess.h"
+#include "SPIBusArbiter.h"
 
 // Settings structure
 struct WiFiSettings {
@@ -44,7 +45,16 @@ struct DataLoggingSettings {
     unsigned int bufferSize;           // Number of readings to buffer (1-1000)
     float powerLossThreshold;          // Voltage threshold to detect power loss
     bool enablePowerLossDetection;     // Enable/disable power loss detection
-    String logFields;                  // Comma-separated list of register names to log
+    String logFields;                  // Comma-separated list of register names to log (Name~band[%] for a deadband)
+    unsigned long maxLogGap;           // Milliseconds between records at most, with deadbands
+    unsigned long sampleInterval;      // Milliseconds between samples aggregated into a record (0: one sample)
+    String overflowPolicy;             // Buffer overflow while the writer is busy: block, drop, aggregate
+    String logFormat;                  // Daily file format: csv or binary
+    unsigned int rollupRetention1m;    // Days of 1-minute rollups kept (0: all)
+    unsigned int rollupRetention15m;   // Days of 15-minute rollups kept (0: all)
+    unsigned int rollupRetention1h;    // Days of hourly rollups kept (0: all)
+    unsigned int freeSpaceLowMB;       // Free space that starts deleting the oldest logs (0: never)
+    unsigned int freeSpaceHighMB;      // Free space that stops it
 };
 
 struct DisplaySettings {
@@ -209,6 +219,9 @@ public:
     // Load/Save settings
     bool loadSettings();
     bool saveSettings();
+
+    // Optional: lets saves yield the SPI bus to metering between chunks
+    void setBusArbiter(SPIBusArbiter* arbiter) { _busArbiter = arbiter; }
     
     //getter/setter for all settings
     const WiFiSettings& getWiFiSettings() { return _wifi; }
@@ -252,9 +265,41 @@ public:
 
     // Apply all settings to chip
     bool applyAllRegistersToChip();
+
+    // Apply only register fields changed since the last apply
+    bool applyChangedRegistersToChip();
+
+    // Statistics from the most recent apply
+    uint16_t getLastApplyWrites() { return _lastApplyWrites; }
+    uint32_t getLastApplyTransactions() { return _lastApplyTransactions; }
+
+    // Configuration monitor - must be called in loop(). Polls the chip's
+    // CRC digest and error flag; on a change, reads back each register
+    // group and rewrites only the groups that no longer match what was
+    // applied. A chip found with the meter disabled gets a full apply.
+    void update();
+
+    // Take the chip's current digest as the reference
+    void captureConfigDigest();
+
+    // A deliberate direct write to a register: take what the chip now
+    // holds for the settings fields in that register as applied, so the
+    // monitor keeps the write, and capture the new digest. The settings
+    // themselves are unchanged; the next apply of them writes them back.
+    void noteRegisterWrite(const char* name);
+
+    // Suspend monitoring while registers are intentionally off-settings
+    void setConfigMonitorEnabled(bool enabled) { _configMonitorEnabled = enabled; }
+
+    // Configuration monitor statistics
+    uint32_t getConfigChecks() { return _configChecks; }
+    uint32_t getConfigMismatches() { return _configMismatches; }
+    uint32_t getGroupRestores() { return _groupRestores; }
+    uint32_t getFullRestores() { return _fullRestores; }
     
 private:
     RegisterAccess& _regAccess;
+    SPIBusArbiter* _busArbiter;
     WiFiSettings _wifi;
     RTCCalibrationSettings _rtcCalibration;
     TimezoneSettings _timezone;
@@ -268,8 +313,37 @@ private:
     FundamentalHarmonicCalibrationRegisters _fundamentalHarmonicCalibrationRegisters;
     MeasurementCalibrationRegisters _measurementCalibrationRegisters;
     EMMStatusRegisters _emmStatusRegisters;
+
+    // Register values as last written to the chip
+    StatusAndSpecialRegisters _appliedStatusAndSpecialRegisters;
+    ConfigurationRegisters _appliedConfigurationRegisters;
+    CalibrationRegisters _appliedCalibrationRegisters;
+    FundamentalHarmonicCalibrationRegisters _appliedFundamentalHarmonicCalibrationRegisters;
+    MeasurementCalibrationRegisters _appliedMeasurementCalibrationRegisters;
+    EMMStatusRegisters _appliedEMMStatusRegisters;
+    bool _registersApplied;
+    uint16_t _lastApplyWrites;
+    uint32_t _lastApplyTransactions;
+
+    bool applyRegisterFields(bool changedOnly);
+    uint8_t* getRegisterGroupData(size_t group, bool applied);
+
+    // Configuration monitor state
+    static const unsigned long CONFIG_CHECK_INTERVAL = 5000;  // ms between digest polls
+    bool _configMonitorEnabled;
+    bool _digestValid;
+    uint16_t _expectedDigest;
+    bool _lastCrcError;
+    unsigned long _lastConfigCheck;
+    uint32_t _configChecks;
+    uint32_t _configMismatches;
+    uint32_t _groupRestores;
+    uint32_t _fullRestores;
+    bool groupMatchesChip(size_t group, bool* readOk);
+    bool restoreRegisterGroup(size_t group);
     
     static const char* SETTINGS_FILE;
+    static const size_t SAVE_CHUNK_SIZE = 512;  // One SD sector per write
     
     // INI file parsing helpers
     String readIniValue(const String& content, const String& section, const String& key);
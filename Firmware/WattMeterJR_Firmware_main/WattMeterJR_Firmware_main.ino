@@ -5,6 +5,8 @@
 #include <Time.h>
 #include "ATM90E32.h"
 #include "RegisterAccess.h"
+#include "RegisterCache.h"
+#include "MeasurementEngine.h"
 #include "CommandParser.h"
 #include "EnergyWebServer.h"
 #include "SDCardLogger.h"
@@ -13,6 +15,7 @@
 #include "DisplayManager.h"
 #include "RebootManager.h"
 #include "EnergyAccumulator.h"
+#include "SPIBusArbiter.h"
 
 
 
@@ -28,6 +31,7 @@
 #define I2C_SDA 21           // I2C SDA pin
 #define I2C_SDL 22           // I2C SDL pin
 #define BUTTON_PIN 3
+#define PIN_M90E32_IRQ0 -1   // M90E32 IRQ0 (Active high), not routed on V3.1 boards; -1 polls the voltage instead
 
 
 enum FaultCode {
@@ -49,14 +53,17 @@ enum WarningCode {
 LiquidCrystal_I2C lcd(0x27, 20, 4);
 ATM90E32 energyChip(PIN_SPI_M90E32_CS);
 RegisterAccess regAccess(energyChip);
+RegisterCache regCache(regAccess);
+MeasurementEngine measurementEngine(regCache);
 TimeManager timeManager;
-SDCardLogger sdLogger(regAccess, timeManager, SD_CS_PIN, SD_CD_PIN, SD_WP_PIN);
+SDCardLogger sdLogger(regAccess, measurementEngine, timeManager, SD_CS_PIN, SD_CD_PIN, SD_WP_PIN);
 CommandParser cmdParser(regAccess);
-EnergyWebServer EnergyWebServer(regAccess);
+EnergyWebServer EnergyWebServer(regAccess, regCache);
 SettingsManager settings(regAccess);
 EnergyAccumulator energyAccumulator(regAccess);
-DisplayManager displayManager(regAccess, timeManager, sdLogger, EnergyWebServer, BUTTON_PIN);
+DisplayManager displayManager(regAccess, measurementEngine, timeManager, sdLogger, EnergyWebServer, BUTTON_PIN);
 RebootManager rebootManager(timeManager, sdLogger);
+SPIBusArbiter busArbiter;
 
 
 
@@ -65,6 +72,14 @@ String serialCommand = "";
 //Heap check timer
 static unsigned long lastHeapCheck = 0;
 
+// ================ SPI Bus Sharing ======================
+
+// Metering work run whenever a long SD write yields the shared bus
+void serviceMetering(void* context) {
+  energyChip.service();
+  measurementEngine.update();
+}
+
 // ================ Settings Helpers ======================
 
 // Apply WiFi settings to web server
@@ -169,8 +184,16 @@ void applyDataLoggingSettings(const DataLoggingSettings& log) {
 
   sdLogger.setBufferSize(log.bufferSize);
   sdLogger.setLoggingInterval(log.loggingInterval);
+  sdLogger.setMaxLogGap(log.maxLogGap);
+  sdLogger.setSampleInterval(log.sampleInterval);
   sdLogger.setPowerLossThreshold(log.powerLossThreshold);
   sdLogger.enablePowerLossDetection(log.enablePowerLossDetection);
+  sdLogger.setOverflowPolicy(log.overflowPolicy);
+  sdLogger.setLogFormat(log.logFormat);
+  sdLogger.setRollupRetention(0, log.rollupRetention1m);
+  sdLogger.setRollupRetention(1, log.rollupRetention15m);
+  sdLogger.setRollupRetention(2, log.rollupRetention1h);
+  sdLogger.setFreeSpaceWatermarks(log.freeSpaceLowMB, log.freeSpaceHighMB);
 }
 
 // Apply display settings
@@ -222,9 +245,9 @@ void applyAllSettings() {
 void applyAllButWIFISettings() {
   Serial.println("\n=== Applying All Settings But WIFI ===");
 
-  // Apply all registers to ATM90E32
-  Serial.println("Applying all registers to ATM90E32...");
-  settings.applyAllRegistersToChip();
+  // Push only the chip registers that changed
+  Serial.println("Applying changed registers to ATM90E32...");
+  settings.applyChangedRegistersToChip();
 
   // Apply RTC settings AND timezone together
   applyRTCSettings(settings.getRTCCalibration(), settings.getTimezoneSettings());
@@ -460,6 +483,13 @@ void setup() {
   // Initialize hardware
   SPI.begin(PIN_SPI_SCLK, PIN_SPI_MISO, PIN_SPI_MOSI);
 
+  // SD writes yield the shared bus to scheduled metering reads, here and
+  // on the SD writer task
+  busArbiter.begin();
+  busArbiter.setServiceCallback(BUS_METERING, serviceMetering);
+  sdLogger.setBusArbiter(&busArbiter);
+  settings.setBusArbiter(&busArbiter);
+
   if (!energyChip.begin()) {
     Serial.println("ERROR: Failed to initialize ATM90E32");
     displayFault(FAULT_CHIP_INIT_FAILED);
@@ -472,6 +502,7 @@ void setup() {
   }
 
   // Critical: SD card must be present with settings
+  sdLogger.setPowerFailPin(PIN_M90E32_IRQ0);
   if (!sdLogger.begin()) {
     Serial.println("ERROR: SD Card initialization failed");
     displayFault(FAULT_SD_MISSING);
@@ -496,14 +527,21 @@ void setup() {
   cmdParser.setSDLogger(&sdLogger);
   cmdParser.setSettingsManager(&settings);
   cmdParser.setRebootManager(&rebootManager);
+  cmdParser.setRegisterCache(&regCache);
+  cmdParser.setMeasurementEngine(&measurementEngine);
+  cmdParser.setBusArbiter(&busArbiter);
 
   //link settings manager to the webserver
   EnergyWebServer.setSettingsManager(&settings);
+  EnergyWebServer.setSDLogger(&sdLogger);
+  EnergyWebServer.setBusArbiter(&busArbiter);
 
   // Initialize energy accumulator
   energyAccumulator.begin(&settings);
   EnergyWebServer.setEnergyAccumulator(&energyAccumulator);
   sdLogger.setEnergyAccumulator(&energyAccumulator);
+  // Totals saved by an emergency flush are newer than settings.ini
+  sdLogger.restoreEnergyCheckpoint();
 
   // Initialize reboot manager
   rebootManager.begin();
@@ -531,12 +569,26 @@ void loop() {
   // Update TimeManager (handles auto-sync with NTP)
   timeManager.update();
 
+  // Clock out queued energy chip reads (bounded time per call). Taking the
+  // bus makes the SD writer task give it up at its next sector.
+  if (energyChip.hasPending()) {
+    busArbiter.acquire(BUS_METERING);
+    energyChip.service();
+    busArbiter.release(BUS_METERING);
+  }
+
+  // Sample subscribed registers for the logger and display
+  measurementEngine.update();
+
   // Handle SD card logging
   sdLogger.update();
 
   // Update energy accumulator (reads energy registers, saves periodically)
   energyAccumulator.update();
 
+  // Check the chip's configuration digest and restore diverged registers
+  settings.update();
+
   // Update display (handles button, backlight, refresh)
   // Only update if no warning is currently being displayed
   if (!warningState.warningDisplayed) {
@@ -585,7 +637,9 @@ void loop() {
 
 
   if (millis() - lastHeapCheck >= 60000) {
-    Serial.printf("Free heap: %u bytes\n", ESP.getFreeHeap());
+    // Low-water mark and largest block show fragmentation over time
+    Serial.printf("Free heap: %u bytes (min %u, largest block %u)\n",
+                  ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
     lastHeapCheck = millis();
   }
 